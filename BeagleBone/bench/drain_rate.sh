@@ -0,0 +1,74 @@
+#!/bin/bash
+#
+# Spool drain rate on a host: how many frames/s CLIENT_DAEMON (or GATEWAY)
+# delivers when the server comes back to a backlog of BACKLOG frames.
+#
+#   drain_rate.sh BACKLOG [PROTO] [gateway]
+#
+# BACKLOG  frames spooled while the server is down (at most SPOOL_CAPACITY)
+# PROTO    highest protocol version offered and accepted (default 4)
+# gateway  measure GATEWAY instead of I2C_DAEMON + CLIENT_DAEMON
+#
+# The backlog is produced at FILL_RATE frames/s (default 20000), slow enough
+# for the FIFO not to overflow, so the spool really holds BACKLOG frames.
+#
+# The daemons are built for the host (make CC=gcc in each directory, and
+# make here for STANDIN_SERVER) and run as root, because they use the
+# target's paths. The spool is REMOVED first; do not run this on a board
+# that has frames to deliver.
+#
+# Prints the stand-in server's line, frames=N secs=S rate=R msgs=M proto=V,
+# where secs runs from the first to the last frame of the drain.
+
+set -u
+
+BACKLOG=${1:?usage: drain_rate.sh BACKLOG [PROTO] [gateway]}
+PROTO=${2:-4}
+MODE=${3:-client}
+FILL_RATE=${FILL_RATE:-20000}
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+BB=$(dirname "$HERE")
+DIR=/home/debian/embedded
+SPOOL=$DIR/client_spool.dat
+SIM_LOG=$DIR/i2c_master.log
+[ "$MODE" = gateway ] && SIM_LOG=$DIR/parking_gateway.log
+
+stop_all() {
+    pkill -INT -x CLIENT_DAEMON
+    pkill -INT -x I2C_DAEMON
+    pkill -INT -x GATEWAY
+    pkill -INT -x STANDIN_SERVER
+    sleep 1
+}
+
+# wait_log FILE PATTERN SECS: poll FILE until PATTERN shows up
+wait_log() {
+    for ((t = 0; t < $3 * 10; t++)); do
+        grep -q "$2" "$1" 2>/dev/null && return 0
+        sleep 0.1
+    done
+    echo "timed out waiting for '$2' in $1" >&2
+    return 1
+}
+
+stop_all
+mkdir -p $DIR
+rm -f $SPOOL $SIM_LOG
+
+# 1. server down: the backlog goes to the spool
+if [ "$MODE" = gateway ]; then
+    "$BB/gateway/GATEWAY" --server 127.0.0.1 --proto "$PROTO" \
+        --sim --sim-rate "$FILL_RATE" --sim-count "$BACKLOG"
+else
+    "$BB/tcp_client_demon/CLIENT_DAEMON" --server 127.0.0.1 --proto "$PROTO"
+    sleep 0.5
+    "$BB/i2c_demon/I2C_DAEMON" --sim --sim-rate "$FILL_RATE" --sim-count "$BACKLOG"
+fi
+wait_log $SIM_LOG "Sim: $BACKLOG frames" 60 || { stop_all; exit 1; }
+sleep 1     # let the client take the last frames off the FIFO
+
+# 2. server up: time the drain, which ends when the frames stop for 1 s
+timeout 120 "$HERE/STANDIN_SERVER" --proto "$PROTO" --expect "$BACKLOG" --idle-ms 1000 ||
+    echo "drain did not finish within 120 s" >&2
+stop_all
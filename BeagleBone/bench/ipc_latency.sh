@@ -0,0 +1,80 @@
+#!/bin/bash
+#
+# I2C_DAEMON -> CLIENT_DAEMON hand-off on a host: delivery latency and CPU
+# per frame through the FIFO and through the shared-memory ring (--ring).
+#
+#   ipc_latency.sh [RATE] [COUNT]
+#
+# RATE   simulated frames per second (default 1000)
+# COUNT  frames per run (default 20000)
+#
+# Same setup as drain_rate.sh: host builds of the daemons and STANDIN_SERVER,
+# run as root; the spool is REMOVED first. The latency is what CLIENT_DAEMON
+# logs ("IPC latency via ..."): CLOCK_REALTIME when it takes a frame off the
+# FIFO or ring minus the frame's edge time. CPU is utime + stime of each
+# daemon from /proc over the run, divided by COUNT.
+
+set -u
+
+RATE=${1:-1000}
+COUNT=${2:-20000}
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+BB=$(dirname "$HERE")
+DIR=/home/debian/embedded
+CLIENT_LOG=$DIR/parking_client.log
+I2C_LOG=$DIR/i2c_master.log
+HZ=$(getconf CLK_TCK)
+
+stop_all() {
+    pkill -INT -x CLIENT_DAEMON
+    pkill -INT -x I2C_DAEMON
+    pkill -INT -x STANDIN_SERVER
+    sleep 1
+}
+
+# wait_log FILE PATTERN SECS: poll FILE until PATTERN shows up
+wait_log() {
+    for ((t = 0; t < $3 * 10; t++)); do
+        grep -q "$2" "$1" 2>/dev/null && return 0
+        sleep 0.1
+    done
+    echo "timed out waiting for '$2' in $1" >&2
+    return 1
+}
+
+# cpu_ticks NAME: utime + stime of the process called NAME
+cpu_ticks() {
+    awk '{ print $14 + $15 }' /proc/$(pgrep -x "$1")/stat
+}
+
+run() {   # run pipe|ring
+    local args=""
+    [ "$1" = ring ] && args="--ring"
+
+    stop_all
+    mkdir -p $DIR
+    rm -f $DIR/client_spool.dat $CLIENT_LOG $I2C_LOG /dev/shm/i2c_ring
+
+    "$HERE/STANDIN_SERVER" 2>/dev/null >/dev/null &
+    "$BB/tcp_client_demon/CLIENT_DAEMON" --server 127.0.0.1 $args
+    wait_log $CLIENT_LOG "Server speaks protocol" 30 || return 1
+
+    local client0
+    client0=$(cpu_ticks CLIENT_DAEMON)
+    "$BB/i2c_demon/I2C_DAEMON" $args --sim --sim-rate "$RATE" --sim-count "$COUNT"
+    wait_log $I2C_LOG "Sim: $COUNT frames" $((COUNT / RATE + 30)) || return 1
+    wait_log $CLIENT_LOG "IPC latency via" 30 || return 1
+
+    local client i2c
+    client=$(( $(cpu_ticks CLIENT_DAEMON) - client0 ))
+    i2c=$(cpu_ticks I2C_DAEMON)
+    grep "IPC latency via" $CLIENT_LOG | tail -1 | sed 's/^.*IPC/IPC/'
+    awk -v c="$client" -v i="$i2c" -v hz="$HZ" -v n="$COUNT" -v m="$1" 'BEGIN {
+        printf "%s: CPU per frame I2C_DAEMON %.1f us, CLIENT_DAEMON %.1f us\n",
+               m, i * 1e6 / hz / n, c * 1e6 / hz / n }'
+}
+
+run pipe
+run ring
+stop_all
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "parking_protocol.h"
+#include "pp_batch.h"
+#include "pp_ack.h"
+
+/**
+ * @file standin_server.c
+ * @brief Stand-in for the parking server in host load tests of
+ *        CLIENT_DAEMON / GATEWAY: speaks the same protocol (HELLO up to v4,
+ *        EVENT, BATCH, ACK, or plain v1 frames) but stores nothing, and
+ *        reports how fast the frames arrived.
+ *
+ * Usage: STANDIN_SERVER [--port N] [--proto N] [--expect N] [--idle-ms N]
+ *        --port    TCP port (default 13777, the daemons' PORT)
+ *        --proto   highest version to accept (default PP_VERSION)
+ *        --expect  exit once N frames arrived, after reporting them
+ *        --idle-ms exit once no frame arrived for N ms after the first one
+ *
+ * Every connection ends with one line on stdout:
+ *     frames=N secs=S rate=R msgs=M proto=V
+ * where secs runs from the first frame to the last one of the connection.
+ */
+
+#define STANDIN_PORT 13777
+
+static volatile sig_atomic_t stop;
+static int idle_ms;                 /**< --idle-ms, 0 to wait forever */
+
+static void on_signal(int sig){ (void)sig; stop = 1; }
+
+static uint64_t mono_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/** @brief Frames of one connection. */
+typedef struct {
+    unsigned long frames;
+    unsigned long msgs;
+    uint64_t first_ns, last_ns;
+} conn_stats;
+
+/**
+ * @brief Read exactly n bytes.
+ * @details With --idle-ms, a receive timeout between messages ends the
+ *          connection once frames have arrived; before that it is retried
+ *          (a v4 client waits for the HELLO reply, a v1 fallback for
+ *          PP_HELLO_TIMEOUT_MS).
+ * @return 0, or -1 on EOF, error, stop or idle
+ */
+static int read_all(int fd, void *buf, size_t n, const conn_stats *st){
+    uint8_t *p = buf;
+    while (n > 0) {
+        ssize_t r = recv(fd, p, n, 0);
+        if (r < 0 && errno == EINTR && !stop) continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && !stop) {
+            if (p == (uint8_t *)buf && st->frames > 0) {
+                stop = 1;
+                return -1;
+            }
+            continue;
+        }
+        if (r <= 0) return -1;
+        p += r;
+        n -= (size_t)r;
+    }
+    return 0;
+}
+
+static void count_frames(conn_stats *st, unsigned long n){
+    uint64_t now = mono_ns();
+    if (st->frames == 0) st->first_ns = now;
+    st->last_ns = now;
+    st->frames += n;
+    st->msgs++;
+}
+
+/**
+ * @brief Serve v2+ messages until the client leaves; every message is
+ *        answered with an ACK on v4, as the server does once it is durable.
+ * @return 0 when the client left, -1 on a protocol error
+ */
+static int serve_messages(int fd, int version, conn_stats *st, unsigned long expect){
+    static uint8_t msg[PP_MSG_BYTES(PP_MAX_PAYLOAD)];
+    static uint8_t reply[PP_MSG_BYTES(2 + PP_ACK_MAX_ENTRIES * sizeof(pp_ack_wire))];
+    static pp_event ev[PP_BATCH_MAX_EVENTS];
+    static pp_ack acks[PP_ACK_MAX_ENTRIES];
+
+    while (!stop && (!expect || st->frames < expect)) {
+        uint8_t type;
+        uint16_t len;
+        if (read_all(fd, msg, PP_HDR_BYTES, st) < 0) return 0;
+        int v = pp_parse_header(msg, &type, &len);
+        if (v < PP_VERSION_2 || v > version || read_all(fd, msg + PP_HDR_BYTES, (size_t)len + PP_CRC_BYTES, st) < 0 ||
+            !pp_crc_ok(msg, len))
+            return -1;
+
+        int n;
+        if (type == PP_MSG_BATCH && version >= PP_VERSION_3) {
+            n = pp_decode_batch(msg + PP_HDR_BYTES, len, ev, PP_BATCH_MAX_EVENTS);
+        } else if (type == PP_MSG_EVENT && len == sizeof(pp_event_wire)) {
+            pp_get_event(msg + PP_HDR_BYTES, &ev[0]);
+            n = 1;
+        } else {
+            n = -1;
+        }
+        if (n < 0) return -1;
+        count_frames(st, (unsigned long)n);
+
+        if (version >= PP_VERSION_4) {
+            for (int i = 0; i < n; i++) {
+                memset(&acks[i], 0, sizeof(acks[i]));
+                acks[i].device_id = ev[i].device_id;
+                acks[i].status = (uint8_t)ev[i].status;
+                acks[i].seq = ev[i].seq;
+                acks[i].result = PP_ACK_JOURNALED;
+            }
+            size_t rlen = pp_encode_ack(reply, acks, (size_t)n);
+            if (send(fd, reply, rlen, MSG_NOSIGNAL) != (ssize_t)rlen) return 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Serve v1 frames (no replies are needed by the client).
+ * @param first_is_frame The bytes read as a HELLO candidate were a frame
+ */
+static void serve_frames(int fd, conn_stats *st, unsigned long expect, bool first_is_frame){
+    uint8_t frame[sizeof(gps_frame)];
+    if (first_is_frame) count_frames(st, 1);
+    while (!stop && (!expect || st->frames < expect) && read_all(fd, frame, sizeof(frame), st) == 0)
+        count_frames(st, 1);
+}
+
+int main(int argc, char **argv){
+    int port = STANDIN_PORT;
+    int proto = PP_VERSION;
+    unsigned long expect = 0, total = 0;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--port") == 0) port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--proto") == 0) proto = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--expect") == 0) expect = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--idle-ms") == 0) idle_ms = atoi(argv[++i]);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;      /* no SA_RESTART: a blocked recv() returns */
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)port);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 4) < 0) {
+        fprintf(stderr, "standin_server: cannot listen on port %d: %s\n", port, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "standin_server: listening on port %d, protocol up to v%d\n", port, proto);
+
+    while (!stop && (!expect || total < expect)) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) continue;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (idle_ms > 0) {
+            struct timeval tv = { idle_ms / 1000, (idle_ms % 1000) * 1000 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        }
+
+        conn_stats st;
+        memset(&st, 0, sizeof(st));
+        unsigned long left = expect ? expect - total : 0;
+        uint8_t first[PP_HELLO_BYTES];
+        int version = PP_VERSION_1;
+        if (read_all(fd, first, sizeof(first), &st) == 0) {
+            uint8_t lo, hi;
+            bool hello = pp_decode_hello(first, &lo, &hi, NULL) == 0;
+            if (hello && proto >= PP_VERSION_2 && lo <= proto) {
+                version = hi < proto ? hi : proto;
+                uint8_t msg[PP_HELLO_BYTES];
+                pp_encode_hello(msg, (uint8_t)version, (uint8_t)version, 0);
+                send(fd, msg, sizeof(msg), MSG_NOSIGNAL);
+                if (serve_messages(fd, version, &st, left) < 0)
+                    fprintf(stderr, "standin_server: protocol error, closing\n");
+            } else {
+                /* unanswered, the client falls back to v1 after PP_HELLO_TIMEOUT_MS */
+                serve_frames(fd, &st, left, !hello);
+            }
+        }
+        close(fd);
+
+        if (st.frames == 0) continue;
+        double secs = (double)(st.last_ns - st.first_ns) / 1e9;
+        printf("frames=%lu secs=%.3f rate=%.0f msgs=%lu proto=%d\n", st.frames, secs,
+               secs > 0 ? (double)st.frames / secs : 0.0, st.msgs, version);
+        fflush(stdout);
+        total += st.frames;
+    }
+    close(lfd);
+    return EXIT_SUCCESS;
+}
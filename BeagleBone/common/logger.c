@@ -0,0 +1,218 @@
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef LOGGER_THREADS
+#include <pthread.h>
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOG_LOCK()   pthread_mutex_lock(&log_lock)
+#define LOG_UNLOCK() pthread_mutex_unlock(&log_lock)
+#else
+#define LOG_LOCK()   ((void)0)
+#define LOG_UNLOCK() ((void)0)
+#endif
+
+static char log_path[256];
+static int log_fd = -1;
+static off_t log_size = 0;                  /**< Bytes already in the current file */
+static log_level cur_level = LOG_LVL_INFO;
+
+static char buf[LOG_BUFFER_SIZE];
+static size_t buf_len = 0;
+static time_t last_flush = 0;
+
+static time_t ts_sec = (time_t)-1;          /**< Second the cached timestamp belongs to */
+static char ts_str[32];
+
+static volatile sig_atomic_t level_delta = 0;   /**< Pending SIGUSR1/SIGUSR2 changes */
+
+static const char *const level_tags[] = { "ERROR ", "WARN ", "", "DEBUG " };
+
+static void open_log_file(void){
+    log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(log_fd < 0){
+        perror("logger open");
+        log_size = 0;
+        return;
+    }
+    struct stat st;
+    log_size = (fstat(log_fd, &st) == 0) ? st.st_size : 0;
+}
+
+/**
+ * @brief Shift <path>.N-1 -> <path>.N ... <path> -> <path>.1 and start a new file.
+ */
+static void rotate(void){
+    char from[sizeof(log_path) + 8], to[sizeof(log_path) + 8];
+
+    if(log_fd >= 0){ close(log_fd); log_fd = -1; }
+
+    for(int i = LOG_KEEP_FILES - 1; i >= 1; i--){
+        snprintf(from, sizeof(from), "%s.%d", log_path, i);
+        snprintf(to, sizeof(to), "%s.%d", log_path, i + 1);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", log_path);
+    rename(log_path, to);
+
+    open_log_file();
+}
+
+static void level_signal(int sig){
+    level_delta += (sig == SIGUSR1) ? 1 : -1;
+}
+
+/**
+ * @brief Apply level changes requested by signals since the last message.
+ */
+static void apply_level_delta(void){
+    if(level_delta == 0) return;
+    int lvl = (int)cur_level + level_delta;
+    level_delta = 0;
+    if(lvl < LOG_LVL_ERROR) lvl = LOG_LVL_ERROR;
+    if(lvl > LOG_LVL_DEBUG) lvl = LOG_LVL_DEBUG;
+    cur_level = (log_level)lvl;
+}
+
+int logger_init(const char *path, log_level level){
+    LOG_LOCK();
+    snprintf(log_path, sizeof(log_path), "%s", path);
+    cur_level = level;
+    last_flush = time(NULL);
+
+    static int registered = 0;
+    if(!registered){
+        atexit(logger_close);
+        registered = 1;
+    }
+
+    if(log_fd >= 0) close(log_fd);
+    open_log_file();
+    int ret = log_fd >= 0 ? 0 : -1;
+    LOG_UNLOCK();
+    return ret;
+}
+
+void logger_install_level_signals(void){
+    signal(SIGUSR1, level_signal);
+    signal(SIGUSR2, level_signal);
+}
+
+void logger_set_level(log_level level){
+    LOG_LOCK();
+    cur_level = level;
+    LOG_UNLOCK();
+}
+
+log_level logger_get_level(void){
+    LOG_LOCK();
+    apply_level_delta();
+    log_level level = cur_level;
+    LOG_UNLOCK();
+    return level;
+}
+
+/**
+ * @brief Write the buffer to the file. Caller holds the lock.
+ */
+static void flush_buffer(void){
+    if(buf_len == 0) return;
+    if(log_fd < 0 && log_path[0]) open_log_file();
+
+    if(log_fd >= 0){
+        if(log_size > 0 && log_size + (off_t)buf_len > LOG_MAX_BYTES)
+            rotate();
+
+        size_t off = 0;
+        while(log_fd >= 0 && off < buf_len){
+            ssize_t n = write(log_fd, buf + off, buf_len - off);
+            if(n < 0){
+                if(errno == EINTR) continue;
+                break;
+            }
+            off += (size_t)n;
+        }
+        log_size += (off_t)off;
+    }
+    buf_len = 0;
+    last_flush = time(NULL);
+}
+
+void logger_flush(void){
+    LOG_LOCK();
+    flush_buffer();
+    LOG_UNLOCK();
+}
+
+void logger_tick(void){
+    LOG_LOCK();
+    if(buf_len > 0 && time(NULL) - last_flush >= LOG_FLUSH_INTERVAL_SEC)
+        flush_buffer();
+    LOG_UNLOCK();
+}
+
+void logger_close(void){
+    LOG_LOCK();
+    flush_buffer();
+    if(log_fd >= 0){
+        close(log_fd);
+        log_fd = -1;
+    }
+    LOG_UNLOCK();
+}
+
+/**
+ * @brief Format one line into the buffer, flushing first if it would not fit.
+ */
+static void append_line(log_level level, const char *fmt, va_list ap){
+    char line[512];
+    time_t now = time(NULL);
+
+    if(now != ts_sec){
+        struct tm tm_buf;
+        localtime_r(&now, &tm_buf);
+        strftime(ts_str, sizeof(ts_str), "%d-%m-%Y %H:%M:%S", &tm_buf);
+        ts_sec = now;
+    }
+
+    int n = snprintf(line, sizeof(line), "[%s] %s", ts_str, level_tags[level]);
+    if(n < 0) return;
+    int m = vsnprintf(line + n, sizeof(line) - (size_t)n, fmt, ap);
+    if(m < 0) return;
+    size_t len = (size_t)n + (size_t)m;
+    if(len > sizeof(line) - 3) len = sizeof(line) - 3;   // truncated message
+    line[len++] = '\n';
+    line[len++] = '\n';
+
+    if(buf_len + len > sizeof(buf))
+        flush_buffer();
+    memcpy(buf + buf_len, line, len);
+    buf_len += len;
+
+    if(level == LOG_LVL_ERROR || now - last_flush >= LOG_FLUSH_INTERVAL_SEC)
+        flush_buffer();
+}
+
+void log_printf(log_level level, const char *fmt, ...){
+    LOG_LOCK();
+    apply_level_delta();
+    if(level <= cur_level){
+        va_list ap;
+        va_start(ap, fmt);
+        append_line(level, fmt, ap);
+        va_end(ap);
+    }
+    LOG_UNLOCK();
+}
+
+void log_message(const char *message){
+    log_printf(LOG_LVL_INFO, "%s", message);
+}
@@ -0,0 +1,96 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <signal.h>
+
+/**
+ * @file logger
+ * @brief Small buffered log writer shared by the BeagleBone daemons.
+ *
+ * Messages are formatted into a static buffer and written to the log file
+ * with a single write() when the buffer fills, when LOG_FLUSH_INTERVAL_SEC
+ * has passed, or when an error is logged. The file is kept open and is
+ * rotated to <path>.1 ... <path>.LOG_KEEP_FILES once it reaches
+ * LOG_MAX_BYTES. SIGUSR1 / SIGUSR2 raise / lower the log level at runtime.
+ * Build with -DLOGGER_THREADS to serialize callers from several threads.
+ */
+
+#ifndef LOG_BUFFER_SIZE
+#define LOG_BUFFER_SIZE       4096            /**< Bytes buffered before a write */
+#endif
+#ifndef LOG_MAX_BYTES
+#define LOG_MAX_BYTES         (512 * 1024)    /**< Rotate when the file reaches this size */
+#endif
+#ifndef LOG_KEEP_FILES
+#define LOG_KEEP_FILES        3               /**< Rotated files kept (<path>.1 .. .N) */
+#endif
+#ifndef LOG_FLUSH_INTERVAL_SEC
+#define LOG_FLUSH_INTERVAL_SEC 2              /**< Max age of buffered messages */
+#endif
+
+/**
+ * @brief Log levels, most severe first.
+ */
+typedef enum {
+    LOG_LVL_ERROR = 0,
+    LOG_LVL_WARN,
+    LOG_LVL_INFO,
+    LOG_LVL_DEBUG
+} log_level;
+
+/**
+ * @brief Open the log file and register a flush at exit.
+ * @param path Log file path
+ * @param level Initial log level
+ * @return 0 on success, -1 if the file could not be opened
+ */
+int logger_init(const char *path, log_level level);
+
+/**
+ * @brief Install the SIGUSR1 (more verbose) / SIGUSR2 (less verbose) handlers.
+ */
+void logger_install_level_signals(void);
+
+/**
+ * @brief Change the log level.
+ * @param level New level
+ */
+void logger_set_level(log_level level);
+
+/**
+ * @brief Get the current log level.
+ * @return Current level
+ */
+log_level logger_get_level(void);
+
+/**
+ * @brief Append a formatted message if its level is enabled.
+ * @param level Message level
+ * @param fmt printf-style format string
+ */
+void log_printf(log_level level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Append a message to the log file with timestamp (INFO level).
+ * @param message Message string to log
+ */
+void log_message(const char *message);
+
+/**
+ * @brief Flush buffered messages if LOG_FLUSH_INTERVAL_SEC has passed.
+ *        Call from the daemon's main loop on poll timeouts.
+ */
+void logger_tick(void);
+
+/**
+ * @brief Write all buffered messages to the file now.
+ *        Must be called before fork() so the child does not inherit them.
+ */
+void logger_flush(void);
+
+/**
+ * @brief Flush and close the log file.
+ */
+void logger_close(void);
+
+#endif
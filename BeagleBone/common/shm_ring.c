@@ -0,0 +1,132 @@
+#include "shm_ring.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define RING_HDR_SIZE 4096   /**< Header page; slots start page-aligned */
+
+static long futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *ts){
+    return syscall(SYS_futex, uaddr, op, val, ts, NULL, 0);
+}
+
+static int ring_valid(const struct shm_ring_hdr *h, uint32_t rec_size, uint32_t capacity){
+    return h->magic == RING_MAGIC && h->version == RING_VERSION &&
+           h->rec_size == rec_size && h->capacity == capacity &&
+           (uint32_t)(h->head - h->tail) <= capacity;
+}
+
+/* fresh header; the magic goes last so a reader never sees a half-written one */
+static void ring_init(struct shm_ring_hdr *h, uint32_t rec_size, uint32_t capacity){
+    memset(h, 0, RING_HDR_SIZE);
+    h->rec_size = rec_size;
+    h->capacity = capacity;
+    h->version = RING_VERSION;
+    __atomic_store_n(&h->magic, RING_MAGIC, __ATOMIC_RELEASE);
+}
+
+int shm_ring_open(shm_ring *r, const char *path, uint32_t rec_size, uint32_t capacity){
+    memset(r, 0, sizeof(*r));
+    if(capacity == 0 || (capacity & (capacity - 1)) != 0) return -1;
+
+    size_t len = RING_HDR_SIZE + (size_t)rec_size * capacity;
+    void *map;
+
+    if(path == NULL){
+        map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if(map == MAP_FAILED) return -1;
+        ring_init((struct shm_ring_hdr *)map, rec_size, capacity);
+    } else {
+        int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        if(fd < 0) return -1;
+
+        /* both daemons may start at once: only one may (re)initialize */
+        flock(fd, LOCK_EX);
+        struct stat st;
+        if(fstat(fd, &st) < 0 || ((size_t)st.st_size != len && ftruncate(fd, (off_t)len) < 0)){
+            flock(fd, LOCK_UN);
+            close(fd);
+            return -1;
+        }
+        map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(map != MAP_FAILED && !ring_valid((struct shm_ring_hdr *)map, rec_size, capacity))
+            ring_init((struct shm_ring_hdr *)map, rec_size, capacity);
+        flock(fd, LOCK_UN);
+        close(fd);
+        if(map == MAP_FAILED) return -1;
+    }
+
+    r->hdr = (struct shm_ring_hdr *)map;
+    r->slots = (uint8_t *)map + RING_HDR_SIZE;
+    r->map_len = len;
+    /* a consumer that died asleep leaves a stale count; it only costs a wake */
+    return 0;
+}
+
+void shm_ring_close(shm_ring *r){
+    if(r->hdr){
+        munmap(r->hdr, r->map_len);
+        r->hdr = NULL;
+    }
+}
+
+int shm_ring_push(shm_ring *r, const void *rec){
+    struct shm_ring_hdr *h = r->hdr;
+    uint32_t head = h->head;   /* only the producer writes head */
+    uint32_t tail = __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE);
+
+    if(head - tail >= h->capacity){
+        h->dropped++;
+        return -1;
+    }
+
+    memcpy(r->slots + (size_t)(head & (h->capacity - 1)) * h->rec_size, rec, h->rec_size);
+    __atomic_store_n(&h->head, head + 1, __ATOMIC_RELEASE);
+
+    __atomic_add_fetch(&h->wake_seq, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&h->waiters, __ATOMIC_SEQ_CST) != 0)
+        futex(&h->wake_seq, FUTEX_WAKE, 1, NULL);
+    return 0;
+}
+
+uint32_t shm_ring_count(const shm_ring *r){
+    uint32_t head = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+    return head - r->hdr->tail;
+}
+
+uint32_t shm_ring_peek(shm_ring *r, void **out){
+    struct shm_ring_hdr *h = r->hdr;
+    uint32_t tail = h->tail;   /* only the consumer writes tail */
+    uint32_t avail = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE) - tail;
+    uint32_t slot = tail & (h->capacity - 1);
+
+    if(avail > h->capacity - slot) avail = h->capacity - slot;   /* stop at the wrap */
+    *out = r->slots + (size_t)slot * h->rec_size;
+    return avail;
+}
+
+void shm_ring_commit(shm_ring *r, uint32_t n){
+    __atomic_store_n(&r->hdr->tail, r->hdr->tail + n, __ATOMIC_RELEASE);
+}
+
+int shm_ring_wait(shm_ring *r, uint64_t timeout_us){
+    struct shm_ring_hdr *h = r->hdr;
+
+    uint32_t seq = __atomic_load_n(&h->wake_seq, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&h->waiters, 1, __ATOMIC_SEQ_CST);
+    if(shm_ring_count(r) == 0 && timeout_us > 0){
+        struct timespec ts = { (time_t)(timeout_us / 1000000), (long)(timeout_us % 1000000) * 1000 };
+        /* returns at once if a push bumped wake_seq after we sampled it */
+        futex(&h->wake_seq, FUTEX_WAIT, seq, &ts);
+    }
+    __atomic_sub_fetch(&h->waiters, 1, __ATOMIC_SEQ_CST);
+
+    return shm_ring_count(r) > 0;
+}
@@ -0,0 +1,104 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @file shm_ring
+ * @brief Single-producer / single-consumer ring of fixed-size records in a
+ *        shared mapping, with futex wakeups.
+ *
+ * Alternative to the /tmp/i2c_pipe FIFO between I2C_DAEMON (producer) and
+ * CLIENT_DAEMON (consumer). Pushing a record is a memcpy plus two atomic
+ * stores; the futex syscall is only made when the consumer is asleep. The
+ * ring lives in a file (on tmpfs by default), so queued records survive a
+ * restart of either daemon: the consumer commits its read index only after
+ * the records were stored elsewhere, and a restarted producer continues at
+ * the persisted write index.
+ */
+
+#define RING_PATH     "/dev/shm/i2c_ring"   /**< Ring file shared by the daemons */
+#define RING_CAPACITY 4096                  /**< Records, must be a power of two */
+#define RING_MAGIC    0x52494E47U           /**< "RING" */
+#define RING_VERSION  1
+
+/**
+ * @brief Shared header. head and tail are free-running indexes on separate
+ *        cache lines; record i lives in slot i & (capacity - 1).
+ */
+struct shm_ring_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t rec_size;
+    uint32_t capacity;
+    uint64_t dropped;                               /**< Pushes rejected while full */
+    uint32_t head __attribute__((aligned(64)));     /**< Written by the producer */
+    uint32_t wake_seq;                              /**< Futex word, bumped on every push */
+    uint32_t tail __attribute__((aligned(64)));     /**< Written by the consumer */
+    uint32_t waiters;                               /**< Consumers sleeping on wake_seq */
+};
+
+/**
+ * @brief Open ring handle.
+ */
+typedef struct {
+    struct shm_ring_hdr *hdr;
+    uint8_t *slots;
+    size_t map_len;
+} shm_ring;
+
+/**
+ * @brief Map (creating or resetting if needed) a ring.
+ * @param r Handle to fill
+ * @param path Backing file, or NULL for an anonymous in-process ring
+ * @param rec_size Record size in bytes
+ * @param capacity Number of records (power of two)
+ * @return 0 on success, -1 on error
+ */
+int shm_ring_open(shm_ring *r, const char *path, uint32_t rec_size, uint32_t capacity);
+
+/**
+ * @brief Unmap the ring. Queued records stay in the backing file.
+ * @param r Ring handle
+ */
+void shm_ring_close(shm_ring *r);
+
+/**
+ * @brief Producer: append one record and wake the consumer if it sleeps.
+ * @param r Ring handle
+ * @param rec Record of rec_size bytes
+ * @return 0 on success, -1 if the ring is full (the record is dropped)
+ */
+int shm_ring_push(shm_ring *r, const void *rec);
+
+/**
+ * @brief Consumer: number of records ready to read.
+ * @param r Ring handle
+ */
+uint32_t shm_ring_count(const shm_ring *r);
+
+/**
+ * @brief Consumer: longest contiguous run of unread records.
+ * @param r Ring handle
+ * @param out Set to the first record of the run
+ * @return Number of records in the run
+ */
+uint32_t shm_ring_peek(shm_ring *r, void **out);
+
+/**
+ * @brief Consumer: release n records returned by shm_ring_peek().
+ * @param r Ring handle
+ * @param n Number of records consumed
+ */
+void shm_ring_commit(shm_ring *r, uint32_t n);
+
+/**
+ * @brief Consumer: sleep until a record is pushed or the timeout expires.
+ * @param r Ring handle
+ * @param timeout_us Maximum wait in microseconds
+ * @return 1 if records are ready, 0 on timeout
+ */
+int shm_ring_wait(shm_ring *r, uint64_t timeout_us);
+
+#endif
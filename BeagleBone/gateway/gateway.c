@@ -0,0 +1,115 @@
+#include "client.h"
+#include "gateway.h"
+#include <pthread.h>
+
+int sock = -1;
+
+static spool sp;
+static shm_ring queue;
+static uint64_t coalesce_us = COALESCE_WINDOW_US;
+
+static void *network_thread(void *arg){
+    (void)arg;
+    client_loop(&sp, &queue, -1, coalesce_us);   /* returns only on a poll error */
+    spool_close(&sp);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief GATEWAY [--gpio-cdev [--gpio-chip PATH] [--gpio-line N]] [--sim [--sim-rate N] [--sim-devices N] [--sim-count N] [--sim-trace FILE]] [--proto N] [--server ADDR]
+ *        Runs the I2C reader and the TCP client in one process: an I2C thread
+ *        and a network thread connected by an in-process ring. Logging,
+ *        spooling and signals behave as in the two daemons.
+ *        --sim   generate frames instead of reading the STM32 (see hw_backend.h)
+ *        --proto highest protocol version to offer the server (as CLIENT_DAEMON)
+ *        --server IPv4 address of the server (as CLIENT_DAEMON)
+ */
+int main(int argc, char **argv) {
+    hw_backend *hw = hw_select(argc, argv);
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--proto") == 0) proto_max = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--server") == 0) server_address = argv[i + 1];
+    }
+
+    /* Make dir for log if not exsist */
+    struct stat st = {0};
+    if (stat("/home/debian/embedded", &st) == -1) {
+        mkdir("/home/debian/embedded", 0777);
+    }
+
+    logger_init(GATEWAY_LOG_FILE, LOG_LVL_INFO);
+
+    /* Daemon setup */
+    logger_flush();     // the child must not inherit buffered lines
+    pid_t pid = fork();
+    if (pid < 0) {
+        log_message("Error: Daemon fork failed.");
+        exit(EXIT_FAILURE);
+    }
+    if (pid > 0) {
+        log_message("Parent process exiting after daemon fork.");
+        exit(EXIT_SUCCESS); // Parent exits
+    }
+    if (setsid() == -1) {
+        log_message("create new session failed");
+        exit(EXIT_FAILURE);
+    }
+    umask(0);
+    if (chdir("/") == -1) {
+        log_message("failed to enter root directory.");
+        exit(EXIT_FAILURE);
+    }
+    close(STDIN_FILENO);
+    close(STDOUT_FILENO);
+    close(STDERR_FILENO);
+    log_message("Daemon started");
+
+    /**
+    * Termination signals are blocked in the worker threads and taken with
+    * sigwait() here, so handle_signal() runs in a normal thread context and
+    * cannot interrupt a thread holding the logger lock. SIGUSR1/SIGUSR2 keep
+    * their async handlers (they only set a flag).
+    */
+    sigset_t term;
+    sigemptyset(&term);
+    sigaddset(&term, SIGINT);
+    sigaddset(&term, SIGTERM);
+    sigaddset(&term, SIGHUP);
+    sigaddset(&term, SIGQUIT);
+    pthread_sigmask(SIG_BLOCK, &term, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    logger_install_level_signals();
+
+    const char *coalesce_env = getenv("CLIENT_COALESCE_US");
+    if (coalesce_env) coalesce_us = strtoull(coalesce_env, NULL, 10);
+
+    if (spool_open(&sp, SPOOL_PATH, SPOOL_CAPACITY) < 0) {
+        log_message("Failed to open spool");
+        exit(EXIT_FAILURE);
+    }
+
+    srand((unsigned)time(NULL) ^ (unsigned)getpid());
+
+    if (shm_ring_open(&queue, NULL, sizeof(gps_record), GATEWAY_QUEUE_CAPACITY) < 0) {
+        log_message("Failed to create frame queue");
+        exit(EXIT_FAILURE);
+    }
+
+    if (gateway_i2c_start(&queue, hw) < 0) {
+        spool_close(&sp);
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, network_thread, NULL) != 0) {
+        log_message("Failed to start network thread");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(tid);
+
+    for (;;) {
+        int sig;
+        if (sigwait(&term, &sig) == 0)
+            handle_signal(sig);
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef GATEWAY_H
+#define GATEWAY_H
+
+#include "shm_ring.h"
+#include "hw_backend.h"
+
+/**
+ * @file gateway
+ * @brief Single-process alternative to I2C_DAEMON + CLIENT_DAEMON.
+ *
+ * An I2C thread waits for the STM32 data-ready GPIO and reads frames, a
+ * network thread spools them and forwards them to the server. The threads
+ * are connected by an in-process single-producer / single-consumer ring
+ * (the shm_ring code on an anonymous mapping), so a frame costs no syscalls
+ * between reading it and spooling it while the network thread is busy.
+ */
+
+#define GATEWAY_LOG_FILE "/home/debian/embedded/parking_gateway.log"   /**< Log file path */
+#define GATEWAY_QUEUE_CAPACITY 4096                                   /**< Frames, power of two */
+
+/**
+ * @brief Open the hardware backend and start the I2C thread.
+ *        Frames read are pushed to queue in wire byte order.
+ * @param queue Ring the I2C thread produces into
+ * @param hw Backend to read frames from (real I2C/GPIO or simulation)
+ * @return 0 on success, -1 on error
+ */
+int gateway_i2c_start(shm_ring *queue, hw_backend *hw);
+
+#endif
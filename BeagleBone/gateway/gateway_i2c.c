@@ -0,0 +1,46 @@
+#include "i2c_master.h"
+#include "gateway.h"
+#include <pthread.h>
+
+int pipe_fd = -1;   // used by handle_signal() in i2c_master.c, no FIFO here
+int i2c_fd = -1;
+int gpio_fd = -1;
+
+static shm_ring *frames;
+
+/**
+ * @brief Hand a frame to the network thread.
+ * @param rec Frame in wire byte order with its edge time
+ */
+static void queue_frame(const gps_record *rec){
+    if(shm_ring_push(frames, rec) < 0)
+        log_printf(LOG_LVL_WARN, "Queue full, frame dropped (%llu total)",
+                   (unsigned long long)frames->hdr->dropped);
+    else
+        log_printf(LOG_LVL_DEBUG, "Gps_frame queued for the network thread");
+}
+
+static void *i2c_thread(void *arg){
+    hw_backend *hw = arg;
+    i2c_poll_loop(hw, queue_frame);
+    hw->close(hw);
+    log_message("I2C thread stopped, exiting");
+    exit(EXIT_FAILURE);
+}
+
+int gateway_i2c_start(shm_ring *queue, hw_backend *hw){
+    frames = queue;
+
+    if(hw->open(hw) < 0){
+        return -1;
+    }
+    log_printf(LOG_LVL_INFO, "Using %s backend", hw->name);
+
+    pthread_t tid;
+    if(pthread_create(&tid, NULL, i2c_thread, hw) != 0){
+        log_message("Failed to start I2C thread");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
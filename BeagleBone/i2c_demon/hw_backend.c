@@ -0,0 +1,41 @@
+#include "i2c_master.h"
+#include "hw_backend.h"
+
+hw_backend *hw_select(int argc, char **argv){
+    int sim = 0, cdev = 0, burst = 0;
+    const char *trace_path = NULL;
+    const char *chip = GPIO_CHIP;
+    unsigned line = GPIO_LINE;
+    unsigned rate = SIM_RATE_HZ, devices = SIM_DEVICES;
+    unsigned long count = 0;
+
+    for(int i = 1; i < argc; i++){
+        const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if(strcmp(argv[i], "--sim") == 0) sim = 1;
+        else if(strcmp(argv[i], "--gpio-cdev") == 0) cdev = 1;
+        else if(strcmp(argv[i], "--burst") == 0) burst = 1;
+        else if(val && strcmp(argv[i], "--gpio-chip") == 0){ chip = val; cdev = 1; i++; }
+        else if(val && strcmp(argv[i], "--gpio-line") == 0){ line = (unsigned)strtoul(val, NULL, 10); cdev = 1; i++; }
+        else if(val && strcmp(argv[i], "--sim-rate") == 0){ rate = (unsigned)strtoul(val, NULL, 10); i++; }
+        else if(val && strcmp(argv[i], "--sim-devices") == 0){ devices = (unsigned)strtoul(val, NULL, 10); i++; }
+        else if(val && strcmp(argv[i], "--sim-count") == 0){ count = strtoul(val, NULL, 10); i++; }
+        else if(val && strcmp(argv[i], "--sim-trace") == 0){
+            /* absolute, the daemons chdir("/") before opening the backend */
+            trace_path = realpath(val, NULL);
+            if(!trace_path) trace_path = val;
+            i++;
+        }
+    }
+
+    if(sim)
+        hw_sim_configure(trace_path, rate, devices, count);
+    if(cdev){
+        hw_gpiocdev_configure(chip, line, sim);
+        hw_gpiocdev.burst = burst && !sim;
+        return &hw_gpiocdev;
+    }
+    if(sim)
+        return &hw_sim;
+    hw_sysfs.burst = burst;
+    return &hw_sysfs;
+}
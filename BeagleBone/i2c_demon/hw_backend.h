@@ -0,0 +1,99 @@
+#ifndef HW_BACKEND_H
+#define HW_BACKEND_H
+
+#include <stdint.h>
+
+/**
+ * @file hw_backend
+ * @brief Edge-wait / frame-read operations of the I2C side behind a small
+ *        interface, so the daemons can run against the real STM32 (sysfs
+ *        GPIO + /dev/i2c-2) or against a simulated source on any Linux box.
+ */
+
+#define SIM_RATE_HZ      10      /**< Default simulated frames per second (0 = unthrottled) */
+#define SIM_DEVICES      16      /**< Default number of simulated devices */
+#define SIM_DEVICE_BASE  1610    /**< First simulated device id (the STM32 DEVICE_ID) */
+
+/**
+ * @brief Backend operations. All functions return -1 on error.
+ */
+typedef struct hw_backend {
+    const char *name;
+
+    /** @brief Acquire the hardware (or set up the simulation). */
+    int (*open)(struct hw_backend *hw);
+
+    /**
+     * @brief Wait for the data-ready edge.
+     * @return 1 if a frame is ready, 0 on timeout, -1 on error / end of input
+     */
+    int (*wait_edge)(struct hw_backend *hw, int timeout_ms);
+
+    /** @brief Read the pending frame (host byte order). */
+    int (*read_frame)(struct hw_backend *hw, uint16_t *device_id, float *cord_x,
+                      float *cord_y, uint16_t *status);
+
+    /** @brief Release the hardware. */
+    void (*close)(struct hw_backend *hw);
+
+    /** CLOCK_REALTIME ns of the edge that announced the last frame read, 0 if unknown */
+    uint64_t event_ns;
+
+    /** Read up to BURST_MAX frames per edge (I2C backends, set before open) */
+    int burst;
+} hw_backend;
+
+/**
+ * @brief Real hardware: GPIO_NUM through sysfs and the STM32 on I2C_BUS.
+ */
+extern hw_backend hw_sysfs;
+
+/**
+ * @brief Real hardware with edges from the GPIO character device: every
+ *        edge is queued by the kernel with its own timestamp, so close
+ *        edges are not merged.
+ */
+extern hw_backend hw_gpiocdev;
+
+/**
+ * @brief Simulated source: frames from a trace file or from the STM32
+ *        coordinates table, paced at a fixed rate.
+ */
+extern hw_backend hw_sim;
+
+/**
+ * @brief Configure the simulated backend.
+ * @param trace_path Text file with "device_id x y status" per line ('#' comments),
+ *                   replayed in a loop; NULL to generate from the coordinates table
+ * @param rate_hz Frames per second, 0 for as fast as the consumer takes them
+ * @param devices Number of device ids generated from the table
+ * @param count Stop generating after this many frames (0 = never); the
+ *              backend then only reports idle timeouts
+ */
+void hw_sim_configure(const char *trace_path, unsigned rate_hz, unsigned devices,
+                      unsigned long count);
+
+/**
+ * @brief Configure the GPIO character-device backend.
+ * @param chip GPIO chip device, e.g. /dev/gpiochip1 or a gpio-sim chip
+ * @param line Line offset on the chip
+ * @param sim_frames Take the frames from hw_sim instead of the I2C bus, so
+ *                   the edge path can be tested with the gpio-sim mock chip
+ */
+void hw_gpiocdev_configure(const char *chip, unsigned line, int sim_frames);
+
+/**
+ * @brief Pick the backend from the command line.
+ *        --sim enables the simulation; --sim-rate N, --sim-devices N,
+ *        --sim-count N and --sim-trace FILE configure it.
+ *        --gpio-cdev uses the GPIO character device; --gpio-chip PATH and
+ *        --gpio-line N select the line (and imply --gpio-cdev). With both,
+ *        edges come from the GPIO line and frames from the simulation.
+ *        Without either the sysfs GPIO is used. --burst reads the STM32
+ *        frame queue in bursts instead of one frame per edge (the firmware
+ *        must be built with I2C_BURST_MODE). Other arguments are ignored.
+ * @return &hw_sim, &hw_gpiocdev or &hw_sysfs
+ */
+hw_backend *hw_select(int argc, char **argv);
+
+#endif
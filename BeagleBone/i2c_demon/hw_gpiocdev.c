@@ -0,0 +1,164 @@
+#include "i2c_master.h"
+#include "hw_backend.h"
+#include <linux/gpio.h>
+
+extern int i2c_fd;
+extern int gpio_fd;
+
+static const char *cdev_chip = GPIO_CHIP;
+static unsigned cdev_line = GPIO_LINE;
+static int cdev_sim_frames;     /**< Frames from hw_sim instead of the I2C bus */
+
+static struct gpio_v2_line_event events[GPIO_EVENT_BUFFER];
+static size_t ev_count;         /**< Events in the last read() */
+static size_t ev_next;          /**< Next event to hand out */
+static uint32_t last_seqno;     /**< line_seqno of the last event seen */
+static int mono_clock;          /**< Kernel gave CLOCK_MONOTONIC timestamps */
+static i2c_burst burst;         /**< Burst mode: frames read but not handed out yet */
+static uint64_t burst_edge_ns;  /**< Edge time shared by the frames of a burst */
+
+void hw_gpiocdev_configure(const char *chip, unsigned line, int sim_frames){
+    cdev_chip = chip;
+    cdev_line = line;
+    cdev_sim_frames = sim_frames;
+}
+
+/**
+ * @brief Request the line for rising-edge events with REALTIME timestamps.
+ *        Kernels before 5.11 do not know the REALTIME flag; fall back to
+ *        MONOTONIC timestamps and convert them when read.
+ * @return Line request fd, or -1 on error
+ */
+static int request_line(void){
+    int chip_fd = open(cdev_chip, O_RDWR | O_CLOEXEC);
+    if(chip_fd < 0){
+        log_printf(LOG_LVL_ERROR, "Failed to open %s: %s", cdev_chip, strerror(errno));
+        return -1;
+    }
+
+    struct gpio_v2_line_request req;
+    memset(&req, 0, sizeof(req));
+    req.offsets[0] = cdev_line;
+    req.num_lines = 1;
+    req.event_buffer_size = GPIO_EVENT_BUFFER;
+    snprintf(req.consumer, sizeof(req.consumer), "parking-i2c");
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING |
+                       GPIO_V2_LINE_FLAG_EVENT_CLOCK_REALTIME;
+
+    mono_clock = 0;
+    if(ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0 && errno == EINVAL){
+        req.config.flags &= ~(uint64_t)GPIO_V2_LINE_FLAG_EVENT_CLOCK_REALTIME;
+        mono_clock = 1;
+        if(ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0) req.fd = -1;
+    }
+    int err = errno;
+    close(chip_fd);
+
+    if(req.fd <= 0){
+        log_printf(LOG_LVL_ERROR, "Failed to request line %u of %s: %s",
+                   cdev_line, cdev_chip, strerror(err));
+        return -1;
+    }
+    log_printf(LOG_LVL_INFO, "GPIO line %u of %s requested (%s timestamps)",
+               cdev_line, cdev_chip, mono_clock ? "monotonic" : "realtime");
+    return req.fd;
+}
+
+static int cdev_open(hw_backend *hw){
+    if(cdev_sim_frames){
+        if(hw_sim.open(&hw_sim) < 0) return -1;
+    } else {
+        i2c_fd = i2c_open_bus(I2C_BUS, I2C_SLAVE_ADDR, &burst);
+        if(i2c_fd < 0){
+            return -1;
+        }
+    }
+
+    gpio_fd = request_line();
+    if(gpio_fd < 0){
+        if(i2c_fd >= 0){ close(i2c_fd); i2c_fd = -1; }
+        return -1;
+    }
+    ev_count = ev_next = 0;
+    last_seqno = 0;
+    if(hw->burst) log_message("I2C burst mode enabled");
+    return 0;
+}
+
+/**
+ * @brief Convert a kernel event timestamp to CLOCK_REALTIME ns.
+ */
+static uint64_t event_realtime_ns(uint64_t ts){
+    if(!mono_clock) return ts;
+    struct timespec rt, mono;
+    clock_gettime(CLOCK_REALTIME, &rt);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    int64_t offset = ((int64_t)rt.tv_sec - mono.tv_sec) * 1000000000ll + (rt.tv_nsec - mono.tv_nsec);
+    return (uint64_t)((int64_t)ts + offset);
+}
+
+static int cdev_wait_edge(hw_backend *hw, int timeout_ms){
+    if(ev_next < ev_count) return 1;   /* edges still queued from the last read */
+    if(hw->burst && i2c_burst_ready(&burst)) return 1;
+
+    struct pollfd pfd = { gpio_fd, POLLIN, 0 };
+    int ret = poll(&pfd, 1, timeout_ms);
+    if(ret < 0){
+        if(errno == EINTR) return 0;
+        log_message("Poll error on GPIO");
+        return -1;
+    }
+    if(ret == 0) return 0;
+
+    ssize_t n = read(gpio_fd, events, sizeof(events));
+    if(n < 0){
+        if(errno == EINTR || errno == EAGAIN) return 0;
+        log_printf(LOG_LVL_ERROR, "GPIO event read failed: %s", strerror(errno));
+        return -1;
+    }
+    ev_count = (size_t)n / sizeof(events[0]);
+    ev_next = 0;
+
+    /* line_seqno counts every edge; a gap means the kernel queue overflowed */
+    if(ev_count > 0){
+        uint32_t first = events[0].line_seqno;
+        if(last_seqno != 0 && first != last_seqno + 1)
+            log_printf(LOG_LVL_WARN, "GPIO event queue overflowed, %u edges lost",
+                       first - last_seqno - 1);
+        last_seqno = events[ev_count - 1].line_seqno;
+    }
+    return ev_count > 0;
+}
+
+static int cdev_read_frame(hw_backend *hw, uint16_t *device_id, float *cord_x,
+                           float *cord_y, uint16_t *status){
+    if(hw->burst){
+        /**
+        * The STM32 holds data-ready high while its queue is non-empty, so a
+        * burst (and the reads that follow while it reports pending frames)
+        * belongs to one edge; a new edge starts a new burst.
+        */
+        if(!i2c_burst_ready(&burst) && ev_next < ev_count)
+            burst_edge_ns = event_realtime_ns(events[ev_next++].timestamp_ns);
+        hw->event_ns = burst_edge_ns;
+        return i2c_burst_next(i2c_fd, &burst, device_id, cord_x, cord_y, status);
+    }
+
+    uint64_t edge = (ev_next < ev_count) ? event_realtime_ns(events[ev_next++].timestamp_ns) : 0;
+    int ret = cdev_sim_frames ? hw_sim.read_frame(&hw_sim, device_id, cord_x, cord_y, status)
+                              : i2c_read_frame(i2c_fd, device_id, cord_x, cord_y, status);
+    hw->event_ns = edge;
+    return ret;
+}
+
+static void cdev_close(hw_backend *hw){
+    (void)hw;
+    if(cdev_sim_frames) hw_sim.close(&hw_sim);
+    if(i2c_fd >= 0){ close(i2c_fd); i2c_fd = -1; }
+    if(gpio_fd >= 0){ close(gpio_fd); gpio_fd = -1; }
+    memset(&burst, 0, sizeof(burst));
+}
+
+hw_backend hw_gpiocdev = {
+    "gpio-cdev", cdev_open, cdev_wait_edge, cdev_read_frame, cdev_close, 0, 0
+};
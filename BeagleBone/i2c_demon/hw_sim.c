@@ -0,0 +1,168 @@
+#include "i2c_master.h"
+#include "hw_backend.h"
+#include "coordinates.h"
+
+/**
+ * @brief One frame of a loaded trace file.
+ */
+typedef struct {
+    uint16_t device_id;
+    float cord_x;
+    float cord_y;
+    uint16_t status;
+} sim_frame;
+
+static const char *sim_trace_path = NULL;
+static unsigned sim_rate = SIM_RATE_HZ;
+static unsigned sim_devices = SIM_DEVICES;
+static unsigned long sim_count = 0;
+
+static sim_frame *trace;          /**< Loaded trace, NULL in table mode */
+static size_t trace_len;
+static unsigned long produced;    /**< Frames handed out so far */
+static uint64_t next_due_ns;      /**< CLOCK_MONOTONIC time of the next frame */
+static uint64_t start_ns;
+static int reported;             /**< Final rate already logged */
+
+static uint64_t sim_now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void hw_sim_configure(const char *trace_path, unsigned rate_hz, unsigned devices,
+                      unsigned long count){
+    sim_trace_path = trace_path;
+    sim_rate = rate_hz;
+    sim_devices = devices ? devices : 1;
+    sim_count = count;
+}
+
+static int load_trace(const char *path){
+    FILE *f = fopen(path, "r");
+    if(!f){
+        log_printf(LOG_LVL_ERROR, "Sim: cannot open trace %s", path);
+        return -1;
+    }
+
+    size_t cap = 256;
+    trace = malloc(cap * sizeof(*trace));
+    char line[128];
+    unsigned id, st;
+    float x, y;
+    while(trace && fgets(line, sizeof(line), f)){
+        if(line[0] == '#' || sscanf(line, "%u %f %f %u", &id, &x, &y, &st) != 4)
+            continue;
+        if(trace_len == cap){
+            cap *= 2;
+            sim_frame *bigger = realloc(trace, cap * sizeof(*trace));
+            if(!bigger){ free(trace); trace = NULL; break; }
+            trace = bigger;
+        }
+        trace[trace_len++] = (sim_frame){ (uint16_t)id, x, y, (uint16_t)st };
+    }
+    fclose(f);
+
+    if(!trace || trace_len == 0){
+        log_printf(LOG_LVL_ERROR, "Sim: no frames in trace %s", path);
+        free(trace);
+        trace = NULL;
+        return -1;
+    }
+    log_printf(LOG_LVL_INFO, "Sim: loaded %zu frames from %s", trace_len, path);
+    return 0;
+}
+
+static int sim_open(hw_backend *hw){
+    (void)hw;
+    if(sim_trace_path && load_trace(sim_trace_path) < 0)
+        return -1;
+
+    produced = 0;
+    reported = 0;
+    start_ns = next_due_ns = sim_now_ns();
+    log_printf(LOG_LVL_INFO, "Sim backend: %s, %u frames/s, %u devices",
+               trace ? "trace" : "coordinates table", sim_rate, sim_devices);
+    return 0;
+}
+
+/**
+ * @brief Log the achieved rate once the configured count is reached.
+ */
+static void sim_report(void){
+    double secs = (double)(sim_now_ns() - start_ns) / 1e9;
+    log_printf(LOG_LVL_INFO, "Sim: %lu frames in %.3f s (%.0f frames/s)",
+               produced, secs, secs > 0 ? (double)produced / secs : 0.0);
+}
+
+/**
+ * @details Frames are due every 1/rate seconds from the start. When the
+ *          consumer falls behind, the due frames are handed out back to back,
+ *          so an unreachable rate measures the pipeline's maximum throughput.
+ */
+static int sim_wait_edge(hw_backend *hw, int timeout_ms){
+    (void)hw;
+    if(sim_count && produced >= sim_count){
+        /* input exhausted: stay idle so the rest of the pipeline drains */
+        if(!reported){
+            sim_report();
+            reported = 1;
+        }
+        struct timespec idle = { timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000 };
+        nanosleep(&idle, NULL);
+        return 0;
+    }
+    if(sim_rate == 0) return 1;
+
+    uint64_t now = sim_now_ns();
+    if(now >= next_due_ns) return 1;
+
+    uint64_t limit = now + (uint64_t)timeout_ms * 1000000ull;
+    uint64_t until = next_due_ns < limit ? next_due_ns : limit;
+    struct timespec ts = { (time_t)(until / 1000000000ull), (long)(until % 1000000000ull) };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    return sim_now_ns() >= next_due_ns ? 1 : 0;
+}
+
+/**
+ * @details Table mode mimics the STM32 firmware for sim_devices devices: each
+ *          device sends START then AND for the same coordinate and moves on
+ *          to the next entry of coordinates.h.
+ */
+static int sim_read_frame(hw_backend *hw, uint16_t *device_id, float *cord_x,
+                          float *cord_y, uint16_t *status){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    hw->event_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+
+    if(trace){
+        const sim_frame *f = &trace[produced % trace_len];
+        *device_id = f->device_id;
+        *cord_x = f->cord_x;
+        *cord_y = f->cord_y;
+        *status = f->status;
+    } else {
+        unsigned long round = produced / sim_devices;
+        unsigned idx = (unsigned)((round / 2) % MAX_COORDINATES);
+        *device_id = (uint16_t)(SIM_DEVICE_BASE + produced % sim_devices);
+        *cord_x = coordinates[idx].x;
+        *cord_y = coordinates[idx].y;
+        *status = (round % 2 == 0) ? START : AND;
+    }
+
+    produced++;
+    if(sim_rate)
+        next_due_ns += 1000000000ull / sim_rate;
+    return 0;
+}
+
+static void sim_close(hw_backend *hw){
+    (void)hw;
+    free(trace);
+    trace = NULL;
+    trace_len = 0;
+}
+
+hw_backend hw_sim = {
+    "sim", sim_open, sim_wait_edge, sim_read_frame, sim_close, 0, 0
+};
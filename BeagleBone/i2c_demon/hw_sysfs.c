@@ -0,0 +1,71 @@
+#include "i2c_master.h"
+#include "hw_backend.h"
+
+extern int i2c_fd;
+extern int gpio_fd;
+
+static uint64_t edge_ns;   /**< CLOCK_REALTIME when the last edge was seen */
+static i2c_burst burst;    /**< Burst mode: frames read but not handed out yet */
+
+static int sysfs_open(hw_backend *hw){
+    i2c_fd = i2c_open_bus(I2C_BUS, I2C_SLAVE_ADDR, &burst);
+    if(i2c_fd < 0){
+        return -1;
+    }
+
+    gpio_fd = gpio_init(GPIO_NUM);
+    if(gpio_fd < 0){
+        log_message("GPIO initialization failed, exiting");
+        close(i2c_fd);
+        i2c_fd = -1;
+        return -1;
+    }
+    log_message("GPIO initialized successfully");
+    if(hw->burst) log_message("I2C burst mode enabled");
+    return 0;
+}
+
+static int sysfs_wait_edge(hw_backend *hw, int timeout_ms){
+    /* the rest of a burst, or frames the STM32 still holds, need no new edge */
+    if(hw->burst && i2c_burst_ready(&burst)) return 1;
+
+    struct pollfd pfd;
+    pfd.fd = gpio_fd;
+    pfd.events = POLLPRI | POLLERR;
+
+    int ret = poll(&pfd, 1, timeout_ms);
+    if(ret < 0){
+        if(errno == EINTR) return 0;
+        log_message("Poll error on GPIO");
+        return -1;
+    }
+    if(ret == 0) return 0;
+
+    /* sysfs has no event timestamps: take the time poll() woke up */
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    edge_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+
+    lseek(gpio_fd, 0, SEEK_SET);
+    char buf[2] = {0};
+    return (read(gpio_fd, buf, 1) > 0 && buf[0] == '1') ? 1 : 0;
+}
+
+static int sysfs_read_frame(hw_backend *hw, uint16_t *device_id, float *cord_x,
+                            float *cord_y, uint16_t *status){
+    hw->event_ns = edge_ns;
+    if(hw->burst)
+        return i2c_burst_next(i2c_fd, &burst, device_id, cord_x, cord_y, status);
+    return i2c_read_frame(i2c_fd, device_id, cord_x, cord_y, status);
+}
+
+static void sysfs_close(hw_backend *hw){
+    (void)hw;
+    if(i2c_fd >= 0){ close(i2c_fd); i2c_fd = -1; }
+    if(gpio_fd >= 0){ close(gpio_fd); gpio_fd = -1; }
+    memset(&burst, 0, sizeof(burst));
+}
+
+hw_backend hw_sysfs = {
+    "sysfs", sysfs_open, sysfs_wait_edge, sysfs_read_frame, sysfs_close, 0, 0
+};
@@ -1,5 +1,5 @@
 #include "i2c_master.h"
-#include "protocol.h"
+#include "shm_ring.h"
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
@@ -20,6 +20,7 @@
  * from any terminal and capable of running in the background.
  */
 static void daemonize(void){
+    logger_flush();     // the child must not inherit buffered lines
     pid_t pid = fork();
     if (pid < 0) {
         log_message("Error: Daemon fork failed.");
@@ -54,8 +55,61 @@ int pipe_fd = -1;   // global for signal handler
 int i2c_fd = -1;
 int gpio_fd = -1;
 
-int main(void){
-    char logbuf[256];
+static shm_ring ring;   // used instead of the FIFO with --ring
+static int use_ring = 0;
+
+/**
+ * @brief Hand a frame to CLIENT_DAEMON through the FIFO or the shared ring.
+ * @param rec Frame in wire byte order with its edge time
+ */
+static void forward_frame(const gps_record *rec){
+    if(use_ring){
+        if(shm_ring_push(&ring, rec) < 0)
+            log_printf(LOG_LVL_WARN, "Ring full, frame dropped (%llu total)",
+                       (unsigned long long)ring.hdr->dropped);
+        else
+            log_printf(LOG_LVL_DEBUG, "Gps_frame pushed to ring");
+        return;
+    }
+
+    if(pipe_fd >= 0){
+        ssize_t written = write(pipe_fd, rec, sizeof(*rec));
+        if (written != sizeof(*rec)){
+            if(errno == EPIPE || errno == ENXIO){
+                log_message("Reader disconnected from FIFO, exitig...");
+                handle_signal(SIGPIPE);
+            }
+            else{
+                log_message("Failed to write full gps_frame to pipe");
+            }
+        }
+        else{
+            log_printf(LOG_LVL_DEBUG, "Gps_frame send successfully to pipe");
+        }
+    }
+}
+
+/**
+ * @brief I2C_DAEMON [--ring] [--gpio-cdev [--gpio-chip PATH] [--gpio-line N]]
+ *                   [--sim [--sim-rate N] [--sim-devices N] [--sim-count N] [--sim-trace FILE]]
+ *        --ring      pass frames through the shared-memory ring (RING_PATH)
+ *                    instead of the PIPE_PATH FIFO; CLIENT_DAEMON must use it too.
+ *        --gpio-cdev take edges from the GPIO character device instead of sysfs
+ *        --sim       generate frames instead of reading the STM32 (see hw_backend.h)
+ */
+int main(int argc, char **argv){
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--ring") == 0) use_ring = 1;
+    }
+    hw_backend *hw = hw_select(argc, argv);
+
+    /* Make dir for log if not exsist */
+    struct stat st = {0};
+    if(stat("/home/debian/embedded", &st) == -1){
+        mkdir("/home/debian/embedded", 0777);
+    }
+
+    logger_init(LOG_FILE, LOG_LVL_INFO);
 
     /* handle signals */
     signal(SIGINT, handle_signal);
@@ -63,110 +117,49 @@ int main(void){
     signal(SIGHUP, handle_signal);
     signal(SIGQUIT, handle_signal);
     signal(SIGPIPE, SIG_IGN);
+    logger_install_level_signals();
 
     /* Daemon setup */
     daemonize();
     log_message("Daemon started");
 
-    /* Make dir for log if not exsist */
-    struct stat st = {0};
-    if(stat("/home/debian/embedded", &st) == -1){
-        mkdir("/home/debian/embedded", 0777);
-    }
-
-    /* Create named pipe if not exists */
-    if(access(PIPE_PATH, F_OK) != 0){
-        if(mkfifo(PIPE_PATH, 0666) < 0){
-            log_message("Failed to create PIPE");
-        } else {
-            log_message("PIPE created");
+    if(use_ring){
+        /* Shared ring: no reader needed, frames wait in RING_PATH */
+        if(shm_ring_open(&ring, RING_PATH, sizeof(gps_record), RING_CAPACITY) < 0){
+            log_message("Failed to open shared ring");
+            return 1;
+        }
+        log_printf(LOG_LVL_INFO, "Shared ring %s opened (%u frames queued)",
+                   RING_PATH, shm_ring_count(&ring));
+    } else {
+        /* Create named pipe if not exists */
+        if(access(PIPE_PATH, F_OK) != 0){
+            if(mkfifo(PIPE_PATH, 0666) < 0){
+                log_message("Failed to create PIPE");
+            } else {
+                log_message("PIPE created");
+            }
         }
-    }
-
-    /* Open FIFO for writing */
-    pipe_fd = open(PIPE_PATH, O_WRONLY | O_NONBLOCK);
-    if(pipe_fd < 0){
-        log_message("Failed to open PIPE for writing");
-    }
-    log_message("PIPE opened successfully");
-
-    /* Open I2C bus */
-    i2c_fd = open(I2C_BUS, O_RDWR);
-    if(i2c_fd < 0){
-        log_message("Failed to open I2C bus");
-        return 1;
-    }
-    log_message("I2C bus opened successfully");
 
-    if(ioctl(i2c_fd, I2C_SLAVE, I2C_SLAVE_ADDR) < 0){
-        log_message("Failed to set I2C slave address");
-        close(i2c_fd);
-        return 1;
+        /* Open FIFO for writing */
+        pipe_fd = open(PIPE_PATH, O_WRONLY | O_NONBLOCK);
+        if(pipe_fd < 0){
+            log_message("Failed to open PIPE for writing");
+        }
+        log_message("PIPE opened successfully");
     }
-    log_message("I2C slave address set successfully");
 
-    /* Open GPIO */
-    gpio_fd = gpio_init(GPIO_NUM);
-    if(gpio_fd < 0){
-        log_message("GPIO initialization failed, exiting");
-        close(i2c_fd);
+    /* Open I2C bus and GPIO, or the simulation */
+    if(hw->open(hw) < 0){
         return 1;
     }
-    log_message("GPIO initialized successfully");
-
-    struct pollfd pfd;
-    pfd.fd = gpio_fd;
-    pfd.events = POLLPRI | POLLERR;
-
-    uint16_t id, status;
-    float x, y;
-    gps_frame frame;
+    log_printf(LOG_LVL_INFO, "Using %s backend", hw->name);
 
     /* Main loop */
-    while(1){
-        int ret = poll(&pfd, 1, -1);
-        if(ret > 0){
-            lseek(gpio_fd, 0, SEEK_SET);
-            char buf[2] = {0};
-            if(read(gpio_fd, buf, 1) > 0 && buf[0] == '1'){
-                log_message("GPIO rising edge detected, reading I2C...");
-                if(i2c_read_frame(i2c_fd, &id, &x, &y, &status) == 0){
-                    snprintf(logbuf, sizeof(logbuf),
-                             "DeviceID=%u X=%.3f Y=%.3f Status=%u",
-                             id, x, y, status);
-                    log_message(logbuf);
-
-                    frame.device_id = htons(id);
-                    frame.cord_x = x;
-                    frame.cord_y = y;
-                    frame.status = htons(status);
-
-                    if(pipe_fd >= 0){
-                        ssize_t written = write(pipe_fd, &frame, sizeof(gps_frame));
-                        if (written != sizeof(frame)){
-                            if(errno == EPIPE || errno == ENXIO){
-                                log_message("Reader disconnected from FIFO, exitig...");
-                                handle_signal(SIGPIPE);
-                            }
-                            else{
-                                log_message("Failed to write full gps_frame to pipe");
-                            }
-                        }
-                        else{
-                            log_message("Gps_frame send successfully to pipe");
-                        }
-                    }
-                }
-            }
-        } else if(ret < 0){
-            log_message("Poll error on GPIO");
-            break;
-        }
-    }
+    i2c_poll_loop(hw, forward_frame);
+    hw->close(hw);
 
     /* Clean close */
-    if(i2c_fd >= 0) close(i2c_fd);
-    if(gpio_fd >= 0) close(gpio_fd);
     if(pipe_fd >= 0) close(pipe_fd);
 
     return 0;
@@ -1,18 +1,5 @@
 #include "i2c_master.h"
 
-void log_message(const char *message){
-    FILE *log=fopen(LOG_FILE,"a");
-    if(!log){
-        perror("log_message fopen");
-        return;
-    }
-    time_t now=time(NULL);
-    char ts[64];
-    strftime(ts,sizeof(ts),"%d-%m-%Y %H:%M:%S",localtime(&now));
-    fprintf(log,"[%s] %s\n\n",ts,message);
-    fclose(log);
-}
-
 int gpio_init(int gpio_num){
     char path[128];
     int fd;
@@ -50,21 +37,122 @@ int gpio_init(int gpio_num){
 }
 
 
+/**
+ * @brief Decode one frame as sent by the STM32 (whole struct byte-reversed).
+ */
+static void decode_frame(const uint8_t *raw, uint16_t *device_id, float *cord_x,
+                         float *cord_y, uint16_t *status){
+    *status    = swap16(*(const uint16_t*)&raw[0]);
+    *cord_y    = swap_float(&raw[2]);
+    *cord_x    = swap_float(&raw[6]);
+    *device_id = swap16(*(const uint16_t*)&raw[10]);
+}
+
 int i2c_read_frame(int fd,uint16_t *device_id,float *cord_x,float *cord_y,uint16_t *status){
     uint8_t raw[12];
     ssize_t n=read(fd,raw,sizeof(raw));
     if(n!=sizeof(raw)){
-        char err[64]; snprintf(err,sizeof(err),"I2C read failed (got %zd bytes)",n);
-        log_message(err);
+        log_printf(LOG_LVL_ERROR,"I2C read failed (got %zd bytes)",n);
         return -1;
     }
-    *status    = swap16(*(uint16_t*)&raw[0]);
-    *cord_y    = swap_float(&raw[2]);
-    *cord_x    = swap_float(&raw[6]);
-    *device_id = swap16(*(uint16_t*)&raw[10]);
+    decode_frame(raw, device_id, cord_x, cord_y, status);
     return 0;
 }
 
+
+/**
+ * @brief Read one burst into b with a single combined I2C_RDWR transaction.
+ * @return 0 on success, -1 on failure
+ */
+static int read_burst(int fd, i2c_burst *b){
+    struct i2c_msg msg = { b->addr, I2C_M_RD, sizeof(b->buf), b->buf };
+    struct i2c_rdwr_ioctl_data xfer = { &msg, 1 };
+
+    b->count = b->next = b->pending = 0;
+    if(ioctl(fd, I2C_RDWR, &xfer) < 0){
+        log_printf(LOG_LVL_ERROR, "I2C burst read failed: %s", strerror(errno));
+        return -1;
+    }
+
+    const burst_hdr *h = (const burst_hdr *)b->buf;
+    if(h->magic != BURST_MAGIC || h->count > BURST_MAX){
+        log_printf(LOG_LVL_ERROR, "Bad I2C burst header (magic 0x%02x, count %u)",
+                   h->magic, h->count);
+        return -1;
+    }
+    b->count = h->count;
+    b->pending = ((unsigned)h->pending_hi << 8) | h->pending_lo;
+    log_printf(LOG_LVL_DEBUG, "I2C burst: %u frames, %u still queued", b->count, b->pending);
+    return 0;
+}
+
+int i2c_burst_next(int fd, i2c_burst *b, uint16_t *device_id, float *cord_x,
+                   float *cord_y, uint16_t *status){
+    if(b->next >= b->count && read_burst(fd, b) < 0)
+        return -1;
+    if(b->next >= b->count)
+        return -1;   /* nothing was queued */
+
+    const uint8_t *raw = b->buf + sizeof(burst_hdr) + (size_t)b->next * sizeof(gps_frame);
+    b->next++;
+    decode_frame(raw, device_id, cord_x, cord_y, status);
+    return 0;
+}
+
+
+int i2c_open_bus(const char *bus, int addr, i2c_burst *b){
+    int fd = open(bus, O_RDWR);
+    if(fd < 0){
+        log_message("Failed to open I2C bus");
+        return -1;
+    }
+    log_message("I2C bus opened successfully");
+
+    if(ioctl(fd, I2C_SLAVE, addr) < 0){
+        log_message("Failed to set I2C slave address");
+        close(fd);
+        return -1;
+    }
+    log_message("I2C slave address set successfully");
+    if(b){
+        memset(b, 0, sizeof(*b));
+        b->addr = (uint16_t)addr;
+    }
+    return fd;
+}
+
+
+int i2c_poll_loop(hw_backend *hw, void (*forward)(const gps_record *rec)){
+    uint16_t id, status;
+    float x, y;
+    gps_record rec;
+
+    while(1){
+        int ret = hw->wait_edge(hw, LOG_FLUSH_INTERVAL_SEC * 1000);
+        if(ret > 0){
+            log_printf(LOG_LVL_DEBUG, "Data-ready edge detected, reading I2C...");
+            if(hw->read_frame(hw, &id, &x, &y, &status) == 0){
+                log_printf(LOG_LVL_INFO, "DeviceID=%u X=%.3f Y=%.3f Status=%u",
+                           id, x, y, status);
+
+                rec.frame.device_id = htons(id);
+                rec.frame.cord_x = x;
+                rec.frame.cord_y = y;
+                rec.frame.status = htons(status);
+                rec.seq = 0;
+                rec.event_time_ns = hw->event_ns;
+
+                forward(&rec);
+            }
+        } else if(ret == 0){
+            logger_tick();
+        } else {
+            log_printf(LOG_LVL_INFO, "%s backend stopped", hw->name);
+            return -1;
+        }
+    }
+}
+
 extern int pipe_fd;
 extern int i2c_fd;
 extern int gpio_fd;
@@ -11,11 +11,15 @@
 #include <time.h>
 #include <sys/ioctl.h>
 #include <linux/i2c-dev.h>
+#include <linux/i2c.h>
 #include <poll.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <signal.h>
 #include <arpa/inet.h>
+#include "logger.h"
+#include "parking_protocol.h"
+#include "hw_backend.h"
 
 #define I2C_BUS        "/dev/i2c-2"           /**< Path to I2C bus device */
 #define I2C_SLAVE_ADDR 0x08                   /**< STM32 slave I2C address */
@@ -23,6 +27,9 @@
 
 #define GPIO_NUM       49                     /**< GPIO number connected to STM32 data-ready pin */
 #define GPIO_BASE_PATH "/sys/class/gpio"      /**< Path for GPIO */
+#define GPIO_CHIP      "/dev/gpiochip1"       /**< Character device of the GPIO_NUM bank (49 / 32) */
+#define GPIO_LINE      17                     /**< Offset of GPIO_NUM on GPIO_CHIP (49 % 32) */
+#define GPIO_EVENT_BUFFER 64                  /**< Edges the kernel queues before dropping */
 
 #define PIPE_PATH "/tmp/i2c_pipe"             /**< Named pipe for IPC */
 
@@ -56,14 +63,6 @@ static inline float swap_float(const uint8_t *b){
 }
 
 
-/**
- * @brief Append a message to the log file with timestamp.
- * @param msg Message string to log
- */
-void log_message(const char *message);
-
-
-
 /**
  * @brief Initialize a GPIO pin for input and rising edge detection.
  * @param gpio_num GPIO number
@@ -85,6 +84,63 @@ int gpio_init(int gpio_num);
 int i2c_read_frame(int fd,uint16_t *device_id,float *cord_x,float *cord_y,uint16_t *status);
 
 
+/**
+ * @brief Frames of the last burst read from the STM32 (see parking_protocol.h).
+ */
+typedef struct {
+    uint8_t buf[BURST_BYTES];
+    unsigned count;     /**< Valid frames in buf */
+    unsigned next;      /**< Next frame to hand out */
+    unsigned pending;   /**< Frames the STM32 still had queued after this burst */
+    uint16_t addr;      /**< Slave address the bursts are read from (i2c_open_bus()) */
+} i2c_burst;
+
+/**
+ * @brief Whether the burst still has frames, or the STM32 reported more queued.
+ * @param b Burst state
+ */
+static inline int i2c_burst_ready(const i2c_burst *b){
+    return b->next < b->count || b->pending > 0;
+}
+
+/**
+ * @brief Return the next frame of the current burst, reading a new burst
+ *        (header + BURST_MAX slots in one I2C_RDWR transaction) when the
+ *        current one is used up.
+ * @param fd File descriptor of I2C bus
+ * @param b Burst state
+ * @param device_id Pointer to store device ID
+ * @param cord_x Pointer to store X coordinate
+ * @param cord_y Pointer to store Y coordinate
+ * @param status Pointer to store status
+ * @return 0 on success, -1 on failure or if the STM32 had no frame queued
+ */
+int i2c_burst_next(int fd, i2c_burst *b, uint16_t *device_id, float *cord_x,
+                   float *cord_y, uint16_t *status);
+
+
+/**
+ * @brief Open the I2C bus and select the STM32 slave address.
+ * @param bus Path to the I2C bus device
+ * @param addr 7-bit slave address
+ * @param b Burst state to reset and read from addr, or NULL
+ * @return File descriptor of the bus, or -1 on error
+ */
+int i2c_open_bus(const char *bus, int addr, i2c_burst *b);
+
+
+/**
+ * @brief Wait for data-ready edges and read one frame per edge.
+ *        Each frame is converted to wire byte order, stamped with the time
+ *        of its edge and passed to forward().
+ *        Buffered log lines are flushed on idle timeouts.
+ * @param hw Opened hardware backend
+ * @param forward Called with every frame read
+ * @return -1 when the backend fails or its input ends (never returns otherwise)
+ */
+int i2c_poll_loop(hw_backend *hw, void (*forward)(const gps_record *rec));
+
+
 /**
  * @brief handle signals
  */
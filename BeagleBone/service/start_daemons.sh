@@ -3,10 +3,29 @@
 CLIENT_DAEMON="/home/debian/embedded/CLIENT_DAEMON"
 I2C_DAEMON="/home/debian/embedded/I2C_DAEMON"
 
+# IPC between the daemons: "" for the /tmp/i2c_pipe FIFO, "--ring" for the
+# shared-memory ring in /dev/shm/i2c_ring (both daemons must match)
+IPC_ARGS=""
+
+# Single-process mode: set USE_GATEWAY=1 to run GATEWAY (I2C and TCP client
+# as two threads of one process) instead of the two daemons below
+GATEWAY="/home/debian/embedded/GATEWAY"
+USE_GATEWAY=0
+
+if [ "$USE_GATEWAY" = "1" ]; then
+    if [ -x "$GATEWAY" ]; then
+        echo "Starting GATEWAY..."
+        $GATEWAY &
+        exit 0
+    fi
+    echo "Error: GATEWAY not found or not executable"
+    exit 1
+fi
+
 # Start CLIENT_DAEMON first
 if [ -x "$CLIENT_DAEMON" ]; then
     echo "Starting CLIENT_DAEMON..."
-    $CLIENT_DAEMON &
+    $CLIENT_DAEMON $IPC_ARGS &
 else
     echo "Error: CLIENT_DAEMON not found or not executable"
     exit 1
@@ -25,7 +44,7 @@ done
 # Start I2C_DAEMON only after client is alive
 if [ -x "$I2C_DAEMON" ]; then
     echo "Starting I2C_DAEMON..."
-    $I2C_DAEMON &
+    $I2C_DAEMON $IPC_ARGS &
 else
     echo "Error: I2C_DAEMON not found or not executable"
     exit 1
@@ -2,7 +2,25 @@
 
 int sock = -1;
 
-int main() {
+/**
+ * @brief CLIENT_DAEMON [--ring] [--proto N] [--server ADDR]
+ *        --ring   read frames from the shared-memory ring (RING_PATH) instead
+ *                 of the PIPE_PATH FIFO; I2C_DAEMON must use it too.
+ *        --proto  highest protocol version to offer the server (default
+ *                 PP_VERSION); 1 skips the HELLO for servers older than v2.
+ *        --server IPv4 address of the server (default SERVER_ADDRESS)
+ */
+int main(int argc, char **argv) {
+    bool use_ring = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--ring") == 0) use_ring = true;
+        else if (strcmp(argv[i], "--proto") == 0 && i + 1 < argc) proto_max = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) server_address = argv[++i];
+    }
+
+
+    logger_init(LOG_FILE, LOG_LVL_INFO);
+
     pid_t pid = fork();
     if (pid < 0) {
         log_message("Error: Daemon fork failed.");
@@ -49,90 +67,69 @@ int main() {
     signal(SIGTERM, handle_signal);
     signal(SIGHUP, handle_signal);
     signal(SIGQUIT, handle_signal);
+    logger_install_level_signals();
 
-    /* Declare socket address structure for client connection. */
-    struct sockaddr_in client_name;
+    /* Ignore SIGPIPE so a dropped server connection is reported by write() */
+    signal(SIGPIPE, SIG_IGN);
 
-    /* Declare gps_frame structure to hold received GPS data. */
-    gps_frame frame;
+    /* Coalescing window, overridable from the environment */
+    uint64_t coalesce_us = COALESCE_WINDOW_US;
+    const char *coalesce_env = getenv("CLIENT_COALESCE_US");
+    if (coalesce_env) coalesce_us = strtoull(coalesce_env, NULL, 10);
 
-     log_message("start socket....");
-
-    /* Create a TCP socket. */
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-        log_message("Socket creation failed.");
+    /* Open the store-and-forward spool; frames survive outages and restarts */
+    spool sp;
+    if (spool_open(&sp, SPOOL_PATH, SPOOL_CAPACITY) < 0) {
+        log_message("Failed to open spool");
         exit(EXIT_FAILURE);
     }
 
-    /**
-    * @brief Establish connection to the server using the socket.
-    * @param sock Socket file descriptor.
-    * @param client_name Pointer to sockaddr_in structure to configure server address.
-    */
-    connect_to_server(sock, &client_name);
-
-    /* Create PIPE FIFO if not exists*/
-    if(access(PIPE_PATH, F_OK) != 0){
-        if(mkfifo(PIPE_PATH, 0666) < 0){
-            if(errno != EEXIST){
-                log_message("Failed to create PIPE");
-                exit(EXIT_FAILURE);
-            }
-        else{
-            log_message("PIPE created by client");
-        }
-        }
-    }
+    srand((unsigned)time(NULL) ^ (unsigned)getpid());
 
-    /* Open PIPE FIFO for reading*/
-    int pipe_fd = open(PIPE_PATH, O_RDONLY);
-    if (pipe_fd < 0){
-        log_message("Failed to open PIPE for reading");
-        exit(EXIT_FAILURE);
-    }
-    log_message("PIPE opend for reading");
-
-    /* Polling setup for both pipe and socket */
-    struct pollfd fds[2];
-    fds[0].fd = pipe_fd;
-    fds[0].events = POLLIN;
-    fds[1].fd = sock;
-    fds[1].events = POLLIN;
-
-    /**
-    * @brief Main loop to wait for data on read_fd and send it to the server.
-    * @details Uses poll to block indefinitely (-1) until data is available on read_fd.
-    *          When data is ready, it reads a gps_frame and sends it over the socket.
-    *          If poll returns an error, logs the error and breaks the loop.
-    */
-    while (1) {
-        int ret = poll(fds, 2, -1); // block indefinitely
-        if (ret < 0) {
-            log_message("Poll error. Exiting client.");
-            close(sock);
-            close(pipe_fd);
+    /* Shared ring alternative to the FIFO */
+    shm_ring ring;
+    int pipe_fd = -1;
+    if (use_ring) {
+        if (shm_ring_open(&ring, RING_PATH, sizeof(gps_record), RING_CAPACITY) < 0) {
+            log_message("Failed to open shared ring");
             exit(EXIT_FAILURE);
         }
-
-        /* Data available from PIPE */
-        if (fds[0].revents & POLLIN) {
-            get_frame(&frame, pipe_fd);
-            send_data(sock, &frame);
+        log_printf(LOG_LVL_INFO, "Shared ring %s opened (%u frames queued)",
+                   RING_PATH, shm_ring_count(&ring));
+    } else {
+        /* Create PIPE FIFO if not exists*/
+        if(access(PIPE_PATH, F_OK) != 0){
+            if(mkfifo(PIPE_PATH, 0666) < 0){
+                if(errno != EEXIST){
+                    log_message("Failed to create PIPE");
+                    exit(EXIT_FAILURE);
+                }
+            else{
+                log_message("PIPE created by client");
+            }
+            }
         }
 
-        /* Socket disconnected or error */
-        if (fds[1].revents & (POLLHUP | POLLERR)) {
-            log_message("Server closed connection. Exiting client.");
-            close(sock);
-            close(pipe_fd);
+        /**
+        * @brief Open PIPE FIFO for reading.
+        * @details O_RDWR keeps a writer reference on the FIFO, so open() does not
+        *          block waiting for I2C_DAEMON and a restarting I2C_DAEMON does not
+        *          leave the pipe at EOF.
+        */
+        pipe_fd = open(PIPE_PATH, O_RDWR | O_NONBLOCK);
+        if (pipe_fd < 0){
+            log_message("Failed to open PIPE for reading");
             exit(EXIT_FAILURE);
         }
-
+        log_message("PIPE opend for reading");
     }
 
+    /* Returns only on a poll error */
+    client_loop(&sp, use_ring ? &ring : NULL, pipe_fd, coalesce_us);
+
     /* Close the socket file descriptor when done. */
-    close(sock);
-    close(pipe_fd);
-    return 0;
-}
\ No newline at end of file
+    if (sock >= 0) close(sock);
+    if (pipe_fd >= 0) close(pipe_fd);
+    spool_close(&sp);
+    return EXIT_FAILURE;
+}
@@ -1,6 +1,8 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 
+#define _GNU_SOURCE     /* ppoll */
+
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
@@ -12,10 +14,15 @@
 #include <sys/stat.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include "protocol.h"
+#include "parking_protocol.h"
+#include "pp_batch.h"
+#include "pp_ack.h"
 #include <stdbool.h>
 #include <poll.h>
 #include <fcntl.h>
+#include "logger.h"
+#include "spool.h"
+#include "shm_ring.h"
 
 //#define SERVER_ADDRESS "127.0.0.1"
 #define SERVER_ADDRESS "10.100.102.30"
@@ -23,26 +30,63 @@
 #define LOG_FILE "/home/debian/embedded/parking_client.log"
 #define PIPE_PATH "/tmp/i2c_pipe"
 
+#define RECONNECT_BASE_MS   500     /**< First reconnect delay */
+#define RECONNECT_MAX_MS    30000   /**< Reconnect backoff cap */
+#define CONNECT_TIMEOUT_SEC 3       /**< connect()/write() timeout */
+#define SEND_BATCH_MAX      512     /**< Spooled frames sent per write */
+#define ACK_WINDOW          4096    /**< v4: frames sent but not yet acknowledged */
+#define PIPE_READ_FRAMES    256     /**< Records read from the pipe per read() */
+#define RING_BLOCKED_SLICE_US 10000 /**< Ring mode: socket poll slice while it is blocked */
+
+/**
+ * Coalescing window: after the first frame of a burst arrives, wait up to
+ * this long for more before sending, so a burst leaves in one TCP segment.
+ * 0 sends immediately. Override at build time or with CLIENT_COALESCE_US.
+ */
+#ifndef COALESCE_WINDOW_US
+#define COALESCE_WINDOW_US  2000
+#endif
+
 extern int sock;
 
+static const char *server_address = SERVER_ADDRESS;    /**< Server to connect to (--server) */
+static int proto_max = PP_VERSION;          /**< Highest version offered (--proto) */
+static int proto_version = PP_VERSION_1;    /**< Version of the current connection */
+
 /**
- * @brief write log result to file
- * @param message - 
- * @param timestamp - date and time the message was sent
+ * @brief v4 sliding window: spooled records sent but not yet acknowledged.
+ * @details Records stay in the spool until the server's ACK for their
+ *          message arrives, so [tail, next) is in flight and [next, head)
+ *          is still to be sent. The server answers messages in order, so
+ *          in-flight messages are a FIFO of their end indexes.
  */
-static void log_message(const char *message){
-    FILE *log = fopen(LOG_FILE, "a");
-    if(!log){
-        perror("Failed to open file");
-        return;
-    }
-    time_t now=time(NULL);
-    char ts[64];
-    strftime(ts,sizeof(ts),"%d-%m-%Y %H:%M:%S",localtime(&now));
-    fprintf(log,"[%s] %s\n\n",ts,message);
-    fclose(log);
-}
+typedef struct {
+    uint64_t next;                  /**< Spool index of the first unsent record */
+    uint64_t acked_to;              /**< Spool index past the last acknowledged message */
+    uint64_t end[ACK_WINDOW];       /**< In-flight messages: spool index past their last record */
+    uint64_t sent_us[ACK_WINDOW];   /**< In-flight messages: monotonic us they were written */
+    uint32_t first, count;          /**< FIFO of in-flight messages */
+    uint8_t rx[PP_MSG_BYTES(PP_MAX_PAYLOAD)];
+    size_t rx_len;                  /**< Reply bytes not yet forming a whole message */
+    uint64_t acked;                 /**< Stats since the last report */
+    uint64_t lat_sum_us, lat_max_us, lat_n;
+} ack_window;
+
+static ack_window acks;
+
+/**
+ * @brief I2C_DAEMON to CLIENT_DAEMON delivery latency: CLOCK_REALTIME when a
+ *        record is taken off the pipe or ring minus its event_time_ns.
+ *        Logged and reset when the input goes idle.
+ */
+typedef struct {
+    uint64_t sum_ns, max_ns, n;
+} ipc_latency;
+
+static ipc_latency ipc_lat;
 
+/** @brief True when the connection acknowledges (v4+). */
+static inline bool acks_enabled(void){ return proto_version >= PP_VERSION_4; }
 
 /**
  * @brief handle signals
@@ -93,59 +137,690 @@ static void handle_signal(int signal){
 }
 
 
-static void connect_to_server(int sock, struct sockaddr_in *client_name){
-    log_message("Client is alive and establishing socket connection.");
-    bzero(client_name, sizeof(*client_name));
-    client_name->sin_family = AF_INET;
-    client_name->sin_addr.s_addr = inet_addr(SERVER_ADDRESS);
-    client_name->sin_port = htons(PORT);
+/**
+ * @brief Current CLOCK_MONOTONIC time in microseconds.
+ */
+static uint64_t now_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
 
+/**
+ * @brief Delay before the next reconnect attempt: exponential backoff
+ *        capped at RECONNECT_MAX_MS, with random jitter over its upper half.
+ * @param attempt Number of consecutive failed attempts so far
+ * @return Delay in milliseconds
+ */
+static uint32_t backoff_delay_ms(unsigned attempt){
+    uint32_t cap = RECONNECT_BASE_MS;
+    while(attempt-- > 0 && cap < RECONNECT_MAX_MS){
+        cap *= 2;
+    }
+    if(cap > RECONNECT_MAX_MS) cap = RECONNECT_MAX_MS;
+    return cap / 2 + (uint32_t)rand() % (cap / 2 + 1);
+}
 
-    if (connect(sock, (struct sockaddr *)client_name, sizeof(*client_name)) < 0)
+/**
+ * @brief Offer protocol versions 1..proto_max with a HELLO and wait up to
+ *        PP_HELLO_TIMEOUT_MS for the server's choice.
+ * @details A server that predates v2 never answers (it takes the HELLO as
+ *          one malformed v1 frame), so a timeout falls back to v1.
+ * @param fd Connected socket
+ * @param epoch Epoch of the spool the sequence numbers come from
+ * @return Version to use on this connection
+ */
+static int negotiate_version(int fd, uint16_t epoch){
+    if (proto_max < PP_VERSION_2) return PP_VERSION_1;
+
+    uint8_t msg[PP_HELLO_BYTES];
+    pp_encode_hello(msg, PP_VERSION_1, (uint8_t)proto_max, epoch);
+    if (send(fd, msg, sizeof(msg), MSG_NOSIGNAL) != (ssize_t)sizeof(msg)) {
+        log_printf(LOG_LVL_WARN, "Failed to send HELLO: %s", strerror(errno));
+        return PP_VERSION_1;
+    }
+
+    size_t got = 0;
+    uint64_t deadline = now_us() + (uint64_t)PP_HELLO_TIMEOUT_MS * 1000;
+    while (got < sizeof(msg)) {
+        uint64_t now = now_us();
+        if (now >= deadline) break;
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int ret = poll(&pfd, 1, (int)((deadline - now + 999) / 1000));
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) break;
+        ssize_t r = recv(fd, msg + got, sizeof(msg) - got, MSG_DONTWAIT);
+        if (r <= 0) break;
+        got += (size_t)r;
+    }
+
+    uint8_t lo, hi;
+    if (got == sizeof(msg) && pp_decode_hello(msg, &lo, &hi, NULL) == 0 && lo == hi && hi >= PP_VERSION_2) {
+        log_printf(LOG_LVL_INFO, "Server speaks protocol v%u", hi);
+        return hi;
+    }
+    log_printf(LOG_LVL_WARN, "No protocol v2 HELLO from server, falling back to v1");
+    return PP_VERSION_1;
+}
+
+/**
+ * @brief Create a socket and make one connection attempt to the server.
+ * @param sp Spool whose records will be sent
+ * @return Connected socket, or -1 on failure
+ */
+static int connect_to_server(const spool *sp){
+    struct sockaddr_in client_name;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_printf(LOG_LVL_ERROR, "Socket creation failed: %s", strerror(errno));
+        return -1;
+    }
+
+    /* bound connect() and write() so a dead link cannot stall the daemon */
+    struct timeval tv = { CONNECT_TIMEOUT_SEC, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    bzero(&client_name, sizeof(client_name));
+    client_name.sin_family = AF_INET;
+    client_name.sin_addr.s_addr = inet_addr(server_address);
+    client_name.sin_port = htons(PORT);
+
+    if (connect(fd, (struct sockaddr *)&client_name, sizeof(client_name)) < 0)
     {
-        log_message("Error establishing communications");
-        close(sock);
-        exit(EXIT_FAILURE);
+        log_printf(LOG_LVL_WARN, "Error establishing communications: %s", strerror(errno));
+        close(fd);
+        return -1;
     }
 
     log_message("Connected to server");
+    proto_version = negotiate_version(fd, sp->hdr->epoch);
+    return fd;
 }
 
-static void get_frame(gps_frame *from_stm, int read_fd)
+/**
+ * @brief Add the delivery latency of n records just taken from the pipe or ring.
+ */
+static void ipc_latency_add(const gps_record *recs, size_t n){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t t = recs[i].event_time_ns;
+        if (t == 0 || t > now) continue;     /* unknown, or the clock stepped */
+        ipc_lat.sum_ns += now - t;
+        ipc_lat.n++;
+        if (now - t > ipc_lat.max_ns) ipc_lat.max_ns = now - t;
+    }
+}
+
+/**
+ * @brief Log and reset the delivery latency since the last report.
+ */
+static void ipc_latency_report(const char *via){
+    if (ipc_lat.n == 0) return;
+    log_printf(LOG_LVL_INFO, "IPC latency via %s: %llu frames, avg %.1f us, max %.1f us", via,
+               (unsigned long long)ipc_lat.n, ipc_lat.sum_ns / 1000.0 / ipc_lat.n, ipc_lat.max_ns / 1000.0);
+    memset(&ipc_lat, 0, sizeof(ipc_lat));
+}
+
+/**
+ * @brief Bytes read from the pipe that do not yet form a whole record.
+ */
+typedef struct {
+    uint8_t buf[PIPE_READ_FRAMES * sizeof(gps_record)] __attribute__((aligned(8)));
+    size_t len;
+} frame_reader;
+
+/**
+ * @brief Drain every frame currently available in the non-blocking pipe.
+ * @param rd Reader state (carries partial frames between calls)
+ * @param read_fd Pipe file descriptor (O_NONBLOCK)
+ * @param sp Spool the frames are appended to
+ * @return Number of frames appended, or -1 if the pipe failed
+ */
+static int get_frames(frame_reader *rd, int read_fd, spool *sp)
 {
-  ssize_t bytes = read(read_fd, from_stm, sizeof(gps_frame));
-  if (bytes != sizeof(gps_frame)){
-    log_message("Failed to read full gps_frame from pipe");
-  }
-  else{
-    log_message("Frame received from I2C via pipe");
-  }
-}
-
-// send data to server
-static void send_data(int sock, gps_frame *from_stm){
-    // Direct sending (frame already in network endian from i2c_daemon)
-    ssize_t sent = write(sock, from_stm, sizeof(*from_stm));
-    if (sent < 0)
-    {
-        log_message("Error writing to socket");
-        close(sock);
-        exit(EXIT_FAILURE);
+    int total = 0;
+
+    for (;;) {
+        size_t room = sizeof(rd->buf) - rd->len;
+        ssize_t bytes = read(read_fd, rd->buf + rd->len, room);
+        if (bytes < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            log_printf(LOG_LVL_ERROR, "Failed to read from pipe: %s", strerror(errno));
+            return -1;
+        }
+        if (bytes == 0) break;
+        rd->len += (size_t)bytes;
+
+        size_t n = rd->len / sizeof(gps_record);
+        ipc_latency_add((const gps_record *)rd->buf, n);
+        size_t dropped = spool_push(sp, (const gps_record *)rd->buf, n);
+        if (dropped > 0)
+            log_printf(LOG_LVL_WARN, "Spool full, dropped %zu oldest frames (%llu total)",
+                       dropped, (unsigned long long)sp->hdr->dropped);
+
+        size_t used = n * sizeof(gps_record);
+        memmove(rd->buf, rd->buf + used, rd->len - used);
+        rd->len -= used;
+        total += (int)n;
+
+        if ((size_t)bytes < room)
+            break;   /* short read: the pipe is empty */
+    }
+
+    if (total > 0)
+        log_printf(LOG_LVL_DEBUG, "%d frames received from I2C via pipe", total);
+    return total;
+}
+
+/**
+ * @brief Move every frame queued in the shared ring into the spool.
+ *        Ring slots are released only after the frames are in the spool.
+ * @param ring Shared ring (consumer side)
+ * @param sp Spool the frames are appended to
+ * @return Number of frames moved
+ */
+static int get_frames_ring(shm_ring *ring, spool *sp)
+{
+    int total = 0;
+    void *recs;
+    uint32_t n;
+
+    while ((n = shm_ring_peek(ring, &recs)) > 0) {
+        ipc_latency_add((const gps_record *)recs, n);
+        size_t dropped = spool_push(sp, (const gps_record *)recs, n);
+        if (dropped > 0)
+            log_printf(LOG_LVL_WARN, "Spool full, dropped %zu oldest frames (%llu total)",
+                       dropped, (unsigned long long)sp->hdr->dropped);
+        shm_ring_commit(ring, n);
+        total += (int)n;
+    }
+
+    if (total > 0)
+        log_printf(LOG_LVL_DEBUG, "%d frames received from I2C via ring", total);
+    return total;
+}
+
+/**
+ * @brief Degrees to PP_COORD_SCALE fixed point, rounded to nearest.
+ */
+static int32_t coord_e6(float deg){
+    double v = (double)deg * PP_COORD_SCALE;
+    return (int32_t)(v < 0 ? v - 0.5 : v + 0.5);
+}
+
+/**
+ * @brief Spooled record to a host-order v2 event.
+ */
+static void record_to_event(const spool_rec *rec, pp_event *ev){
+    ev->device_id = ntohs(rec->frame.device_id);
+    ev->status = ntohs(rec->frame.status);
+    ev->seq = rec->seq;
+    ev->event_time_ms = rec->event_time_ns / 1000000;
+    ev->lat_e6 = coord_e6(rec->frame.cord_x);
+    ev->lng_e6 = coord_e6(rec->frame.cord_y);
+}
+
+/**
+ * @brief Encode a spooled record as the message of the negotiated version:
+ *        the v1 frame as stored, or a v2 EVENT with fixed-point coordinates.
+ * @return Bytes written to out (sizeof(gps_frame) or PP_EVENT_BYTES)
+ */
+static size_t encode_record(const spool_rec *rec, uint8_t *out){
+    if (proto_version < PP_VERSION_2) {
+        memcpy(out, &rec->frame, sizeof(gps_frame));
+        return sizeof(gps_frame);
+    }
+    pp_event ev;
+    record_to_event(rec, &ev);
+    return pp_encode_event(out, &ev);
+}
+
+/**
+ * @brief Messages encoded from the spool and not yet fully written.
+ * @details Records [first, first + recs) are encoded once into buf and the
+ *          buffer is written until it is empty, so a short write resumes at
+ *          the exact byte. Single messages complete (and their records are
+ *          consumed) one by one; a BATCH only as a whole.
+ */
+typedef struct {
+    uint8_t buf[PP_MSG_BYTES(PP_MAX_PAYLOAD)];
+    size_t len;         /**< Encoded bytes */
+    size_t off;         /**< Bytes already written */
+    uint64_t first;     /**< Spool index of the first encoded record */
+    size_t recs;        /**< Records encoded */
+    size_t msg_size;    /**< Size of every message, 0 for a single BATCH */
+    size_t done;        /**< Records whose message was completed */
+} send_buf;
+
+PP_STATIC_ASSERT(SEND_BATCH_MAX * PP_EVENT_BYTES <= PP_MSG_BYTES(PP_MAX_PAYLOAD), "a send batch fits the buffer");
+PP_STATIC_ASSERT(SEND_BATCH_MAX <= PP_BATCH_MAX_EVENTS, "a send batch fits one BATCH");
+
+/**
+ * @brief Spool index of the first record not yet written: the tail, or with
+ *        acknowledgements the end of the in-flight window.
+ */
+static uint64_t send_from(const spool *sp){
+    if (!acks_enabled() || acks.next < sp->hdr->tail) return sp->hdr->tail;
+    return acks.next;
+}
+
+/**
+ * @brief Spooled records not yet written to the current connection.
+ */
+static size_t unsent_count(const spool *sp){
+    return (size_t)(sp->hdr->head - send_from(sp));
+}
+
+/**
+ * @brief True if the ack window has no room for another message.
+ */
+static bool window_full(const spool *sp){
+    return acks_enabled() &&
+           (acks.count == ACK_WINDOW || send_from(sp) - sp->hdr->tail >= ACK_WINDOW);
+}
+
+/**
+ * @brief Forget everything in flight (new connection); unacknowledged
+ *        records are sent again and the server drops those it already has.
+ */
+static void acks_reset(const spool *sp){
+    acks.next = acks.acked_to = sp->hdr->tail;
+    acks.first = acks.count = 0;
+    acks.rx_len = 0;
+}
+
+/**
+ * @brief Append a written message to the in-flight FIFO.
+ * @param end Spool index past its last record
+ * @param now Monotonic us it was written
+ */
+static void acks_push(uint64_t end, uint64_t now){
+    uint32_t slot = (acks.first + acks.count++) % ACK_WINDOW;
+    acks.end[slot] = end;
+    acks.sent_us[slot] = now;
+}
+
+/**
+ * @brief Encode the oldest unsent records (up to SEND_BATCH_MAX, and within
+ *        the ack window) into sb: one BATCH when the connection speaks v3
+ *        and at least PP_BATCH_MIN_EVENTS are waiting, otherwise one message
+ *        per record.
+ * @return Number of records encoded
+ */
+static size_t fill_send_buf(send_buf *sb, spool *sp){
+    static pp_event ev[SEND_BATCH_MAX];
+    size_t max = SEND_BATCH_MAX;
+    spool_rec *run;
+    size_t n = 0, got;
+
+    sb->len = sb->off = sb->done = sb->msg_size = 0;
+    sb->first = send_from(sp);
+    if (acks_enabled() && ACK_WINDOW - (size_t)(sb->first - sp->hdr->tail) < max)
+        max = ACK_WINDOW - (size_t)(sb->first - sp->hdr->tail);
+    bool batch = proto_version >= PP_VERSION_3 && unsent_count(sp) >= PP_BATCH_MIN_EVENTS &&
+                 max >= PP_BATCH_MIN_EVENTS;
+    /* single messages take one in-flight slot each, a BATCH one in total */
+    if (acks_enabled() && !batch && ACK_WINDOW - acks.count < max)
+        max = ACK_WINDOW - acks.count;
+
+    while (n < max && (got = spool_peek(sp, sb->first + n, &run)) > 0) {
+        if (got > max - n) got = max - n;
+        for (size_t i = 0; i < got; i++) {
+            if (batch)
+                record_to_event(&run[i], &ev[n + i]);
+            else
+                sb->len += sb->msg_size = encode_record(&run[i], sb->buf + sb->len);
+        }
+        n += got;
+    }
+    if (batch && n > 0) {
+        sb->len = pp_encode_batch(sb->buf, ev, n);
+        sb->msg_size = 0;
     }
+    sb->recs = n;
+    return n;
+}
 
-    // Convert only the 16-bit fields back to host order
-    uint16_t dev_id = ntohs(from_stm->device_id);
-    uint16_t status = ntohs(from_stm->status);
+/**
+ * @brief Record messages completed by a write.
+ * @details Without acknowledgements the records leave the spool now; with
+ *          them each completed message joins the in-flight FIFO.
+ * @param sb Send buffer
+ * @param from Records of sb completed before this write
+ * @param to Records of sb completed after it
+ */
+static void complete_records(spool *sp, const send_buf *sb, size_t from, size_t to){
+    if (!acks_enabled()) {
+        /* Records dropped from a full spool while in flight are already gone */
+        uint64_t upto = sb->first + to;
+        if (upto > sp->hdr->tail) spool_consume(sp, (size_t)(upto - sp->hdr->tail));
+        return;
+    }
+    uint64_t now = now_us();
+    if (sb->msg_size == 0) {
+        if (to > from) acks_push(sb->first + to, now);     /* the whole BATCH */
+    } else {
+        for (size_t i = from; i < to; i++)
+            acks_push(sb->first + i + 1, now);
+    }
+    acks.next = sb->first + to;
+}
 
-    // Keep float as-is (no conversion)
-    float x = from_stm->cord_x;
-    float y = from_stm->cord_y;
+/**
+ * @brief Write the pending send buffer (encoding the next one from the spool
+ *        when it is empty) with a single non-blocking send() and retire the
+ *        records of completed messages (complete_records()).
+ * @param sock Connected socket
+ * @param sp Spool
+ * @param sb Send buffer, kept across calls; clear len and off on reconnect
+ * @return Number of frames completed (0 if the socket buffer is full), -1 on error
+ */
+static int send_data(int sock, spool *sp, send_buf *sb){
+    if (sb->off == sb->len && fill_send_buf(sb, sp) == 0) return 0;
+
+    ssize_t sent = send(sock, sb->buf + sb->off, sb->len - sb->off, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        log_printf(LOG_LVL_WARN, "Error writing to socket: %s", strerror(errno));
+        return -1;
+    }
+    sb->off += (size_t)sent;
+
+    size_t complete = sb->msg_size ? sb->off / sb->msg_size : (sb->off == sb->len ? sb->recs : 0);
+    size_t done = complete - sb->done;
 
-    char buffer[128];
-    snprintf(buffer, sizeof(buffer),
-             "Frame sent to server: ID=%u, X=%.3f, Y=%.3f, STATUS=%u",
-             dev_id, x, y, status);
-    log_message(buffer);
+    if (logger_get_level() >= LOG_LVL_DEBUG || (done == 1 && sb->recs == 1)) {
+        for (size_t i = 0; i < done; i++) {
+            spool_rec *rec;
+            spool_peek(sp, sb->first + sb->done + i, &rec);
+            // Convert only the 16-bit fields back to host order, keep float as-is
+            log_printf(LOG_LVL_INFO, "Frame sent to server: ID=%u, X=%.3f, Y=%.3f, STATUS=%u, SEQ=%u",
+                       ntohs(rec->frame.device_id), rec->frame.cord_x, rec->frame.cord_y,
+                       ntohs(rec->frame.status), rec->seq);
+        }
+    } else if (done > 0 && sb->msg_size == 0) {
+        log_printf(LOG_LVL_INFO, "Sent %zu frames to server in one BATCH of %zu bytes (%zu left)",
+                   done, sb->len, unsent_count(sp) - done);
+    } else if (done > 0) {
+        log_printf(LOG_LVL_INFO, "Sent %zu frames to server in one write (%zu left)",
+                   done, unsent_count(sp) - done);
+    }
+
+    complete_records(sp, sb, sb->done, complete);
+    sb->done = complete;
+    return (int)done;
+}
+
+static int cmp_u64(const void *a, const void *b){
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Check an ACK against the in-flight message it answers.
+ * @details It must have one entry per record of the message, with the same
+ *          device ids and sequence numbers. The entries of a BATCH follow
+ *          its device grouping (pp_batch.h), so they are compared sorted.
+ *          Records dropped from a full spool meanwhile can only be counted.
+ * @param start Spool index of the message's first record
+ * @param end Spool index past its last record
+ */
+static bool ack_matches(const spool *sp, uint64_t start, uint64_t end, const uint8_t *payload, int n){
+    static uint64_t want[SEND_BATCH_MAX], got[SEND_BATCH_MAX];
+    if (end - start != (uint64_t)n || n > SEND_BATCH_MAX) return false;
+    if (start < sp->hdr->tail) return true;
+
+    for (int i = 0; i < n; i++) {
+        spool_rec *rec;
+        pp_ack a;
+        spool_peek(sp, start + (uint64_t)i, &rec);
+        pp_get_ack(payload + 2 + (size_t)i * sizeof(pp_ack_wire), &a);
+        want[i] = (uint64_t)ntohs(rec->frame.device_id) << 32 | rec->seq;
+        got[i] = (uint64_t)a.device_id << 32 | a.seq;
+    }
+    if (n > 1) {
+        qsort(want, (size_t)n, sizeof(want[0]), cmp_u64);
+        qsort(got, (size_t)n, sizeof(got[0]), cmp_u64);
+    }
+    return memcmp(want, got, (size_t)n * sizeof(want[0])) == 0;
+}
+
+/**
+ * @brief Apply one ACK: retire the oldest in-flight message.
+ * @return 0, or -1 if there is no message in flight or the ACK does not
+ *         answer the oldest one (the caller drops the connection)
+ */
+static int handle_ack(spool *sp, const uint8_t *payload, int n){
+    if (acks.count == 0) {
+        log_printf(LOG_LVL_WARN, "ACK for %d frames with nothing in flight", n);
+        return -1;
+    }
+    uint32_t slot = acks.first;
+    if (!ack_matches(sp, acks.acked_to, acks.end[slot], payload, n)) {
+        log_printf(LOG_LVL_WARN, "ACK for %d frames does not match the oldest message in flight (%llu frames)",
+                   n, (unsigned long long)(acks.end[slot] - acks.acked_to));
+        return -1;
+    }
+    acks.first = (acks.first + 1) % ACK_WINDOW;
+    acks.count--;
+    acks.acked_to = acks.end[slot];
+
+    uint64_t lat = now_us() - acks.sent_us[slot];
+    acks.lat_sum_us += lat;
+    acks.lat_n++;
+    if (lat > acks.lat_max_us) acks.lat_max_us = lat;
+    acks.acked += (uint64_t)n;
+
+    if (logger_get_level() >= LOG_LVL_DEBUG) {
+        for (int i = 0; i < n; i++) {
+            pp_ack a;
+            pp_get_ack(payload + 2 + (size_t)i * sizeof(pp_ack_wire), &a);
+            log_printf(LOG_LVL_DEBUG, "ACK ID=%u SEQ=%u STATUS=%u result=%u session=%llu fee=%u.%02u",
+                       a.device_id, a.seq, a.status, a.result, (unsigned long long)a.session_id,
+                       a.fee_cents / 100, a.fee_cents % 100);
+        }
+    }
+
+    uint64_t upto = acks.end[slot];
+    if (upto > sp->hdr->tail) spool_consume(sp, (size_t)(upto - sp->hdr->tail));
+
+    if (acks.count == 0 && unsent_count(sp) == 0 && acks.lat_n > 0) {
+        log_printf(LOG_LVL_INFO, "All sent frames acknowledged: %llu frames, ack latency avg %.2f ms, max %.2f ms",
+                   (unsigned long long)acks.acked, acks.lat_sum_us / 1000.0 / acks.lat_n,
+                   acks.lat_max_us / 1000.0);
+        acks.acked = acks.lat_sum_us = acks.lat_max_us = acks.lat_n = 0;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read server replies: ACKs on v4+ connections, otherwise text
+ *        ("OK CLOSED") that is discarded.
+ * @return 0 while connected, -1 if the server closed the connection, failed
+ *         or sent a corrupt reply
+ */
+static int read_replies(int sock, spool *sp){
+    for (;;) {
+        uint8_t *buf = acks_enabled() ? acks.rx + acks.rx_len : acks.rx;
+        size_t room = acks_enabled() ? sizeof(acks.rx) - acks.rx_len : sizeof(acks.rx);
+        ssize_t n = recv(sock, buf, room, MSG_DONTWAIT);
+        if (n == 0) return -1;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        if (!acks_enabled()) continue;
+        acks.rx_len += (size_t)n;
+
+        /* Take every whole message, keep the rest for the next read */
+        size_t off = 0;
+        while (acks.rx_len - off >= PP_HDR_BYTES) {
+            uint8_t type;
+            uint16_t len;
+            const uint8_t *m = acks.rx + off;
+            int v = pp_parse_header(m, &type, &len);
+            if (v < PP_VERSION_2 || v > proto_version) {
+                log_printf(LOG_LVL_WARN, "Bad reply header 0x%02x from server", m[0]);
+                return -1;
+            }
+            if (acks.rx_len - off < PP_MSG_BYTES(len)) break;
+            if (!pp_crc_ok(m, len)) {
+                log_message("Reply CRC mismatch from server");
+                return -1;
+            }
+            if (type == PP_MSG_ACK) {
+                int count = pp_ack_count(m + PP_HDR_BYTES, len);
+                if (count < 0 || handle_ack(sp, m + PP_HDR_BYTES, count) < 0) return -1;
+            }
+            off += PP_MSG_BYTES(len);
+        }
+        memmove(acks.rx, acks.rx + off, acks.rx_len - off);
+        acks.rx_len -= off;
+    }
+}
+
+/**
+ * @brief Main loop: spool incoming frames and forward them to the server.
+ * @details Frames come from the ring when one is given, otherwise from the
+ *          non-blocking pipe_fd. Every frame is appended to the spool first.
+ *          While connected, the spool is sent in coalesced send() batches
+ *          once the burst window has passed; when the server is unreachable,
+ *          connects are retried with exponential backoff and jitter while
+ *          frames keep accumulating in the spool.
+ * @param sp Open spool
+ * @param ring Ring to read frames from (consumer side), or NULL to use pipe_fd
+ * @param pipe_fd FIFO read end (O_NONBLOCK), ignored when ring is given
+ * @param coalesce_us Coalescing window in microseconds
+ * @return -1 on a poll error (never returns otherwise)
+ */
+static int client_loop(spool *sp, shm_ring *ring, int pipe_fd, uint64_t coalesce_us)
+{
+    /* Pipe bytes not yet forming a whole frame */
+    static frame_reader reader;
+
+    /* Polling setup for both pipe and socket */
+    struct pollfd fds[2];
+    fds[0].fd = pipe_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = -1;
+    fds[1].events = POLLIN;
+
+    unsigned attempts = 0;          /* consecutive failed connects */
+    uint64_t next_connect = 0;      /* monotonic us of the next attempt */
+    uint64_t pending_since = 0;     /* monotonic us the oldest unsent frame arrived */
+    static send_buf sb;             /* encoded messages not yet fully written */
+    bool blocked = false;           /* socket buffer full, wait for POLLOUT */
+
+    while (1) {
+        uint64_t now = now_us();
+
+        if (sock < 0 && now >= next_connect) {
+            sock = connect_to_server(sp);
+            if (sock < 0) {
+                uint32_t delay = backoff_delay_ms(attempts++);
+                next_connect = now + (uint64_t)delay * 1000;
+                log_printf(LOG_LVL_INFO, "Reconnect attempt %u in %u ms, %zu frames spooled",
+                           attempts, delay, spool_count(sp));
+            } else {
+                attempts = 0;
+                sb.len = sb.off = 0;     /* re-encode for the new connection's version */
+                acks_reset(sp);
+                blocked = false;
+                if (spool_count(sp) > 0)
+                    log_printf(LOG_LVL_INFO, "Draining %zu spooled frames", spool_count(sp));
+            }
+        }
+
+        /**
+        * Send when the window expired, a full batch is ready or a message is
+        * half sent. With a full ack window wait for ACKs (POLLIN) instead.
+        */
+        bool pending = sock >= 0 && unsent_count(sp) > 0 && (sb.off < sb.len || !window_full(sp));
+        bool due = pending && (sb.off < sb.len || unsent_count(sp) >= SEND_BATCH_MAX ||
+                               now - pending_since >= coalesce_us);
+        if (due && !blocked) {
+            int sent = send_data(sock, sp, &sb);
+            if (sent < 0) {
+                close(sock);
+                sock = -1;
+                next_connect = now + (uint64_t)backoff_delay_ms(attempts++) * 1000;
+                log_message("Lost server connection, spooling frames");
+            } else {
+                blocked = (unsent_count(sp) > 0 && sb.off < sb.len);
+                if (spool_count(sp) == 0) spool_sync(sp);
+            }
+            pending = sock >= 0 && unsent_count(sp) > 0 && (sb.off < sb.len || !window_full(sp));
+            due = pending && !blocked;
+        }
+
+        uint64_t timeout_us = (uint64_t)LOG_FLUSH_INTERVAL_SEC * 1000000;
+        if (due) {
+            timeout_us = 0;   /* keep draining, but service the pipe in between */
+        } else if (pending && !blocked) {
+            uint64_t left = pending_since + coalesce_us > now ? pending_since + coalesce_us - now : 0;
+            if (left < timeout_us) timeout_us = left;
+        } else if (sock < 0) {
+            uint64_t wait = next_connect > now ? next_connect - now : 0;
+            if (wait < timeout_us) timeout_us = wait;
+        }
+        bool idle = timeout_us == (uint64_t)LOG_FLUSH_INTERVAL_SEC * 1000000;  /* nothing to send or retry */
+
+        /**
+        * With the ring there is no fd to poll for frames: sleep on the ring
+        * futex instead and only check the socket without blocking. While the
+        * socket is blocked or ACKs are outstanding, poll it in short slices
+        * and keep taking frames.
+        */
+        if (ring) {
+            if (!blocked && !(sock >= 0 && acks_enabled() && acks.count > 0)) {
+                if (timeout_us > 0 && shm_ring_count(ring) == 0)
+                    shm_ring_wait(ring, timeout_us);
+                timeout_us = 0;
+            } else if (timeout_us > RING_BLOCKED_SLICE_US) {
+                timeout_us = RING_BLOCKED_SLICE_US;
+            }
+        }
+
+        fds[1].fd = sock;   /* negative fd is ignored by poll */
+        fds[1].events = POLLIN | (blocked ? POLLOUT : 0);
+        struct timespec ts = { (time_t)(timeout_us / 1000000), (long)(timeout_us % 1000000) * 1000 };
+        int ret = ppoll(fds, 2, &ts, NULL);
+        if (ret == 0) {
+            if (idle && (!ring || shm_ring_count(ring) == 0))
+                ipc_latency_report(ring ? "ring" : "pipe");     /* the input went quiet */
+            logger_tick();
+        }
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            log_message("Poll error. Exiting client.");
+            return -1;
+        }
+
+        /* Data available from PIPE or ring: take the whole burst */
+        if (ring ? shm_ring_count(ring) > 0 : (fds[0].revents & POLLIN) != 0) {
+            bool was_empty = unsent_count(sp) == 0;
+            int got = ring ? get_frames_ring(ring, sp) : get_frames(&reader, pipe_fd, sp);
+            if (got > 0 && was_empty)
+                pending_since = now_us();
+        }
+
+        if (sock >= 0 && (fds[1].revents & POLLOUT))
+            blocked = false;
+
+        /* Server reply, disconnect or error */
+        if (sock >= 0 && (fds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+            if (read_replies(sock, sp) < 0) {
+                log_message("Server closed connection, spooling frames");
+                close(sock);
+                sock = -1;
+                next_connect = now + (uint64_t)backoff_delay_ms(attempts++) * 1000;
+            }
+        }
+    }
 }
 
 
@@ -0,0 +1,136 @@
+#include "spool.h"
+#include "logger.h"
+
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SPOOL_HDR_SIZE 4096   /**< Header page; records start page-aligned */
+
+/**
+ * @brief Draw an epoch for a new numbering: the clock and pid make it unlikely
+ *        to repeat the epoch of the spool it replaces.
+ */
+static uint16_t spool_new_epoch(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint32_t v = (uint32_t)ts.tv_sec ^ (uint32_t)ts.tv_nsec ^ ((uint32_t)getpid() << 16);
+    uint16_t epoch = (uint16_t)(v ^ (v >> 16));
+    return epoch ? epoch : 1;
+}
+
+static void spool_reset(spool *sp, uint32_t capacity){
+    memset(sp->hdr, 0, sizeof(*sp->hdr));
+    sp->hdr->rec_size = sizeof(spool_rec);
+    sp->hdr->capacity = capacity;
+    sp->hdr->epoch = spool_new_epoch();
+    sp->hdr->version = SPOOL_VERSION;
+    sp->hdr->magic = SPOOL_MAGIC;
+}
+
+int spool_open(spool *sp, const char *path, uint32_t capacity){
+    memset(sp, 0, sizeof(*sp));
+    sp->fd = -1;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd < 0){
+        log_printf(LOG_LVL_ERROR, "Spool: failed to open %s", path);
+        return -1;
+    }
+
+    size_t len = SPOOL_HDR_SIZE + (size_t)capacity * sizeof(spool_rec) +
+                 SPOOL_DEVICE_IDS * sizeof(uint32_t);
+    struct stat st;
+    if(fstat(fd, &st) < 0 || ((size_t)st.st_size != len && ftruncate(fd, (off_t)len) < 0)){
+        log_printf(LOG_LVL_ERROR, "Spool: failed to size %s", path);
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED){
+        log_printf(LOG_LVL_ERROR, "Spool: mmap failed");
+        close(fd);
+        return -1;
+    }
+
+    sp->fd = fd;
+    sp->map_len = len;
+    sp->hdr = (struct spool_hdr *)map;
+    sp->recs = (spool_rec *)((uint8_t *)map + SPOOL_HDR_SIZE);
+    sp->seqs = (uint32_t *)(sp->recs + capacity);
+
+    struct spool_hdr *h = sp->hdr;
+    if(h->magic != SPOOL_MAGIC || h->version != SPOOL_VERSION ||
+       h->rec_size != sizeof(spool_rec) || h->capacity != capacity ||
+       h->head < h->tail || h->head - h->tail > capacity){
+        if(h->magic != 0)
+            log_printf(LOG_LVL_WARN, "Spool: %s has an incompatible layout, reinitializing", path);
+        spool_reset(sp, capacity);
+        memset(sp->seqs, 0, SPOOL_DEVICE_IDS * sizeof(uint32_t));
+    } else {
+        if(h->epoch == 0)
+            h->epoch = spool_new_epoch();   // written before epochs: its numbering goes on under one
+        if(h->head != h->tail)
+            log_printf(LOG_LVL_INFO, "Spool: recovered %llu unsent frames",
+                       (unsigned long long)(h->head - h->tail));
+    }
+    log_printf(LOG_LVL_INFO, "Spool: epoch %u", (unsigned)h->epoch);
+    return 0;
+}
+
+void spool_close(spool *sp){
+    if(sp->hdr){
+        msync(sp->hdr, sp->map_len, MS_SYNC);
+        munmap(sp->hdr, sp->map_len);
+        sp->hdr = NULL;
+    }
+    if(sp->fd >= 0){
+        close(sp->fd);
+        sp->fd = -1;
+    }
+}
+
+size_t spool_push(spool *sp, const spool_rec *recs, size_t n){
+    struct spool_hdr *h = sp->hdr;
+    size_t dropped = 0;
+
+    for(size_t i = 0; i < n; i++){
+        if(h->head - h->tail >= h->capacity){
+            h->tail++;
+            dropped++;
+        }
+        spool_rec *r = &sp->recs[h->head % h->capacity];
+        *r = recs[i];
+        r->seq = ++sp->seqs[ntohs(r->frame.device_id)];
+        h->head++;
+    }
+    h->dropped += dropped;
+    return dropped;
+}
+
+size_t spool_peek(const spool *sp, uint64_t from, spool_rec **out){
+    const struct spool_hdr *h = sp->hdr;
+    if(from < h->tail) from = h->tail;
+    if(from >= h->head) return 0;
+
+    size_t slot = (size_t)(from % h->capacity);
+    size_t run = (size_t)(h->head - from);
+    if(run > h->capacity - slot) run = h->capacity - slot;   // stop at the wrap
+    *out = &sp->recs[slot];
+    return run;
+}
+
+void spool_consume(spool *sp, size_t n){
+    struct spool_hdr *h = sp->hdr;
+    if(n > h->head - h->tail) n = (size_t)(h->head - h->tail);
+    h->tail += n;
+}
+
+void spool_sync(spool *sp){
+    msync(sp->hdr, sp->map_len, MS_ASYNC);
+}
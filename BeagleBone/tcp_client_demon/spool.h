@@ -0,0 +1,114 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "parking_protocol.h"
+
+/**
+ * @file spool
+ * @brief Fixed-size, mmap-backed on-disk queue of outbound frames.
+ *
+ * Every frame read from the I2C daemon is appended here first and is only
+ * removed once it has been written to the server, so frames survive server
+ * outages and CLIENT_DAEMON restarts. The file holds a header page followed
+ * by a ring of SPOOL_CAPACITY records; when the ring is full the oldest
+ * frame is dropped and counted. After the ring the file keeps the last
+ * sequence number given to each device id, so numbering continues across
+ * restarts. The header also keeps the spool's epoch, drawn when the file is
+ * created: a recreated spool numbers from 1 again under a new epoch, which
+ * the client sends to the server in its HELLO (parking_protocol.h).
+ */
+
+#define SPOOL_PATH     "/home/debian/embedded/client_spool.dat"   /**< Spool file */
+#define SPOOL_CAPACITY 65536                                      /**< Frames kept while offline */
+#define SPOOL_MAGIC    0x53504F4CU                                /**< "SPOL" */
+#define SPOOL_VERSION  3
+#define SPOOL_DEVICE_IDS 65536                                    /**< One sequence counter per 16-bit id */
+
+/** @brief Record type stored in the spool (frame plus its edge time). */
+typedef gps_record spool_rec;
+
+/**
+ * @brief Persistent header stored in the first page of the spool file.
+ * head and tail are free-running counters; record i lives in slot i % capacity.
+ */
+struct spool_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t rec_size;
+    uint32_t capacity;
+    uint64_t head;      /**< Next record to write */
+    uint64_t tail;      /**< Oldest record not yet sent */
+    uint64_t dropped;   /**< Records overwritten while the ring was full */
+    uint16_t epoch;     /**< Generation of the sequence numbers, never 0 */
+};
+
+/**
+ * @brief Open spool handle.
+ */
+typedef struct {
+    int fd;
+    struct spool_hdr *hdr;
+    spool_rec *recs;
+    uint32_t *seqs;     /**< Last sequence number per device id */
+    size_t map_len;
+} spool;
+
+/**
+ * @brief Open or create the spool file and map it.
+ *        A file with a different layout is reinitialized (its frames are lost).
+ * @param sp Handle to fill
+ * @param path Spool file path
+ * @param capacity Number of records
+ * @return 0 on success, -1 on error
+ */
+int spool_open(spool *sp, const char *path, uint32_t capacity);
+
+/**
+ * @brief Sync and unmap the spool.
+ * @param sp Spool handle
+ */
+void spool_close(spool *sp);
+
+/**
+ * @brief Append records, dropping the oldest ones if the ring is full.
+ *        Each stored record gets the next sequence number of its device.
+ * @param sp Spool handle
+ * @param recs Records to append
+ * @param n Number of records
+ * @return Number of older records dropped to make room
+ */
+size_t spool_push(spool *sp, const spool_rec *recs, size_t n);
+
+/**
+ * @brief Number of records waiting to be sent.
+ * @param sp Spool handle
+ */
+static inline size_t spool_count(const spool *sp){
+    return (size_t)(sp->hdr->head - sp->hdr->tail);
+}
+
+/**
+ * @brief Get the longest contiguous run of queued records starting at index `from`.
+ * @param sp Spool handle
+ * @param from Absolute record index (tail <= from <= head)
+ * @param out Set to the first record of the run
+ * @return Number of records in the run (0 if from == head)
+ */
+size_t spool_peek(const spool *sp, uint64_t from, spool_rec **out);
+
+/**
+ * @brief Remove the n oldest records.
+ * @param sp Spool handle
+ * @param n Number of records sent
+ */
+void spool_consume(spool *sp, size_t n);
+
+/**
+ * @brief Schedule write-back of the mapping to disk (msync MS_ASYNC).
+ * @param sp Spool handle
+ */
+void spool_sync(spool *sp);
+
+#endif
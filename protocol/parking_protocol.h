@@ -0,0 +1,299 @@
+#ifndef PARKING_PROTOCOL_H
+#define PARKING_PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @file parking_protocol
+ * @brief Wire formats shared by the BeagleBone daemons and the server
+ *        (C and C++). The STM32 firmware keeps its own copy of the I2C part
+ *        (stm32/.../my_project/Inc/protocol.h) since CubeIDE builds only its
+ *        own tree; keep the two in sync.
+ *
+ * Hops:
+ *  - STM32 -> BeagleBone (I2C): gps_frame, byte-reversed as a whole, or a
+ *    burst (burst_hdr + frames).
+ *  - I2C daemon -> client daemon (FIFO / shared ring / spool): gps_record.
+ *  - client daemon -> server (TCP): v1 = bare gps_frame stream; v2 = the
+ *    framed messages below, chosen with a HELLO exchange at connect.
+ */
+
+#ifdef __cplusplus
+#define PP_STATIC_ASSERT static_assert
+#else
+#define PP_STATIC_ASSERT _Static_assert
+#endif
+
+#define START 1
+#define AND 0
+
+/* ------------------------------------------------------------------------ */
+/* v1 frame                                                                  */
+/* ------------------------------------------------------------------------ */
+
+/**
+ * @brief struct that contains the information
+ * that is passed to UUT
+ * @param device_id - identifies the device
+ * @param cord_x - latitude
+ * @param cord_y - longitude
+ * @param status - START or AND
+ * On the v1 TCP hop device_id and status are big-endian; the floats are
+ * whatever the sender wrote (the server assumes big-endian, the BeagleBone
+ * sends host order), which is one of the reasons for v2.
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t device_id;
+    float cord_x;
+    float cord_y;
+    uint16_t status;
+} gps_frame;
+
+PP_STATIC_ASSERT(sizeof(gps_frame) == 12, "gps_frame is 12 bytes on the wire");
+
+/**
+ * Burst mode: on one data-ready edge the master reads BURST_BYTES in a single
+ * I2C read: a burst_hdr followed by BURST_MAX frame slots, of which the first
+ * `count` are valid (each in the same byte-reversed layout as a single frame).
+ * `pending` tells the master how many frames are still queued on the STM32,
+ * so it can read again without waiting for another edge.
+ */
+#define BURST_MAGIC 0xB5
+#define BURST_MAX   8                                        /**< Frame slots per burst */
+
+typedef struct __attribute__((packed)) {
+    uint8_t magic;      /**< BURST_MAGIC */
+    uint8_t count;      /**< Valid frames in this burst (0..BURST_MAX) */
+    uint8_t pending_hi; /**< Frames still queued, big-endian */
+    uint8_t pending_lo;
+} burst_hdr;
+
+#define BURST_BYTES (sizeof(burst_hdr) + BURST_MAX * sizeof(gps_frame))
+
+PP_STATIC_ASSERT(sizeof(burst_hdr) == 4, "burst_hdr is 4 bytes");
+
+/**
+ * @brief A frame plus the moment its data-ready interrupt fired.
+ * This is the record passed between the BeagleBone daemons (FIFO, shared
+ * ring) and kept in the client spool.
+ * @param frame - the frame, device_id and status big-endian, floats host order
+ * @param seq - per-device sequence number, assigned when the record enters
+ *              the client spool (0 before that)
+ * @param event_time_ns - CLOCK_REALTIME of the edge in ns, 0 if unknown
+ */
+typedef struct {
+    gps_frame frame;
+    uint32_t seq;
+    uint64_t event_time_ns;
+} gps_record;
+
+PP_STATIC_ASSERT(sizeof(gps_record) == 24, "gps_record is 24 bytes (FIFO, ring and spool layout)");
+PP_STATIC_ASSERT(offsetof(gps_record, seq) == 12, "seq fills the padding after the frame");
+
+/* ------------------------------------------------------------------------ */
+/* v2 messages (TCP hop)                                                     */
+/* ------------------------------------------------------------------------ */
+
+/**
+ * Every v2 message is
+ *     pp_header | payload (length bytes) | CRC-16/CCITT-FALSE (2 bytes)
+ * with all multi-byte fields big-endian and the CRC computed over header and
+ * payload. magic_ver holds PP_MAGIC in the high nibble and the protocol
+ * version in the low nibble.
+ *
+ * Negotiation: the client's first message is a HELLO carrying the range of
+ * versions it speaks. A v2 server answers with a HELLO whose min and max are
+ * the chosen version. A HELLO is exactly sizeof(gps_frame) bytes, so the
+ * server reads 12 bytes first and, if they are not a valid HELLO, handles
+ * them as the first v1 frame. A client that gets no HELLO back within
+ * PP_HELLO_TIMEOUT_MS falls back to v1.
+ *
+ * The client's HELLO also carries the epoch of its spool, drawn when the
+ * spool file is created. Sequence numbers restart at 1 with a new spool;
+ * the server tells the two numberings apart by the epoch and restarts a
+ * device's duplicate window only when it changes. Clients that send 0
+ * keep one numbering forever.
+ *
+ * The version nibble of a message is the version that introduced its type
+ * (EVENT: 2, BATCH: 3, ACK: 4); a receiver accepts any version from 2 up to
+ * the negotiated one.
+ */
+#define PP_MAGIC            0xC
+#define PP_VERSION_1        1
+#define PP_VERSION_2        2                       /**< HELLO, EVENT */
+#define PP_VERSION_3        3                       /**< + BATCH (pp_batch.h) */
+#define PP_VERSION_4        4                       /**< + ACK from the server (pp_ack.h) */
+#define PP_VERSION          PP_VERSION_4            /**< Newest version spoken here */
+#define PP_MAGIC_VER(v)     ((uint8_t)((PP_MAGIC << 4) | ((v) & 0x0F)))
+
+#define PP_MSG_HELLO        1
+#define PP_MSG_EVENT        2
+
+#define PP_MAX_PAYLOAD      20480                   /**< Longer messages are rejected */
+#define PP_HELLO_TIMEOUT_MS 2000
+#define PP_COORD_SCALE      1000000                 /**< Fixed point: degrees * 1e6 */
+
+typedef struct __attribute__((packed)) {
+    uint8_t magic_ver;
+    uint8_t type;               /**< PP_MSG_* */
+    uint16_t length;            /**< Payload bytes */
+} pp_header;
+
+typedef struct __attribute__((packed)) {
+    uint8_t min_version;
+    uint8_t max_version;
+    uint16_t flags;             /**< Reserved, 0 */
+    uint16_t spool_epoch;       /**< Client: generation of its spool, 0 if none; server: 0 */
+} pp_hello;
+
+typedef struct __attribute__((packed)) {
+    uint16_t device_id;
+    uint16_t status;            /**< START or AND */
+    uint32_t seq;               /**< Per-device, from the client spool */
+    uint64_t event_time_ms;     /**< Unix time of the edge in ms, 0 if unknown */
+    int32_t lat_e6;             /**< Latitude * PP_COORD_SCALE */
+    int32_t lng_e6;             /**< Longitude * PP_COORD_SCALE */
+} pp_event_wire;
+
+#define PP_HDR_BYTES   sizeof(pp_header)
+#define PP_CRC_BYTES   2
+#define PP_MSG_BYTES(payload) (PP_HDR_BYTES + (payload) + PP_CRC_BYTES)
+#define PP_HELLO_BYTES PP_MSG_BYTES(sizeof(pp_hello))
+#define PP_EVENT_BYTES PP_MSG_BYTES(sizeof(pp_event_wire))
+
+PP_STATIC_ASSERT(sizeof(pp_header) == 4, "pp_header is 4 bytes");
+PP_STATIC_ASSERT(sizeof(pp_hello) == 6, "pp_hello is 6 bytes");
+PP_STATIC_ASSERT(sizeof(pp_event_wire) == 24, "pp_event_wire is 24 bytes");
+PP_STATIC_ASSERT(offsetof(pp_event_wire, event_time_ms) == 8, "event_time_ms offset");
+PP_STATIC_ASSERT(offsetof(pp_event_wire, lat_e6) == 16, "lat_e6 offset");
+PP_STATIC_ASSERT(PP_HELLO_BYTES == sizeof(gps_frame), "a HELLO must fill exactly one v1 frame");
+
+/**
+ * @brief Decoded event in host byte order.
+ */
+typedef struct {
+    uint16_t device_id;
+    uint16_t status;
+    uint32_t seq;
+    uint64_t event_time_ms;
+    int32_t lat_e6;
+    int32_t lng_e6;
+} pp_event;
+
+static inline void pp_put16(uint8_t *p, uint16_t v){ p[0] = (uint8_t)(v >> 8); p[1] = (uint8_t)v; }
+static inline void pp_put32(uint8_t *p, uint32_t v){ pp_put16(p, (uint16_t)(v >> 16)); pp_put16(p + 2, (uint16_t)v); }
+static inline void pp_put64(uint8_t *p, uint64_t v){ pp_put32(p, (uint32_t)(v >> 32)); pp_put32(p + 4, (uint32_t)v); }
+static inline uint16_t pp_get16(const uint8_t *p){ return (uint16_t)((p[0] << 8) | p[1]); }
+static inline uint32_t pp_get32(const uint8_t *p){ return ((uint32_t)pp_get16(p) << 16) | pp_get16(p + 2); }
+static inline uint64_t pp_get64(const uint8_t *p){ return ((uint64_t)pp_get32(p) << 32) | pp_get32(p + 4); }
+
+/**
+ * @brief CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF), a nibble at a time.
+ */
+static inline uint16_t pp_crc16(const uint8_t *p, size_t n){
+    static const uint16_t nib[16] = {
+        0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+        0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+    };
+    uint16_t crc = 0xFFFF;
+    while(n--){
+        crc = (uint16_t)((crc << 4) ^ nib[(crc >> 12) ^ (*p >> 4)]);
+        crc = (uint16_t)((crc << 4) ^ nib[(crc >> 12) ^ (*p & 0x0F)]);
+        p++;
+    }
+    return crc;
+}
+
+/**
+ * @brief Write the header and trailing CRC around a payload already placed
+ *        at msg + PP_HDR_BYTES.
+ * @return Total message size
+ */
+static inline size_t pp_seal(uint8_t *msg, uint8_t version, uint8_t type, uint16_t payload_len){
+    msg[0] = PP_MAGIC_VER(version);
+    msg[1] = type;
+    pp_put16(msg + 2, payload_len);
+    pp_put16(msg + PP_HDR_BYTES + payload_len, pp_crc16(msg, PP_HDR_BYTES + payload_len));
+    return PP_MSG_BYTES(payload_len);
+}
+
+/**
+ * @brief Validate a received header.
+ * @param hdr PP_HDR_BYTES bytes
+ * @param type Set to the message type
+ * @param payload_len Set to the payload length
+ * @return Protocol version, or -1 if the magic or length is invalid
+ */
+static inline int pp_parse_header(const uint8_t *hdr, uint8_t *type, uint16_t *payload_len){
+    if((hdr[0] >> 4) != PP_MAGIC) return -1;
+    *type = hdr[1];
+    *payload_len = pp_get16(hdr + 2);
+    if(*payload_len > PP_MAX_PAYLOAD) return -1;
+    return hdr[0] & 0x0F;
+}
+
+/**
+ * @brief Check the CRC of a complete message.
+ * @return 1 if it matches, 0 otherwise
+ */
+static inline int pp_crc_ok(const uint8_t *msg, uint16_t payload_len){
+    return pp_get16(msg + PP_HDR_BYTES + payload_len) == pp_crc16(msg, PP_HDR_BYTES + payload_len);
+}
+
+static inline size_t pp_encode_hello(uint8_t *msg, uint8_t min_version, uint8_t max_version, uint16_t spool_epoch){
+    uint8_t *p = msg + PP_HDR_BYTES;
+    p[offsetof(pp_hello, min_version)] = min_version;
+    p[offsetof(pp_hello, max_version)] = max_version;
+    pp_put16(p + offsetof(pp_hello, flags), 0);
+    pp_put16(p + offsetof(pp_hello, spool_epoch), spool_epoch);
+    return pp_seal(msg, max_version, PP_MSG_HELLO, sizeof(pp_hello));
+}
+
+/**
+ * @brief Parse a HELLO.
+ * @param msg PP_HELLO_BYTES received bytes
+ * @param spool_epoch Set to the sender's spool epoch (may be NULL)
+ * @return 0 if msg is a valid HELLO, -1 otherwise
+ */
+static inline int pp_decode_hello(const uint8_t *msg, uint8_t *min_version, uint8_t *max_version,
+                                  uint16_t *spool_epoch){
+    uint8_t type;
+    uint16_t len;
+    if(pp_parse_header(msg, &type, &len) < 0 || type != PP_MSG_HELLO ||
+       len != sizeof(pp_hello) || !pp_crc_ok(msg, len))
+        return -1;
+    *min_version = msg[PP_HDR_BYTES + offsetof(pp_hello, min_version)];
+    *max_version = msg[PP_HDR_BYTES + offsetof(pp_hello, max_version)];
+    if(spool_epoch) *spool_epoch = pp_get16(msg + PP_HDR_BYTES + offsetof(pp_hello, spool_epoch));
+    return *min_version <= *max_version ? 0 : -1;
+}
+
+static inline void pp_put_event(uint8_t *p, const pp_event *ev){
+    pp_put16(p + offsetof(pp_event_wire, device_id), ev->device_id);
+    pp_put16(p + offsetof(pp_event_wire, status), ev->status);
+    pp_put32(p + offsetof(pp_event_wire, seq), ev->seq);
+    pp_put64(p + offsetof(pp_event_wire, event_time_ms), ev->event_time_ms);
+    pp_put32(p + offsetof(pp_event_wire, lat_e6), (uint32_t)ev->lat_e6);
+    pp_put32(p + offsetof(pp_event_wire, lng_e6), (uint32_t)ev->lng_e6);
+}
+
+static inline void pp_get_event(const uint8_t *p, pp_event *ev){
+    ev->device_id = pp_get16(p + offsetof(pp_event_wire, device_id));
+    ev->status = pp_get16(p + offsetof(pp_event_wire, status));
+    ev->seq = pp_get32(p + offsetof(pp_event_wire, seq));
+    ev->event_time_ms = pp_get64(p + offsetof(pp_event_wire, event_time_ms));
+    ev->lat_e6 = (int32_t)pp_get32(p + offsetof(pp_event_wire, lat_e6));
+    ev->lng_e6 = (int32_t)pp_get32(p + offsetof(pp_event_wire, lng_e6));
+}
+
+/**
+ * @brief Encode one EVENT message.
+ * @return PP_EVENT_BYTES
+ */
+static inline size_t pp_encode_event(uint8_t *msg, const pp_event *ev){
+    pp_put_event(msg + PP_HDR_BYTES, ev);
+    return pp_seal(msg, PP_VERSION_2, PP_MSG_EVENT, sizeof(pp_event_wire));
+}
+
+#endif
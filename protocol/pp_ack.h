@@ -0,0 +1,95 @@
+#ifndef PP_ACK_H
+#define PP_ACK_H
+
+#include "parking_protocol.h"
+
+/**
+ * @file pp_ack
+ * @brief ACK message (protocol v4): the server's answer to every EVENT or
+ *        BATCH, sent once the events are durable on the server.
+ *
+ * Payload:
+ *     uint16  count (events of the acknowledged message, in its order)
+ *     count x pp_ack_wire
+ *
+ * The server handles messages in order and answers each one with exactly
+ * one ACK, so the client matches ACKs to its in-flight messages by
+ * position and may drop the acknowledged records from its spool.
+ */
+
+#define PP_MSG_ACK          4
+#define PP_ACK_MAX_ENTRIES  512     /**< Entries per ACK (one BATCH) */
+
+#define PP_ACK_APPLIED      0       /**< Stored; session_id is the opened/closed session */
+#define PP_ACK_DUPLICATE    1       /**< Already applied earlier, dropped */
+#define PP_ACK_NO_SESSION   2       /**< END without an open session, nothing stored */
+#define PP_ACK_JOURNALED    3       /**< Durably journaled, session applied later; session_id and fee are 0 */
+
+typedef struct __attribute__((packed)) {
+    uint16_t device_id;
+    uint8_t result;             /**< PP_ACK_* */
+    uint8_t status;             /**< START or AND of the acknowledged event */
+    uint32_t seq;
+    uint64_t session_id;        /**< Server session id, 0 if none */
+    uint32_t fee_cents;         /**< Fee of the session closed by an END, else 0 */
+} pp_ack_wire;
+
+PP_STATIC_ASSERT(sizeof(pp_ack_wire) == 20, "pp_ack_wire is 20 bytes");
+PP_STATIC_ASSERT(2 + PP_ACK_MAX_ENTRIES * sizeof(pp_ack_wire) <= PP_MAX_PAYLOAD, "a full ACK fits in one message");
+
+/**
+ * @brief Decoded ACK entry in host byte order.
+ */
+typedef struct {
+    uint16_t device_id;
+    uint8_t result;
+    uint8_t status;
+    uint32_t seq;
+    uint64_t session_id;
+    uint32_t fee_cents;
+} pp_ack;
+
+static inline void pp_put_ack(uint8_t *p, const pp_ack *a){
+    pp_put16(p + offsetof(pp_ack_wire, device_id), a->device_id);
+    p[offsetof(pp_ack_wire, result)] = a->result;
+    p[offsetof(pp_ack_wire, status)] = a->status;
+    pp_put32(p + offsetof(pp_ack_wire, seq), a->seq);
+    pp_put64(p + offsetof(pp_ack_wire, session_id), a->session_id);
+    pp_put32(p + offsetof(pp_ack_wire, fee_cents), a->fee_cents);
+}
+
+static inline void pp_get_ack(const uint8_t *p, pp_ack *a){
+    a->device_id = pp_get16(p + offsetof(pp_ack_wire, device_id));
+    a->result = p[offsetof(pp_ack_wire, result)];
+    a->status = p[offsetof(pp_ack_wire, status)];
+    a->seq = pp_get32(p + offsetof(pp_ack_wire, seq));
+    a->session_id = pp_get64(p + offsetof(pp_ack_wire, session_id));
+    a->fee_cents = pp_get32(p + offsetof(pp_ack_wire, fee_cents));
+}
+
+/**
+ * @brief Encode one ACK message.
+ * @param msg Output, at least PP_MSG_BYTES(2 + n * sizeof(pp_ack_wire)) bytes
+ * @param acks Entries (n <= PP_ACK_MAX_ENTRIES)
+ * @return Total message size
+ */
+static inline size_t pp_encode_ack(uint8_t *msg, const pp_ack *acks, size_t n){
+    uint8_t *p = msg + PP_HDR_BYTES;
+    pp_put16(p, (uint16_t)n);
+    for(size_t i = 0; i < n; i++)
+        pp_put_ack(p + 2 + i * sizeof(pp_ack_wire), &acks[i]);
+    return pp_seal(msg, PP_VERSION_4, PP_MSG_ACK, (uint16_t)(2 + n * sizeof(pp_ack_wire)));
+}
+
+/**
+ * @brief Number of entries of an ACK payload.
+ * @return Entry count, or -1 if the length does not match it
+ */
+static inline int pp_ack_count(const uint8_t *payload, uint16_t len){
+    if(len < 2) return -1;
+    uint16_t n = pp_get16(payload);
+    if(n > PP_ACK_MAX_ENTRIES || len != 2 + n * sizeof(pp_ack_wire)) return -1;
+    return n;
+}
+
+#endif
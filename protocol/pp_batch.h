@@ -0,0 +1,182 @@
+#ifndef PP_BATCH_H
+#define PP_BATCH_H
+
+#include "parking_protocol.h"
+
+/**
+ * @file pp_batch
+ * @brief BATCH message (protocol v3): many events in one message, grouped by
+ *        device and delta encoded.
+ *
+ * Payload:
+ *     varint count
+ *     groups until count events were read:
+ *         zigzag  device_id - previous group's device_id
+ *         varint  run (events of this device, >= 1)
+ *         run x event:
+ *             varint  (seq_delta << 2) | code   code 0 = AND, 1 = START,
+ *                                               2 = other status, varint follows
+ *             zigzag  event_time_ms - previous event's
+ *             zigzag  lat_e6 - previous event's
+ *             zigzag  lng_e6 - previous event's
+ *
+ * "Previous" starts at 0 and runs over the whole batch in encoded order;
+ * seq_delta is the difference to the previous event of the same group (the
+ * absolute seq for a group's first event), modulo 2^32. The encoder groups
+ * the events of each device together, keeping their relative order, so
+ * events of different devices may be reordered. A typical event of a device
+ * that parks and leaves at the same spot costs 5-8 bytes instead of
+ * PP_EVENT_BYTES.
+ */
+
+#define PP_MSG_BATCH         3
+#define PP_BATCH_MAX_EVENTS  512    /**< Events per BATCH, the decoder rejects more */
+#define PP_BATCH_MIN_EVENTS  4      /**< Smaller backlogs go out as single EVENTs */
+
+/* worst case per event: group header 3 + 2, tag 5 + 3, deltas 10 + 5 + 5 */
+PP_STATIC_ASSERT(3 + PP_BATCH_MAX_EVENTS * 33 <= PP_MAX_PAYLOAD, "a full batch fits in one message");
+
+static inline uint8_t *pp_put_varint(uint8_t *p, uint64_t v){
+    while(v >= 0x80){
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+/**
+ * @return Pointer past the varint, or NULL if it runs past end or is too long.
+ */
+static inline const uint8_t *pp_get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v){
+    uint64_t r = 0;
+    for(int shift = 0; shift < 64 && p < end; shift += 7){
+        uint8_t b = *p++;
+        r |= (uint64_t)(b & 0x7F) << shift;
+        if(!(b & 0x80)){
+            *v = r;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static inline uint64_t pp_zigzag(int64_t v){ return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+static inline int64_t pp_unzigzag(uint64_t v){ return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+/**
+ * @brief Encode events as one BATCH message.
+ * @param msg Output, at least PP_MSG_BYTES(PP_MAX_PAYLOAD) bytes
+ * @param ev Events (1..PP_BATCH_MAX_EVENTS); reordered in place so that each
+ *           device's events are adjacent, in their original relative order
+ * @param n Number of events
+ * @return Total message size
+ */
+static inline size_t pp_encode_batch(uint8_t *msg, pp_event *ev, size_t n){
+    /* stable grouping by device id: insertion sort, runs are usually short */
+    for(size_t i = 1; i < n; i++){
+        pp_event cur = ev[i];
+        size_t j = i;
+        while(j > 0 && ev[j - 1].device_id > cur.device_id){
+            ev[j] = ev[j - 1];
+            j--;
+        }
+        ev[j] = cur;
+    }
+
+    uint8_t *p = pp_put_varint(msg + PP_HDR_BYTES, n);
+    int64_t prev_time = 0, prev_lat = 0, prev_lng = 0;
+    int32_t prev_dev = 0;
+
+    for(size_t i = 0; i < n; ){
+        size_t run = 1;
+        while(i + run < n && ev[i + run].device_id == ev[i].device_id) run++;
+
+        p = pp_put_varint(p, pp_zigzag((int64_t)ev[i].device_id - prev_dev));
+        p = pp_put_varint(p, run);
+        prev_dev = ev[i].device_id;
+
+        uint32_t prev_seq = 0;
+        for(size_t k = i; k < i + run; k++){
+            const pp_event *e = &ev[k];
+            uint64_t code = e->status == AND ? 0 : e->status == START ? 1 : 2;
+            p = pp_put_varint(p, ((uint64_t)(uint32_t)(e->seq - prev_seq) << 2) | code);
+            if(code == 2) p = pp_put_varint(p, e->status);
+            p = pp_put_varint(p, pp_zigzag((int64_t)(e->event_time_ms - (uint64_t)prev_time)));
+            p = pp_put_varint(p, pp_zigzag((int64_t)e->lat_e6 - prev_lat));
+            p = pp_put_varint(p, pp_zigzag((int64_t)e->lng_e6 - prev_lng));
+            prev_seq = e->seq;
+            prev_time = (int64_t)e->event_time_ms;
+            prev_lat = e->lat_e6;
+            prev_lng = e->lng_e6;
+        }
+        i += run;
+    }
+    return pp_seal(msg, PP_VERSION_3, PP_MSG_BATCH, (uint16_t)(p - (msg + PP_HDR_BYTES)));
+}
+
+/**
+ * @brief Decode a BATCH payload in one pass.
+ * @param payload Payload bytes (after the header)
+ * @param len Payload length
+ * @param out Decoded events, in encoded order
+ * @param max Capacity of out
+ * @return Number of events, or -1 if the payload is malformed
+ */
+static inline int pp_decode_batch(const uint8_t *payload, uint16_t len, pp_event *out, size_t max){
+    const uint8_t *p = payload, *end = payload + len;
+    uint64_t count, v;
+
+    if(!(p = pp_get_varint(p, end, &count)) || count > max || count > PP_BATCH_MAX_EVENTS)
+        return -1;
+
+    uint64_t prev_time = 0;
+    int64_t prev_lat = 0, prev_lng = 0, prev_dev = 0;
+    size_t n = 0;
+
+    while(n < count){
+        uint64_t run;
+        if(!(p = pp_get_varint(p, end, &v)) || !(p = pp_get_varint(p, end, &run)))
+            return -1;
+        int64_t dev = prev_dev + pp_unzigzag(v);
+        if(dev < 0 || dev > 0xFFFF || run == 0 || run > count - n)
+            return -1;
+        prev_dev = dev;
+
+        uint32_t prev_seq = 0;
+        for(uint64_t k = 0; k < run; k++){
+            pp_event *e = &out[n++];
+            uint64_t tag;
+            if(!(p = pp_get_varint(p, end, &tag)))
+                return -1;
+            e->device_id = (uint16_t)dev;
+            e->seq = prev_seq + (uint32_t)(tag >> 2);
+            switch(tag & 3){
+            case 0: e->status = AND; break;
+            case 1: e->status = START; break;
+            case 2:
+                if(!(p = pp_get_varint(p, end, &v)) || v > 0xFFFF) return -1;
+                e->status = (uint16_t)v;
+                break;
+            default: return -1;
+            }
+            if(!(p = pp_get_varint(p, end, &v))) return -1;
+            e->event_time_ms = prev_time + (uint64_t)pp_unzigzag(v);
+            if(!(p = pp_get_varint(p, end, &v))) return -1;
+            int64_t lat = prev_lat + pp_unzigzag(v);
+            if(!(p = pp_get_varint(p, end, &v))) return -1;
+            int64_t lng = prev_lng + pp_unzigzag(v);
+            if(lat < INT32_MIN || lat > INT32_MAX || lng < INT32_MIN || lng > INT32_MAX)
+                return -1;
+            e->lat_e6 = (int32_t)lat;
+            e->lng_e6 = (int32_t)lng;
+            prev_seq = e->seq;
+            prev_time = e->event_time_ms;
+            prev_lat = lat;
+            prev_lng = lng;
+        }
+    }
+    return p == end ? (int)n : -1;
+}
+
+#endif
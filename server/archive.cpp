@@ -0,0 +1,200 @@
+#include "archive.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace
+{
+    /// @brief Columns of customer_data, in table order.
+    const char *const COLUMNS =
+        "id, customer_id, city_code, gps_lat, gps_lng, status, "
+        "parking_duration_minutes, ticket_fee, created_at, ended_at";
+
+    /// @brief Sessions due for the archive: closed before ?1, with a well-formed ended_at.
+    const char *const DUE =
+        "status=0 AND ended_at < ?1 AND ended_at GLOB '[0-9][0-9][0-9][0-9]-[0-9][0-9]-*'";
+
+    /// @brief "YYYY-MM" as a month name in file names.
+    bool is_month(const std::string &m)
+    {
+        int y, mo;
+        char tail;
+        return m.size() == 7 && sscanf(m.c_str(), "%4d-%2d%c", &y, &mo, &tail) == 2 && mo >= 1 && mo <= 12;
+    }
+
+    int exec_bound(sqlite3 *db, const char *sql, const std::string &arg)
+    {
+        sqlite3_stmt *s = nullptr;
+        int rc = sqlite3_prepare_v2(db, sql, -1, &s, nullptr);
+        if(rc == SQLITE_OK) {
+            sqlite3_bind_text(s, 1, arg.c_str(), -1, SQLITE_TRANSIENT);
+            rc = sqlite3_step(s);
+            if(rc == SQLITE_DONE) rc = SQLITE_OK;
+        }
+        sqlite3_finalize(s);
+        return rc;
+    }
+}
+
+namespace archive
+{
+    std::string month_path(const std::string &dir, const std::string &month)
+    {
+        return dir + "/customer_data_" + month + ".db";
+    }
+
+    std::vector<std::string> list_months(const std::string &dir)
+    {
+        std::vector<std::string> months;
+        DIR *d = opendir(dir.c_str());
+        if(!d) return months;
+        while(struct dirent *e = readdir(d)) {
+            const char *name = e->d_name;
+            size_t len = strlen(name);
+            if(len != strlen("customer_data_YYYY-MM.db") || strncmp(name, "customer_data_", 14) != 0 ||
+               strcmp(name + len - 3, ".db") != 0)
+                continue;
+            std::string m(name + 14, 7);
+            if(is_month(m)) months.push_back(m);
+        }
+        closedir(d);
+        std::sort(months.begin(), months.end());
+        return months;
+    }
+
+    Archiver::Archiver(sqlite3 *db, const std::string &dir) : db_(db), dir_(dir) {}
+
+    Archiver::~Archiver()
+    {
+        detach();
+        sqlite3_finalize(pick_);
+        sqlite3_finalize(remove_);
+    }
+
+    int Archiver::attach(const std::string &month)
+    {
+        if(attached_ == month) return SQLITE_OK;
+        detach();
+
+        if(mkdir(dir_.c_str(), 0755) < 0 && errno != EEXIST) return SQLITE_CANTOPEN;
+        int rc = exec_bound(db_, "ATTACH DATABASE ?1 AS archive_month;", month_path(dir_, month));
+        if(rc != SQLITE_OK) return rc;
+        attached_ = month;
+
+        rc = sqlite3_exec(db_,
+            "CREATE TABLE IF NOT EXISTS archive_month.customer_data ("
+            "  id INTEGER PRIMARY KEY,"
+            "  customer_id TEXT,"
+            "  city_code INTEGER,"
+            "  gps_lat REAL,"
+            "  gps_lng REAL,"
+            "  status INTEGER,"
+            "  parking_duration_minutes INTEGER,"
+            "  ticket_fee REAL,"
+            "  created_at DATETIME,"
+            "  ended_at DATETIME"
+            ");", nullptr, nullptr, nullptr);
+        if(rc != SQLITE_OK) return rc;
+
+        std::string sql = std::string("INSERT OR REPLACE INTO archive_month.customer_data SELECT ") + COLUMNS +
+                          " FROM main.customer_data WHERE id BETWEEN ?2 AND ?3 AND " + DUE +
+                          " AND substr(ended_at, 1, 7)=?4;";
+        return sqlite3_prepare_v2(db_, sql.c_str(), -1, &copy_, nullptr);
+    }
+
+    void Archiver::detach()
+    {
+        sqlite3_finalize(copy_);
+        copy_ = nullptr;
+        if(attached_.empty()) return;
+        sqlite3_exec(db_, "DETACH DATABASE archive_month;", nullptr, nullptr, nullptr);
+        attached_.clear();
+    }
+
+    int Archiver::step(const std::string &cutoff, long chunk_rows, Step &out)
+    {
+        out = Step();
+        int rc;
+        if(!pick_) {
+            std::string sql = std::string("SELECT id, substr(ended_at, 1, 7) FROM main.customer_data WHERE ") +
+                              DUE + " ORDER BY id LIMIT ?2;";
+            rc = sqlite3_prepare_v2(db_, sql.c_str(), -1, &pick_, nullptr);
+            if(rc != SQLITE_OK) return rc;
+            sql = std::string("DELETE FROM main.customer_data WHERE id BETWEEN ?2 AND ?3 AND ") + DUE +
+                  " AND substr(ended_at, 1, 7)=?4;";
+            rc = sqlite3_prepare_v2(db_, sql.c_str(), -1, &remove_, nullptr);
+            if(rc != SQLITE_OK) return rc;
+        }
+
+        /// @brief The chunk is the id range of the first due month's sessions
+        ///        among the first chunk_rows due ones.
+        sqlite3_int64 lo = 0, hi = 0;
+        sqlite3_bind_text(pick_, 1, cutoff.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(pick_, 2, chunk_rows);
+        while((rc = sqlite3_step(pick_)) == SQLITE_ROW) {
+            const char *m = (const char*)sqlite3_column_text(pick_, 1);
+            if(out.month.empty()) {
+                out.month = m;
+                lo = sqlite3_column_int64(pick_, 0);
+            }
+            if(out.month == m) hi = sqlite3_column_int64(pick_, 0);
+        }
+        sqlite3_reset(pick_);
+        if(rc != SQLITE_DONE) return rc;
+        if(out.month.empty()) return SQLITE_OK;
+        if(!is_month(out.month)) return SQLITE_MISMATCH;
+
+        rc = attach(out.month);
+        for(sqlite3_stmt *s : {copy_, remove_}) {
+            if(rc != SQLITE_OK) break;
+            sqlite3_bind_text(s, 1, cutoff.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int64(s, 2, lo);
+            sqlite3_bind_int64(s, 3, hi);
+            sqlite3_bind_text(s, 4, out.month.c_str(), -1, SQLITE_TRANSIENT);
+            rc = sqlite3_step(s);
+            sqlite3_reset(s);
+            if(rc == SQLITE_DONE) rc = SQLITE_OK;
+        }
+        if(rc == SQLITE_OK) out.rows = (long)sqlite3_changes(db_);
+        return rc;
+    }
+
+    int query(sqlite3 *db, const std::string &dir, const std::string &where,
+              const std::string &from, const std::string &to,
+              const std::function<bool(sqlite3_stmt*)> &row)
+    {
+        std::vector<std::string> parts;
+        if(!from.empty())
+            for(const std::string &m : list_months(dir))
+                if(m >= from && (to.empty() || m <= to)) parts.push_back(m);
+        parts.push_back("");        // the hot table
+
+        for(const std::string &m : parts) {
+            const char *schema = m.empty() ? "main" : "archive_query";
+            int rc = SQLITE_OK;
+            if(!m.empty()) {
+                rc = exec_bound(db, "ATTACH DATABASE ?1 AS archive_query;", month_path(dir, m));
+                if(rc != SQLITE_OK) return rc;
+            }
+
+            std::string sql = std::string("SELECT ") + COLUMNS + " FROM " + schema + ".customer_data" +
+                              (where.empty() ? "" : " WHERE " + where) + " ORDER BY id;";
+            sqlite3_stmt *s = nullptr;
+            rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &s, nullptr);
+            bool more = true;
+            while(rc == SQLITE_OK && more) {
+                int step = sqlite3_step(s);
+                if(step == SQLITE_ROW) more = row(s);
+                else if(step == SQLITE_DONE) break;
+                else rc = step;
+            }
+            sqlite3_finalize(s);
+            if(!m.empty()) sqlite3_exec(db, "DETACH DATABASE archive_query;", nullptr, nullptr, nullptr);
+            if(rc != SQLITE_OK || !more) return rc;
+        }
+        return SQLITE_OK;
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include "sqlite3.h"
+
+/**
+ * @file archive.h
+ * @brief Month partitions of customer_data: closed sessions move out of the
+ *        hot table into one archive database per month.
+ *
+ * customer_data has no index besides its rowid, so every lookup of the
+ * materializer scans it. Sessions closed more than archive_after_days ago
+ * (storage.h) are moved to ARCHIVE_DIR/customer_data_YYYY-MM.db, by the
+ * month of ended_at, so the hot table only holds the open and recent
+ * sessions whatever the history kept.
+ *
+ * Archiver::step() moves at most chunk_rows sessions of one month and is
+ * called by the materializer between journal batches, only while few
+ * records wait (maintenance_backlog).
+ * A chunk is copied into the attached month in one transaction and deleted
+ * from data.db in a second one: in WAL mode a transaction over several
+ * attached databases is not atomic as a whole, and copying first means a
+ * crash can only leave a chunk in both places. The copy is INSERT OR
+ * REPLACE by id, so the next step moves it again and removes the duplicate.
+ *
+ * Queries see the hot table only. query() adds archive months when asked,
+ * attaching one month at a time, so any number of months can be read
+ * within SQLite's limit on attached databases.
+ */
+namespace archive
+{
+    /// @brief What one Archiver::step() moved.
+    struct Step {
+        long rows = 0;              ///< Sessions moved, 0 if none is due
+        std::string month;          ///< "YYYY-MM" of their ended_at
+    };
+
+    /// @brief Path of a month's archive database.
+    std::string month_path(const std::string &dir, const std::string &month);
+
+    /// @brief Months archived in dir, oldest first.
+    std::vector<std::string> list_months(const std::string &dir);
+
+    class Archiver {
+    public:
+        /**
+         * @param db data.db, used only by the caller's thread
+         * @param dir Directory of the month databases, created on first use
+         */
+        Archiver(sqlite3 *db, const std::string &dir);
+        ~Archiver();
+
+        Archiver(const Archiver&) = delete;
+        Archiver& operator=(const Archiver&) = delete;
+
+        /**
+         * @brief Move the first chunk of sessions closed before cutoff.
+         * @param cutoff Local time as stored in ended_at ("YYYY-MM-DD HH:MM:SS")
+         * @param chunk_rows Most sessions moved
+         * @return SQLITE_OK (out.rows is 0 when nothing is due) or the SQLite error code
+         */
+        int step(const std::string &cutoff, long chunk_rows, Step &out);
+
+        /// @brief Detach the month attached by step(), if any, before its file is removed.
+        void detach();
+
+    private:
+        /// @brief Attach a month's database as "archive_month", creating its table.
+        int attach(const std::string &month);
+
+        sqlite3 *db_;
+        std::string dir_;
+        std::string attached_;      ///< Month attached now, empty if none
+        sqlite3_stmt *pick_ = nullptr;
+        sqlite3_stmt *copy_ = nullptr;
+        sqlite3_stmt *remove_ = nullptr;
+    };
+
+    /**
+     * @brief Run a SELECT over customer_data and the archive months from..to.
+     * @param where Condition on customer_data's columns, "" for all rows
+     * @param from First month "YYYY-MM" to include, "" for none: hot table only
+     * @param to Last month to include, "" for the newest
+     * @param row Called with the statement on each row; false stops the query
+     * @return SQLITE_OK or the SQLite error code
+     * @details Months are read oldest first, then the hot table: the same
+     *          order as the ids. One month is attached at a time.
+     */
+    int query(sqlite3 *db, const std::string &dir, const std::string &where,
+              const std::string &from, const std::string &to,
+              const std::function<bool(sqlite3_stmt*)> &row);
+}
+
+#endif // ARCHIVE_H
@@ -0,0 +1,144 @@
+#include "codec.h"
+#include <cstring>
+
+namespace
+{
+    constexpr int HASH_BITS = 14;
+    constexpr size_t MIN_MATCH = 4;
+    constexpr size_t LAST_LITERALS = 5;     ///< The block ends with at least this many literals
+    constexpr size_t MF_LIMIT = 12;         ///< No match starts in the last MF_LIMIT bytes
+    constexpr size_t MAX_OFFSET = 65535;
+
+    uint32_t read32(const uint8_t *p)
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    uint32_t hash(uint32_t v)
+    {
+        return (v * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    /// @brief Extra length bytes of a literal or match length of 15 or more.
+    uint8_t *put_length(uint8_t *op, size_t len)
+    {
+        for(len -= 15; len >= 255; len -= 255) *op++ = 255;
+        *op++ = (uint8_t)len;
+        return op;
+    }
+
+    /// @brief Read extra length bytes; false if they run past end.
+    bool get_length(const uint8_t *&ip, const uint8_t *end, size_t &len)
+    {
+        uint8_t b;
+        do {
+            if(ip >= end) return false;
+            b = *ip++;
+            len += b;
+        } while(b == 255);
+        return true;
+    }
+
+    /// @brief One sequence: literals [anchor, anchor+lit), then a match of mlen at offset (mlen 0: none).
+    uint8_t *put_sequence(uint8_t *op, const uint8_t *anchor, size_t lit, size_t offset, size_t mlen)
+    {
+        uint8_t *token = op++;
+        *token = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+        if(lit >= 15) op = put_length(op, lit);
+        if(lit) memcpy(op, anchor, lit);
+        op += lit;
+        if(mlen == 0) return op;
+
+        *op++ = (uint8_t)(offset & 0xFF);
+        *op++ = (uint8_t)(offset >> 8);
+        mlen -= MIN_MATCH;
+        *token |= (uint8_t)(mlen >= 15 ? 15 : mlen);
+        if(mlen >= 15) op = put_length(op, mlen);
+        return op;
+    }
+}
+
+namespace codec
+{
+    size_t compress(const uint8_t *src, size_t n, uint8_t *dst)
+    {
+        uint8_t *op = dst;
+        const uint8_t *anchor = src;
+
+        if(n > MF_LIMIT) {
+            uint32_t table[1 << HASH_BITS] = {};    // last position of each hashed 4-byte sequence
+            const uint8_t *ip = src + 1;
+            const uint8_t *match_limit = src + n - MF_LIMIT;
+            const uint8_t *end_limit = src + n - LAST_LITERALS;
+
+            while(ip < match_limit) {
+                uint32_t v = read32(ip);
+                uint32_t h = hash(v);
+                const uint8_t *ref = src + table[h];
+                table[h] = (uint32_t)(ip - src);
+                if((size_t)(ip - ref) > MAX_OFFSET || read32(ref) != v) {
+                    ip += 1 + ((ip - anchor) >> 6);     // skip faster through incompressible data
+                    continue;
+                }
+
+                while(ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                    ip--;
+                    ref--;
+                }
+                const uint8_t *mp = ip + MIN_MATCH;
+                const uint8_t *rp = ref + MIN_MATCH;
+                while(mp < end_limit && *mp == *rp) {
+                    mp++;
+                    rp++;
+                }
+
+                op = put_sequence(op, anchor, (size_t)(ip - anchor), (size_t)(ip - ref), (size_t)(mp - ip));
+                if(mp < match_limit)
+                    table[hash(read32(mp - 2))] = (uint32_t)(mp - 2 - src);
+                ip = anchor = mp;
+            }
+        }
+        return (size_t)(put_sequence(op, anchor, (size_t)(src + n - anchor), 0, 0) - dst);
+    }
+
+    int decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t dst_n)
+    {
+        const uint8_t *ip = src;
+        const uint8_t *iend = src + n;
+        uint8_t *op = dst;
+        uint8_t *oend = dst + dst_n;
+
+        while(ip < iend) {
+            uint8_t token = *ip++;
+            size_t lit = token >> 4;
+            if(lit == 15 && !get_length(ip, iend, lit)) return -1;
+            if((size_t)(iend - ip) < lit || (size_t)(oend - op) < lit) return -1;
+            if(lit) memcpy(op, ip, lit);
+            op += lit;
+            ip += lit;
+            if(ip == iend) break;               // the last sequence has no match
+
+            if(iend - ip < 2) return -1;
+            size_t offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+            ip += 2;
+            if(offset == 0 || offset > (size_t)(op - dst)) return -1;
+            size_t mlen = token & 15;
+            if(mlen == 15 && !get_length(ip, iend, mlen)) return -1;
+            mlen += MIN_MATCH;
+            if((size_t)(oend - op) < mlen) return -1;
+
+            /// @brief An overlapping match repeats the last offset bytes; copy them in growing chunks.
+            const uint8_t *m = op - offset;
+            for(size_t span = offset; mlen > 0;) {
+                size_t c = mlen < span ? mlen : span;
+                memcpy(op, m, c);
+                op += c;
+                mlen -= c;
+                span += c;
+            }
+        }
+        return op == oend ? 0 : -1;
+    }
+}
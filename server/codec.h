@@ -0,0 +1,37 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @file codec.h
+ * @brief Fast byte-oriented compression in the LZ4 block format.
+ *
+ * A greedy LZ77 coder with a hash of 4-byte sequences and no entropy stage:
+ * a few hundred MB/s to compress and over 1 GB/s to decompress on one core,
+ * which is what packing journal segments and scanning them back needs. The
+ * output is plain LZ4 block format (token, literals, 16-bit offset, match
+ * length), so any LZ4 block decoder reads it. There is no frame or checksum;
+ * callers store the sizes and check the data themselves.
+ */
+namespace codec
+{
+    /// @brief Largest compressed size of n input bytes.
+    inline size_t compress_bound(size_t n) { return n + n / 255 + 16; }
+
+    /**
+     * @brief Compress src into dst.
+     * @param dst At least compress_bound(n) bytes
+     * @return Compressed size
+     */
+    size_t compress(const uint8_t *src, size_t n, uint8_t *dst);
+
+    /**
+     * @brief Decompress exactly dst_n bytes.
+     * @return 0, or -1 if src is malformed or does not decode to dst_n bytes
+     */
+    int decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t dst_n);
+}
+
+#endif // CODEC_H
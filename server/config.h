@@ -10,4 +10,62 @@
 // Log filename
 #define SERVER_LOG "server.log"
 
+// Trace every Nth frame per thread (0 disables stage tracing)
+#define TRACE_SAMPLE_EVERY 64
+
+// Stage events kept per thread before the oldest are overwritten
+#define TRACE_BUFFER_EVENTS 16384
+
+// Chrome trace JSON written on SIGUSR1
+#define TRACE_FILE "trace.json"
+
+// Give up on a client that does not read its replies for this long
+#define REPLY_TIMEOUT_MS 3000
+
+// Directory of the event journal segments (journal.h)
+#define JOURNAL_DIR "journal"
+
+// Size of one journal segment, preallocated when it is created; a change
+// applies to segments created afterwards (their capacity is in the header)
+#define JOURNAL_SEGMENT_BYTES (64u * 1024 * 1024)
+
+// Journaled records held back for one group fdatasync while more input is waiting
+#define JOURNAL_GROUP_RECORDS 4096
+
+// Reply bytes held back for one group fdatasync
+#define JOURNAL_GROUP_REPLY_BYTES (64 * 1024)
+
+// Journal records applied to SQLite per materializer transaction
+#define MATERIALIZE_BATCH 4096
+
+// Startup backlog (journal records not in customer_data) replayed in parallel (replay.h)
+#define REPLAY_MIN_RECORDS 10000
+
+// Replay worker threads, 0 for one per CPU
+#define REPLAY_THREADS 0
+
+// Journal records per replay transaction
+#define REPLAY_CHUNK_RECORDS 262144
+
+// Applied START/END pairs older than this are dropped when journal segments are packed
+#define JOURNAL_RETENTION_DAYS 30
+
+// Seconds between checks for journal segments to pack
+#define JOURNAL_COMPACT_INTERVAL_S 60
+
+// Runtime SQLite settings (JSON, optional; keys and defaults in storage.h)
+#define STORAGE_CONFIG_FILE "storage.json"
+
+// Journal records SQLite rejected, one JSON object per line
+#define DEAD_LETTER_FILE "dead_letter.jsonl"
+
+// Materializer retries, pauses and dead letters are logged this often while they change
+#define SQL_REPORT_S 60
+
+// Month archives of customer_data (archive.h), one database per month
+#define ARCHIVE_DIR "archive"
+
+// Progress of a long retention pass (retention.h) is logged this often
+#define RETENTION_REPORT_S 10
+
 #endif // CONFIG_H
\ No newline at end of file
@@ -0,0 +1,107 @@
+#include "dedup.h"
+
+namespace dedup
+{
+    SeqFilter::SeqFilter() : win_(DEVICE_IDS), is_dirty_(DEVICE_IDS, 0)
+    {
+        dirty_.reserve(1024);
+    }
+
+    SeqFilter::~SeqFilter()
+    {
+        if(stmt_upsert_) sqlite3_finalize(stmt_upsert_);
+    }
+
+    Verdict SeqFilter::check(uint16_t device_id, uint32_t seq, uint16_t epoch)
+    {
+        DeviceWindow &w = win_[device_id];
+        Verdict v = ACCEPT;
+
+        /// @brief A window kept without an epoch takes the first one it is sent:
+        ///        the client's spool predates epochs and numbers on.
+        if(epoch != 0 && epoch != w.epoch) {
+            if(w.epoch != 0) {
+                w.hwm = 0;
+                w.seen = 0;
+                v = RESTART;
+            }
+            w.epoch = epoch;
+            mark_dirty(device_id);
+        }
+
+        if(seq > w.hwm) {
+            uint32_t shift = seq - w.hwm;
+            w.seen = shift >= WINDOW ? 0 : w.seen << shift;
+            w.seen |= 1;
+            w.hwm = seq;
+        } else {
+            uint32_t back = w.hwm - seq;
+            if(back < WINDOW) {
+                uint64_t bit = 1ull << back;
+                if(w.seen & bit) return DUPLICATE;
+                w.seen |= bit;
+            } else {
+                return TOO_OLD;
+            }
+        }
+
+        mark_dirty(device_id);
+        return v;
+    }
+
+    void SeqFilter::mark_dirty(uint16_t device_id)
+    {
+        if(!is_dirty_[device_id]) {
+            is_dirty_[device_id] = 1;
+            dirty_.push_back(device_id);
+        }
+    }
+
+    int SeqFilter::load(sqlite3 *db)
+    {
+        sqlite3_stmt *stmt = nullptr;
+        int rc = sqlite3_prepare_v2(db, "SELECT device_id, hwm, seen, epoch FROM ingest_hwm;", -1, &stmt, nullptr);
+        if(rc != SQLITE_OK) return rc;
+
+        while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            sqlite3_int64 dev = sqlite3_column_int64(stmt, 0);
+            if(dev < 0 || dev >= (sqlite3_int64)DEVICE_IDS) continue;
+            win_[dev].hwm = (uint32_t)sqlite3_column_int64(stmt, 1);
+            win_[dev].seen = (uint64_t)sqlite3_column_int64(stmt, 2);
+            win_[dev].epoch = (uint16_t)sqlite3_column_int(stmt, 3);
+        }
+        sqlite3_finalize(stmt);
+        return rc == SQLITE_DONE ? SQLITE_OK : rc;
+    }
+
+    int SeqFilter::flush(sqlite3 *db)
+    {
+        if(dirty_.empty()) return SQLITE_OK;
+
+        int rc;
+        if(!stmt_upsert_) {
+            rc = sqlite3_prepare_v2(db,
+                "INSERT INTO ingest_hwm (device_id, hwm, seen, epoch) VALUES (?1, ?2, ?3, ?4) "
+                "ON CONFLICT(device_id) DO UPDATE SET hwm=excluded.hwm, seen=excluded.seen, epoch=excluded.epoch;",
+                -1, &stmt_upsert_, nullptr);
+            if(rc != SQLITE_OK) return rc;
+        }
+
+        for(uint16_t dev : dirty_) {
+            sqlite3_bind_int(stmt_upsert_, 1, dev);
+            sqlite3_bind_int64(stmt_upsert_, 2, win_[dev].hwm);
+            sqlite3_bind_int64(stmt_upsert_, 3, (sqlite3_int64)win_[dev].seen);
+            sqlite3_bind_int(stmt_upsert_, 4, win_[dev].epoch);
+            rc = sqlite3_step(stmt_upsert_);
+            sqlite3_reset(stmt_upsert_);
+            if(rc != SQLITE_DONE) return rc;
+        }
+        return SQLITE_OK;
+    }
+
+    void SeqFilter::committed()
+    {
+        for(uint16_t dev : dirty_) is_dirty_[dev] = 0;
+        dirty_.clear();
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "sqlite3.h"
+
+/**
+ * @file dedup.h
+ * @brief Duplicate suppression by per-device sequence number.
+ *
+ * For every device the server keeps the highest sequence number applied (the
+ * high-water mark) and a 64-bit bitmap of which of the 64 numbers up to it
+ * were applied, so events that arrive again after a reconnect are dropped in
+ * O(1) before any SQL runs. The windows of the devices touched by an ingest
+ * transaction are written to the ingest_hwm table inside that transaction,
+ * so the stored windows always match the stored sessions.
+ *
+ * Sequence numbers come from the client spool and start over at 1 when the
+ * spool is recreated. The spool's epoch (parking_protocol.h) tells the two
+ * numberings apart: a window is restarted only when an event arrives under
+ * a different epoch than the window's. Without one (epoch 0) a lower
+ * sequence number is never taken as a restart, so an old event sent again
+ * cannot wipe a valid window.
+ */
+namespace dedup
+{
+    constexpr uint32_t WINDOW = 64;          ///< Sequence numbers tracked below the high-water mark
+    constexpr size_t DEVICE_IDS = 65536;     ///< device_id is 16 bits
+
+    /// @brief Result of SeqFilter::check().
+    enum Verdict {
+        ACCEPT,         ///< New event, apply it
+        DUPLICATE,      ///< Already applied
+        TOO_OLD,        ///< Below the window, treated as already applied
+        RESTART         ///< New spool epoch: the window was restarted, apply it
+    };
+
+    /// @brief Window of one device. Bit i of seen is set when hwm - i was applied.
+    struct DeviceWindow {
+        uint32_t hwm = 0;
+        uint64_t seen = 0;
+        uint16_t epoch = 0;     ///< Spool epoch of hwm, 0 if none was sent
+    };
+
+    class SeqFilter {
+    public:
+        SeqFilter();
+        ~SeqFilter();
+
+        SeqFilter(const SeqFilter&) = delete;             /// Copy constructor deleted
+        SeqFilter& operator=(const SeqFilter&) = delete;  /// Copy assignment deleted
+
+        /**
+         * @brief Check an event and, unless it is a duplicate, mark it applied.
+         * @param device_id Device of the event
+         * @param seq Its sequence number (never 0; v1 events carry none and skip the filter)
+         * @param epoch Spool epoch of seq, 0 if the client sent none
+         * @return ACCEPT or RESTART if the event must be applied, DUPLICATE or TOO_OLD if not
+         */
+        Verdict check(uint16_t device_id, uint32_t seq, uint16_t epoch);
+
+        /**
+         * @brief Load the persisted windows (ingest_hwm).
+         * @return SQLITE_OK or the SQLite error code
+         */
+        int load(sqlite3 *db);
+
+        /**
+         * @brief Write the windows changed since the last commit; call inside
+         *        the transaction that applied the events.
+         * @return SQLITE_OK or the SQLite error code
+         */
+        int flush(sqlite3 *db);
+
+        /// @brief The flushed transaction committed; until then a rolled-back flush is written again.
+        void committed();
+
+        /// @brief High-water mark of a device, 0 if none.
+        uint32_t hwm(uint16_t device_id) const { return win_[device_id].hwm; }
+
+    private:
+        void mark_dirty(uint16_t device_id);
+
+        std::vector<DeviceWindow> win_;       ///< Indexed by device_id
+        std::vector<uint8_t> is_dirty_;       ///< Indexed by device_id
+        std::vector<uint16_t> dirty_;         ///< Devices changed since the last commit
+        sqlite3_stmt *stmt_upsert_ = nullptr;
+    };
+}
+
+#endif // DEDUP_H
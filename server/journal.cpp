@@ -0,0 +1,878 @@
+#include "journal.h"
+#include "codec.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <ctime>
+#include <algorithm>
+#include <unordered_map>
+#include <cmath>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace
+{
+    /// @brief CRC-32C table, reflected polynomial 0x82F63B78.
+    struct Crc32cTable {
+        uint32_t t[256];
+        Crc32cTable() {
+            for(uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for(int k = 0; k < 8; k++) c = (c & 1) ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+                t[i] = c;
+            }
+        }
+    };
+    const Crc32cTable crc_table;
+
+    uint64_t now_ms()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+    }
+
+    std::string segment_path(const std::string &dir, uint64_t first_lsn)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%020llu.jnl", (unsigned long long)first_lsn);
+        return dir + "/" + name;
+    }
+
+    /// @brief Path of the packed form of a segment.
+    std::string packed_path(const journal::SegmentInfo &seg)
+    {
+        return seg.path.substr(0, seg.path.size() - 4) + ".jnz";
+    }
+
+    /// @brief pread() exactly n bytes; a short read fails with EBADMSG.
+    int pread_all(int fd, void *buf, size_t n, off_t off)
+    {
+        char *p = (char*)buf;
+        while(n > 0) {
+            ssize_t r = pread(fd, p, n, off);
+            if(r < 0) {
+                if(errno == EINTR) continue;
+                return -1;
+            }
+            if(r == 0) {
+                errno = EBADMSG;
+                return -1;
+            }
+            p += r;
+            n -= (size_t)r;
+            off += r;
+        }
+        return 0;
+    }
+
+    /// @brief write() all of buf.
+    int write_all(int fd, const void *buf, size_t n)
+    {
+        const char *p = (const char*)buf;
+        while(n > 0) {
+            ssize_t w = write(fd, p, n);
+            if(w < 0) {
+                if(errno == EINTR) continue;
+                return -1;
+            }
+            p += w;
+            n -= (size_t)w;
+        }
+        return 0;
+    }
+
+    /// @brief fsync a directory so a created or removed entry is durable.
+    int sync_dir(const std::string &dir)
+    {
+        int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if(fd < 0) return -1;
+        int rc = fsync(fd);
+        close(fd);
+        return rc;
+    }
+}
+
+namespace journal
+{
+    uint32_t crc32c(const void *data, size_t n)
+    {
+        const uint8_t *p = (const uint8_t*)data;
+        uint32_t c = 0xFFFFFFFFu;
+        while(n--) c = crc_table.t[(c ^ *p++) & 0xFF] ^ (c >> 8);
+        return c ^ 0xFFFFFFFFu;
+    }
+
+    void seal(Record &r)
+    {
+        r.crc = crc32c(&r, offsetof(Record, crc));
+    }
+
+    bool valid(const Record &r)
+    {
+        return r.crc == crc32c(&r, offsetof(Record, crc));
+    }
+
+    void pack_rows(const Record *recs, size_t n, uint8_t *cols)
+    {
+        uint64_t prev_lsn = 0, prev_time = 0;
+        for(size_t i = 0; i < n; i++) {
+            Record r = recs[i];
+            r.lsn -= prev_lsn;
+            r.event_time_ms -= prev_time;      // wraps for late events, undone the same way
+            prev_lsn = recs[i].lsn;
+            prev_time = recs[i].event_time_ms;
+            const uint8_t *b = (const uint8_t*)&r;
+            for(size_t k = 0; k < PACKED_ROW; k++) cols[k * n + i] = b[k];
+        }
+    }
+
+    void unpack_rows(const uint8_t *cols, size_t n, Record *recs)
+    {
+        uint64_t prev_lsn = 0, prev_time = 0;
+        for(size_t i = 0; i < n; i++) {
+            Record &r = recs[i];
+            uint8_t *b = (uint8_t*)&r;
+            for(size_t k = 0; k < PACKED_ROW; k++) b[k] = cols[k * n + i];
+            r.lsn += prev_lsn;
+            r.event_time_ms += prev_time;
+            prev_lsn = r.lsn;
+            prev_time = r.event_time_ms;
+            seal(r);
+        }
+    }
+
+    std::string index_path(const SegmentInfo &seg)
+    {
+        return seg.path.substr(0, seg.path.size() - 4) + ".idx";
+    }
+
+    /// @brief Seal an index entry.
+    static void seal_entry(IndexEntry &e)
+    {
+        e.crc = crc32c(&e, offsetof(IndexEntry, crc));
+    }
+
+    int load_index(const SegmentInfo &seg, uint64_t records, std::vector<IndexEntry> &out)
+    {
+        out.clear();
+        uint64_t covered = 0;
+
+        int fd = ::open(index_path(seg).c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd >= 0) {
+            SegmentHeader h;
+            bool ok = pread(fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h) && h.magic == INDEX_MAGIC &&
+                      h.format == FORMAT && h.first_lsn == seg.first_lsn;
+            IndexEntry e[256];
+            off_t off = sizeof(h);
+            while(ok) {
+                ssize_t r = pread(fd, e, sizeof(e), off);
+                size_t n = r > 0 ? (size_t)r / sizeof(IndexEntry) : 0;
+                if(n == 0) break;
+                for(size_t i = 0; i < n && ok; i++) {
+                    const IndexEntry &x = e[i];
+                    ok = x.crc == crc32c(&x, offsetof(IndexEntry, crc)) && x.first_lsn == seg.first_lsn + covered &&
+                         x.records > 0 && x.records <= INDEX_EVERY && covered + x.records <= records;
+                    if(!ok) break;
+                    out.push_back(x);
+                    covered += x.records;
+                    ok = x.records == INDEX_EVERY;      // a short block ends the segment
+                }
+                off += (off_t)(n * sizeof(IndexEntry));
+            }
+            close(fd);
+        }
+
+        /// @brief Complete blocks the index file does not cover (lost or not yet written).
+        if((out.empty() || out.back().records == INDEX_EVERY) && covered + INDEX_EVERY <= records) {
+            fd = ::open(seg.path.c_str(), O_RDONLY | O_CLOEXEC);
+            if(fd < 0) return -1;
+            std::vector<Record> buf(INDEX_EVERY);
+            while(covered + INDEX_EVERY <= records) {
+                off_t off = (off_t)(sizeof(SegmentHeader) + covered * sizeof(Record));
+                ssize_t r = pread(fd, buf.data(), INDEX_EVERY * sizeof(Record), off);
+                if(r != (ssize_t)(INDEX_EVERY * sizeof(Record))) {
+                    int e = errno;
+                    close(fd);
+                    errno = r < 0 ? e : EIO;
+                    return -1;
+                }
+                IndexEntry x{};
+                x.first_lsn = seg.first_lsn + covered;
+                x.records = INDEX_EVERY;
+                x.min_time_ms = UINT64_MAX;
+                for(const Record &rec : buf) {
+                    x.min_time_ms = std::min(x.min_time_ms, rec.event_time_ms);
+                    x.max_time_ms = std::max(x.max_time_ms, rec.event_time_ms);
+                }
+                seal_entry(x);
+                out.push_back(x);
+                covered += INDEX_EVERY;
+            }
+            close(fd);
+        }
+        return 0;
+    }
+
+    std::vector<SegmentInfo> list_segments(const std::string &dir)
+    {
+        std::vector<SegmentInfo> segs;
+        DIR *d = opendir(dir.c_str());
+        if(!d) return segs;
+        while(struct dirent *e = readdir(d)) {
+            unsigned long long first;
+            char tail[8];
+            if(sscanf(e->d_name, "%20llu.%7s", &first, tail) != 2) continue;
+            if(strcmp(tail, "jnl") == 0 || strcmp(tail, "jnz") == 0)
+                segs.push_back({dir + "/" + e->d_name, (uint64_t)first, tail[2] == 'z'});
+        }
+        closedir(d);
+        std::sort(segs.begin(), segs.end(), [](const SegmentInfo &a, const SegmentInfo &b) {
+            return a.first_lsn != b.first_lsn ? a.first_lsn < b.first_lsn : !a.packed && b.packed;
+        });
+        /// @brief A crash in compact() can leave both forms; the .jnl wins and is packed again.
+        segs.erase(std::unique(segs.begin(), segs.end(), [](const SegmentInfo &a, const SegmentInfo &b) {
+            return a.first_lsn == b.first_lsn;
+        }), segs.end());
+        return segs;
+    }
+
+    // ----------------------------------------------------------------------------
+    PackedSegment::~PackedSegment()
+    {
+        if(fd_ >= 0) close(fd_);
+    }
+
+    int PackedSegment::open(const SegmentInfo &seg)
+    {
+        if(fd_ >= 0) close(fd_);
+        frames_.clear();
+        fd_ = ::open(seg.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd_ < 0) return -1;
+        if(pread_all(fd_, &header_, sizeof(header_), 0) < 0) return -1;
+        if(header_.magic != PACKED_MAGIC || header_.format != FORMAT || header_.first_lsn != seg.first_lsn ||
+           header_.end_lsn < header_.first_lsn) {
+            errno = EBADMSG;
+            return -1;
+        }
+        frames_.resize(header_.frames);
+        return pread_all(fd_, frames_.data(), frames_.size() * sizeof(Frame), sizeof(PackedHeader));
+    }
+
+    int PackedSegment::read_frame(size_t i, std::vector<Record> &out)
+    {
+        const Frame &f = frames_[i];
+        const size_t n = f.block.records;
+        buf_.resize(f.bytes + n * PACKED_ROW);
+        if(pread_all(fd_, buf_.data(), f.bytes, (off_t)f.offset) < 0) return -1;
+
+        uint8_t *cols = buf_.data() + f.bytes;
+        if(crc32c(buf_.data(), f.bytes) != f.crc || n == 0 || n > INDEX_EVERY ||
+           codec::decompress(buf_.data(), f.bytes, cols, n * PACKED_ROW) < 0) {
+            errno = EBADMSG;
+            return -1;
+        }
+        out.resize(n);
+        unpack_rows(cols, n, out.data());
+
+        uint64_t end = i + 1 < frames_.size() ? frames_[i + 1].block.first_lsn : header_.end_lsn;
+        bool ok = out[0].lsn == f.block.first_lsn && out[n - 1].lsn < end;
+        for(size_t k = 1; ok && k < n; k++) ok = out[k].lsn > out[k - 1].lsn;
+        if(!ok) {
+            errno = EBADMSG;
+            return -1;
+        }
+        return 0;
+    }
+
+    /// @brief All records of a sealed segment, checked.
+    static int load_segment(const SegmentInfo &seg, uint64_t end_lsn, std::vector<Record> &out)
+    {
+        if(seg.packed) {
+            PackedSegment p;
+            if(p.open(seg) < 0) return -1;
+            std::vector<Record> frame;
+            for(size_t i = 0; i < p.frames().size(); i++) {
+                if(p.read_frame(i, frame) < 0) return -1;
+                out.insert(out.end(), frame.begin(), frame.end());
+            }
+            return 0;
+        }
+
+        int fd = ::open(seg.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0) return -1;
+        out.resize(end_lsn - seg.first_lsn);
+        int rc = pread_all(fd, out.data(), out.size() * sizeof(Record), sizeof(SegmentHeader));
+        close(fd);
+        if(rc < 0) return -1;
+        for(size_t i = 0; i < out.size(); i++) {
+            if(!valid(out[i]) || out[i].lsn != seg.first_lsn + i) {
+                errno = EBADMSG;
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    uint64_t session_key(const Record &r)
+    {
+        return (uint64_t)r.device_id << 48 |
+               ((uint64_t)std::lround(r.x * 1000.0) & 0xFFFFFF) << 24 |
+               ((uint64_t)std::lround(r.y * 1000.0) & 0xFFFFFF);
+    }
+
+    /**
+     * @brief Apply recs to open the way SessionStore::apply() does and mark
+     *        the sessions opened and closed in recs before cutoff_ms in drop.
+     * @return repack_ms for the packed file
+     */
+    static uint64_t pair_sessions(const std::vector<Record> &recs, uint64_t cutoff_ms, OpenSessions &open,
+                                  std::vector<bool> &drop, CompactStats &stats)
+    {
+        /// @brief A session opened in recs: its START and the STARTs ignored while it was open.
+        struct Opened {
+            std::vector<size_t> starts;
+            uint64_t newest_ms;
+        };
+        std::unordered_map<uint64_t, Opened> opened;
+        uint64_t repack_ms = UINT64_MAX;
+        for(size_t i = 0; i < recs.size(); i++) {
+            const Record &r = recs[i];
+            if(r.status != 1 && r.status != 0) continue;     // IGNORED by the stores
+            const uint64_t key = session_key(r);
+            auto it = opened.find(key);
+
+            if(r.status == 1) {
+                if(open.insert(key).second) {
+                    opened[key] = Opened{{i}, r.event_time_ms};
+                } else if(it != opened.end()) {     // ALREADY_OPEN: goes with its session
+                    it->second.starts.push_back(i);
+                    it->second.newest_ms = std::max(it->second.newest_ms, r.event_time_ms);
+                }
+                continue;
+            }
+
+            if(open.erase(key) == 0 || it == opened.end()) continue;   // NOT_OPEN, or opened earlier
+            uint64_t newest = std::max(it->second.newest_ms, r.event_time_ms);
+            if(newest < cutoff_ms) {
+                for(size_t s : it->second.starts) drop[s] = true;
+                drop[i] = true;
+                stats.pairs_dropped++;
+            } else {
+                repack_ms = std::min(repack_ms, newest + 1);
+            }
+            opened.erase(it);
+        }
+        return repack_ms;
+    }
+
+    int track_sessions(const SegmentInfo &seg, uint64_t end_lsn, OpenSessions &open)
+    {
+        std::vector<Record> recs;
+        if(load_segment(seg, end_lsn, recs) < 0) return -1;
+        std::vector<bool> drop(recs.size());
+        CompactStats stats;
+        pair_sessions(recs, 0, open, drop, stats);
+        return 0;
+    }
+
+    /// @brief Read a packed file back: its frames must decode to exactly recs.
+    static int verify_packed(const std::string &path, uint64_t first_lsn, const std::vector<Record> &recs)
+    {
+        PackedSegment p;
+        if(p.open({path, first_lsn, true}) < 0) return -1;
+        std::vector<Record> out;
+        size_t at = 0;
+        for(size_t i = 0; i < p.frames().size(); i++) {
+            if(p.read_frame(i, out) < 0) return -1;
+            if(out.size() > recs.size() - at || memcmp(out.data(), &recs[at], out.size() * sizeof(Record)) != 0) {
+                errno = EBADMSG;
+                return -1;
+            }
+            at += out.size();
+        }
+        if(at != recs.size()) {
+            errno = EBADMSG;
+            return -1;
+        }
+        return 0;
+    }
+
+    int compact(const SegmentInfo &seg, uint64_t end_lsn, uint64_t cutoff_ms, OpenSessions &open,
+                CompactStats &stats)
+    {
+        stats = CompactStats();
+        struct stat st;
+        if(stat(seg.path.c_str(), &st) < 0) return -1;
+        stats.bytes_in = (uint64_t)st.st_size;
+
+        std::vector<Record> recs;
+        if(load_segment(seg, end_lsn, recs) < 0) return -1;
+        stats.records_in = recs.size();
+
+        std::vector<bool> drop(recs.size());
+        OpenSessions at_end = open;
+        const uint64_t repack_ms = pair_sessions(recs, cutoff_ms, at_end, drop, stats);
+        stats.repack_ms = repack_ms;
+        size_t kept = 0;
+        for(size_t i = 0; i < recs.size(); i++)
+            if(!drop[i]) recs[kept++] = recs[i];
+        recs.resize(kept);
+        stats.records_out = kept;
+
+        /// @brief Header and frame table go in last, once the frame offsets are known.
+        PackedHeader h{};
+        h.magic = PACKED_MAGIC;
+        h.format = FORMAT;
+        h.first_lsn = seg.first_lsn;
+        h.created_ms = now_ms();
+        h.end_lsn = end_lsn;
+        h.repack_ms = repack_ms;
+        h.frames = (uint32_t)((kept + INDEX_EVERY - 1) / INDEX_EVERY);
+        h.records = (uint32_t)kept;
+        std::vector<Frame> frames(h.frames);
+        uint64_t offset = sizeof(PackedHeader) + frames.size() * sizeof(Frame);
+
+        std::string path = packed_path(seg);
+        std::string tmp = path + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(fd < 0) return -1;
+        std::vector<uint8_t> cols(INDEX_EVERY * PACKED_ROW), packed(codec::compress_bound(INDEX_EVERY * PACKED_ROW));
+        bool ok = lseek(fd, (off_t)offset, SEEK_SET) >= 0;
+        for(size_t f = 0; ok && f < frames.size(); f++) {
+            const Record *r = &recs[f * INDEX_EVERY];
+            size_t n = std::min<size_t>(INDEX_EVERY, kept - f * INDEX_EVERY);
+            IndexEntry &e = frames[f].block;
+            e.first_lsn = r[0].lsn;
+            e.min_time_ms = UINT64_MAX;
+            for(size_t k = 0; k < n; k++) {
+                e.min_time_ms = std::min(e.min_time_ms, r[k].event_time_ms);
+                e.max_time_ms = std::max(e.max_time_ms, r[k].event_time_ms);
+            }
+            e.records = (uint32_t)n;
+            seal_entry(e);
+
+            pack_rows(r, n, cols.data());
+            size_t bytes = codec::compress(cols.data(), n * PACKED_ROW, packed.data());
+            frames[f].offset = offset;
+            frames[f].bytes = (uint32_t)bytes;
+            frames[f].crc = crc32c(packed.data(), bytes);
+            ok = write_all(fd, packed.data(), bytes) == 0;
+            offset += bytes;
+        }
+        ok = ok && pwrite(fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h) &&
+             pwrite(fd, frames.data(), frames.size() * sizeof(Frame), sizeof(h)) == (ssize_t)(frames.size() * sizeof(Frame)) &&
+             fdatasync(fd) == 0;
+        int e = errno;
+        close(fd);
+        /// @brief The segment is removed below: check the new file decodes before it replaces it.
+        if(ok && verify_packed(tmp, seg.first_lsn, recs) < 0) {
+            ok = false;
+            e = errno;
+        }
+        if(!ok || rename(tmp.c_str(), path.c_str()) < 0 || sync_dir(seg.path.substr(0, seg.path.rfind('/'))) < 0) {
+            if(ok) e = errno;
+            unlink(tmp.c_str());
+            errno = e;
+            return -1;
+        }
+        stats.bytes_out = offset;
+        open = std::move(at_end);
+
+        if(!seg.packed) {
+            (void)unlink(seg.path.c_str());
+            (void)unlink(index_path(seg).c_str());
+        }
+        return 0;
+    }
+
+    // ----------------------------------------------------------------------------
+    Writer::~Writer()
+    {
+        if(fd_ >= 0) close(fd_);
+        if(idx_fd_ >= 0) close(idx_fd_);
+    }
+
+    /**
+     * @brief Start the index file of the segment at first_lsn with entries.
+     * @details Index I/O errors are ignored: a missing or short index only
+     *          makes load_index() compute the blocks itself.
+     */
+    void Writer::open_index(uint64_t first_lsn, const std::vector<IndexEntry> &entries)
+    {
+        if(idx_fd_ >= 0) close(idx_fd_);
+        std::string path = index_path({segment_path(dir_, first_lsn), first_lsn});
+        idx_fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        if(idx_fd_ < 0) return;
+
+        SegmentHeader h{};
+        h.magic = INDEX_MAGIC;
+        h.format = FORMAT;
+        h.first_lsn = first_lsn;
+        h.created_ms = now_ms();
+        if(write_all(idx_fd_, &h, sizeof(h)) < 0) {
+            close(idx_fd_);
+            idx_fd_ = -1;
+            return;
+        }
+        write_index(entries);
+    }
+
+    void Writer::write_index(const std::vector<IndexEntry> &entries)
+    {
+        if(idx_fd_ >= 0 && !entries.empty())
+            (void)write_all(idx_fd_, entries.data(), entries.size() * sizeof(IndexEntry));
+    }
+
+    /// @brief Account a record to the open index block, closing it when full.
+    void Writer::index_record(const Record &r, std::vector<IndexEntry> &done)
+    {
+        if(block_.records == 0) {
+            block_.first_lsn = r.lsn;
+            block_.min_time_ms = block_.max_time_ms = r.event_time_ms;
+        } else {
+            block_.min_time_ms = std::min(block_.min_time_ms, r.event_time_ms);
+            block_.max_time_ms = std::max(block_.max_time_ms, r.event_time_ms);
+        }
+        if(++block_.records == INDEX_EVERY) close_block(done);
+    }
+
+    void Writer::close_block(std::vector<IndexEntry> &done)
+    {
+        if(block_.records == 0) return;
+        seal_entry(block_);
+        done.push_back(block_);
+        block_ = IndexEntry{};
+    }
+
+    /**
+     * @brief Create the segment starting at first_lsn and make it current.
+     * @details The blocks are reserved with FALLOC_FL_KEEP_SIZE so the file
+     *          length still marks the end of the data and O_APPEND works.
+     */
+    int Writer::open_segment(uint64_t first_lsn)
+    {
+        std::string path = segment_path(dir_, first_lsn);
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+        if(fd < 0) return -1;
+
+        SegmentHeader h{};
+        h.magic = MAGIC;
+        h.format = FORMAT;
+        h.first_lsn = first_lsn;
+        h.created_ms = now_ms();
+        h.capacity = segment_records(segment_bytes_);
+#ifdef FALLOC_FL_KEEP_SIZE
+        (void)fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)segment_bytes_);  // best effort
+#endif
+        if(write_all(fd, &h, sizeof(h)) < 0 || fdatasync(fd) < 0 || sync_dir(dir_) < 0) {
+            int e = errno;
+            close(fd);
+            errno = e;
+            return -1;
+        }
+
+        if(fd_ >= 0) close(fd_);
+        fd_ = fd;
+        seg_first_ = first_lsn;
+        seg_count_ = 0;
+        seg_cap_ = h.capacity;
+        block_ = IndexEntry{};
+        open_index(first_lsn, {});
+        return 0;
+    }
+
+    /**
+     * @brief Reopen the newest segment for appending, cutting off anything
+     *        after its last valid record (a write torn by a crash).
+     * @details A segment without a stored capacity takes the configured one;
+     *          if it already holds that many records it is sealed as it is.
+     */
+    int Writer::recover_tail(const SegmentInfo &seg)
+    {
+        int fd = ::open(seg.path.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+        if(fd < 0) return -1;
+
+        SegmentHeader h;
+        if(pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || h.magic != MAGIC ||
+           h.format != FORMAT || h.first_lsn != seg.first_lsn) {
+            close(fd);
+            errno = EINVAL;
+            return -1;
+        }
+
+        struct stat st;
+        if(fstat(fd, &st) < 0) { int e = errno; close(fd); errno = e; return -1; }
+        uint64_t stored = ((uint64_t)st.st_size - sizeof(h)) / sizeof(Record);
+
+        std::vector<Record> buf(4096);
+        std::vector<IndexEntry> entries;
+        uint64_t good = 0;
+        block_ = IndexEntry{};
+        while(good < stored) {
+            size_t want = (size_t)std::min<uint64_t>(buf.size(), stored - good);
+            off_t off = (off_t)(sizeof(h) + good * sizeof(Record));
+            ssize_t r = pread(fd, buf.data(), want * sizeof(Record), off);
+            if(r < (ssize_t)(want * sizeof(Record))) { int e = errno; close(fd); errno = r < 0 ? e : EIO; return -1; }
+            size_t i = 0;
+            while(i < want && valid(buf[i]) && buf[i].lsn == seg.first_lsn + good + i) {
+                index_record(buf[i], entries);
+                i++;
+            }
+            good += i;
+            if(i < want) break;
+        }
+
+        off_t end = (off_t)(sizeof(h) + good * sizeof(Record));
+        if(end != st.st_size) {
+            truncated_ += (uint64_t)(st.st_size - end);
+            if(ftruncate(fd, end) < 0 || fdatasync(fd) < 0) { int e = errno; close(fd); errno = e; return -1; }
+        }
+
+        fd_ = fd;
+        seg_first_ = seg.first_lsn;
+        seg_count_ = good;
+        seg_cap_ = h.capacity ? h.capacity : segment_records(segment_bytes_);
+        next_lsn_ = seg.first_lsn + good;
+        open_index(seg.first_lsn, entries);     // rebuilt: the old one may be torn too
+        if(h.capacity == 0 && seg_count_ >= seg_cap_) {
+            /// @brief Readers take it as full at its file size (see Reader::locate()).
+            std::vector<IndexEntry> last;
+            close_block(last);
+            write_index(last);
+            return open_segment(seg_first_ + seg_count_);
+        }
+        return 0;
+    }
+
+    int Writer::open(const std::string &dir, size_t segment_bytes)
+    {
+        dir_ = dir;
+        segment_bytes_ = segment_bytes;
+        if(mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) return -1;
+
+        std::vector<SegmentInfo> segs = list_segments(dir);
+
+        /// @brief A crash while creating a segment can leave it without a full header.
+        while(!segs.empty()) {
+            struct stat st;
+            if(stat(segs.back().path.c_str(), &st) < 0) return -1;
+            if((size_t)st.st_size >= sizeof(SegmentHeader)) break;
+            if(unlink(segs.back().path.c_str()) < 0) return -1;
+            (void)unlink(index_path(segs.back()).c_str());
+            truncated_ += (uint64_t)st.st_size;
+            segs.pop_back();
+        }
+
+        if(segs.empty()) {
+            if(open_segment(1) < 0) return -1;
+            next_lsn_ = 1;
+        } else if(recover_tail(segs.back()) < 0) {
+            return -1;
+        }
+        durable_.store(next_lsn_ - 1, std::memory_order_release);
+        return 0;
+    }
+
+    uint64_t Writer::append(Record r)
+    {
+        r.lsn = next_lsn_++;
+        seal(r);
+        pending_.push_back(r);
+        return r.lsn;
+    }
+
+    int Writer::commit()
+    {
+        std::vector<IndexEntry> entries;
+        size_t done = 0;
+
+        while(done < pending_.size()) {
+            if(seg_count_ >= seg_cap_) {
+                /// @brief Seal the full segment, and its index, before starting the next one.
+                close_block(entries);
+                write_index(entries);
+                entries.clear();
+                if(fdatasync(fd_) < 0 || open_segment(seg_first_ + seg_count_) < 0) return -1;
+            }
+            size_t n = (size_t)std::min<uint64_t>(pending_.size() - done, seg_cap_ - seg_count_);
+            if(write_all(fd_, &pending_[done], n * sizeof(Record)) < 0) return -1;
+            for(size_t i = done; i < done + n; i++) index_record(pending_[i], entries);
+            write_index(entries);
+            entries.clear();
+            seg_count_ += n;
+            done += n;
+        }
+        if(done > 0 && fdatasync(fd_) < 0) return -1;
+
+        if(done > 0) durable_.store(pending_.back().lsn, std::memory_order_release);
+        pending_.clear();
+        return 0;
+    }
+
+    // ----------------------------------------------------------------------------
+    Reader::~Reader()
+    {
+        if(fd_ >= 0) close(fd_);
+    }
+
+    void Reader::open(const std::string &dir, size_t segment_bytes, uint64_t from_lsn)
+    {
+        dir_ = dir;
+        segment_bytes_ = segment_bytes;
+        next_ = from_lsn;
+        if(fd_ >= 0) close(fd_);
+        fd_ = -1;
+        in_packed_ = false;
+    }
+
+    /**
+     * @brief Open the unpacked segment seg and find where it ends.
+     * @details A sealed segment ends where the next one starts. The newest
+     *          ends at the capacity in its header; one written before that
+     *          was stored is sealed at the configured capacity, or at its
+     *          size if it already held more when the writer reopened it.
+     * @param end Set to the first LSN after the segment
+     */
+    int Reader::segment_end(const std::vector<SegmentInfo> &segs, const SegmentInfo &seg, uint64_t &end)
+    {
+        fd_ = ::open(seg.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd_ < 0) return -1;
+
+        auto next = std::upper_bound(segs.begin(), segs.end(), seg.first_lsn,
+                                     [](uint64_t lsn, const SegmentInfo &s) { return lsn < s.first_lsn; });
+        if(next != segs.end()) {
+            end = next->first_lsn;
+            return 0;
+        }
+
+        SegmentHeader h;
+        struct stat st;
+        if(pread(fd_, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || h.magic != MAGIC || h.first_lsn != seg.first_lsn ||
+           fstat(fd_, &st) < 0) {
+            errno = EBADMSG;
+            return -1;
+        }
+        uint64_t cap = h.capacity;
+        if(cap == 0)
+            cap = std::max<uint64_t>(segment_records(segment_bytes_), ((uint64_t)st.st_size - sizeof(h)) / sizeof(Record));
+        end = seg.first_lsn + cap;
+        return 0;
+    }
+
+    /**
+     * @brief Open the segment holding next_.
+     */
+    int Reader::locate()
+    {
+        if(fd_ >= 0) close(fd_);
+        fd_ = -1;
+        in_packed_ = false;
+
+        std::vector<SegmentInfo> segs = list_segments(dir_);
+        const SegmentInfo *hit = nullptr;
+        for(const SegmentInfo &s : segs)
+            if(s.first_lsn <= next_) hit = &s;
+        if(!hit) {
+            errno = ENOENT;
+            return -1;
+        }
+
+        if(hit->packed) {
+            if(packed_.open(*hit) < 0) return -1;
+            seg_first_ = hit->first_lsn;
+            seg_end_ = packed_.header().end_lsn;
+            const std::vector<Frame> &frames = packed_.frames();
+            frame_ = std::upper_bound(frames.begin(), frames.end(), next_, [](uint64_t lsn, const Frame &f) {
+                return lsn < f.block.first_lsn;
+            }) - frames.begin();
+            if(frame_ > 0) frame_--;
+            frame_recs_.clear();
+            frame_pos_ = 0;
+            in_packed_ = true;
+        } else {
+            if(segment_end(segs, *hit, seg_end_) < 0) return -1;
+            seg_first_ = hit->first_lsn;
+        }
+        if(next_ >= seg_end_) {
+            if(fd_ >= 0) close(fd_);
+            fd_ = -1;
+            in_packed_ = false;
+            errno = ENOENT;
+            return -1;
+        }
+        return 0;
+    }
+
+    /**
+     * @brief read() from the open packed segment; next_ moves over the
+     *        LSNs of dropped records.
+     */
+    int Reader::read_packed(Record *out, size_t max, uint64_t limit)
+    {
+        size_t got = 0;
+        while(got < max && next_ <= limit && next_ < seg_end_) {
+            if(frame_pos_ == frame_recs_.size()) {
+                if(frame_ == packed_.frames().size()) {
+                    next_ = seg_end_;       // the rest of the segment was dropped
+                    break;
+                }
+                if(packed_.read_frame(frame_++, frame_recs_) < 0) return -1;
+                frame_pos_ = 0;
+            }
+            const Record &r = frame_recs_[frame_pos_];
+            if(r.lsn < next_) {
+                frame_pos_++;
+                continue;
+            }
+            if(r.lsn > limit) {
+                next_ = limit + 1;
+                break;
+            }
+            out[got++] = r;
+            frame_pos_++;
+            next_ = r.lsn + 1;
+        }
+        return (int)got;
+    }
+
+    int Reader::read(Record *out, size_t max, uint64_t limit)
+    {
+        size_t got = 0;
+        while(got < max && next_ <= limit) {
+            if((fd_ < 0 && !in_packed_) || next_ >= seg_end_) {
+                if(locate() < 0) return -1;
+            }
+            if(in_packed_) {
+                int n = read_packed(out + got, max - got, limit);
+                if(n < 0) return -1;
+                got += (size_t)n;
+                continue;
+            }
+            uint64_t want = std::min<uint64_t>({(uint64_t)(max - got), limit - next_ + 1, seg_end_ - next_});
+            off_t off = (off_t)(sizeof(SegmentHeader) + (next_ - seg_first_) * sizeof(Record));
+            ssize_t r = pread(fd_, out + got, (size_t)want * sizeof(Record), off);
+            if(r < 0) {
+                if(errno == EINTR) continue;
+                return -1;
+            }
+            size_t n = (size_t)r / sizeof(Record);
+            if(n == 0) {
+                errno = EIO;    // durable records missing from the segment
+                return -1;
+            }
+            for(size_t i = 0; i < n; i++) {
+                if(!valid(out[got + i]) || out[got + i].lsn != next_ + i) {
+                    errno = EBADMSG;
+                    return -1;
+                }
+            }
+            got += n;
+            next_ += n;
+        }
+        return (int)got;
+    }
+}
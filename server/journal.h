@@ -0,0 +1,353 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <atomic>
+
+/**
+ * @file journal.h
+ * @brief Append-only binary event journal, the server's durability point.
+ *
+ * Every accepted event is appended as a fixed-size, CRC-32C checked record
+ * and made durable with one fdatasync per group (one client message) before
+ * it is acknowledged. SQLite is fed from the journal afterwards by the
+ * materializer thread, so customer_data may lag behind it.
+ *
+ * The journal is a directory of segments named by their first LSN
+ * (%020llu.jnl). A segment is a SegmentHeader followed by Records in LSN
+ * order; its blocks are preallocated when it is created and it is sealed
+ * (never written again) once it holds the capacity stored in its header, so
+ * a changed JOURNAL_SEGMENT_BYTES only applies to new segments. A sealed
+ * segment ends where the next one starts. Records are in host byte order:
+ * the journal never leaves the server box.
+ *
+ * Beside every segment a sparse index (%020llu.idx) holds one IndexEntry per
+ * INDEX_EVERY records with the block's event time range, so time-window
+ * queries read only the blocks that can match (journal-scan). Event times
+ * are not monotonic in LSN order (spooled events arrive late), so the index
+ * keeps a min and a max per block rather than a single timestamp. The index
+ * is advisory: it is not synced, the writer rebuilds it for the segment it
+ * reopens after a crash, and load_index() fills in what is missing.
+ *
+ * Sealed segments whose records are all materialized are packed (compact())
+ * into %020llu.jnz: START/END pairs past retention are dropped and the rest
+ * is compressed in frames of one index block each (codec.h), so the frame
+ * table doubles as the segment's index. LSNs in a packed segment have gaps
+ * where pairs were dropped; Reader and journal-scan read both kinds.
+ */
+namespace journal
+{
+    constexpr uint32_t MAGIC = 0x314A4B50;      ///< "PKJ1"
+    constexpr uint32_t INDEX_MAGIC = 0x31494B50;    ///< "PKI1"
+    constexpr uint32_t PACKED_MAGIC = 0x315A4B50;   ///< "PKZ1"
+    constexpr uint32_t FORMAT = 1;
+    constexpr uint32_t INDEX_EVERY = 1024;      ///< Records per index block
+    constexpr uint8_t RECORD_ARRIVAL_TIME = 0x01;   ///< Record::flags: event_time_ms is the arrival time
+
+    /// @brief First bytes of every segment.
+    struct SegmentHeader {
+        uint32_t magic;
+        uint32_t format;
+        uint64_t first_lsn;         ///< LSN of the first record
+        uint64_t created_ms;        ///< Unix time the segment was created
+        uint64_t capacity;          ///< Records it is sealed at, 0 in segments written before it was stored
+        uint8_t reserved[32];
+    };
+    static_assert(sizeof(SegmentHeader) == 64, "SegmentHeader is 64 bytes");
+
+    /// @brief One journaled event.
+    struct Record {
+        uint64_t lsn;               ///< Log sequence number, 1 for the first record ever
+        uint64_t event_time_ms;     ///< Client event time, or the arrival time (RECORD_ARRIVAL_TIME)
+        double x;                   ///< Latitude as stored in customer_data
+        double y;                   ///< Longitude
+        uint32_t seq;               ///< Per-device sequence number, 0 for v1
+        uint16_t device_id;
+        uint16_t status;            ///< START (1) or END (0)
+        uint8_t version;            ///< Protocol version it arrived with
+        uint8_t flags;              ///< RECORD_* bits, 0 in journals written before them
+        uint16_t epoch;             ///< Spool epoch of seq (HELLO), 0 if none
+        uint32_t crc;               ///< CRC-32C of the bytes before it
+    };
+    static_assert(sizeof(Record) == 48, "Record is 48 bytes");
+
+    /**
+     * @brief Sparse index entry of one block of records.
+     * @details The block starts at offset sizeof(SegmentHeader) +
+     *          (first_lsn - segment first_lsn) * sizeof(Record). Only the
+     *          last block of a sealed segment may hold fewer than INDEX_EVERY.
+     */
+    struct IndexEntry {
+        uint64_t first_lsn;
+        uint64_t min_time_ms;       ///< Smallest event time in the block
+        uint64_t max_time_ms;       ///< Largest event time in the block
+        uint32_t records;           ///< Records in the block
+        uint32_t crc;               ///< CRC-32C of the bytes before it
+    };
+    static_assert(sizeof(IndexEntry) == 32, "IndexEntry is 32 bytes");
+
+    /// @brief First bytes of a packed segment, followed by its Frame table.
+    struct PackedHeader {
+        uint32_t magic;
+        uint32_t format;
+        uint64_t first_lsn;         ///< LSN the segment started at before packing
+        uint64_t created_ms;        ///< Unix time it was packed
+        uint64_t end_lsn;           ///< First LSN of the next segment
+        uint64_t repack_ms;         ///< Retention cutoff from which packing again drops more, UINT64_MAX if never
+        uint32_t frames;
+        uint32_t records;           ///< Records kept
+        uint8_t reserved[16];
+    };
+    static_assert(sizeof(PackedHeader) == 64, "PackedHeader is 64 bytes");
+
+    /**
+     * @brief One compressed block of a packed segment.
+     * @details Records are stored without their crc, lsn and event time
+     *          delta coded and the bytes transposed by column, which
+     *          turns the repeated coordinates, versions and statuses into
+     *          long runs for the codec.
+     */
+    struct Frame {
+        IndexEntry block;           ///< Kept records: first LSN, event time range and count
+        uint64_t offset;            ///< File offset of the compressed bytes
+        uint32_t bytes;             ///< Compressed size
+        uint32_t crc;               ///< CRC-32C of the compressed bytes
+    };
+    static_assert(sizeof(Frame) == 48, "Frame is 48 bytes");
+
+    /// @brief CRC-32C (Castagnoli).
+    uint32_t crc32c(const void *data, size_t n);
+
+    /// @brief Fill in r.crc.
+    void seal(Record &r);
+
+    /// @brief True if r.crc matches.
+    bool valid(const Record &r);
+
+    /// @brief Bytes of a record stored in a packed frame (all but the crc).
+    constexpr size_t PACKED_ROW = offsetof(Record, crc);
+
+    /// @brief Delta code lsn and event time of n records, then transpose them
+    ///        into PACKED_ROW columns of n bytes (the uncompressed Frame).
+    void pack_rows(const Record *recs, size_t n, uint8_t *cols);
+
+    /// @brief Inverse of pack_rows(); the crc of every record is computed again.
+    void unpack_rows(const uint8_t *cols, size_t n, Record *recs);
+
+    /// @brief Records that fit a segment of segment_bytes.
+    inline uint64_t segment_records(size_t segment_bytes)
+    {
+        return (segment_bytes - sizeof(SegmentHeader)) / sizeof(Record);
+    }
+
+    /// @brief A segment file found in the journal directory.
+    struct SegmentInfo {
+        std::string path;
+        uint64_t first_lsn;
+        bool packed = false;        ///< .jnz (PackedSegment) rather than .jnl
+    };
+
+    /// @brief Segments of dir, oldest first.
+    std::vector<SegmentInfo> list_segments(const std::string &dir);
+
+    /// @brief Index file of a segment.
+    std::string index_path(const SegmentInfo &seg);
+
+    /**
+     * @brief Index entries of a segment holding `records` records.
+     * @details Entries are taken from the index file as long as they are
+     *          valid; the complete blocks after them are computed from the
+     *          segment. Records after the last entry (fewer than
+     *          INDEX_EVERY, the open block of the active segment) are left
+     *          to the caller.
+     * @return 0, or -1 with errno set if the segment cannot be read
+     */
+    int load_index(const SegmentInfo &seg, uint64_t records, std::vector<IndexEntry> &out);
+
+    /**
+     * @brief Read access to a packed segment.
+     */
+    class PackedSegment {
+    public:
+        PackedSegment() = default;
+        ~PackedSegment();
+
+        PackedSegment(const PackedSegment&) = delete;             /// Copy constructor deleted
+        PackedSegment& operator=(const PackedSegment&) = delete;  /// Copy assignment deleted
+
+        /// @brief Open seg and load its frame table; 0, or -1 with errno set.
+        int open(const SegmentInfo &seg);
+
+        const PackedHeader &header() const { return header_; }
+        const std::vector<Frame> &frames() const { return frames_; }
+
+        /**
+         * @brief Decompress frame i into out.
+         * @return 0, or -1 with errno set (EBADMSG if the frame is damaged)
+         */
+        int read_frame(size_t i, std::vector<Record> &out);
+
+    private:
+        int fd_ = -1;
+        PackedHeader header_{};
+        std::vector<Frame> frames_;
+        std::vector<uint8_t> buf_;
+    };
+
+    /// @brief Outcome of compact().
+    struct CompactStats {
+        uint64_t records_in = 0;
+        uint64_t records_out = 0;
+        uint64_t pairs_dropped = 0;
+        uint64_t bytes_in = 0;
+        uint64_t bytes_out = 0;
+        uint64_t repack_ms = UINT64_MAX;    ///< PackedHeader::repack_ms of the new file
+    };
+
+    /**
+     * @brief Sessions open at a point of the journal, by session_key(): those
+     *        a session store applying the journal from its start would hold.
+     */
+    using OpenSessions = std::unordered_set<uint64_t>;
+
+    /// @brief Device and position of an event: the session it opens or closes.
+    uint64_t session_key(const Record &r);
+
+    /**
+     * @brief Follow the sessions opened and closed by a sealed segment.
+     * @param open Sessions open at the segment's start; on success, at its end
+     * @return 0, or -1 with errno set (open is unchanged)
+     */
+    int track_sessions(const SegmentInfo &seg, uint64_t end_lsn, OpenSessions &open);
+
+    /**
+     * @brief Pack a sealed segment, or pack a packed one again.
+     * @details Sessions opened and closed within the segment whose events
+     *          are all older than cutoff_ms are dropped: the START, the END,
+     *          and the STARTs that met the session open. Events are paired
+     *          by SessionStore::apply()'s rules, from the sessions open at
+     *          the segment's start: a START for an open session is ignored,
+     *          an END without one too, and any other status. Sessions
+     *          spanning two segments are kept, so the sessions open at each
+     *          segment boundary stay the same. The packed file is synced,
+     *          read back and compared with the kept records, and renamed
+     *          into place before the original (and its index) is removed,
+     *          so a crash or a bad frame leaves one complete copy. All records
+     *          must be materialized: packed records are for scans, audits
+     *          and the journal store.
+     * @param seg Segment to pack (.jnl or .jnz)
+     * @param end_lsn First LSN of the next segment
+     * @param open Sessions open at the segment's start; on success, at its end
+     * @return 0, or -1 with errno set, EBADMSG if the packed file did not
+     *         read back (nothing is changed)
+     */
+    int compact(const SegmentInfo &seg, uint64_t end_lsn, uint64_t cutoff_ms, OpenSessions &open,
+                CompactStats &stats);
+
+    /**
+     * @brief Appends records; used by the connection thread only.
+     */
+    class Writer {
+    public:
+        Writer() = default;
+        ~Writer();
+
+        Writer(const Writer&) = delete;             /// Copy constructor deleted
+        Writer& operator=(const Writer&) = delete;  /// Copy assignment deleted
+
+        /**
+         * @brief Open (creating if needed) the journal in dir and continue
+         *        after its last valid record; a torn tail is cut off.
+         * @return 0, or -1 with errno set
+         */
+        int open(const std::string &dir, size_t segment_bytes);
+
+        /**
+         * @brief Queue a record for the next commit().
+         * @return The LSN assigned to it
+         */
+        uint64_t append(Record r);
+
+        /**
+         * @brief Write the queued records and fdatasync them.
+         * @return 0, or -1 with errno set (the journal can no longer be trusted)
+         */
+        int commit();
+
+        /// @brief Last LSN known to be on disk (0 if none); readable from any thread.
+        uint64_t durable_lsn() const { return durable_.load(std::memory_order_acquire); }
+
+        /// @brief Bytes of a torn tail cut off by open().
+        uint64_t truncated() const { return truncated_; }
+
+    private:
+        int open_segment(uint64_t first_lsn);
+        int recover_tail(const SegmentInfo &seg);
+        void open_index(uint64_t first_lsn, const std::vector<IndexEntry> &entries);
+        void index_record(const Record &r, std::vector<IndexEntry> &done);
+        void close_block(std::vector<IndexEntry> &done);
+        void write_index(const std::vector<IndexEntry> &entries);
+
+        std::string dir_;
+        size_t segment_bytes_ = 0;
+        int fd_ = -1;
+        int idx_fd_ = -1;                   ///< Index of the open segment
+        IndexEntry block_{};                ///< Open index block of the open segment
+        uint64_t seg_first_ = 0;            ///< First LSN of the open segment
+        uint64_t seg_count_ = 0;            ///< Records in the open segment
+        uint64_t seg_cap_ = 0;              ///< Records the open segment is sealed at
+        uint64_t next_lsn_ = 1;
+        uint64_t truncated_ = 0;
+        std::vector<Record> pending_;
+        std::atomic<uint64_t> durable_{0};
+    };
+
+    /**
+     * @brief Sequential reader over the segments, from any LSN on.
+     */
+    class Reader {
+    public:
+        Reader() = default;
+        ~Reader();
+
+        Reader(const Reader&) = delete;             /// Copy constructor deleted
+        Reader& operator=(const Reader&) = delete;  /// Copy assignment deleted
+
+        /// @brief Position the reader at from_lsn.
+        void open(const std::string &dir, size_t segment_bytes, uint64_t from_lsn);
+
+        /**
+         * @brief Read the next records, up to max and never past limit.
+         * @details In packed segments LSNs have gaps; next_lsn() moves over them.
+         * @return Records read (0 only when no record is left up to limit), or
+         *         -1 on an I/O error, a missing segment or a bad record
+         */
+        int read(Record *out, size_t max, uint64_t limit);
+
+        /// @brief LSN the next read() starts at.
+        uint64_t next_lsn() const { return next_; }
+
+    private:
+        int locate();
+        int segment_end(const std::vector<SegmentInfo> &segs, const SegmentInfo &seg, uint64_t &end);
+        int read_packed(Record *out, size_t max, uint64_t limit);
+
+        std::string dir_;
+        size_t segment_bytes_ = 0;
+        int fd_ = -1;
+        uint64_t seg_first_ = 0;
+        uint64_t seg_end_ = 0;              ///< First LSN after the open segment
+        uint64_t next_ = 1;
+        PackedSegment packed_;
+        bool in_packed_ = false;            ///< The open segment is packed_
+        size_t frame_ = 0;                  ///< Next frame of packed_ to decompress
+        std::vector<Record> frame_recs_;    ///< Records of the last decompressed frame
+        size_t frame_pos_ = 0;              ///< Next of them to return
+    };
+}
+
+#endif // JOURNAL_H
@@ -0,0 +1,302 @@
+#include "journal.h"
+#include "config.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * @file journal_scan.cpp
+ * @brief journal-scan: print the journaled events of a time window and/or
+ *        one device, e.g. "what did device 1610 send between 10:00 and 10:05".
+ *
+ * For every segment the sparse index (journal.h) is binary searched for the
+ * blocks whose event time range overlaps the window, and only those record
+ * ranges are mapped; in packed segments only those frames are decompressed.
+ * A device-only query has no time bound and reads every block. Events are
+ * printed in event time order.
+ *
+ * Usage: journal-scan [--dir DIR] [--from TIME] [--to TIME] [--device ID] [--stats]
+ *   TIME is "YYYY-MM-DD HH:MM[:SS]" or "HH:MM[:SS]" (today), local time.
+ *   --from is inclusive, --to exclusive.
+ */
+
+namespace
+{
+    struct Query {
+        uint64_t from_ms = 0;
+        uint64_t to_ms = UINT64_MAX;
+        int device = -1;                ///< -1: any device
+    };
+
+    struct ScanStats {
+        size_t segments = 0;
+        uint64_t blocks = 0;            ///< Index blocks (plus unindexed tails) in the journal
+        uint64_t blocks_read = 0;
+        uint64_t bytes_read = 0;        ///< Mapped, or compressed bytes of packed frames
+    };
+
+    /**
+     * @brief Parse a local time argument.
+     * @return true and out = Unix time in ms, or false if it is malformed
+     */
+    bool parse_time(const char *s, uint64_t &out)
+    {
+        struct tm tm_buf{};
+        int n = 0;
+        if(std::sscanf(s, "%d-%d-%d %d:%d%n", &tm_buf.tm_year, &tm_buf.tm_mon, &tm_buf.tm_mday,
+                       &tm_buf.tm_hour, &tm_buf.tm_min, &n) == 5) {
+            tm_buf.tm_year -= 1900;
+            tm_buf.tm_mon -= 1;
+        } else if(std::sscanf(s, "%d:%d%n", &tm_buf.tm_hour, &tm_buf.tm_min, &n) == 2) {
+            time_t now = time(nullptr);
+            struct tm today;
+            localtime_r(&now, &today);
+            tm_buf.tm_year = today.tm_year;
+            tm_buf.tm_mon = today.tm_mon;
+            tm_buf.tm_mday = today.tm_mday;
+        } else {
+            return false;
+        }
+        s += n;
+        if(*s == ':') {
+            if(std::sscanf(s, ":%d%n", &tm_buf.tm_sec, &n) != 1) return false;
+            s += n;
+        }
+        if(*s != '\0') return false;
+
+        tm_buf.tm_isdst = -1;
+        time_t t = mktime(&tm_buf);
+        if(t == (time_t)-1) return false;
+        out = (uint64_t)t * 1000;
+        return true;
+    }
+
+    void print_record(const journal::Record &r)
+    {
+        time_t sec = (time_t)(r.event_time_ms / 1000);
+        struct tm tm_buf;
+        localtime_r(&sec, &tm_buf);
+        std::printf("%04d-%02d-%02d %02d:%02d:%02d.%03d%s  ID=%u  %-5s  X=%.6f  Y=%.6f  SEQ=%u  v%u  LSN=%llu\n",
+                    tm_buf.tm_year + 1900, tm_buf.tm_mon + 1, tm_buf.tm_mday,
+                    tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec, (int)(r.event_time_ms % 1000),
+                    (r.flags & journal::RECORD_ARRIVAL_TIME) ? " (arrival)" : "", r.device_id, r.status ? "START" : "END", r.x, r.y, r.seq, r.version,
+                    (unsigned long long)r.lsn);
+    }
+
+    bool matches(const journal::Record &r, const Query &q)
+    {
+        return r.event_time_ms >= q.from_ms && r.event_time_ms < q.to_ms &&
+               (q.device < 0 || r.device_id == q.device);
+    }
+
+    /**
+     * @brief Blocks that can hold events of the window.
+     * @details Block i can only match if max_prefix[i] >= from and
+     *          min_suffix[i] < to, and both arrays are sorted, so two binary
+     *          searches bound the candidates before their own ranges are checked.
+     */
+    std::vector<size_t> candidates(const std::vector<journal::IndexEntry> &idx, const Query &q)
+    {
+        size_t n = idx.size();
+        std::vector<uint64_t> max_prefix(n), min_suffix(n);
+        for(size_t i = 0; i < n; i++)
+            max_prefix[i] = std::max(idx[i].max_time_ms, i ? max_prefix[i - 1] : 0);
+        for(size_t i = n; i-- > 0;)
+            min_suffix[i] = std::min(idx[i].min_time_ms, i + 1 < n ? min_suffix[i + 1] : UINT64_MAX);
+        size_t lo = std::lower_bound(max_prefix.begin(), max_prefix.end(), q.from_ms) - max_prefix.begin();
+        size_t hi = std::lower_bound(min_suffix.begin(), min_suffix.end(), q.to_ms) - min_suffix.begin();
+
+        std::vector<size_t> out;
+        for(size_t i = lo; i < hi; i++)
+            if(idx[i].max_time_ms >= q.from_ms && idx[i].min_time_ms < q.to_ms) out.push_back(i);
+        return out;
+    }
+
+    /**
+     * @brief Collect the matching records of a packed segment.
+     * @return 0, or -1 with errno set
+     */
+    int scan_packed(const journal::SegmentInfo &seg, const Query &q,
+                    std::vector<journal::Record> &out, ScanStats &st)
+    {
+        journal::PackedSegment p;
+        if(p.open(seg) < 0) return -1;
+        std::vector<journal::IndexEntry> idx;
+        for(const journal::Frame &f : p.frames()) idx.push_back(f.block);
+
+        std::vector<journal::Record> frame;
+        for(size_t i : candidates(idx, q)) {
+            if(p.read_frame(i, frame) < 0) return -1;
+            st.blocks_read++;
+            st.bytes_read += p.frames()[i].bytes;
+            for(const journal::Record &r : frame)
+                if(matches(r, q)) out.push_back(r);
+        }
+        st.blocks += idx.size();
+        st.segments++;
+        return 0;
+    }
+
+    /**
+     * @brief Map records [first, end) of a segment and collect the matching ones.
+     * @return 0, or -1 with errno set
+     */
+    int read_range(int fd, const journal::SegmentInfo &seg, uint64_t first, uint64_t end,
+                   const Query &q, std::vector<journal::Record> &out, ScanStats &st)
+    {
+        static const off_t page = sysconf(_SC_PAGESIZE);
+        off_t begin = (off_t)(sizeof(journal::SegmentHeader) + first * sizeof(journal::Record));
+        off_t start = begin - begin % page;
+        size_t len = (size_t)(begin - start) + (size_t)(end - first) * sizeof(journal::Record);
+
+        void *p = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, start);
+        if(p == MAP_FAILED) return -1;
+        madvise(p, len, MADV_SEQUENTIAL);
+        st.bytes_read += len;
+
+        const journal::Record *rec = (const journal::Record *)((const char *)p + (begin - start));
+        for(uint64_t i = 0; i < end - first; i++) {
+            const journal::Record &r = rec[i];
+            if(matches(r, q) && r.lsn == seg.first_lsn + first + i && journal::valid(r))    // not a torn or unwritten tail
+                out.push_back(r);
+        }
+        munmap(p, len);
+        return 0;
+    }
+
+    /**
+     * @brief Collect the matching records of one segment.
+     * @return 0, or -1 with errno set
+     */
+    int scan_segment(const journal::SegmentInfo &seg, const Query &q,
+                     std::vector<journal::Record> &out, ScanStats &st)
+    {
+        if(seg.packed) return scan_packed(seg, q, out, st);
+
+        int fd = ::open(seg.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0) return -1;
+        struct stat sb;
+        if(fstat(fd, &sb) < 0) { close(fd); return -1; }
+        uint64_t records = sb.st_size > (off_t)sizeof(journal::SegmentHeader)
+                         ? (uint64_t)(sb.st_size - sizeof(journal::SegmentHeader)) / sizeof(journal::Record) : 0;
+
+        std::vector<journal::IndexEntry> idx;
+        if(journal::load_index(seg, records, idx) < 0) { close(fd); return -1; }
+
+        /// @brief Ranges of overlapping blocks, coalesced; the unindexed tail is always read.
+        std::vector<std::pair<uint64_t,uint64_t>> ranges;
+        auto add = [&](uint64_t first, uint64_t end) {
+            st.blocks_read++;
+            if(!ranges.empty() && ranges.back().second == first) ranges.back().second = end;
+            else ranges.emplace_back(first, end);
+        };
+        for(size_t i : candidates(idx, q))
+            add(idx[i].first_lsn - seg.first_lsn, idx[i].first_lsn - seg.first_lsn + idx[i].records);
+        uint64_t covered = idx.empty() ? 0 : idx.back().first_lsn - seg.first_lsn + idx.back().records;
+        st.blocks += idx.size();
+        if(covered < records) {
+            st.blocks++;
+            add(covered, records);
+        }
+
+        for(const auto &r : ranges) {
+            if(read_range(fd, seg, r.first, r.second, q, out, st) < 0) {
+                int e = errno;
+                close(fd);
+                errno = e;
+                return -1;
+            }
+        }
+        close(fd);
+        st.segments++;
+        return 0;
+    }
+
+    void usage()
+    {
+        std::fprintf(stderr,
+            "Usage: journal-scan [--dir DIR] [--from TIME] [--to TIME] [--device ID] [--stats]\n"
+            "  TIME: \"YYYY-MM-DD HH:MM[:SS]\" or \"HH:MM[:SS]\" (today), local time\n"
+            "  --from is inclusive, --to exclusive; default DIR is %s\n", JOURNAL_DIR);
+    }
+}
+
+/**
+ * @brief Entry point of journal-scan.
+ * @return 0 on success, 1 on bad arguments, 2 if the journal cannot be read
+ */
+int main(int argc, char **argv)
+{
+    std::string dir = JOURNAL_DIR;
+    Query q;
+    bool stats = false;
+
+    for(int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if(!std::strcmp(argv[i], "--dir") && has_value) {
+            dir = argv[++i];
+        } else if(!std::strcmp(argv[i], "--from") && has_value) {
+            if(!parse_time(argv[++i], q.from_ms)) { usage(); return 1; }
+        } else if(!std::strcmp(argv[i], "--to") && has_value) {
+            if(!parse_time(argv[++i], q.to_ms)) { usage(); return 1; }
+        } else if(!std::strcmp(argv[i], "--device") && has_value) {
+            char *end = nullptr;
+            long d = std::strtol(argv[++i], &end, 10);
+            if(*end != '\0' || d < 0 || d > 0xFFFF) { usage(); return 1; }
+            q.device = (int)d;
+        } else if(!std::strcmp(argv[i], "--stats")) {
+            stats = true;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    /// @brief A segment packed by the server while it is scanned disappears; scan again.
+    std::vector<journal::Record> found;
+    ScanStats st;
+    for(int attempt = 0;; attempt++) {
+        found.clear();
+        st = ScanStats();
+        int rc = 0;
+        std::string failed;
+        for(const journal::SegmentInfo &seg : journal::list_segments(dir)) {
+            rc = scan_segment(seg, q, found, st);
+            if(rc < 0) {
+                failed = seg.path;
+                break;
+            }
+        }
+        if(rc == 0) break;
+        if(errno != ENOENT || attempt == 2) {
+            std::fprintf(stderr, "[ERROR] %s: %s\n", failed.c_str(), std::strerror(errno));
+            return 2;
+        }
+    }
+
+    std::sort(found.begin(), found.end(), [](const journal::Record &a, const journal::Record &b) {
+        return a.event_time_ms != b.event_time_ms ? a.event_time_ms < b.event_time_ms : a.lsn < b.lsn;
+    });
+    for(const journal::Record &r : found) print_record(r);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if(stats) {
+        double ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+        std::fprintf(stderr, "%zu events, %zu segments, %llu of %llu blocks read, %llu KB read, %.1f ms\n",
+                     found.size(), st.segments, (unsigned long long)st.blocks_read,
+                     (unsigned long long)st.blocks, (unsigned long long)(st.bytes_read / 1024), ms);
+    }
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include "journal.h"
+#include "codec.h"
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * @file journal_test.cpp
+ * @brief journal-test: round trips of the codec and of the packed frame
+ *        layout (pack_rows()/unpack_rows()), the two steps compact() relies
+ *        on to rebuild a segment's records.
+ *
+ * Usage: journal-test (exit status 1 if a check failed); "make test" runs it.
+ */
+
+static int checks = 0, failures = 0;
+
+static void check(bool ok, const std::string &what)
+{
+    checks++;
+    if(!ok) {
+        failures++;
+        printf("FAIL %s\n", what.c_str());
+    }
+}
+
+/// @brief Compress and decompress src; also check that a wrong size or a cut input is refused.
+static void round_trip(const std::vector<uint8_t> &src, const std::string &what)
+{
+    std::vector<uint8_t> packed(codec::compress_bound(src.size()));
+    size_t bytes = codec::compress(src.data(), src.size(), packed.data());
+    check(bytes <= packed.size(), what + ": within compress_bound");
+
+    std::vector<uint8_t> out(src.size() + 1);
+    check(codec::decompress(packed.data(), bytes, out.data(), src.size()) == 0 &&
+          memcmp(out.data(), src.data(), src.size()) == 0, what + ": decodes to the input");
+    check(codec::decompress(packed.data(), bytes, out.data(), src.size() + 1) < 0,
+          what + ": a longer size is refused");
+    if(bytes > 1)
+        check(codec::decompress(packed.data(), bytes - 1, out.data(), src.size()) < 0,
+              what + ": a cut input is refused");
+}
+
+static void test_codec()
+{
+    std::mt19937 rng(1);
+    auto random_bytes = [&](size_t n) {
+        std::vector<uint8_t> v(n);
+        for(uint8_t &b : v) b = (uint8_t)rng();
+        return v;
+    };
+
+    round_trip({}, "empty");
+    /// @brief Up to and just past MF_LIMIT (12): all literals, then the first match.
+    for(size_t n = 1; n <= 20; n++) {
+        round_trip(random_bytes(n), "random " + std::to_string(n));
+        round_trip(std::vector<uint8_t>(n, 'a'), "run " + std::to_string(n));
+    }
+    /// @brief Lengths that need 255-byte extension bytes, for literals and matches.
+    for(size_t n : {270, 271, 272, 525, 526, 70000}) {
+        round_trip(std::vector<uint8_t>(n, 0), "run " + std::to_string(n));
+        round_trip(random_bytes(n), "random " + std::to_string(n));
+    }
+    round_trip(random_bytes(1 << 20), "incompressible 1 MB");
+
+    /// @brief Offsets shorter than the match: the decoder copies bytes it just wrote.
+    for(size_t period : {1, 2, 3, 7, 16}) {
+        std::vector<uint8_t> v = random_bytes(period);
+        while(v.size() < 5000) v.push_back(v[v.size() - period]);
+        round_trip(v, "period " + std::to_string(period));
+    }
+
+    /// @brief A block repeated at the largest offset and just past it.
+    for(size_t gap : {65535 - 64, 65536 - 64}) {
+        std::vector<uint8_t> head = random_bytes(64);
+        std::vector<uint8_t> v = head;
+        std::vector<uint8_t> mid = random_bytes(gap);
+        v.insert(v.end(), mid.begin(), mid.end());
+        v.insert(v.end(), head.begin(), head.end());
+        v.resize(v.size() + 32, 0);
+        round_trip(v, "offset " + std::to_string(gap + 64));
+    }
+}
+
+static void test_pack_rows()
+{
+    std::mt19937_64 rng(2);
+    for(size_t n : {1u, 2u, 1000u, journal::INDEX_EVERY}) {
+        std::vector<journal::Record> recs(n);
+        uint64_t lsn = 1000, t = 1700000000000ull;
+        for(journal::Record &r : recs) {
+            memset(&r, 0, sizeof(r));
+            lsn += 1 + rng() % 3;                       // gaps left by dropped pairs
+            r.lsn = lsn;
+            /// @brief Late spooled events go back in time: the delta wraps.
+            t = rng() % 8 == 0 ? t - rng() % 3600000 : t + rng() % 5000;
+            r.event_time_ms = t;
+            r.x = 45.0 + (double)(rng() % 1000) / 1000.0;
+            r.y = 19.0 + (double)(rng() % 1000) / 1000.0;
+            r.seq = (uint32_t)rng();
+            r.device_id = (uint16_t)(rng() % 5000);
+            r.status = (uint16_t)(rng() % 2);
+            r.version = (uint8_t)(1 + rng() % 2);
+            r.flags = rng() % 4 == 0 ? journal::RECORD_ARRIVAL_TIME : 0;
+            r.epoch = (uint16_t)rng();
+            journal::seal(r);
+        }
+        const std::string what = std::to_string(n) + " records";
+
+        std::vector<uint8_t> cols(n * journal::PACKED_ROW);
+        journal::pack_rows(recs.data(), n, cols.data());
+        std::vector<journal::Record> out(n);
+        journal::unpack_rows(cols.data(), n, out.data());
+        check(memcmp(out.data(), recs.data(), n * sizeof(journal::Record)) == 0, what + ": unpack_rows(pack_rows())");
+
+        /// @brief The whole frame path of compact() and PackedSegment::read_frame().
+        std::vector<uint8_t> packed(codec::compress_bound(cols.size())), back(cols.size());
+        size_t bytes = codec::compress(cols.data(), cols.size(), packed.data());
+        std::fill(out.begin(), out.end(), journal::Record());
+        check(codec::decompress(packed.data(), bytes, back.data(), back.size()) == 0, what + ": frame decodes");
+        journal::unpack_rows(back.data(), n, out.data());
+        bool valid = true;
+        for(const journal::Record &r : out) valid = valid && journal::valid(r);
+        check(valid && memcmp(out.data(), recs.data(), n * sizeof(journal::Record)) == 0, what + ": frame round trip");
+    }
+}
+
+int main()
+{
+    test_codec();
+    test_pack_rows();
+    printf("%d checks, %d failed\n", checks, failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,90 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/**
+ * @file probes.h
+ * @brief USDT (SystemTap SDT) static probe points of the server.
+ *
+ * When <sys/sdt.h> is available (package systemtap-sdt-dev) every probe
+ * compiles to a single nop plus an ELF note, so it costs nothing until a
+ * tracer such as bpftrace attaches to it:
+ *
+ *     bpftrace -l 'usdt:./server:parking:*'
+ *
+ * Without the header, or when built with -DPARKING_NO_USDT (make USDT=0),
+ * the probes expand to nothing. Example scripts live in bpftrace/.
+ */
+
+#if defined(__has_include) && !defined(PARKING_NO_USDT)
+#  if __has_include(<sys/sdt.h>)
+#    include <sys/sdt.h>
+#    define PARKING_USDT 1
+#  endif
+#endif
+
+/// @brief Statement identifiers passed to the sql_step probes.
+enum SqlProbeStmt {
+    SQL_PROBE_FIND_CITY = 1,
+    SQL_PROBE_CHECK_OPEN,
+    SQL_PROBE_INSERT_OPEN,
+    SQL_PROBE_FIND_OPEN,
+    SQL_PROBE_MINUTES,          ///< Unused: the duration is computed in SessionStore::apply()
+    SQL_PROBE_PRICE,
+    SQL_PROBE_UPDATE_CLOSE
+};
+
+/// @brief Kinds of maintenance step passed to the maintenance_step probe.
+enum MaintenanceStep {
+    MAINT_ARCHIVE = 1,          ///< Sessions moved to a month archive
+    MAINT_PURGE,                ///< Expired sessions deleted (or an archive month dropped)
+    MAINT_VACUUM                ///< Free pages returned to the file system
+};
+
+#ifdef PARKING_USDT
+
+/// @brief A full frame was read from a client (device_id, status, client fd).
+#define PROBE_FRAME_RECV(dev, status, fd)      DTRACE_PROBE3(parking, frame_recv, dev, status, fd)
+/// @brief Coordinates resolved to a city (device_id, city_code; 0 = unknown).
+#define PROBE_CITY_RESOLVED(dev, city)         DTRACE_PROBE2(parking, city_resolved, dev, city)
+/// @brief New parking session inserted (device_id, city_code).
+#define PROBE_SESSION_OPENED(dev, city)        DTRACE_PROBE2(parking, session_opened, dev, city)
+/// @brief Parking session closed (device_id, minutes, fee in agorot).
+#define PROBE_SESSION_CLOSED(dev, min, cents)  DTRACE_PROBE3(parking, session_closed, dev, min, cents)
+/// @brief Price update from prices.txt started.
+#define PROBE_PRICE_RELOAD_START()             DTRACE_PROBE(parking, price_reload_start)
+/// @brief Price cache reloaded from shared memory (number of prices).
+#define PROBE_PRICE_RELOAD(count)              DTRACE_PROBE1(parking, price_reload, count)
+/// @brief sqlite3_step about to run (SqlProbeStmt).
+#define PROBE_SQL_STEP_START(stmt)             DTRACE_PROBE1(parking, sql_step_start, stmt)
+/// @brief sqlite3_step returned (SqlProbeStmt, result code).
+#define PROBE_SQL_STEP_DONE(stmt, rc)          DTRACE_PROBE2(parking, sql_step_done, stmt, rc)
+/// @brief Materializer transaction rolled back, retried after a wait (result code, attempt, wait ms).
+#define PROBE_SQL_RETRY(rc, attempt, ms)       DTRACE_PROBE3(parking, sql_retry, rc, attempt, ms)
+/// @brief Journal record written to the dead-letter file (LSN, result code).
+#define PROBE_DEAD_LETTER(lsn, rc)             DTRACE_PROBE2(parking, dead_letter, lsn, rc)
+/// @brief Maintenance step done between batches (MaintenanceStep, sessions or pages, duration us, journal backlog).
+#define PROBE_MAINTENANCE_STEP(kind, n, us, backlog) DTRACE_PROBE4(parking, maintenance_step, kind, n, us, backlog)
+/// @brief Retention pass progress (next id, highest id of the pass, sessions deleted in the pass).
+#define PROBE_RETENTION_PROGRESS(next, end, rows) DTRACE_PROBE3(parking, retention_progress, next, end, rows)
+/// @brief Incremental vacuum step (pages freed, free pages left).
+#define PROBE_VACUUM(freed, left)              DTRACE_PROBE2(parking, vacuum, freed, left)
+
+#else
+
+#define PROBE_FRAME_RECV(dev, status, fd)      do {} while (0)
+#define PROBE_CITY_RESOLVED(dev, city)         do {} while (0)
+#define PROBE_SESSION_OPENED(dev, city)        do {} while (0)
+#define PROBE_SESSION_CLOSED(dev, min, cents)  do {} while (0)
+#define PROBE_PRICE_RELOAD_START()             do {} while (0)
+#define PROBE_PRICE_RELOAD(count)              do {} while (0)
+#define PROBE_SQL_STEP_START(stmt)             do {} while (0)
+#define PROBE_SQL_STEP_DONE(stmt, rc)          do {} while (0)
+#define PROBE_SQL_RETRY(rc, attempt, ms)       do {} while (0)
+#define PROBE_DEAD_LETTER(lsn, rc)             do {} while (0)
+#define PROBE_MAINTENANCE_STEP(kind, n, us, backlog) do {} while (0)
+#define PROBE_RETENTION_PROGRESS(next, end, rows) do {} while (0)
+#define PROBE_VACUUM(freed, left)              do {} while (0)
+
+#endif
+
+#endif // PROBES_H
@@ -0,0 +1,320 @@
+#include "replay.h"
+#include "journal.h"
+#include "session_store.h"
+#include "stmt_handle.h"
+#include "utils.h"
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+namespace
+{
+    using sessions::Prices;
+    using sessions::Key;
+    using sessions::KeyHash;
+    using sessions::sql_seconds;
+    using sessions::load_prices;
+
+    struct Session;
+
+    /// @brief Session row to insert, closed already if its END is in the same chunk.
+    struct Row {
+        uint64_t lsn;               ///< LSN of the START: insert order
+        uint16_t device;
+        int city;
+        double x;
+        double y;
+        std::string created_at;
+        int status = 1;
+        int minutes = 0;
+        double fee = 0.0;
+        std::string ended_at;       ///< Empty while open
+        Session *session = nullptr; ///< Still open at the end of the chunk: gets the rowid
+    };
+
+    /// @brief Close of a session inserted by an earlier chunk or before the replay.
+    struct Update {
+        int64_t rowid;
+        int minutes;
+        double fee;
+        std::string ended_at;
+    };
+
+    /// @brief An open session.
+    struct Session {
+        int64_t rowid = 0;          ///< 0 while its row is pending in the current chunk
+        size_t row = 0;             ///< Index in Partition::rows while pending
+        int64_t created_s = 0;      ///< created_at in seconds, as strftime('%s') reads it
+        bool has_time = false;      ///< created_at could be parsed
+    };
+
+    /**
+     * @brief The devices of one worker and their open sessions.
+     */
+    struct Partition {
+        std::unordered_map<Key, Session, KeyHash> open;
+        std::vector<Row> rows;          ///< This chunk's inserts, in LSN order
+        std::vector<Update> updates;    ///< This chunk's closes of older rows
+        replay::Stats stats;
+
+        /// @brief Pair this partition's records of a chunk.
+        void pair(const journal::Record *recs, size_t n, unsigned index, unsigned count,
+                  const Prices &prices) {
+            rows.clear();
+            updates.clear();
+            for(size_t i = 0; i < n; i++)
+                if(recs[i].device_id % count == index) apply(recs[i], prices);
+        }
+
+        /// @brief SessionStore::apply() on the in-memory sessions.
+        void apply(const journal::Record &r, const Prices &prices) {
+            int city = prices.city_at(r.x, r.y);
+            Key k = sessions::key_of(r, city);
+            stats.records++;
+
+            if(r.status == 1) {
+                if(open.count(k)) {
+                    stats.already_open++;
+                    return;
+                }
+                Row row;
+                row.lsn = r.lsn;
+                row.device = r.device_id;
+                row.city = city;
+                row.x = r.x;
+                row.y = r.y;
+                row.created_at = utils::local_time_from_ms(r.event_time_ms);
+
+                Session s;
+                s.row = rows.size();
+                s.has_time = sql_seconds(row.created_at.c_str(), s.created_s);
+                row.session = &open.emplace(k, s).first->second;
+                rows.push_back(std::move(row));
+                stats.opened++;
+            } else if(r.status == 0) {
+                auto it = open.find(k);
+                if(it == open.end()) {
+                    stats.unmatched++;
+                    return;
+                }
+                Session &s = it->second;
+                std::string ended_at = utils::local_time_from_ms(r.event_time_ms);
+                int64_t ended_s = 0;
+                int minutes = 0;
+                if(s.has_time && sql_seconds(ended_at.c_str(), ended_s))
+                    minutes = (int)((ended_s - s.created_s) / 60);
+                double fee = std::round(prices.hourly(city) * minutes / 60.0 * 100.0) / 100.0;
+
+                if(s.rowid == 0) {
+                    Row &row = rows[s.row];
+                    row.status = 0;
+                    row.minutes = minutes;
+                    row.fee = fee;
+                    row.ended_at = std::move(ended_at);
+                    row.session = nullptr;
+                } else {
+                    updates.push_back({s.rowid, minutes, fee, std::move(ended_at)});
+                }
+                open.erase(it);
+                stats.closed++;
+            }
+        }
+    };
+
+    /**
+     * @brief Hand the sessions open in customer_data to the partitions of their devices.
+     * @details Rows are read oldest first so the newest of duplicates wins,
+     *          like the ORDER BY created_at DESC of the sqlite store's find_open().
+     */
+    int load_open_sessions(sqlite3 *db, std::vector<Partition> &parts)
+    {
+        StmtHandle q;
+        int rc = sqlite3_prepare_v2(db,
+            "SELECT id, customer_id, city_code, gps_lat, gps_lng, created_at FROM customer_data "
+            "WHERE status=1 ORDER BY created_at, id;", -1, &q.stmt, nullptr);
+        if(rc != SQLITE_OK) return rc;
+
+        while((rc = sqlite3_step(q.stmt)) == SQLITE_ROW) {
+            const char *customer = (const char*)sqlite3_column_text(q.stmt, 1);
+            unsigned dev;
+            char canon[16];
+            if(!customer || sscanf(customer, "%u", &dev) != 1 || dev > 0xFFFF) continue;
+            snprintf(canon, sizeof(canon), "%u", dev);
+            if(strcmp(canon, customer) != 0) continue;      // never matched by an event
+
+            Key k{(uint16_t)dev, sqlite3_column_int(q.stmt, 2),
+                  std::lround(sqlite3_column_double(q.stmt, 3) * 1000.0),
+                  std::lround(sqlite3_column_double(q.stmt, 4) * 1000.0)};
+            Session s;
+            s.rowid = sqlite3_column_int64(q.stmt, 0);
+            s.has_time = sql_seconds((const char*)sqlite3_column_text(q.stmt, 5), s.created_s);
+            parts[dev % parts.size()].open[k] = s;
+        }
+        return rc == SQLITE_DONE ? SQLITE_OK : rc;
+    }
+
+    /// @brief Statements of the apply step.
+    struct Writer {
+        StmtHandle insert;
+        StmtHandle close;
+        StmtHandle applied;
+
+        int prepare(sqlite3 *db) {
+            int rc = sqlite3_prepare_v2(db,
+                "INSERT INTO customer_data (customer_id, city_code, gps_lat, gps_lng, status, "
+                "parking_duration_minutes, ticket_fee, created_at, ended_at) "
+                "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9);", -1, &insert.stmt, nullptr);
+            if(rc != SQLITE_OK) return rc;
+            rc = sqlite3_prepare_v2(db,
+                "UPDATE customer_data SET status=0, parking_duration_minutes=?1, ticket_fee=?2, ended_at=?3 "
+                "WHERE rowid=?4;", -1, &close.stmt, nullptr);
+            if(rc != SQLITE_OK) return rc;
+            return sqlite3_prepare_v2(db, "UPDATE journal_state SET applied_lsn=?1 WHERE id=0;", -1,
+                                      &applied.stmt, nullptr);
+        }
+    };
+
+    /**
+     * @brief Write one chunk: closes of older rows, new rows in LSN order,
+     *        sequence windows and applied_lsn, all in one transaction.
+     */
+    int apply_chunk(sqlite3 *db, Writer &w, std::vector<Partition> &parts, dedup::SeqFilter &windows,
+                    uint64_t last_lsn)
+    {
+        int rc = sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+        if(rc != SQLITE_OK) return rc;
+
+        for(Partition &p : parts) {
+            for(const Update &u : p.updates) {
+                sqlite3_reset(w.close.stmt);
+                sqlite3_bind_int(w.close.stmt, 1, u.minutes);
+                sqlite3_bind_double(w.close.stmt, 2, u.fee);
+                sqlite3_bind_text(w.close.stmt, 3, u.ended_at.c_str(), -1, SQLITE_STATIC);
+                sqlite3_bind_int64(w.close.stmt, 4, u.rowid);
+                rc = sqlite3_step(w.close.stmt);
+                if(rc != SQLITE_DONE) goto fail;
+            }
+        }
+
+        {
+            std::vector<Row*> rows;
+            for(Partition &p : parts)
+                for(Row &r : p.rows) rows.push_back(&r);
+            std::sort(rows.begin(), rows.end(), [](const Row *a, const Row *b) { return a->lsn < b->lsn; });
+
+            char customer_id[16];
+            for(Row *r : rows) {
+                snprintf(customer_id, sizeof(customer_id), "%u", (unsigned)r->device);
+                sqlite3_reset(w.insert.stmt);
+                sqlite3_bind_text(w.insert.stmt, 1, customer_id, -1, SQLITE_TRANSIENT);
+                sqlite3_bind_int(w.insert.stmt, 2, r->city);
+                sqlite3_bind_double(w.insert.stmt, 3, r->x);
+                sqlite3_bind_double(w.insert.stmt, 4, r->y);
+                sqlite3_bind_int(w.insert.stmt, 5, r->status);
+                sqlite3_bind_int(w.insert.stmt, 6, r->minutes);
+                sqlite3_bind_double(w.insert.stmt, 7, r->fee);
+                sqlite3_bind_text(w.insert.stmt, 8, r->created_at.c_str(), -1, SQLITE_STATIC);
+                if(r->status == 0)
+                    sqlite3_bind_text(w.insert.stmt, 9, r->ended_at.c_str(), -1, SQLITE_STATIC);
+                else
+                    sqlite3_bind_null(w.insert.stmt, 9);
+                rc = sqlite3_step(w.insert.stmt);
+                if(rc != SQLITE_DONE) goto fail;
+                if(r->session) r->session->rowid = sqlite3_last_insert_rowid(db);
+            }
+        }
+
+        rc = windows.flush(db);
+        if(rc != SQLITE_OK) goto fail;
+        sqlite3_reset(w.applied.stmt);
+        sqlite3_bind_int64(w.applied.stmt, 1, (sqlite3_int64)last_lsn);
+        rc = sqlite3_step(w.applied.stmt);
+        if(rc != SQLITE_DONE) goto fail;
+
+        rc = sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+        if(rc != SQLITE_OK) goto fail;
+        windows.committed();
+        return SQLITE_OK;
+
+    fail:
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return rc;
+    }
+}
+
+namespace replay
+{
+    int run(sqlite3 *db, const Options &opt, dedup::SeqFilter &windows,
+            const std::function<void(const Progress&)> &progress, Stats &stats)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        auto elapsed = [&] {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        };
+        stats = Stats();
+        stats.applied_lsn = opt.from_lsn - 1;
+
+        Prices prices;
+        prices.overrides = opt.price_overrides;
+        int rc = load_prices(db, prices);
+        if(rc != SQLITE_OK) return rc;
+
+        const unsigned nparts = opt.threads > 0 ? opt.threads : 1;
+        std::vector<Partition> parts(nparts);
+        rc = load_open_sessions(db, parts);
+        if(rc != SQLITE_OK) return rc;
+
+        Writer w;
+        rc = w.prepare(db);
+        if(rc != SQLITE_OK) return rc;
+
+        journal::Reader reader;
+        reader.open(opt.dir, opt.segment_bytes, opt.from_lsn);
+        std::vector<journal::Record> recs(opt.chunk_records > 0 ? opt.chunk_records : 1);
+        const uint64_t total = opt.to_lsn >= opt.from_lsn ? opt.to_lsn - opt.from_lsn + 1 : 0;
+        uint64_t applied = 0;
+
+        while(reader.next_lsn() <= opt.to_lsn) {
+            int n = reader.read(recs.data(), recs.size(), opt.to_lsn);
+            if(n <= 0) {
+                rc = SQLITE_IOERR;
+                break;
+            }
+
+            /// @brief Workers pair their devices while this thread advances the sequence windows.
+            std::vector<std::thread> workers;
+            for(unsigned k = 0; k < nparts; k++)
+                workers.emplace_back([&, k] { parts[k].pair(recs.data(), (size_t)n, k, nparts, prices); });
+            for(int i = 0; i < n; i++)
+                if(recs[i].seq) (void)windows.check(recs[i].device_id, recs[i].seq, recs[i].epoch);
+            for(std::thread &t : workers) t.join();
+
+            rc = apply_chunk(db, w, parts, windows, recs[n - 1].lsn);
+            if(rc != SQLITE_OK) break;
+
+            /// @brief Totals of the committed chunks only: the partitions also counted a rolled-back one.
+            Stats done;
+            done.applied_lsn = recs[n - 1].lsn;
+            for(const Partition &p : parts) {
+                done.records += p.stats.records;
+                done.opened += p.stats.opened;
+                done.closed += p.stats.closed;
+                done.already_open += p.stats.already_open;
+                done.unmatched += p.stats.unmatched;
+            }
+            stats = done;
+
+            applied += (uint64_t)n;
+            if(progress) progress({applied, total, elapsed()});
+        }
+
+        stats.seconds = elapsed();
+        return rc;
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <functional>
+#include <unordered_map>
+#include "sqlite3.h"
+#include "dedup.h"
+
+/**
+ * @file replay.h
+ * @brief Parallel crash-recovery replay of the event journal into SQLite.
+ *
+ * Applying a large journal backlog one event at a time costs several SQL
+ * lookups per event. Replay instead loads the prices and the open sessions
+ * once and partitions the records by device id across worker threads.
+ * Sessions belong to one device, so each worker pairs its devices' START
+ * and END events in memory exactly as SessionStore::apply() would. The
+ * main thread writes the results of every chunk in one transaction: rows
+ * are inserted in journal order, so they get the same ids a sequential run
+ * would give, and a session opened and closed within the chunk is written
+ * once, already closed. Each transaction also stores the sequence windows
+ * and the new applied_lsn, so an interrupted replay resumes at the last
+ * committed chunk.
+ */
+namespace replay
+{
+    /// @brief What to replay and how.
+    struct Options {
+        std::string dir;                    ///< Journal directory
+        size_t segment_bytes = 0;           ///< Journal segment size
+        uint64_t from_lsn = 1;              ///< First record to apply
+        uint64_t to_lsn = 0;                ///< Last record to apply
+        unsigned threads = 1;               ///< Worker threads (device partitions)
+        size_t chunk_records = 1;           ///< Records per transaction
+        const std::unordered_map<int,double> *price_overrides = nullptr;  ///< Prices from shared memory
+    };
+
+    /// @brief Progress after a committed chunk.
+    struct Progress {
+        uint64_t applied;                   ///< Records applied so far
+        uint64_t total;                     ///< Records to apply
+        double seconds;                     ///< Time since the replay started
+    };
+
+    /// @brief Totals of the committed chunks.
+    struct Stats {
+        uint64_t applied_lsn = 0;           ///< Last record committed, from_lsn - 1 if none
+        uint64_t records = 0;
+        uint64_t opened = 0;                ///< Sessions inserted
+        uint64_t closed = 0;                ///< Sessions closed
+        uint64_t already_open = 0;          ///< STARTs that found their session open
+        uint64_t unmatched = 0;             ///< ENDs without an open session
+        double seconds = 0.0;
+    };
+
+    /**
+     * @brief Apply journal records from_lsn..to_lsn to customer_data.
+     * @param db Database; nothing else may use it during the replay
+     * @param opt What to replay
+     * @param windows Sequence windows of the applied events, flushed to ingest_hwm
+     * @param progress Called after every committed chunk
+     * @param stats Totals, also of a replay that failed
+     * @return SQLITE_OK, the SQLite error code, or SQLITE_IOERR if the journal
+     *         cannot be read (errno set); the failing chunk is rolled back and
+     *         a new run() resumes after stats.applied_lsn
+     */
+    int run(sqlite3 *db, const Options &opt, dedup::SeqFilter &windows,
+            const std::function<void(const Progress&)> &progress, Stats &stats);
+}
+
+#endif // REPLAY_H
@@ -0,0 +1,116 @@
+#include "retention.h"
+#include "archive.h"
+#include <cerrno>
+#include <unistd.h>
+
+namespace
+{
+    /// @brief Sessions expired at ?1: closed before it, with a well-formed ended_at.
+    const char *const EXPIRED =
+        "status=0 AND ended_at < ?1 AND ended_at GLOB '[0-9][0-9][0-9][0-9]-[0-9][0-9]-*'";
+}
+
+namespace retention
+{
+    Purger::Purger(sqlite3 *db, const std::string &dir) : db_(db), dir_(dir) {}
+
+    Purger::~Purger()
+    {
+        sqlite3_finalize(bound_);
+        sqlite3_finalize(remove_);
+    }
+
+    int Purger::start(const std::string &cutoff)
+    {
+        months_.clear();
+        const std::string month = cutoff.substr(0, 7);
+        for(const std::string &m : archive::list_months(dir_))
+            if(m < month) months_.push_back(m);
+
+        sqlite3_stmt *s = nullptr;
+        int rc = sqlite3_prepare_v2(db_, "SELECT MIN(id), MAX(id) FROM main.customer_data;", -1, &s, nullptr);
+        if(rc == SQLITE_OK) rc = sqlite3_step(s);
+        if(rc == SQLITE_ROW) {
+            /// @brief An empty table gives NULLs: next_id_ > end_id_, nothing to walk.
+            first_id_ = next_id_ = sqlite3_column_type(s, 0) == SQLITE_NULL ? 1 : sqlite3_column_int64(s, 0);
+            end_id_ = sqlite3_column_int64(s, 1);
+            rc = SQLITE_OK;
+        }
+        sqlite3_finalize(s);
+        if(rc == SQLITE_OK) pass_ = true;
+        return rc;
+    }
+
+    int Purger::drop(const std::string &month)
+    {
+        const std::string path = archive::month_path(dir_, month);
+        if(unlink(path.c_str()) < 0 && errno != ENOENT) return SQLITE_IOERR_DELETE;
+        for(const char *suffix : {"-wal", "-shm", "-journal"})
+            unlink((path + suffix).c_str());
+        return SQLITE_OK;
+    }
+
+    int Purger::step(const std::string &cutoff, long chunk_rows, Step &out)
+    {
+        out = Step();
+        int rc;
+        if(!remove_) {
+            rc = sqlite3_prepare_v2(db_,
+                "SELECT id FROM main.customer_data WHERE id >= ?1 ORDER BY id LIMIT 1 OFFSET ?2;",
+                -1, &bound_, nullptr);
+            if(rc != SQLITE_OK) return rc;
+            std::string sql = std::string("DELETE FROM main.customer_data WHERE id BETWEEN ?2 AND ?3 AND ") +
+                              EXPIRED + ";";
+            rc = sqlite3_prepare_v2(db_, sql.c_str(), -1, &remove_, nullptr);
+            if(rc != SQLITE_OK) return rc;
+        }
+
+        if(!pass_) {
+            rc = start(cutoff);
+            if(rc != SQLITE_OK) return rc;
+            out.started = true;
+        }
+
+        if(!months_.empty()) {
+            out.month = months_.front();
+            rc = drop(out.month);
+            months_.erase(months_.begin());
+        } else if(next_id_ <= end_id_) {
+            /// @brief The chunk ends at the chunk_rows-th row from next_id_, so
+            ///        it spans chunk_rows rows however sparse the ids are.
+            sqlite3_int64 hi = end_id_;
+            sqlite3_bind_int64(bound_, 1, next_id_);
+            sqlite3_bind_int64(bound_, 2, chunk_rows - 1);
+            rc = sqlite3_step(bound_);
+            if(rc == SQLITE_ROW && sqlite3_column_int64(bound_, 0) < end_id_) hi = sqlite3_column_int64(bound_, 0);
+            sqlite3_reset(bound_);
+
+            if(rc == SQLITE_ROW || rc == SQLITE_DONE) {
+                sqlite3_bind_text(remove_, 1, cutoff.c_str(), -1, SQLITE_TRANSIENT);
+                sqlite3_bind_int64(remove_, 2, next_id_);
+                sqlite3_bind_int64(remove_, 3, hi);
+                rc = sqlite3_step(remove_);
+                sqlite3_reset(remove_);
+            }
+            if(rc == SQLITE_DONE) {
+                rc = SQLITE_OK;
+                out.rows = (long)sqlite3_changes(db_);
+                next_id_ = hi + 1;
+            }
+        }
+
+        if(rc != SQLITE_OK) {
+            pass_ = false;
+            return rc;
+        }
+        out.next_id = next_id_;
+        out.first_id = first_id_;
+        out.end_id = end_id_;
+        out.months_left = months_.size();
+        if(months_.empty() && next_id_ > end_id_) {
+            pass_ = false;
+            out.done = true;
+        }
+        return SQLITE_OK;
+    }
+}
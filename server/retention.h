@@ -0,0 +1,82 @@
+#ifndef RETENTION_H
+#define RETENTION_H
+
+#include <string>
+#include <vector>
+#include "sqlite3.h"
+
+/**
+ * @file retention.h
+ * @brief Retention of closed sessions: those closed more than
+ *        retention_days ago (storage.h) are deleted from customer_data and
+ *        from the month archives (archive.h).
+ *
+ * A pass walks customer_data by rowid from its lowest to its highest id at
+ * the start of the pass. Each Purger::step() covers the next chunk_rows
+ * rows of that range and deletes the expired ones among them in one short
+ * transaction, so the write lock is held for a bounded time whatever the
+ * size of the table or the number of expired sessions. Sessions opened
+ * during a pass get higher ids and are left to the next one.
+ *
+ * Archive months are dropped whole, one month database per step, once
+ * every session in them has expired: the months before the month of the
+ * cutoff. A month is therefore kept up to a month longer than
+ * retention_days.
+ *
+ * The freed pages go back to the file system with storage::vacuum_step()
+ * when data.db is in auto_vacuum=INCREMENTAL mode.
+ */
+namespace retention
+{
+    /// @brief What one Purger::step() did.
+    struct Step {
+        bool started = false;       ///< This step began a pass
+        bool done = false;          ///< This step ended the pass
+        long rows = 0;              ///< Sessions deleted from customer_data
+        std::string month;          ///< Archive month dropped instead of a chunk, "" if none
+        sqlite3_int64 next_id = 0;  ///< First id of the next chunk
+        sqlite3_int64 first_id = 0; ///< Lowest id of the pass
+        sqlite3_int64 end_id = 0;   ///< Highest id of the pass
+        size_t months_left = 0;     ///< Expired archive months still to drop
+    };
+
+    class Purger {
+    public:
+        /**
+         * @param db data.db, used only by the caller's thread
+         * @param dir Directory of the month archives
+         */
+        Purger(sqlite3 *db, const std::string &dir);
+        ~Purger();
+
+        Purger(const Purger&) = delete;
+        Purger& operator=(const Purger&) = delete;
+
+        /**
+         * @brief Drop one expired archive month, or delete the expired
+         *        sessions among the next chunk_rows rows of customer_data.
+         * @param cutoff Local time as stored in ended_at ("YYYY-MM-DD HH:MM:SS")
+         * @return SQLITE_OK or the SQLite error code; the pass then starts over
+         */
+        int step(const std::string &cutoff, long chunk_rows, Step &out);
+
+        /// @brief A pass is under way: the next step() continues it.
+        bool in_pass() const { return pass_; }
+
+    private:
+        int start(const std::string &cutoff);
+        int drop(const std::string &month);
+
+        sqlite3 *db_;
+        std::string dir_;
+        bool pass_ = false;
+        std::vector<std::string> months_;   ///< Expired months still to drop
+        sqlite3_int64 first_id_ = 0;
+        sqlite3_int64 next_id_ = 0;
+        sqlite3_int64 end_id_ = 0;
+        sqlite3_stmt *bound_ = nullptr;     ///< Last id of a chunk
+        sqlite3_stmt *remove_ = nullptr;
+    };
+}
+
+#endif // RETENTION_H
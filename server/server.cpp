@@ -1,7 +1,12 @@
 #include "server.h"
 #include "config.h"
 #include "utils.h"
-#include "protocol.h"
+#include "parking_protocol.h"
+#include "pp_batch.h"
+#include "pp_ack.h"
+#include "trace.h"
+#include "probes.h"
+#include "replay.h"
 #include <sstream> 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -27,6 +32,9 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <sys/ioctl.h>
 
 /// @brief Shared memory name for inter-process price updates.
 const std::string SHM_NAME = "/prices_shm";
@@ -46,8 +54,8 @@ std::unordered_map<int,double> prices_cache; // מחיר לכל city_code
  * @class SignalHandlerRAII
  * @brief RAII-style signal handler manager.
  * 
- * Handles system signals such as SIGINT, SIGTERM, SIGQUIT, and SIGHUP.
- * Allows safe shutdown and dynamic price update signaling.
+ * Handles system signals such as SIGINT, SIGTERM, SIGQUIT, SIGHUP and SIGUSR1.
+ * Allows safe shutdown, dynamic price update signaling and trace dumps.
  */
 class SignalHandlerRAII {
 public:
@@ -55,10 +63,13 @@ public:
         static std::atomic<bool> stop;
         static std::atomic<int> sig_received;
         static std::atomic<bool> update_prices;
+        static std::atomic<bool> dump_trace;
 
         static void handle(int sig) {
             if(sig == SIGHUP){
                 update_prices.store(true);
+            } else if(sig == SIGUSR1){
+                dump_trace.store(true);
             } else {
                 stop.store(true);
                 sig_received.store(sig);
@@ -75,6 +86,7 @@ public:
             sigaction(SIGTERM, &sa, nullptr);
             sigaction(SIGQUIT, &sa, nullptr);
             sigaction(SIGHUP, &sa, nullptr);
+            sigaction(SIGUSR1, &sa, nullptr);
         }
     };
 
@@ -97,6 +109,16 @@ public:
         SigGuard::update_prices.store(false);
     }
 
+    /// @brief Check if a trace dump (SIGUSR1) was requested.
+    static bool need_dump_trace() {
+        return SigGuard::dump_trace.load();
+    }
+
+    /// @brief Reset the SIGUSR1 trace dump flag.
+    static void reset_dump_trace_flag() {
+        SigGuard::dump_trace.store(false);
+    }
+
 private:
     inline static SigGuard guard{};
 };
@@ -104,6 +126,7 @@ private:
 std::atomic<bool> SignalHandlerRAII::SigGuard::stop{false};
 std::atomic<int> SignalHandlerRAII::SigGuard::sig_received{-1};
 std::atomic<bool> SignalHandlerRAII::SigGuard::update_prices{false};
+std::atomic<bool> SignalHandlerRAII::SigGuard::dump_trace{false};
 
 // --------------------------------------------------------------------------------
 /**
@@ -132,6 +155,15 @@ static double round3(double val)
     return std::round(val * 1000.0) / 1000.0;
 }
 
+/**
+ * @brief Current Unix time in milliseconds.
+ */
+static uint64_t wall_clock_ms()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
 // --------------------------------------------------------------------------------
 /**
  * @brief Write the current prices table from the database into prices.txt.
@@ -226,6 +258,7 @@ static void load_prices_from_shm()
 
     munmap(ptr, SHM_SIZE);
     close(fd);
+    PROBE_PRICE_RELOAD(prices_cache.size());
 }
 
 // --------------------------------------------------------------------------------
@@ -236,6 +269,7 @@ static void load_prices_from_shm()
  */
 static void update_db_from_prices_file(sqlite3* db, std::unordered_map<int,double>& cache)
 {
+    PROBE_PRICE_RELOAD_START();
     std::ifstream f(PRICES_FILE);
     if(!f.is_open()) {
         std::cerr << "[ERR] Cannot open prices file for reading: " << PRICES_FILE << "\n";
@@ -315,6 +349,7 @@ Server::~Server() = default;
  */
 void Server::logf(const char *fmt, ...)
 {
+    std::lock_guard<std::mutex> lock(log_mtx_);
     va_list ap;
     va_start(ap, fmt);
     char mbuf[2048];
@@ -335,6 +370,19 @@ void Server::logf(const char *fmt, ...)
     }
 }
 
+/**
+ * @brief Write the per-thread stage traces to TRACE_FILE and reset the SIGUSR1 flag.
+ */
+void Server::dump_trace()
+{
+    SignalHandlerRAII::reset_dump_trace_flag();
+    long n = trace::dump_chrome_json(TRACE_FILE);
+    if(n < 0)
+        logf("[ERR] Failed to write trace file %s: %s", TRACE_FILE, strerror(errno));
+    else
+        logf("[INFO] Trace dump written to %s (%ld events)", TRACE_FILE, n);
+}
+
 /**
  * @brief Initialize SQLite database connection and schema.
  * @return SQLITE_OK on success, otherwise error code.
@@ -352,11 +400,24 @@ int Server::init_db()
     db_ = std::move(tmp_db);
 
     logf("[INIT] SQLite runtime version: %s", sqlite3_libversion());
+
+    std::string problem, effective;
+    if(!storage::load_config(STORAGE_CONFIG_FILE, storage_, problem))
+        logf("[WARN] %s: %s, using the default", STORAGE_CONFIG_FILE, problem.c_str());
+    rc = storage::apply(db_.db, storage_, effective);
+    if(rc != SQLITE_OK) {
+        logf("[SQL-ERR] Cannot apply storage settings: %s", sqlite3_errmsg(db_.db));
+        return rc;
+    }
+    logf("[INIT] Storage: %s", effective.c_str());
     rc = utils::init_db_schema_and_seed(db_.db);
     if(rc != 0) {
         logf("[SQL-ERR] init_db_schema_and_seed failed");
         return rc;
     }
+    if(storage_.auto_vacuum == "INCREMENTAL" && !storage::incremental_vacuum(db_.db))
+        logf("[WARN] %s was created without auto_vacuum=INCREMENTAL: deleted sessions free pages for reuse "
+             "but the file never shrinks; convert it once with a VACUUM while the server is stopped", DB_FILE);
 
     // Generate prices.txt automatically
     write_prices_file_from_db(db_.db);
@@ -365,77 +426,34 @@ int Server::init_db()
 }
 
 /**
- * @brief Prepare all required SQL statements for efficient reuse.
- * 
- * This function prepares all SQLite statements the server will use frequently,
- * storing them in member variables for fast execution. Statements include insert,
- * update, and select operations for customer and price data.
- * 
+ * @brief Create the session store selected in storage.json and prepare it.
  * @return int SQLITE_OK on success, otherwise the SQLite error code.
  */
-int Server::prepare_statements()
+int Server::open_store()
 {
-    const char *sql_insert_open =
-        "INSERT INTO customer_data "
-        "(customer_id, city_code, gps_lat, gps_lng, status , parking_duration_minutes, ticket_fee, created_at)"
-        "VALUES (?1, ?2, ?3, ?4, 1, 0, 0.0, ?5);";
-
-    const char *sql_check_open =
-        "SELECT rowid FROM customer_data WHERE customer_id=?1 AND city_code=?2 "
-        "AND ABS(gps_lat - ?3)<0.0001 AND ABS(gps_lng - ?4)<0.0001 AND status=1 LIMIT 1;";
-
-    const char *sql_find_open =
-        "SELECT rowid, created_at FROM customer_data WHERE customer_id=?1 AND city_code=?2 "
-        "AND ABS(gps_lat - ?3)<0.0001 AND ABS(gps_lng - ?4)<0.0001 AND status=1 "
-        "ORDER BY created_at DESC LIMIT 1;";
-
-    const char *sql_minutes =
-        "SELECT CAST((strftime('%s','now','localtime') - strftime('%s', ?1)) / 60 AS INTEGER);";
-
-    const char *sql_price =
-        "SELECT price_per_hour FROM prices WHERE city_code=?1 LIMIT 1;";
-
-    const char *sql_update_close =
-        "UPDATE customer_data SET status=0, parking_duration_minutes=?1, ticket_fee=?2, ended_at=?3 "
-        "WHERE rowid=?4;";
-
-    const char *sql_find_city =
-        "SELECT city_code FROM prices WHERE ABS(gps_lat - ?1)<0.0001 "
-        "AND ABS(gps_lng - ?2)<0.0001 LIMIT 1;";
-
-    int rc;
-    rc = sqlite3_prepare_v2(db_.db, sql_insert_open, -1, &stmt_insert_open_.stmt, nullptr);
-    CHECK_SQL(rc, db_.db, "prepare insert open");
-
-    rc = sqlite3_prepare_v2(db_.db, sql_check_open, -1, &stmt_check_open_.stmt, nullptr);
-    CHECK_SQL(rc, db_.db, "prepare check open");
-
-    rc = sqlite3_prepare_v2(db_.db, sql_find_open, -1, &stmt_find_open_.stmt, nullptr);
-    CHECK_SQL(rc, db_.db, "prepare find open");
-
-    rc = sqlite3_prepare_v2(db_.db, sql_minutes, -1, &stmt_minutes_.stmt, nullptr);
-    CHECK_SQL(rc, db_.db, "prepare minutes");
-
-    rc = sqlite3_prepare_v2(db_.db, sql_price, -1, &stmt_price_.stmt, nullptr);
-    CHECK_SQL(rc, db_.db, "prepare price");
-
-    rc = sqlite3_prepare_v2(db_.db, sql_update_close, -1, &stmt_update_close_.stmt, nullptr);
-    CHECK_SQL(rc, db_.db, "prepare update close");
-
-    rc = sqlite3_prepare_v2(db_.db, sql_find_city, -1, &stmt_find_city_.stmt, nullptr);
-    CHECK_SQL(rc, db_.db, "prepare find city");
-
+    store_ = sessions::make_store(storage_.session_store, db_.db, &prices_cache);
+    if(!store_) {
+        logf("[SQL-ERR] Unknown session store \"%s\"", storage_.session_store.c_str());
+        return SQLITE_ERROR;
+    }
+    int rc = store_->prepare();
+    CHECK_SQL(rc, db_.db, "prepare session store");
+    logf("[SQL] Sessions kept in the %s store", store_->name());
     return SQLITE_OK;
 }
 
 /**
  * @brief Read exactly n bytes from non-blocking socket with signal handling.
+ * @details A trace dump request (SIGUSR1) interrupts the read only before its
+ *          first byte; price updates (SIGHUP) are applied by the materializer
+ *          thread and never stop the connection.
  * @param fd File descriptor.
  * @param buf Buffer to read into.
  * @param n Number of bytes to read.
- * @return Number of bytes read, -1 on error, -2 if SIGHUP/update-prices requested.
+ * @param first_byte_ns Optional, set to trace::now_ns() when the first bytes arrive.
+ * @return Number of bytes read, -1 on error, -2 if a SIGUSR1 trace dump was requested.
  */
-static ssize_t read_n_nonblocking(int fd, void *buf, size_t n)
+static ssize_t read_n_nonblocking(int fd, void *buf, size_t n, uint64_t *first_byte_ns = nullptr)
 {
     size_t got = 0;
     char *p = (char*)buf;
@@ -443,10 +461,11 @@ static ssize_t read_n_nonblocking(int fd, void *buf, size_t n)
     while(got < n) {
         
         if(SignalHandlerRAII::SigGuard::stop.load()) return -1;  // stop requested
-        if(SignalHandlerRAII::need_update_prices()) return -2;   // price update requested
+        if(got == 0 && SignalHandlerRAII::need_dump_trace()) return -2;  // trace dump requested
 
         ssize_t r = recv(fd, p + got, n - got, 0);
         if(r > 0) {
+            if(got == 0 && first_byte_ns) *first_byte_ns = trace::now_ns();
             got += (size_t)r;
             continue;
         }
@@ -459,7 +478,7 @@ static ssize_t read_n_nonblocking(int fd, void *buf, size_t n)
         }
         if(errno == EAGAIN || errno == EWOULDBLOCK) {
             for(int i=0;i<5;i++){
-                if(SignalHandlerRAII::need_update_prices()) return -2;
+                if(got == 0 && SignalHandlerRAII::need_dump_trace()) return -2;
                 usleep(2000); // 10ms total sleep
             }
             continue;
@@ -469,12 +488,1061 @@ static ssize_t read_n_nonblocking(int fd, void *buf, size_t n)
     return (ssize_t)got;
 }
 
+/**
+ * @brief Apply a pending trace dump (SIGUSR1) while a client is connected.
+ */
+void Server::service_requests()
+{
+    if(SignalHandlerRAII::need_dump_trace()) {
+        dump_trace();
+    }
+}
+
+/**
+ * @brief Read exactly n bytes from the client, serving SIGUSR1 requests while idle.
+ * @return n on success, less on disconnect, -1 on error or stop.
+ */
+ssize_t Server::read_client(int fd, void *buf, size_t n, uint64_t *first_byte_ns)
+{
+    for(;;) {
+        ssize_t r = read_n_nonblocking(fd, buf, n, first_byte_ns);
+        if(r != -2) return r;
+        service_requests();
+    }
+}
+
+/**
+ * @brief Log why a client read stopped.
+ * @param n Result of read_client().
+ */
+void Server::log_read_end(ssize_t n, const char *ip, int port, int fd)
+{
+    if(n < 0 && (errno != ECONNRESET && errno != EPIPE) && !SignalHandlerRAII::SigGuard::stop.load())
+        logf("[SOCK-ERR] recv error from %s:%d: %s", ip, port, strerror(errno));
+    else
+        logf("[INFO] Client disconnected from %s:%d (fd=%d)", ip, port, fd);
+}
+
+/**
+ * @brief Serve a v1 client: a stream of bare 12-byte gps_frame.
+ * @details v1 frames carry no time, so the arrival time is journaled as the
+ *          event time. "OK CLOSED" answers every END once it is journaled.
+ * @param first The first frame, already read during negotiation.
+ */
+void Server::serve_v1(int fd, const char *ip, int port, const uint8_t *first, uint64_t first_ns)
+{
+    gps_frame raw;
+    memcpy(&raw, first, sizeof(raw));
+    uint64_t recv_start_ns = first_ns;
+    bool have_frame = true;
+
+    while (!SignalHandlerRAII::SigGuard::stop.load()) {
+        if(!have_frame) {
+            ssize_t n = read_client(fd, &raw, sizeof(raw), &recv_start_ns);
+            if(n != (ssize_t)sizeof(raw)) {
+                log_read_end(n, ip, port, fd);
+                break;
+            }
+        }
+        have_frame = false;
+        uint64_t recv_end_ns = trace::now_ns();
+
+        /// @brief Stage trace for this frame (recorded only when sampled).
+        trace::FrameTrace ft;
+        ft.span(trace::STAGE_RECV, recv_start_ns, recv_end_ns);
+
+        /// @brief Parse GPS frame and convert coordinates/status to usable format.
+        ft.begin(trace::STAGE_DECODE);
+        ParkingEvent ev;
+        ev.device_id = ntohs(raw.device_id);
+        ev.status = ntohs(raw.status);
+        ev.seq = 0;
+        ev.epoch = 0;
+        ev.event_time_ms = wall_clock_ms();
+        ev.arrival_time = true;
+        ev.x = round3(float_from_big_endian(raw.cord_x));
+        ev.y = round3(float_from_big_endian(raw.cord_y));
+        ft.end(trace::STAGE_DECODE);
+
+        journal_event(ev, PP_VERSION_1, fd, ip, port);
+        const char *ok = ev.status == 0 ? "OK CLOSED\n" : "";
+        if(reply_after_journal(fd, ok, strlen(ok), ip, port, ft) < 0)
+            break;
+    }
+
+    held_replies_.clear();      // the client is gone or closing, it resends what it did not see answered
+    commit_journal(fd, ip, port, nullptr);
+}
+
+/**
+ * @brief Wire event to the server's representation.
+ * @details A client that did not know the edge time sends 0; like a v1
+ *          frame, the event then takes the time the message arrived.
+ * @param epoch Spool epoch from the client's HELLO
+ * @param arrival_ms Unix time in ms the message was read
+ */
+static ParkingEvent from_wire(const pp_event &pe, uint16_t epoch, uint64_t arrival_ms)
+{
+    ParkingEvent ev;
+    ev.device_id = pe.device_id;
+    ev.status = pe.status;
+    ev.seq = pe.seq;
+    ev.epoch = epoch;
+    ev.arrival_time = pe.event_time_ms == 0;
+    ev.event_time_ms = ev.arrival_time ? arrival_ms : pe.event_time_ms;
+    ev.x = round3((double)pe.lat_e6 / PP_COORD_SCALE);
+    ev.y = round3((double)pe.lng_e6 / PP_COORD_SCALE);
+    return ev;
+}
+
+/**
+ * @brief ACK entry for an event.
+ * @param result PP_ACK_JOURNALED or PP_ACK_DUPLICATE
+ */
+static pp_ack to_ack(const ParkingEvent &ev, uint8_t result)
+{
+    pp_ack a;
+    a.device_id = ev.device_id;
+    a.result = result;
+    a.status = (uint8_t)ev.status;
+    a.seq = ev.seq;
+    a.session_id = 0;
+    a.fee_cents = 0;
+    return a;
+}
+
+/**
+ * @brief Send a whole reply on the non-blocking client socket.
+ * @details A client that stops reading would otherwise make the replies
+ *          pile up silently; after REPLY_TIMEOUT_MS without progress the
+ *          send fails and the caller drops the connection.
+ * @return 0 on success, -1 on error or timeout
+ */
+int Server::send_reply(int fd, const void *buf, size_t len, const char *ip, int port)
+{
+    const char *p = (const char*)buf;
+    while(len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if(n > 0) {
+            p += n;
+            len -= (size_t)n;
+            continue;
+        }
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pfd = { fd, POLLOUT, 0 };
+            int r = poll(&pfd, 1, REPLY_TIMEOUT_MS);
+            if(r > 0 || (r < 0 && errno == EINTR)) continue;
+            logf("[SOCK-ERR] Reply to %s:%d timed out", ip, port);
+            return -1;
+        }
+        logf("[SOCK-ERR] Reply to %s:%d failed: %s", ip, port, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Drop events whose sequence number was already journaled.
+ * @details Events without a sequence number (v1) always pass.
+ */
+bool Server::accept_event(const ParkingEvent &ev, const char *ip, int port)
+{
+    if(ev.seq == 0) return true;
+
+    switch(dedup_.check(ev.device_id, ev.seq, ev.epoch)) {
+    case dedup::ACCEPT:
+        return true;
+    case dedup::RESTART:
+        logf("[DEDUP] ID=%u numbers from a new spool (epoch %u), window reset",
+             (unsigned)ev.device_id, (unsigned)ev.epoch);
+        return true;
+    case dedup::DUPLICATE:
+    case dedup::TOO_OLD:
+        break;
+    }
+    duplicates_++;
+    logf("[DEDUP] Dropped duplicate from %s:%d -> ID=%u, SEQ=%u (hwm %u, %llu dropped)",
+         ip, port, (unsigned)ev.device_id, (unsigned)ev.seq, (unsigned)dedup_.hwm(ev.device_id),
+         (unsigned long long)duplicates_);
+    return false;
+}
+
+/**
+ * @brief Log an accepted event and queue it for the next journal commit.
+ */
+void Server::journal_event(const ParkingEvent &ev, int version, int fd, const char *ip, int port)
+{
+    PROBE_FRAME_RECV(ev.device_id, ev.status, fd);
+    (void)fd;
+
+    logf("[RECV] From %s:%d -> ID=%u, X=%.3f, Y=%.3f, STATUS=%u, SEQ=%u",
+         ip, port, (unsigned)ev.device_id, ev.x, ev.y, (unsigned)ev.status, (unsigned)ev.seq);
+
+    journal::Record r{};
+    r.event_time_ms = ev.event_time_ms;
+    r.x = ev.x;
+    r.y = ev.y;
+    r.seq = ev.seq;
+    r.epoch = ev.epoch;
+    r.device_id = ev.device_id;
+    r.status = ev.status;
+    r.version = (uint8_t)version;
+    r.flags = ev.arrival_time ? journal::RECORD_ARRIVAL_TIME : 0;
+    journal_.append(r);
+    unsynced_++;
+}
+
+/**
+ * @brief Group commit: while the next message is already in the socket
+ *        buffer, its records join the same fdatasync and the replies wait.
+ * @details The wait is bounded by JOURNAL_GROUP_RECORDS records and
+ *          JOURNAL_GROUP_REPLY_BYTES of replies, and never spans a blocking
+ *          read: with nothing pending the group is committed at once.
+ * @param reply Reply to the current message, len 0 if none
+ */
+int Server::reply_after_journal(int fd, const void *reply, size_t len, const char *ip, int port,
+                                trace::FrameTrace &ft)
+{
+    ft.begin(trace::STAGE_JOURNAL);
+    held_replies_.append((const char*)reply, len);
+
+    int pending = 0;
+    if(ioctl(fd, FIONREAD, &pending) < 0) pending = 0;
+    if(pending > 0 && unsynced_ < JOURNAL_GROUP_RECORDS && held_replies_.size() < JOURNAL_GROUP_REPLY_BYTES) {
+        ft.end(trace::STAGE_JOURNAL);
+        return 0;
+    }
+    return commit_journal(fd, ip, port, &ft);
+}
+
+/**
+ * @brief Make the appended records durable, then release their replies.
+ * @details A failed journal write leaves the server unable to promise
+ *          durability, so it stops instead of acknowledging anything more.
+ * @param ft Trace of the message that closed the group, nullptr if none
+ */
+int Server::commit_journal(int fd, const char *ip, int port, trace::FrameTrace *ft)
+{
+    if(unsynced_ > 0) {
+        if(journal_.commit() < 0) {
+            logf("[JOURNAL-ERR] Journal write failed: %s, stopping", strerror(errno));
+            SignalHandlerRAII::SigGuard::stop.store(true);
+            held_replies_.clear();
+            return -1;
+        }
+        unsynced_ = 0;
+        { std::lock_guard<std::mutex> lock(mat_mtx_); }
+        mat_cv_.notify_one();
+    }
+    if(ft) ft->end(trace::STAGE_JOURNAL);
+    if(held_replies_.empty()) return 0;
+
+    if(ft) ft->begin(trace::STAGE_ACK);
+    int r = send_reply(fd, held_replies_.data(), held_replies_.size(), ip, port);
+    if(ft) ft->end(trace::STAGE_ACK);
+    held_replies_.clear();
+    return r;
+}
+
+/**
+ * @brief Serve a v2+ client: header, payload and CRC per message.
+ * @details A bad magic, version or CRC, or a message of a type or length
+ *          the version does not allow, means the stream can no longer be
+ *          trusted to be in sync, so the connection is closed; the client
+ *          resends everything still in its spool after reconnecting.
+ *          Events already journaled (same device and sequence number) are
+ *          dropped; the rest are appended to the journal, and on v4 every
+ *          message is answered with one ACK once its records are durable.
+ *          No SQL runs on this path: the materializer thread applies the
+ *          journal to customer_data behind it.
+ * @param version Negotiated version; messages may carry any version from 2 up to it.
+ * @param epoch Spool epoch from the client's HELLO, 0 if none
+ */
+void Server::serve_v2(int fd, const char *ip, int port, int version, uint16_t epoch)
+{
+    static uint8_t msg[PP_MSG_BYTES(PP_MAX_PAYLOAD)];
+    static uint8_t reply[PP_MSG_BYTES(PP_MAX_PAYLOAD)];
+    static pp_event batch[PP_BATCH_MAX_EVENTS];
+    static pp_ack acks[PP_ACK_MAX_ENTRIES];
+
+    /// @brief Hold the answer to the current message (its n ACK entries on v4) for the journal commit.
+    auto finish = [&](size_t n, trace::FrameTrace &ft) {
+        size_t rlen = version >= PP_VERSION_4 ? pp_encode_ack(reply, acks, n) : 0;
+        return reply_after_journal(fd, reply, rlen, ip, port, ft);
+    };
+
+    while (!SignalHandlerRAII::SigGuard::stop.load()) {
+        uint64_t recv_start_ns = 0;
+        ssize_t n = read_client(fd, msg, PP_HDR_BYTES, &recv_start_ns);
+        if(n != (ssize_t)PP_HDR_BYTES) {
+            log_read_end(n, ip, port, fd);
+            break;
+        }
+
+        uint8_t type;
+        uint16_t len;
+        int msg_version = pp_parse_header(msg, &type, &len);
+        if(msg_version < PP_VERSION_2 || msg_version > version) {
+            logf("[PROTO-ERR] Bad header from %s:%d (magic/version 0x%02x, length %u), closing",
+                 ip, port, msg[0], (unsigned)pp_get16(msg + 2));
+            break;
+        }
+        n = read_client(fd, msg + PP_HDR_BYTES, (size_t)len + PP_CRC_BYTES, nullptr);
+        if(n != (ssize_t)len + PP_CRC_BYTES) {
+            log_read_end(n, ip, port, fd);
+            break;
+        }
+        uint64_t recv_end_ns = trace::now_ns();
+        uint64_t arrival_ms = wall_clock_ms();
+
+        trace::FrameTrace ft;
+        ft.span(trace::STAGE_RECV, recv_start_ns, recv_end_ns);
+
+        ft.begin(trace::STAGE_DECODE);
+        if(!pp_crc_ok(msg, len)) {
+            logf("[PROTO-ERR] CRC mismatch from %s:%d, closing", ip, port);
+            break;
+        }
+        if(type == PP_MSG_BATCH && version >= PP_VERSION_3) {
+            int count = pp_decode_batch(msg + PP_HDR_BYTES, len, batch, PP_BATCH_MAX_EVENTS);
+            if(count < 0) {
+                logf("[PROTO-ERR] Malformed BATCH (%u bytes) from %s:%d, closing", (unsigned)len, ip, port);
+                break;
+            }
+            ft.end(trace::STAGE_DECODE);
+            logf("[INFO] BATCH of %d events (%u bytes) from %s:%d", count, (unsigned)len, ip, port);
+
+            for(int i = 0; i < count; i++) {
+                ParkingEvent ev = from_wire(batch[i], epoch, arrival_ms);
+                uint8_t result = PP_ACK_DUPLICATE;
+                if(accept_event(ev, ip, port)) {
+                    journal_event(ev, msg_version, fd, ip, port);
+                    result = PP_ACK_JOURNALED;
+                }
+                acks[i] = to_ack(ev, result);
+            }
+            if(finish((size_t)count, ft) < 0)
+                break;
+            continue;
+        }
+        if(type != PP_MSG_EVENT || len != sizeof(pp_event_wire)) {
+            logf("[PROTO-ERR] Unexpected message type %u (%u bytes) from %s:%d, closing",
+                 (unsigned)type, (unsigned)len, ip, port);
+            break;
+        }
+        pp_event pe;
+        pp_get_event(msg + PP_HDR_BYTES, &pe);
+        ParkingEvent ev = from_wire(pe, epoch, arrival_ms);
+        ft.end(trace::STAGE_DECODE);
+
+        uint8_t result = PP_ACK_DUPLICATE;
+        if(accept_event(ev, ip, port)) {
+            journal_event(ev, msg_version, fd, ip, port);
+            result = PP_ACK_JOURNALED;
+        }
+        acks[0] = to_ack(ev, result);
+        if(finish(1, ft) < 0)
+            break;
+    }
+
+    held_replies_.clear();      // the client is gone or closing, it resends what it did not see acknowledged
+    commit_journal(fd, ip, port, nullptr);
+}
+
+/**
+ * @brief Read the materializer position and rebuild the duplicate filter.
+ * @details ingest_hwm holds the windows of the events already applied; the
+ *          events journaled after applied_lsn were accepted too, so their
+ *          sequence numbers are replayed into dedup_ before any client is
+ *          served. A journal that ends before applied_lsn was lost or
+ *          replaced, and new records would be skipped, so it is refused.
+ */
+int Server::recover_journal()
+{
+    if(journal_.open(JOURNAL_DIR, JOURNAL_SEGMENT_BYTES) < 0) {
+        logf("[JOURNAL-ERR] Cannot open journal in %s: %s", JOURNAL_DIR, strerror(errno));
+        return -1;
+    }
+    if(journal_.truncated() > 0)
+        logf("[JOURNAL] Cut %llu bytes of a torn write off the end of the journal",
+             (unsigned long long)journal_.truncated());
+
+    uint64_t durable = journal_.durable_lsn();
+    uint64_t applied = 0, windows_lsn = 0;
+    int rc = store_->recover(durable, applied, dedup_, windows_lsn);
+    CHECK_SQL(rc, db_.db, "recover session store");
+    applied_lsn_ = applied;
+    if(applied_lsn_ > durable) {
+        logf("[JOURNAL-ERR] customer_data is at LSN %llu but the journal in %s ends at %llu",
+             (unsigned long long)applied_lsn_, JOURNAL_DIR, (unsigned long long)durable);
+        return -1;
+    }
+
+    static journal::Record recs[MATERIALIZE_BATCH];
+    journal::Reader reader;
+    reader.open(JOURNAL_DIR, JOURNAL_SEGMENT_BYTES, windows_lsn + 1);
+    while(reader.next_lsn() <= durable) {
+        int n = reader.read(recs, MATERIALIZE_BATCH, durable);
+        if(n <= 0) {
+            logf("[JOURNAL-ERR] Cannot read journal at LSN %llu: %s",
+                 (unsigned long long)reader.next_lsn(), strerror(errno));
+            return -1;
+        }
+        for(int i = 0; i < n; i++)
+            if(recs[i].seq) (void)dedup_.check(recs[i].device_id, recs[i].seq, recs[i].epoch);
+    }
+
+    logf("[JOURNAL] Journal at LSN %llu, %s store at LSN %llu (%llu records to materialize)",
+         (unsigned long long)durable, store_->name(), (unsigned long long)applied_lsn_,
+         (unsigned long long)(durable - applied_lsn_));
+    return 0;
+}
+
+/**
+ * @brief Bring customer_data up to the journal with replay::run() when the
+ *        backlog is REPLAY_MIN_RECORDS or more (typically after a crash);
+ *        smaller backlogs are left to the materializer.
+ * @details A chunk with an event SQLite rejects is halved until only that
+ *          record fails, which apply_events() dead-letters; the bulk replay
+ *          resumes after it. Lock contention is retried like in
+ *          materialize(); any other failure leaves the rest of the backlog
+ *          to the materializer.
+ */
+int Server::replay_journal()
+{
+    uint64_t durable = journal_.durable_lsn();
+    if(durable - applied_lsn_ < REPLAY_MIN_RECORDS) return 0;
+
+    replay::Options opt;
+    opt.dir = JOURNAL_DIR;
+    opt.segment_bytes = JOURNAL_SEGMENT_BYTES;
+    opt.to_lsn = durable;
+    opt.threads = REPLAY_THREADS > 0 ? REPLAY_THREADS : std::max(1u, std::thread::hardware_concurrency());
+    opt.chunk_records = REPLAY_CHUNK_RECORDS;
+    opt.price_overrides = &prices_cache;
+
+    const uint64_t start_lsn = applied_lsn_;
+    logf("[REPLAY] Replaying %llu journal records (LSN %llu..%llu) into the %s store",
+         (unsigned long long)(durable - start_lsn), (unsigned long long)(start_lsn + 1),
+         (unsigned long long)durable, store_->name());
+
+    replay::Stats total;
+    bool slow = false;      // the next record is rejected: apply_events() dead-letters it
+    long attempt = 0;
+    int rc = SQLITE_OK;
+    while(applied_lsn_ < durable) {
+        if(slow) {
+            rc = apply_events(1, durable);
+        } else {
+            /// @brief Progress of the whole replay, not of this run.
+            const uint64_t base = applied_lsn_ - start_lsn;
+            opt.from_lsn = applied_lsn_ + 1;
+            replay::Stats stats;
+            rc = store_->bulk_apply(opt, [&](const replay::Progress &p) {
+                if(opt.chunk_records < REPLAY_CHUNK_RECORDS) return;   // narrowing down a rejected record
+                uint64_t done = base + p.applied, all = durable - start_lsn;
+                logf("[REPLAY] %llu/%llu records (%.0f%%), %.0f records/s",
+                     (unsigned long long)done, (unsigned long long)all,
+                     all ? 100.0 * (double)done / (double)all : 100.0,
+                     p.seconds > 0 ? (double)p.applied / p.seconds : 0.0);
+            }, stats);
+            if(stats.applied_lsn > applied_lsn_) applied_lsn_ = stats.applied_lsn;
+            total.records += stats.records;
+            total.opened += stats.opened;
+            total.closed += stats.closed;
+            total.already_open += stats.already_open;
+            total.unmatched += stats.unmatched;
+            total.seconds += stats.seconds;
+        }
+        if(rc == SQLITE_OK) {
+            attempt = 0;
+            slow = false;
+            continue;
+        }
+        if(rc == SQLITE_IOERR) {
+            logf("[REPLAY-ERR] Replay failed at LSN %llu: %s",
+                 (unsigned long long)(applied_lsn_ + 1), strerror(errno));
+            return -1;
+        }
+
+        storage::Failure f = storage::classify(rc);
+        if(f == storage::TRANSIENT && attempt < storage_.retry_attempts) {
+            long ms = storage::backoff_ms(storage_, attempt);
+            sql_retries_++;
+            sql_retry_ms_ += (uint64_t)ms;
+            PROBE_SQL_RETRY(rc, attempt, ms);
+            attempt++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+            continue;
+        }
+        if(f == storage::EVENT && !slow) {
+            /// @brief Halve the chunk until the failing one is the rejected record alone.
+            attempt = 0;
+            if(opt.chunk_records > 1) {
+                opt.chunk_records /= 2;
+                continue;
+            }
+            slow = true;
+            opt.chunk_records = REPLAY_CHUNK_RECORDS;
+            continue;
+        }
+        logf("[REPLAY-ERR] Replay stopped at LSN %llu: %s (rc=%d), the materializer applies the rest",
+             (unsigned long long)(applied_lsn_ + 1), sqlite3_errstr(rc), rc);
+        break;
+    }
+
+    logf("[REPLAY] %s: %llu records in %.2f s (%.0f records/s), %llu sessions opened, %llu closed, "
+         "%llu STARTs already open, %llu ENDs without a session",
+         applied_lsn_ >= durable ? "Done" : "Stopped",
+         (unsigned long long)total.records, total.seconds,
+         total.seconds > 0 ? (double)total.records / total.seconds : 0.0,
+         (unsigned long long)total.opened, (unsigned long long)total.closed,
+         (unsigned long long)total.already_open, (unsigned long long)total.unmatched);
+    return 0;
+}
+
+/**
+ * @details One MATERIALIZE_BATCH transaction at a time, before the
+ *          materializer thread starts.
+ */
+int Server::apply_events(size_t count, uint64_t to_lsn)
+{
+    static journal::Record recs[MATERIALIZE_BATCH];
+    journal::Reader reader;
+    reader.open(JOURNAL_DIR, JOURNAL_SEGMENT_BYTES, applied_lsn_ + 1);
+    while(count > 0 && applied_lsn_ < to_lsn) {
+        int n = reader.read(recs, std::min(count, (size_t)MATERIALIZE_BATCH), to_lsn);
+        if(n <= 0) return SQLITE_IOERR;
+        int rc = apply_batch(recs, (size_t)n);
+        if(rc != SQLITE_OK) return rc;
+        count -= (size_t)n;
+    }
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Apply a pending price update (SIGHUP).
+ * @details Runs in the materializer thread, the only one using the database
+ *          and the price cache once clients are served.
+ */
+void Server::update_prices()
+{
+    logf("[INFO] SIGHUP received: updating prices from file and shared memory...");
+    update_db_from_prices_file(db_.db, prices_cache);
+    load_prices_from_shm();
+    int rc = store_->prices_changed();
+    if(rc != SQLITE_OK)
+        logf("[SQL-ERR] Session store kept its old prices: %s (rc=%d)", sqlite3_errstr(rc), rc);
+    logf("[INFO] Prices update completed.");
+    reload_maintenance();
+    SignalHandlerRAII::reset_update_flag();
+}
+
+/**
+ * @details Only the maintenance keys are taken: the others are read by the
+ *          checkpoint thread or only matter at startup. An invalid key
+ *          keeps its current value.
+ */
+void Server::reload_maintenance()
+{
+    storage::Config cfg = storage_;
+    std::string problem;
+    if(!storage::load_config(STORAGE_CONFIG_FILE, cfg, problem))
+        logf("[WARN] %s: %s, keeping the current value", STORAGE_CONFIG_FILE, problem.c_str());
+    storage_.archive_after_days = cfg.archive_after_days;
+    storage_.archive_chunk_rows = cfg.archive_chunk_rows;
+    storage_.archive_interval_ms = cfg.archive_interval_ms;
+    storage_.retention_days = cfg.retention_days;
+    storage_.retention_chunk_rows = cfg.retention_chunk_rows;
+    storage_.retention_interval_ms = cfg.retention_interval_ms;
+    storage_.vacuum_pages = cfg.vacuum_pages;
+    storage_.maintenance_backlog = cfg.maintenance_backlog;
+
+    /// @brief Look for due sessions with the new settings right away.
+    archive_next_ = purge_next_ = std::chrono::steady_clock::time_point();
+    logf("[INFO] Maintenance: archive after %ld days, retention %ld days, while at most %ld records wait",
+         storage_.archive_after_days, storage_.retention_days, storage_.maintenance_backlog);
+}
+
+/**
+ * @brief Apply journal records in one transaction, together with their
+ *        sequence windows and the new applied_lsn, so a restart resumes
+ *        exactly after the last applied record.
+ * @details Lock contention is retried retry_attempts times with a growing
+ *          backoff. After that, or on a storage failure, the materializer
+ *          pauses and retries every retry_backoff_max_ms. Ingestion goes on
+ *          into the journal meanwhile.
+ */
+void Server::materialize(const journal::Record *recs, size_t n)
+{
+    uint64_t waited_ms = 0;
+    bool stalled = false;
+    for(long attempt = 0;; attempt++) {
+        int rc = apply_batch(recs, n);
+        if(rc == SQLITE_OK) break;
+
+        bool busy = storage::classify(rc) == storage::TRANSIENT;
+        long ms = storage::backoff_ms(storage_, attempt);
+        if(!busy || attempt >= storage_.retry_attempts) {
+            ms = storage_.retry_backoff_max_ms;
+            if(!stalled) {
+                stalled = true;
+                sql_stalls_++;
+                logf("[SQL-ERR] Cannot apply LSN %llu..%llu: %s (rc=%d), materializer paused, retrying every %ld ms",
+                     (unsigned long long)recs[0].lsn, (unsigned long long)recs[n - 1].lsn,
+                     sqlite3_errstr(rc), rc, ms);
+            }
+        }
+        sql_retries_++;
+        PROBE_SQL_RETRY(rc, attempt, ms);
+
+        std::unique_lock<std::mutex> lock(mat_mtx_);
+        if(mat_cv_.wait_for(lock, std::chrono::milliseconds(ms), [&] { return mat_stop_.load(); }))
+            return;     // applied from the journal at the next start
+        waited_ms += (uint64_t)ms;
+        sql_retry_ms_ += (uint64_t)ms;
+        report_sql(false);
+    }
+
+    if(waited_ms > 0)
+        logf("[SQL] LSN %llu..%llu applied after waiting %llu ms for the database (%llu retries so far)",
+             (unsigned long long)recs[0].lsn, (unsigned long long)recs[n - 1].lsn,
+             (unsigned long long)waited_ms, (unsigned long long)sql_retries_);
+}
+
+int Server::apply_batch(const journal::Record *recs, size_t n)
+{
+    pending_dead_.clear();
+    int rc = store_->begin();
+    if(rc != SQLITE_OK) return rc;
+
+    for(size_t i = 0; i < n && rc == SQLITE_OK; i++) {
+        sessions::Applied a;
+        trace::FrameTrace ft;
+        rc = store_->apply(recs[i], a, &ft);
+        if(rc == SQLITE_OK) log_applied(recs[i], a);
+        else if(store_->rejected(rc)) {
+            dead_letter(recs[i], rc);
+            rc = SQLITE_OK;
+        }
+    }
+
+    if(rc == SQLITE_OK && !pending_dead_.empty() && write_dead_letters() < 0) {
+        logf("[SQL-ERR] Cannot write %s: %s", DEAD_LETTER_FILE, strerror(errno));
+        rc = SQLITE_IOERR;
+    }
+    if(rc == SQLITE_OK) rc = store_->commit(recs[n - 1].lsn);
+    if(rc != SQLITE_OK) {
+        /// @brief Keep the message of the failure, not of the ROLLBACK.
+        std::string err = sqlite3_errmsg(db_.db);
+        store_->rollback();
+        if(storage::classify(rc) != storage::TRANSIENT)
+            logf("[SQL-ERR] Transaction for LSN %llu..%llu rolled back: %s (rc=%d)",
+                 (unsigned long long)recs[0].lsn, (unsigned long long)recs[n - 1].lsn, err.c_str(), rc);
+        return rc;
+    }
+
+    dead_letters_ += pending_dead_.size();
+    applied_lsn_ = recs[n - 1].lsn;
+    return SQLITE_OK;
+}
+
+void Server::report_sql(bool final)
+{
+    auto now = std::chrono::steady_clock::now();
+    if(!final && now < sql_report_) return;
+    sql_report_ = now + std::chrono::seconds(SQL_REPORT_S);
+    uint64_t seen = sql_retries_ + sql_stalls_ + dead_letters_;
+    if(!final && seen == sql_reported_) return;
+    sql_reported_ = seen;
+    logf("[SQL] %llu transactions retried after %llu ms of waiting, %llu pauses, %llu events dead-lettered",
+         (unsigned long long)sql_retries_, (unsigned long long)sql_retry_ms_,
+         (unsigned long long)sql_stalls_, (unsigned long long)dead_letters_);
+}
+
+/**
+ * @details The line is written before COMMIT, so a COMMIT that fails after
+ *          it writes the line again on the retry; lsn identifies the record.
+ */
+void Server::dead_letter(const journal::Record &rec, int rc)
+{
+    char line[512];
+    snprintf(line, sizeof(line),
+             "{\"lsn\":%llu,\"device_id\":%u,\"status\":%u,\"seq\":%u,\"event_time_ms\":%llu,"
+             "\"x\":%.3f,\"y\":%.3f,\"rc\":%d,\"error\":\"%s\"}\n",
+             (unsigned long long)rec.lsn, (unsigned)rec.device_id, (unsigned)rec.status, (unsigned)rec.seq,
+             (unsigned long long)rec.event_time_ms, rec.x, rec.y, rc, sqlite3_errstr(rc));
+    pending_dead_.push_back(line);
+    PROBE_DEAD_LETTER(rec.lsn, rc);
+    logf("[SQL-ERR] LSN %llu (ID=%u, STATUS=%u) rejected: %s, written to %s",
+         (unsigned long long)rec.lsn, (unsigned)rec.device_id, (unsigned)rec.status,
+         sqlite3_errmsg(db_.db), DEAD_LETTER_FILE);
+}
+
+int Server::write_dead_letters()
+{
+    int fd = open(DEAD_LETTER_FILE, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0) return -1;
+    std::string all;
+    for(const std::string &line : pending_dead_) all += line;
+    int rc = 0;
+    if(write(fd, all.data(), all.size()) != (ssize_t)all.size() || fdatasync(fd) != 0) rc = -1;
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return rc;
+}
+
+/**
+ * @brief Materializer thread: follow the durable end of the journal and
+ *        apply up to MATERIALIZE_BATCH records per transaction.
+ * @details On shutdown it stops after the current transaction; whatever is
+ *          left is applied from the journal at the next start.
+ */
+void Server::materialize_loop()
+{
+    static journal::Record recs[MATERIALIZE_BATCH];
+    journal::Reader reader;
+    reader.open(JOURNAL_DIR, JOURNAL_SEGMENT_BYTES, applied_lsn_ + 1);
+
+    while(!mat_stop_.load()) {
+        if(SignalHandlerRAII::need_update_prices()) update_prices();
+        report_sql(false);
+
+        uint64_t durable = journal_.durable_lsn();
+        uint64_t backlog = durable > applied_lsn_ ? durable - applied_lsn_ : 0;
+        /// @brief Maintenance only uses the time the journal leaves: one bounded
+        ///        step between batches, none while the backlog is deeper.
+        bool more = backlog <= (uint64_t)storage_.maintenance_backlog && maintenance_step(backlog);
+        if(backlog == 0) {
+            if(more) continue;
+            std::unique_lock<std::mutex> lock(mat_mtx_);
+            mat_cv_.wait_for(lock, std::chrono::milliseconds(100), [&] {
+                return mat_stop_.load() || journal_.durable_lsn() > applied_lsn_;
+            });
+            continue;
+        }
+
+        int n = reader.read(recs, MATERIALIZE_BATCH, durable);
+        if(n <= 0) {
+            logf("[JOURNAL-ERR] Cannot read journal at LSN %llu: %s, stopping",
+                 (unsigned long long)reader.next_lsn(), strerror(errno));
+            SignalHandlerRAII::SigGuard::stop.store(true);
+            return;
+        }
+        materialize(recs, (size_t)n);
+    }
+
+    logf("[JOURNAL] Materializer stopped at LSN %llu, journal at LSN %llu",
+         (unsigned long long)applied_lsn_, (unsigned long long)journal_.durable_lsn());
+    report_sql(true);
+    if(archiver_)
+        logf("[ARCHIVE] %llu sessions moved to %s since start", (unsigned long long)archived_, ARCHIVE_DIR);
+    if(purger_)
+        logf("[RETENTION] %llu sessions deleted, %llu archive months dropped, %llu pages vacuumed since start; "
+             "longest maintenance step %.1f ms",
+             (unsigned long long)purged_, (unsigned long long)months_dropped_,
+             (unsigned long long)vacuumed_, maint_longest_us_ / 1000.0);
+}
+
+/**
+ * @details Archiving goes first, so sessions are archived before they
+ *          expire when archive_after_days is the shorter, then retention,
+ *          then the vacuum of the pages both have freed.
+ */
+bool Server::maintenance_step(uint64_t backlog)
+{
+    if(!archiver_) return false;
+    auto t0 = std::chrono::steady_clock::now();
+    long n = 0;
+    MaintenanceStep kind = archive_chunk(n) ? MAINT_ARCHIVE
+                         : purge_chunk(n) ? MAINT_PURGE
+                         : vacuum_chunk(n) ? MAINT_VACUUM : (MaintenanceStep)0;
+    if(!kind) return false;
+
+    uint64_t us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - t0).count();
+    if(us > maint_longest_us_) maint_longest_us_ = us;
+    PROBE_MAINTENANCE_STEP((int)kind, n, us, backlog);
+    (void)backlog;
+    return true;
+}
+
+/**
+ * @details Due sessions are looked for every archive_interval_ms; once some
+ *          are found, chunks follow each other between journal batches
+ *          (maintenance_step()). A pass is logged when it has caught up.
+ */
+bool Server::archive_chunk(long &rows)
+{
+    auto now = std::chrono::steady_clock::now();
+    if(storage_.archive_after_days <= 0 || now < archive_next_) return false;
+
+    const uint64_t now_ms = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    std::string cutoff = utils::local_time_from_ms(now_ms - (uint64_t)storage_.archive_after_days * 86400000ull);
+
+    archive::Step step;
+    int rc = archiver_->step(cutoff, storage_.archive_chunk_rows, step);
+    if(rc != SQLITE_OK || step.rows == 0) {
+        if(rc != SQLITE_OK)
+            logf("[ARCHIVE-ERR] Cannot move sessions ended in %s to %s: %s (rc=%d), retrying in %ld ms",
+                 step.month.c_str(), archive::month_path(ARCHIVE_DIR, step.month).c_str(),
+                 sqlite3_errmsg(db_.db), rc, storage_.archive_interval_ms);
+        else if(archive_pass_rows_ > 0) {
+            logf("[ARCHIVE] Moved %llu sessions closed before %s to %s in %.1f s",
+                 (unsigned long long)archive_pass_rows_, cutoff.c_str(), ARCHIVE_DIR,
+                 std::chrono::duration<double>(now - archive_pass_start_).count());
+            vacuum_due_ = vacuum_;
+        }
+        archive_pass_rows_ = 0;
+        archive_next_ = now + std::chrono::milliseconds(storage_.archive_interval_ms);
+        return false;
+    }
+
+    if(archive_pass_rows_ == 0) archive_pass_start_ = now;
+    archive_pass_rows_ += (uint64_t)step.rows;
+    archived_ += (uint64_t)step.rows;
+    rows = step.rows;
+    return true;
+}
+
+/**
+ * @details A pass starts every retention_interval_ms and walks the whole
+ *          table; its progress is logged every RETENTION_REPORT_S while it
+ *          lasts. The month attached by the archiver is detached first, as
+ *          the step may remove its file.
+ */
+bool Server::purge_chunk(long &rows)
+{
+    auto now = std::chrono::steady_clock::now();
+    if(storage_.retention_days <= 0 || (!purger_->in_pass() && now < purge_next_)) return false;
+
+    const uint64_t now_ms = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    std::string cutoff = utils::local_time_from_ms(now_ms - (uint64_t)storage_.retention_days * 86400000ull);
+
+    archiver_->detach();
+    retention::Step step;
+    int rc = purger_->step(cutoff, storage_.retention_chunk_rows, step);
+    if(rc != SQLITE_OK) {
+        logf("[RETENTION-ERR] Cannot delete sessions closed before %s: %s (rc=%d), retrying in %ld ms",
+             cutoff.c_str(), step.month.empty() ? sqlite3_errmsg(db_.db) : step.month.c_str(), rc,
+             storage_.retention_interval_ms);
+        purge_next_ = now + std::chrono::milliseconds(storage_.retention_interval_ms);
+        return false;
+    }
+
+    if(step.started) {
+        purge_pass_start_ = now;
+        purge_report_ = now + std::chrono::seconds(RETENTION_REPORT_S);
+        purge_pass_rows_ = purge_pass_chunks_ = 0;
+        logf("[RETENTION] Deleting sessions closed before %s: ids %lld..%lld, %zu archive months",
+             cutoff.c_str(), (long long)step.first_id, (long long)step.end_id,
+             step.months_left + !step.month.empty());
+    }
+    if(!step.month.empty()) {
+        months_dropped_++;
+        logf("[RETENTION] Dropped %s", archive::month_path(ARCHIVE_DIR, step.month).c_str());
+    }
+    purge_pass_rows_ += (uint64_t)step.rows;
+    purge_pass_chunks_++;
+    purged_ += (uint64_t)step.rows;
+    rows = step.rows;
+    PROBE_RETENTION_PROGRESS(step.next_id, step.end_id, purge_pass_rows_);
+
+    if(step.done) {
+        logf("[RETENTION] Deleted %llu sessions closed before %s in %.1f s (%llu steps)",
+             (unsigned long long)purge_pass_rows_, cutoff.c_str(),
+             std::chrono::duration<double>(now - purge_pass_start_).count(),
+             (unsigned long long)purge_pass_chunks_);
+        purge_next_ = now + std::chrono::milliseconds(storage_.retention_interval_ms);
+        if(purge_pass_rows_ > 0) vacuum_due_ = vacuum_;
+    } else if(now >= purge_report_) {
+        double span = (double)(step.end_id - step.first_id + 1);
+        logf("[RETENTION] %.0f%% of ids %lld..%lld walked, %llu sessions deleted",
+             100.0 * (double)(step.next_id - step.first_id) / span,
+             (long long)step.first_id, (long long)step.end_id, (unsigned long long)purge_pass_rows_);
+        purge_report_ = now + std::chrono::seconds(RETENTION_REPORT_S);
+    }
+    return true;
+}
+
+/**
+ * @details Once no free page is left the checkpoint thread is woken, so
+ *          the file shrinks without waiting for its next round.
+ */
+bool Server::vacuum_chunk(long &pages)
+{
+    if(!vacuum_due_) return false;
+    storage::VacuumResult v = storage::vacuum_step(db_.db, storage_.vacuum_pages);
+    if(v.rc != SQLITE_OK)
+        logf("[VACUUM-ERR] Incremental vacuum failed: %s (rc=%d)", sqlite3_errmsg(db_.db), v.rc);
+    PROBE_VACUUM(v.freed_pages, v.free_pages);
+    vacuum_pass_pages_ += (uint64_t)v.freed_pages;
+    vacuumed_ += (uint64_t)v.freed_pages;
+    pages = v.freed_pages;
+    if(v.rc == SQLITE_OK && v.freed_pages > 0 && v.free_pages > 0) return true;
+
+    vacuum_due_ = false;
+    if(vacuum_pass_pages_ > 0) {
+        logf("[VACUUM] %llu free pages returned to the file system", (unsigned long long)vacuum_pass_pages_);
+        ckpt_cv_.notify_one();
+    }
+    vacuum_pass_pages_ = 0;
+    return v.freed_pages > 0;
+}
+
+/**
+ * @brief Checkpointer thread: copy the WAL back into data.db off the
+ *        materializer's path, on a connection of its own.
+ * @details The connection has no busy timeout, so a TRUNCATE that would
+ *          have to wait for the writer is simply tried again next round.
+ */
+void Server::checkpoint_loop()
+{
+    DBHandle ck;
+    if(sqlite3_open_v2(DB_FILE, &ck.db, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK) {
+        logf("[CKPT-ERR] Cannot open %s: %s, checkpoints stopped", DB_FILE,
+             ck.db ? sqlite3_errmsg(ck.db) : "out of memory");
+        return;
+    }
+    /// @brief A connection finds the WAL on its first read; until then a checkpoint is a no-op.
+    sqlite3_exec(ck.db, "PRAGMA schema_version;", nullptr, nullptr, nullptr);
+
+    while(!mat_stop_.load()) {
+        {
+            std::unique_lock<std::mutex> lock(mat_mtx_);
+            ckpt_cv_.wait_for(lock, std::chrono::milliseconds(storage_.checkpoint_interval_ms),
+                              [&] { return mat_stop_.load(); });
+        }
+        storage::CheckpointResult r = storage::checkpoint(ck.db, storage_.wal_truncate_pages);
+        if(r.rc != SQLITE_OK && r.rc != SQLITE_BUSY)
+            logf("[CKPT-ERR] Checkpoint failed: %s", sqlite3_errmsg(ck.db));
+        else if(r.truncated)
+            logf("[CKPT] WAL of %d pages copied back and truncated", r.wal_pages);
+    }
+}
+
+/**
+ * @brief Compactor thread: pack segments now and then, sleeping in between.
+ */
+void Server::compact_loop()
+{
+    while(!mat_stop_.load()) {
+        compact_journal();
+        std::unique_lock<std::mutex> lock(mat_mtx_);
+        compact_cv_.wait_for(lock, std::chrono::seconds(JOURNAL_COMPACT_INTERVAL_S), [&] { return mat_stop_.load(); });
+    }
+}
+
+/**
+ * @brief Pack the journal segments that are sealed and applied.
+ * @details A segment qualifies once a newer one exists (it is sealed) and
+ *          all its records are applied: only scans, audits and the journal
+ *          store read it afterwards. Packed segments are packed again once
+ *          retention has passed sessions they kept. Failures are logged and
+ *          retried later.
+ *
+ *          Pairing a segment's events needs the sessions open at its start
+ *          (journal::compact()). They are followed from the first segment
+ *          once, then kept for the segments that may be packed again.
+ */
+void Server::compact_journal()
+{
+    const uint64_t cutoff = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count() - JOURNAL_RETENTION_DAYS * 86400000ull;
+
+    std::vector<journal::SegmentInfo> segs = journal::list_segments(JOURNAL_DIR);
+    for(size_t i = 0; i + 1 < segs.size() && !mat_stop_.load(); i++) {
+        const uint64_t end_lsn = segs[i + 1].first_lsn;
+        if(end_lsn - 1 > applied_lsn_.load()) break;
+        const bool followed = segs[i].first_lsn < compact_lsn_;
+        bool due = !segs[i].packed;
+        if(segs[i].packed) {
+            journal::PackedSegment p;
+            due = p.open(segs[i]) == 0 && p.header().repack_ms <= cutoff;
+            if(!due && !followed) {
+                journal::OpenSessions start = compact_open_;
+                if(journal::track_sessions(segs[i], end_lsn, compact_open_) < 0) {
+                    logf("[COMPACT-ERR] Cannot read %s: %s", segs[i].path.c_str(), strerror(errno));
+                    compact_open_ = std::move(start);
+                    break;
+                }
+                if(p.header().repack_ms != UINT64_MAX) compact_starts_[segs[i].first_lsn] = std::move(start);
+                compact_lsn_ = end_lsn;
+            }
+        }
+        if(!due) continue;
+
+        auto known = compact_starts_.find(segs[i].first_lsn);
+        if(followed && known == compact_starts_.end()) continue;    // never packed again
+        journal::OpenSessions start = followed ? known->second : compact_open_;
+        journal::OpenSessions open = start;
+
+        auto t0 = std::chrono::steady_clock::now();
+        journal::CompactStats st;
+        if(journal::compact(segs[i], end_lsn, cutoff, open, st) < 0) {
+            logf("[COMPACT-ERR] Cannot pack %s: %s", segs[i].path.c_str(), strerror(errno));
+            if(!followed) break;
+            continue;
+        }
+        if(st.repack_ms != UINT64_MAX) compact_starts_[segs[i].first_lsn] = std::move(start);
+        else compact_starts_.erase(segs[i].first_lsn);
+        if(!followed) {
+            compact_open_ = std::move(open);
+            compact_lsn_ = end_lsn;
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        logf("[COMPACT] Packed %s: kept %llu of %llu records (%llu pairs past retention dropped), "
+             "%.1f MB -> %.1f MB in %.2f s",
+             segs[i].path.c_str(), (unsigned long long)st.records_out, (unsigned long long)st.records_in,
+             (unsigned long long)st.pairs_dropped, st.bytes_in / 1048576.0, st.bytes_out / 1048576.0, secs);
+    }
+}
+
+/**
+ * @brief Log what the session store did with one journaled event (materializer thread).
+ * @details Sessions are opened and closed at the event's own time when the
+ *          client sent one (v2), so spooled events replayed after an outage
+ *          are billed for the real parking time; v1 events carry their arrival time.
+ * @param rec Journaled event.
+ * @param a Outcome of SessionStore::apply().
+ */
+void Server::log_applied(const journal::Record &rec, const sessions::Applied &a)
+{
+    unsigned customer_id = rec.device_id;
+    PROBE_CITY_RESOLVED(rec.device_id, a.city_code);
+
+    switch(a.outcome) {
+    case sessions::OPENED:
+        PROBE_SESSION_OPENED(rec.device_id, a.city_code);
+        logf("[DB] Inserted RAW OPEN for customer=%u", customer_id);
+        break;
+    case sessions::ALREADY_OPEN:
+        logf("[DB] Already open record exists for customer=%u at coords %.3f,%.3f",
+             customer_id, rec.x, rec.y);
+        break;
+    case sessions::CLOSED:
+        PROBE_SESSION_CLOSED(rec.device_id, a.minutes, (long)std::lround(a.fee * 100.0));
+        logf("[DB] CLOSED customer=%u minutes=%d fee=%.2f", customer_id, a.minutes, a.fee);
+        break;
+    case sessions::NOT_OPEN:
+        logf("[DB] No open record found to close for customer=%u at coords %.3f,%.3f",
+             customer_id, rec.x, rec.y);
+        break;
+    case sessions::IGNORED:
+        break;
+    }
+}
+
 /**
  * @brief Main server loop to accept clients and process their GPS frames.
  * 
  * The server listens for client connections, sets non-blocking mode, applies
- * TCP keepalive options, and processes GPS frames in a loop. It also handles
- * SIGHUP updates and termination signals.
+ * TCP keepalive options, and journals GPS frames in a loop. It also handles
+ * trace dumps and termination signals; no SQL runs here.
  * 
  * @param listen_fd Listening socket file descriptor.
  */
@@ -489,28 +1557,17 @@ int Server::run_loop(int listen_fd)
     int flags = fcntl(listen_sock.fd, F_GETFL, 0);
     fcntl(listen_sock.fd, F_SETFL, flags | O_NONBLOCK);
 
-    // Load prices initially from shared memory
-    load_prices_from_shm();
-
     /**
     * @brief Main server loop handling incoming client connections and processing GPS frames.
     * This loop continuously accepts new clients on the listening socket, sets
-    * appropriate socket options, and processes GPS frame data. It also checks
-    * for SIGHUP signals to update prices in real-time.
+    * appropriate socket options, and journals their GPS frames. SIGHUP price
+    * updates are applied by the materializer thread.
     */
     while (!SignalHandlerRAII::SigGuard::stop.load()) {
 
-        /**
-        * @brief Check if a price update has been requested via SIGHUP.
-        * If the update flag is set, refresh the database from the prices file
-        * and reload the shared memory cache. Reset the update flag afterward.
-        */
-        if(SignalHandlerRAII::need_update_prices()){
-            logf("[INFO] SIGHUP received: updating prices from file and shared memory...");
-            update_db_from_prices_file(db_.db, prices_cache);
-            load_prices_from_shm();
-            logf("[INFO] Prices update completed.");
-            SignalHandlerRAII::reset_update_flag();
+        /// @brief Dump stage traces if requested via SIGUSR1.
+        if(SignalHandlerRAII::need_dump_trace()){
+            dump_trace();
         }
 
         /** 
@@ -532,7 +1589,6 @@ int Server::run_loop(int listen_fd)
         int cflags = fcntl(client_sock.fd, F_GETFL, 0);
         fcntl(client_sock.fd, F_SETFL, cflags | O_NONBLOCK);
 
-
         /// @brief Enable TCP keep-alive to detect dead peers and avoid stale connections.
         int yes = 1;
         setsockopt(client_sock.fd, SOL_SOCKET, SO_KEEPALIVE, &yes, sizeof(yes));
@@ -547,157 +1603,42 @@ int Server::run_loop(int listen_fd)
         int client_port = ntohs(client_addr.sin_port);
         logf("[INFO] Client connected from %s:%d (fd=%d)", ipbuf, client_port, client_sock.fd);
 
-        /// @brief Inner loop to handle client-specific GPS frames until disconnect or stop.
-        while (!SignalHandlerRAII::SigGuard::stop.load()) {
-
-            /// @brief Real-time check for SIGHUP to update prices while client connected.
-            if(SignalHandlerRAII::need_update_prices()){
-                logf("[INFO] SIGHUP received: updating prices from file and shared memory...");
-                update_db_from_prices_file(db_.db, prices_cache);
-                load_prices_from_shm();
-                logf("[INFO] Prices update completed.");
-                SignalHandlerRAII::reset_update_flag();
-            }
+        /**
+        * @brief Protocol negotiation.
+        *
+        * A v2+ client opens with a 12-byte HELLO and gets the highest version
+        * both sides speak; anything else is the first frame of a v1 client,
+        * which is served as before.
+        */
+        uint8_t first[PP_HELLO_BYTES];
+        uint64_t first_ns = 0;
+        ssize_t n = read_client(client_sock.fd, first, sizeof(first), &first_ns);
+        if(n != (ssize_t)sizeof(first)) {
+            log_read_end(n, ipbuf, client_port, client_sock.fd);
+            continue;
+        }
 
-            /**
-            * @brief Read a GPS frame from the non-blocking client socket.
-            * 
-            * Handles special return values:
-            * - -2: price update requested
-            * - <=0: client disconnected or error
-            */
-            gps_frame raw;
-            ssize_t n = read_n_nonblocking(client_sock.fd, &raw, sizeof(raw));
-
-            if(n == -2) {
-                logf("[INFO] Detected price-update request while client connected. Applying update...");
-                update_db_from_prices_file(db_.db, prices_cache);
-                load_prices_from_shm();
-                logf("[INFO] Prices update completed while client connected.");
-                SignalHandlerRAII::reset_update_flag();
-                // continue to wait for client data
+        uint8_t lo, hi;
+        uint16_t epoch;
+        if(pp_decode_hello(first, &lo, &hi, &epoch) == 0) {
+            int version = hi < PP_VERSION ? hi : PP_VERSION;
+            if(version < lo || version < PP_VERSION_2) {
+                logf("[PROTO-ERR] %s:%d offers protocol v%u..v%u, none supported, closing",
+                     ipbuf, client_port, (unsigned)lo, (unsigned)hi);
                 continue;
             }
-
-            if(n <= 0) {
-                if(n < 0 && (errno != ECONNRESET && errno != EPIPE))
-                    logf("[SOCK-ERR] recv error from %s:%d: %s", ipbuf, client_port, strerror(errno));
-                else
-                    logf("[INFO] Client disconnected from %s:%d (fd=%d)", ipbuf, client_port, client_sock.fd);
-                break;
-            }
-       
-            /// @brief Parse GPS frame and convert coordinates/status to usable format.
-            uint16_t dev_id = ntohs(raw.device_id);
-            uint16_t status = ntohs(raw.status);
-            double x = round3(float_from_big_endian(raw.cord_x));
-            double y = round3(float_from_big_endian(raw.cord_y));
-
-            logf("[RECV] From %s:%d -> ID=%u, X=%.3f, Y=%.3f, STATUS=%u",
-                 ipbuf, client_port, (unsigned)dev_id, x, y, (unsigned)status);
-
-            /// @brief Generate string ID for customer based on device ID.
-            char customer_id[64];
-            snprintf(customer_id, sizeof(customer_id), "%u", (unsigned)dev_id);
-
-            /// @brief Determine city code for the GPS coordinates using prepared statement.
-            int city_code = 0;
-            sqlite3_reset(stmt_find_city_.stmt);
-            sqlite3_clear_bindings(stmt_find_city_.stmt);
-            sqlite3_bind_double(stmt_find_city_.stmt, 1, x);
-            sqlite3_bind_double(stmt_find_city_.stmt, 2, y);
-            int rc = sqlite3_step(stmt_find_city_.stmt);
-            if(rc == SQLITE_ROW) city_code = sqlite3_column_int(stmt_find_city_.stmt, 0);
-
-            /// @brief Handle parking open (status=1) events.
-            if(status == 1) {
-                /// @brief Check if a parking session is already open for this customer/location.
-                sqlite3_reset(stmt_check_open_.stmt);
-                sqlite3_clear_bindings(stmt_check_open_.stmt);
-                sqlite3_bind_text(stmt_check_open_.stmt, 1, customer_id, -1, SQLITE_TRANSIENT);
-                sqlite3_bind_int(stmt_check_open_.stmt, 2, city_code);
-                sqlite3_bind_double(stmt_check_open_.stmt, 3, x);
-                sqlite3_bind_double(stmt_check_open_.stmt, 4, y);
-
-                rc = sqlite3_step(stmt_check_open_.stmt);
-                bool already_open = (rc == SQLITE_ROW);
-
-                /// @brief Insert a new parking session if none exists.
-                if(!already_open) {
-                    sqlite3_reset(stmt_insert_open_.stmt);
-                    sqlite3_clear_bindings(stmt_insert_open_.stmt);
-                    std::string now_str = utils::current_local_time();
-                    sqlite3_bind_text(stmt_insert_open_.stmt, 1, customer_id, -1, SQLITE_TRANSIENT);
-                    sqlite3_bind_int(stmt_insert_open_.stmt, 2, city_code);
-                    sqlite3_bind_double(stmt_insert_open_.stmt, 3, x);
-                    sqlite3_bind_double(stmt_insert_open_.stmt, 4, y);
-                    sqlite3_bind_text(stmt_insert_open_.stmt, 5, now_str.c_str(), -1, SQLITE_TRANSIENT);
-                    rc = sqlite3_step(stmt_insert_open_.stmt);
-                    CHECK_SQL(rc, db_.db, "insert raw open step");
-                    logf("[DB] Inserted RAW OPEN for customer=%s", customer_id);
-                } else {
-                    logf("[DB] Already open record exists for customer=%s at coords %.3f,%.3f",
-                         customer_id, x, y);
-                }
-            /// @brief Handle parking close (status=0) events.
-            } else if(status == 0) {
-                /// @brief Handle closing of an existing parking session.
-                sqlite3_reset(stmt_find_open_.stmt);
-                sqlite3_clear_bindings(stmt_find_open_.stmt);
-                sqlite3_bind_text(stmt_find_open_.stmt, 1, customer_id, -1, SQLITE_TRANSIENT);
-                sqlite3_bind_int(stmt_find_open_.stmt, 2, city_code);
-                sqlite3_bind_double(stmt_find_open_.stmt, 3, x);
-                sqlite3_bind_double(stmt_find_open_.stmt, 4, y);
-
-                rc = sqlite3_step(stmt_find_open_.stmt);
-                if(rc == SQLITE_ROW) {
-                    int rowid = sqlite3_column_int(stmt_find_open_.stmt, 0);
-                    const unsigned char *created_at_text = sqlite3_column_text(stmt_find_open_.stmt, 1);
-
-                    /// @brief Calculate parking duration in minutes from the created_at timestamp.
-                    sqlite3_reset(stmt_minutes_.stmt);
-                    sqlite3_clear_bindings(stmt_minutes_.stmt);
-                    sqlite3_bind_text(stmt_minutes_.stmt, 1, (const char*)created_at_text, -1, SQLITE_TRANSIENT);
-                    rc = sqlite3_step(stmt_minutes_.stmt);
-                    int parking_minutes = 0;
-                    if(rc == SQLITE_ROW) parking_minutes = sqlite3_column_int(stmt_minutes_.stmt, 0);
-
-                    /// @brief Lookup the hourly price from cache or database.
-                    sqlite3_reset(stmt_price_.stmt);
-                    sqlite3_clear_bindings(stmt_price_.stmt);
-                    sqlite3_bind_int(stmt_price_.stmt, 1, city_code);
-                    rc = sqlite3_step(stmt_price_.stmt);
-                    double price_per_hour = (rc==SQLITE_ROW) ? sqlite3_column_double(stmt_price_.stmt,0) : 0.0;
-
-                    if(prices_cache.find(city_code) != prices_cache.end()){
-                        price_per_hour = prices_cache[city_code];
-                    }
-
-                    /// @brief Calculate the ticket fee and update the database.
-                    double ticket_fee = std::round(price_per_hour * parking_minutes / 60.0 * 100.0) / 100.0;
-
-                    sqlite3_reset(stmt_update_close_.stmt);
-                    sqlite3_clear_bindings(stmt_update_close_.stmt);
-                    std::string ended_at_str = utils::current_local_time();
-                    sqlite3_bind_int(stmt_update_close_.stmt, 1, parking_minutes);
-                    sqlite3_bind_double(stmt_update_close_.stmt, 2, ticket_fee);
-                    sqlite3_bind_text(stmt_update_close_.stmt, 3, ended_at_str.c_str(), -1, SQLITE_TRANSIENT);
-                    sqlite3_bind_int(stmt_update_close_.stmt, 4, rowid);
-                    rc = sqlite3_step(stmt_update_close_.stmt);
-                    CHECK_SQL(rc, db_.db, "update close step");
-
-                    logf("[DB] CLOSED customer=%s minutes=%d fee=%.2f",
-                         customer_id, parking_minutes, ticket_fee);
-                    const char *ok = "OK CLOSED\n";
-                    send(client_sock.fd, ok, (int)strlen(ok), 0);
-                } else {
-                    logf("[DB] No open record found to close for customer=%s at coords %.3f,%.3f",
-                         customer_id, x, y);
-                }
+            uint8_t reply[PP_HELLO_BYTES];
+            pp_encode_hello(reply, (uint8_t)version, (uint8_t)version, 0);
+            if(send(client_sock.fd, reply, sizeof(reply), MSG_NOSIGNAL) != (ssize_t)sizeof(reply)) {
+                logf("[SOCK-ERR] HELLO reply to %s:%d failed: %s, closing", ipbuf, client_port, strerror(errno));
+                continue;
             }
+            logf("[INFO] %s:%d speaks protocol v%d, spool epoch %u", ipbuf, client_port, version, (unsigned)epoch);
+            serve_v2(client_sock.fd, ipbuf, client_port, version, epoch);
+        } else {
+            logf("[INFO] %s:%d speaks protocol v1", ipbuf, client_port);
+            serve_v1(client_sock.fd, ipbuf, client_port, first, first_ns);
         }
-        /// @brief Client has disconnected, log info.
-        logf("[INFO] Client disconnected from %s:%d (fd=%d)", ipbuf, client_port, client_sock.fd);
     }
 
     if(SignalHandlerRAII::SigGuard::stop.load()) {
@@ -710,8 +1651,6 @@ int Server::run_loop(int listen_fd)
         }
         logf("[INFO] Terminating due to signal %s", sig_name);
     }
-
-    logf("[INFO] All resources cleaned up, server exiting.");
     return 0;
 }
 
@@ -728,8 +1667,18 @@ int Server::start()
 {
     int rc = init_db();
     if(rc != SQLITE_OK) return rc;
-    rc = prepare_statements();
+    rc = open_store();
     if(rc != SQLITE_OK) return rc;
+    if(storage_.session_store == "sqlite") {
+        archiver_.reset(new archive::Archiver(db_.db, ARCHIVE_DIR));
+        purger_.reset(new retention::Purger(db_.db, ARCHIVE_DIR));
+        vacuum_ = vacuum_due_ = storage::incremental_vacuum(db_.db);
+    }
+    if(recover_journal() < 0) return -1;
+
+    // Load prices initially from shared memory
+    load_prices_from_shm();
+    if(replay_journal() < 0) return -1;
 
     int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
     if(listen_fd < 0) {
@@ -757,5 +1706,27 @@ int Server::start()
     }
 
     logf("[OK] Server listening on port %d...", SERVER_PORT);
-    return run_loop(listen_sock.fd);
+
+    /// @brief From here on only the materializer thread touches the database.
+    if(storage_.wal()) {
+        sqlite3_wal_autocheckpoint(db_.db, 0);
+        checkpointer_ = std::thread(&Server::checkpoint_loop, this);
+    }
+    materializer_ = std::thread(&Server::materialize_loop, this);
+    compactor_ = std::thread(&Server::compact_loop, this);
+    rc = run_loop(listen_sock.fd);
+
+    {
+        std::lock_guard<std::mutex> lock(mat_mtx_);
+        mat_stop_.store(true);
+    }
+    mat_cv_.notify_one();
+    compact_cv_.notify_one();
+    ckpt_cv_.notify_one();
+    materializer_.join();
+    compactor_.join();
+    if(checkpointer_.joinable()) checkpointer_.join();
+
+    logf("[INFO] All resources cleaned up, server exiting.");
+    return rc;
 }
\ No newline at end of file
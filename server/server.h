@@ -2,9 +2,40 @@
 #define SERVER_H
 
 #include <string>
+#include <vector>
+#include <map>
+#include <memory>
 #include <unistd.h>
 #include <atomic>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <sys/types.h>
 #include "sqlite3.h"
+#include "dedup.h"
+#include "journal.h"
+#include "storage.h"
+#include "session_store.h"
+#include "archive.h"
+#include "retention.h"
+
+namespace trace { class FrameTrace; }
+
+/**
+ * @brief One parking event decoded from either protocol version.
+ */
+struct ParkingEvent {
+    uint16_t device_id;
+    uint16_t status;            ///< START (1) or AND (0)
+    uint32_t seq;               ///< Per-device sequence number, 0 for v1
+    uint16_t epoch;             ///< Spool epoch of seq, from the client's HELLO (0 if none)
+    uint64_t event_time_ms;     ///< Unix time of the event in ms (arrival time for v1)
+    bool arrival_time;          ///< event_time_ms is the arrival time (v1, or the client sent 0)
+    double x;                   ///< Latitude, rounded to 3 decimals
+    double y;                   ///< Longitude, rounded to 3 decimals
+};
 
 /**
  * @brief RAII wrapper for sqlite3* database handle.
@@ -36,37 +67,6 @@ struct DBHandle {
     sqlite3* get() const { return db; }
 };
 
-/**
- * @brief RAII wrapper for sqlite3_stmt* statement handle.
- * Ensures the prepared statement is finalized when the object goes out of scope.
- */
-struct StmtHandle {
-    sqlite3_stmt* stmt = nullptr;  /// Pointer to SQLite statement
-
-    /// @brief Destructor finalizes the statement if not null
-    ~StmtHandle() { if(stmt) sqlite3_finalize(stmt); }
-
-    StmtHandle() = default;
-
-    /// @brief Move constructor transfers ownership
-    StmtHandle(StmtHandle&& other) noexcept : stmt(other.stmt) { other.stmt = nullptr; }
-
-    /// @brief Move assignment operator transfers ownership
-    StmtHandle& operator=(StmtHandle&& other) noexcept {
-        if(this != &other) {
-            if(stmt) sqlite3_finalize(stmt);
-            stmt = other.stmt; other.stmt = nullptr;
-        }
-        return *this;
-    }
-
-    StmtHandle(const StmtHandle&) = delete;             /// Copy constructor deleted
-    StmtHandle& operator=(const StmtHandle&) = delete;  /// Copy assignment deleted
-
-    /// @brief Get raw sqlite3_stmt pointer
-    sqlite3_stmt* get() const { return stmt; }
-};
-
 /**
  * @brief RAII wrapper for a socket file descriptor.
  * Ensures the socket is closed when the object goes out of scope.
@@ -117,21 +117,73 @@ public:
 
 private:
     DBHandle db_;                 /// RAII SQLite database handle
-    StmtHandle stmt_insert_open_; /// Statement handle for insert open
+    std::unique_ptr<sessions::SessionStore> store_;  /// Parking sessions (storage.json "session_store")
 
-    /// @brief Additional statements for RAII
-    StmtHandle stmt_check_open_;
-    StmtHandle stmt_find_open_;
-    StmtHandle stmt_minutes_;
-    StmtHandle stmt_price_;
-    StmtHandle stmt_update_close_;
-    StmtHandle stmt_find_city_; 
+    dedup::SeqFilter dedup_;      /// Per-device sequence windows of the journaled events (v2+)
+    uint64_t duplicates_ = 0;     /// Events dropped by dedup_ since start
+
+    journal::Writer journal_;     /// Durable ingest log, written by the connection thread
+    size_t unsynced_ = 0;         /// Records appended since the last journal commit
+    std::string held_replies_;    /// Replies waiting for the next journal commit
+
+    /// @brief Materializer: applies the journal to customer_data in its own thread.
+    std::thread materializer_;
+    std::mutex mat_mtx_;
+    std::condition_variable mat_cv_;
+    std::atomic<bool> mat_stop_{false};
+    std::atomic<uint64_t> applied_lsn_{0};  /// Last journal record applied (written by the materializer thread)
+
+    /// @brief Materializer SQL error handling (storage::classify()); the counters are logged
+    ///        every SQL_REPORT_S while they change, and when it stops.
+    std::vector<std::string> pending_dead_;  /// Dead-letter lines of the open transaction
+    uint64_t sql_retries_ = 0;    /// Transactions rolled back and retried
+    uint64_t sql_retry_ms_ = 0;   /// Time spent waiting before those retries
+    uint64_t sql_stalls_ = 0;     /// Times retry_attempts ran out and the materializer paused
+    uint64_t dead_letters_ = 0;   /// Events written to DEAD_LETTER_FILE
+    std::chrono::steady_clock::time_point sql_report_;  /// Next look at the counters
+    uint64_t sql_reported_ = 0;   /// Retries, pauses and dead letters at the last report
+
+    /// @brief Month archives, moved by the materializer between batches (nullptr: not the sqlite store).
+    std::unique_ptr<archive::Archiver> archiver_;
+    std::chrono::steady_clock::time_point archive_next_;  /// Next look for due sessions
+    std::chrono::steady_clock::time_point archive_pass_start_;
+    uint64_t archive_pass_rows_ = 0;  /// Sessions moved since the archive was last caught up
+    uint64_t archived_ = 0;       /// Sessions moved since start
+
+    /// @brief Retention passes and incremental vacuum, between batches like the archive.
+    std::unique_ptr<retention::Purger> purger_;
+    std::chrono::steady_clock::time_point purge_next_;    /// Next pass
+    std::chrono::steady_clock::time_point purge_pass_start_;
+    std::chrono::steady_clock::time_point purge_report_;  /// Next progress line of a long pass
+    uint64_t purge_pass_rows_ = 0;    /// Sessions deleted in the current pass
+    uint64_t purge_pass_chunks_ = 0;
+    uint64_t purged_ = 0;         /// Sessions deleted since start
+    uint64_t months_dropped_ = 0; /// Archive months removed since start
+    bool vacuum_ = false;         /// data.db is in auto_vacuum=INCREMENTAL mode
+    bool vacuum_due_ = false;     /// Pages may have been freed since the last vacuum
+    uint64_t vacuum_pass_pages_ = 0;
+    uint64_t vacuumed_ = 0;       /// Pages returned to the file system since start
+    uint64_t maint_longest_us_ = 0;   /// Longest maintenance step since start
+
+    /// @brief Compactor: packs sealed, fully applied journal segments in its own thread.
+    std::thread compactor_;
+    std::condition_variable compact_cv_;
+    uint64_t compact_lsn_ = 0;    /// Segments before this LSN are followed in compact_open_
+    journal::OpenSessions compact_open_;    /// Sessions open at compact_lsn_
+    std::map<uint64_t, journal::OpenSessions> compact_starts_;  /// Sessions open at the start of the segments to pack again, by first LSN
+
+    /// @brief Checkpointer: WAL checkpoints on a connection of its own (storage.h).
+    storage::Config storage_;
+    std::thread checkpointer_;
+    std::condition_variable ckpt_cv_;
+
+    std::mutex log_mtx_;          /// Serializes logf() between the two threads
 
     /** @brief Initialize the database, creating tables if necessary */
     int init_db();
 
-    /** @brief Prepare all required SQLite statements */
-    int prepare_statements();
+    /** @brief Create store_ for storage_.session_store and prepare it */
+    int open_store();
 
     /** 
      * @brief Main server loop handling client connections.
@@ -146,6 +198,143 @@ private:
      * @param ... Arguments
      */
     void logf(const char *fmt, ...);
+
+    /** @brief Dump per-frame stage traces as Chrome trace JSON (SIGUSR1). */
+    void dump_trace();
+
+    /** @brief Apply pending SIGHUP/SIGUSR1 requests while a client is connected. */
+    void service_requests();
+
+    /** @brief Read exactly n bytes from a client, serving requests while idle. */
+    ssize_t read_client(int fd, void *buf, size_t n, uint64_t *first_byte_ns);
+
+    /** @brief Log the end of a client read (disconnect or error). */
+    void log_read_end(ssize_t n, const char *ip, int port, int fd);
+
+    /** @brief Serve a protocol v1 client whose first frame was already read. */
+    void serve_v1(int fd, const char *ip, int port, const uint8_t *first, uint64_t first_ns);
+
+    /** @brief Serve a protocol v2+ client after the HELLO exchange. */
+    void serve_v2(int fd, const char *ip, int port, int version, uint16_t epoch);
+
+    /**
+     * @brief Pass an event through the duplicate filter.
+     * @return true if the event must be journaled, false if it already was
+     */
+    bool accept_event(const ParkingEvent &ev, const char *ip, int port);
+
+    /** @brief Log an accepted event and append it to the journal. */
+    void journal_event(const ParkingEvent &ev, int version, int fd, const char *ip, int port);
+
+    /**
+     * @brief Hold a reply until the records before it are durable, then
+     *        commit the journal unless more input is already waiting.
+     * @return 0, or -1 if the connection must be closed
+     */
+    int reply_after_journal(int fd, const void *reply, size_t len, const char *ip, int port,
+                            trace::FrameTrace &ft);
+
+    /**
+     * @brief fdatasync the appended records, wake the materializer and send the held replies.
+     * @return 0, or -1 if the connection must be closed (journal failure also stops the server)
+     */
+    int commit_journal(int fd, const char *ip, int port, trace::FrameTrace *ft);
+
+    /** @brief Send a whole reply, waiting up to REPLY_TIMEOUT_MS for socket space. */
+    int send_reply(int fd, const void *buf, size_t len, const char *ip, int port);
+
+    /**
+     * @brief Load the materializer position and rebuild dedup_ from the journal tail.
+     * @return 0, or -1 if the journal cannot be used
+     */
+    int recover_journal();
+
+    /**
+     * @brief Replay a large journal backlog in parallel before serving clients.
+     * @return 0, or -1 if the journal cannot be read
+     */
+    int replay_journal();
+
+    /**
+     * @brief Apply the next count journal records, up to to_lsn, with
+     *        apply_batch(), which dead-letters the events SQLite rejects
+     *        (replay_journal()).
+     * @return SQLITE_OK, the error of the failed transaction, or SQLITE_IOERR
+     *         if the journal cannot be read (errno set)
+     */
+    int apply_events(size_t count, uint64_t to_lsn);
+
+    /** @brief Materializer thread body: apply journal records until stopped. */
+    void materialize_loop();
+
+    /**
+     * @brief Apply journal records to customer_data in one transaction,
+     *        retrying it while SQLite is busy or failing.
+     * @details Returns without applying them only when the materializer stops.
+     */
+    void materialize(const journal::Record *recs, size_t n);
+
+    /**
+     * @brief One attempt at a materializer transaction. Events SQLite rejects
+     *        are dead-lettered and the rest of the batch is kept.
+     * @return SQLITE_OK, or the error after rolling back
+     */
+    int apply_batch(const journal::Record *recs, size_t n);
+
+    /** @brief Log the SQL error counters if SQL_REPORT_S passed and they changed (or always if final). */
+    void report_sql(bool final);
+
+    /** @brief Queue a rejected record for DEAD_LETTER_FILE, written by apply_batch() before COMMIT. */
+    void dead_letter(const journal::Record &rec, int rc);
+
+    /** @brief Append and fdatasync the queued dead-letter lines. */
+    int write_dead_letters();
+
+    /** @brief Checkpointer thread body: storage::checkpoint() every checkpoint_interval_ms until stopped. */
+    void checkpoint_loop();
+
+    /** @brief Compactor thread body: compact_journal() every JOURNAL_COMPACT_INTERVAL_S until stopped. */
+    void compact_loop();
+
+    /** @brief Pack the journal segments that are sealed and applied (journal::compact()). */
+    void compact_journal();
+
+    /**
+     * @brief Run one archive, retention or vacuum step, the first one due.
+     * @param backlog Journal records waiting to be applied
+     * @return true if a step ran: more may be due right away
+     */
+    bool maintenance_step(uint64_t backlog);
+
+    /**
+     * @brief Move one chunk of old closed sessions to the month archives.
+     * @param rows Set to the sessions moved
+     * @return true if more may be due right away
+     */
+    bool archive_chunk(long &rows);
+
+    /**
+     * @brief Delete the expired sessions of one chunk, or drop an expired archive month.
+     * @param rows Set to the sessions deleted
+     * @return true while a retention pass is under way
+     */
+    bool purge_chunk(long &rows);
+
+    /**
+     * @brief Return vacuum_pages free pages of data.db to the file system.
+     * @param pages Set to the pages freed
+     * @return true while free pages are left
+     */
+    bool vacuum_chunk(long &pages);
+
+    /** @brief Apply a pending SIGHUP price update (materializer thread). */
+    void update_prices();
+
+    /** @brief Read the maintenance keys of storage.json again (SIGHUP, materializer thread). */
+    void reload_maintenance();
+
+    /** @brief Log what store_ did with an event and fire the session probes. */
+    void log_applied(const journal::Record &rec, const sessions::Applied &a);
 };
 
 #endif // SERVER_H
\ No newline at end of file
@@ -0,0 +1,107 @@
+#include "archive.h"
+#include "config.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+/**
+ * @file session_query.cpp
+ * @brief session-query: print the parking sessions of customer_data, with
+ *        the month archives (archive.h) only when asked for.
+ *
+ * Without --from or --all only the hot table is read: open and recent
+ * sessions. --from/--to add the archive months whose sessions ended in that
+ * range; archived sessions are always closed.
+ *
+ * Usage: session-query [--db FILE] [--archive DIR] [--customer ID] [--open]
+ *                      [--from YYYY-MM] [--to YYYY-MM] [--all] [--stats]
+ */
+
+namespace
+{
+    void usage()
+    {
+        std::fprintf(stderr,
+            "Usage: session-query [--db FILE] [--archive DIR] [--customer ID] [--open]\n"
+            "                     [--from YYYY-MM] [--to YYYY-MM] [--all] [--stats]\n"
+            "  --from/--to/--all add archive months (by ended_at) to the hot table\n"
+            "  default FILE is %s, DIR is %s\n", DB_FILE, ARCHIVE_DIR);
+    }
+
+    const char *text(sqlite3_stmt *s, int col)
+    {
+        const unsigned char *t = sqlite3_column_text(s, col);
+        return t ? (const char*)t : "-";
+    }
+}
+
+/**
+ * @brief Entry point of session-query.
+ * @return 0 on success, 1 on bad arguments, 2 if a database cannot be read
+ */
+int main(int argc, char **argv)
+{
+    std::string db_path = DB_FILE, dir = ARCHIVE_DIR, from, to;
+    std::string where;
+    bool stats = false;
+
+    for(int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if(!std::strcmp(argv[i], "--db") && has_value) {
+            db_path = argv[++i];
+        } else if(!std::strcmp(argv[i], "--archive") && has_value) {
+            dir = argv[++i];
+        } else if(!std::strcmp(argv[i], "--customer") && has_value) {
+            char *end = nullptr;
+            long d = std::strtol(argv[++i], &end, 10);
+            if(*end != '\0' || d < 0 || d > 0xFFFF) { usage(); return 1; }
+            where += std::string(where.empty() ? "" : " AND ") + "customer_id='" + std::to_string(d) + "'";
+        } else if(!std::strcmp(argv[i], "--open")) {
+            where += std::string(where.empty() ? "" : " AND ") + "status=1";
+        } else if(!std::strcmp(argv[i], "--from") && has_value) {
+            from = argv[++i];
+        } else if(!std::strcmp(argv[i], "--to") && has_value) {
+            to = argv[++i];
+            if(from.empty()) from = "0000-00";
+        } else if(!std::strcmp(argv[i], "--all")) {
+            from = "0000-00";
+        } else if(!std::strcmp(argv[i], "--stats")) {
+            stats = true;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    sqlite3 *db = nullptr;
+    if(sqlite3_open_v2(db_path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        std::fprintf(stderr, "[ERROR] %s: %s\n", db_path.c_str(), db ? sqlite3_errmsg(db) : "out of memory");
+        sqlite3_close(db);
+        return 2;
+    }
+    sqlite3_busy_timeout(db, 5000);
+
+    unsigned long long rows = 0, open = 0;
+    double fees = 0.0;
+    int rc = archive::query(db, dir, where, from, to, [&](sqlite3_stmt *s) {
+        std::printf("%lld  customer=%s  city=%d  %.3f,%.3f  %-6s  %d min  %.2f  %s -> %s\n",
+                    (long long)sqlite3_column_int64(s, 0), text(s, 1), sqlite3_column_int(s, 2),
+                    sqlite3_column_double(s, 3), sqlite3_column_double(s, 4),
+                    sqlite3_column_int(s, 5) ? "OPEN" : "CLOSED", sqlite3_column_int(s, 6),
+                    sqlite3_column_double(s, 7), text(s, 8), text(s, 9));
+        rows++;
+        open += sqlite3_column_int(s, 5) != 0;
+        fees += sqlite3_column_double(s, 7);
+        return true;
+    });
+    if(rc != SQLITE_OK) {
+        std::fprintf(stderr, "[ERROR] Query failed: %s\n", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return 2;
+    }
+    if(stats)
+        std::fprintf(stderr, "%llu sessions (%llu open), %.2f in fees\n", rows, open, fees);
+    sqlite3_close(db);
+    return 0;
+}
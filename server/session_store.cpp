@@ -0,0 +1,298 @@
+#include "session_store.h"
+#include "stmt_handle.h"
+#include "trace.h"
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <chrono>
+
+namespace
+{
+    void stage_begin(trace::FrameTrace *ft, trace::Stage s) { if(ft) ft->begin(s); }
+    void stage_end(trace::FrameTrace *ft, trace::Stage s) { if(ft) ft->end(s); }
+
+    /**
+     * @brief Sessions in a hash table. Closed sessions are only counted.
+     * @details A transaction keeps an undo log, so a rollback restores the
+     *          sessions the batch opened or closed.
+     */
+    class MemoryStore : public sessions::SessionStore {
+    public:
+        MemoryStore(sqlite3 *db, const std::unordered_map<int,double> *overrides)
+            : db_(db) { prices_.overrides = overrides; }
+
+        const char *name() const override { return "memory"; }
+
+        int prepare() override { return sessions::load_prices(db_, prices_); }
+
+        /// @brief Nothing is kept across runs: start at the end of the journal.
+        int recover(uint64_t durable, uint64_t &applied, dedup::SeqFilter &windows,
+                    uint64_t &windows_lsn) override {
+            (void)windows;
+            applied = durable;
+            windows_lsn = 0;
+            return SQLITE_OK;
+        }
+
+        int begin() override {
+            undo_.clear();
+            next_id_at_begin_ = next_id_;
+            return SQLITE_OK;
+        }
+
+        int commit(uint64_t lsn) override {
+            (void)lsn;
+            undo_.clear();
+            return SQLITE_OK;
+        }
+
+        void rollback() override {
+            for(auto u = undo_.rbegin(); u != undo_.rend(); ++u) {
+                if(u->was_open) open_[u->key] = u->session;
+                else open_.erase(u->key);
+            }
+            undo_.clear();
+            next_id_ = next_id_at_begin_;
+        }
+
+        int prices_changed() override {
+            sessions::Prices prices;
+            prices.overrides = prices_.overrides;
+            int rc = sessions::load_prices(db_, prices);
+            if(rc == SQLITE_OK) prices_ = std::move(prices);
+            return rc;
+        }
+
+    protected:
+        int locate(double x, double y, int &city_code) override {
+            city_code = prices_.city_at(x, y);
+            return SQLITE_OK;
+        }
+
+        int hourly_price(int city_code, double &per_hour) override {
+            per_hour = prices_.hourly(city_code);
+            return SQLITE_OK;
+        }
+
+        int find_open(const journal::Record &r, int city_code, sessions::Open &s, bool &found) override {
+            auto it = open_.find(sessions::key_of(r, city_code));
+            found = it != open_.end();
+            if(found) s = it->second;
+            return SQLITE_OK;
+        }
+
+        int open(const journal::Record &r, int city_code) override {
+            sessions::Key k = sessions::key_of(r, city_code);
+            sessions::Open s;
+            s.id = ++next_id_;
+            s.created_s = sessions::sql_seconds_of_ms(r.event_time_ms);
+            s.has_time = true;
+            open_.emplace(k, s);
+            undo_.push_back({k, sessions::Open(), false});
+            return SQLITE_OK;
+        }
+
+        int close(const sessions::Open &s, const journal::Record &r, int city_code, int minutes, double fee) override {
+            (void)minutes;
+            (void)fee;
+            sessions::Key k = sessions::key_of(r, city_code);
+            open_.erase(k);
+            undo_.push_back({k, s, true});
+            return SQLITE_OK;
+        }
+
+    private:
+        /// @brief Change to undo on rollback: a session opened, or closed (was_open).
+        struct Undo {
+            sessions::Key key;
+            sessions::Open session;
+            bool was_open;
+        };
+
+        sqlite3 *db_;
+        sessions::Prices prices_;
+        std::unordered_map<sessions::Key, sessions::Open, sessions::KeyHash> open_;
+        std::vector<Undo> undo_;
+        int64_t next_id_ = 0;
+        int64_t next_id_at_begin_ = 0;
+    };
+
+    /// @brief The memory store, rebuilt from the whole journal at startup.
+    class JournalStore : public MemoryStore {
+    public:
+        using MemoryStore::MemoryStore;
+
+        const char *name() const override { return "journal"; }
+
+        int recover(uint64_t durable, uint64_t &applied, dedup::SeqFilter &windows,
+                    uint64_t &windows_lsn) override {
+            (void)durable;
+            (void)windows;
+            applied = 0;
+            windows_lsn = 0;
+            return SQLITE_OK;
+        }
+    };
+}
+
+namespace sessions
+{
+    int Prices::city_at(double x, double y) const
+    {
+        for(const City &c : cities)
+            if(std::fabs(c.lat - x) < 0.0001 && std::fabs(c.lng - y) < 0.0001) return c.code;
+        return 0;
+    }
+
+    double Prices::hourly(int city) const
+    {
+        if(overrides) {
+            auto o = overrides->find(city);
+            if(o != overrides->end()) return o->second;
+        }
+        auto p = per_hour.find(city);
+        return p != per_hour.end() ? p->second : 0.0;
+    }
+
+    int load_prices(sqlite3 *db, Prices &prices)
+    {
+        StmtHandle q;
+        int rc = sqlite3_prepare_v2(db, "SELECT city_code, gps_lat, gps_lng, price_per_hour FROM prices ORDER BY rowid;",
+                                    -1, &q.stmt, nullptr);
+        if(rc != SQLITE_OK) return rc;
+        while((rc = sqlite3_step(q.stmt)) == SQLITE_ROW) {
+            int code = sqlite3_column_int(q.stmt, 0);
+            if(sqlite3_column_type(q.stmt, 1) != SQLITE_NULL && sqlite3_column_type(q.stmt, 2) != SQLITE_NULL)
+                prices.cities.push_back({code, sqlite3_column_double(q.stmt, 1), sqlite3_column_double(q.stmt, 2)});
+            prices.per_hour.emplace(code, sqlite3_column_double(q.stmt, 3));
+        }
+        return rc == SQLITE_DONE ? SQLITE_OK : rc;
+    }
+
+    Key key_of(const journal::Record &r, int city)
+    {
+        return Key{r.device_id, city, std::lround(r.x * 1000.0), std::lround(r.y * 1000.0)};
+    }
+
+    bool sql_seconds(const char *text, int64_t &out)
+    {
+        struct tm tm_buf{};
+        if(!text || sscanf(text, "%d-%d-%d %d:%d:%d", &tm_buf.tm_year, &tm_buf.tm_mon, &tm_buf.tm_mday,
+                           &tm_buf.tm_hour, &tm_buf.tm_min, &tm_buf.tm_sec) != 6)
+            return false;
+        tm_buf.tm_year -= 1900;
+        tm_buf.tm_mon -= 1;
+        out = (int64_t)timegm(&tm_buf);
+        return true;
+    }
+
+    int64_t sql_seconds_of_ms(uint64_t ms)
+    {
+        time_t sec = (time_t)(ms / 1000);
+        struct tm tm_buf;
+        localtime_r(&sec, &tm_buf);
+        return (int64_t)timegm(&tm_buf);
+    }
+
+    int SessionStore::apply(const journal::Record &r, Applied &out, trace::FrameTrace *ft)
+    {
+        out = Applied();
+        stage_begin(ft, trace::STAGE_CITY);
+        int rc = locate(r.x, r.y, out.city_code);
+        stage_end(ft, trace::STAGE_CITY);
+        if(rc != SQLITE_OK || (r.status != 1 && r.status != 0)) return rc;
+
+        Open s;
+        bool found = false;
+        stage_begin(ft, trace::STAGE_CHECK_OPEN);
+        rc = find_open(r, out.city_code, s, found);
+        stage_end(ft, trace::STAGE_CHECK_OPEN);
+        if(rc != SQLITE_OK) return rc;
+
+        if(r.status == 1) {
+            if(found) {
+                out.outcome = ALREADY_OPEN;
+                return SQLITE_OK;
+            }
+            stage_begin(ft, trace::STAGE_SQL_STEP);
+            rc = open(r, out.city_code);
+            stage_end(ft, trace::STAGE_SQL_STEP);
+            if(rc == SQLITE_OK) out.outcome = OPENED;
+            return rc;
+        }
+
+        if(!found) {
+            out.outcome = NOT_OPEN;
+            return SQLITE_OK;
+        }
+
+        // Duration from the session's start to the close event, fee at the hourly price
+        stage_begin(ft, trace::STAGE_SQL_STEP);
+        if(s.has_time) out.minutes = (int)((sql_seconds_of_ms(r.event_time_ms) - s.created_s) / 60);
+        double per_hour = 0.0;
+        rc = hourly_price(out.city_code, per_hour);
+        if(rc == SQLITE_OK) {
+            out.fee = std::round(per_hour * out.minutes / 60.0 * 100.0) / 100.0;
+            rc = close(s, r, out.city_code, out.minutes, out.fee);
+        }
+        stage_end(ft, trace::STAGE_SQL_STEP);
+        if(rc == SQLITE_OK) out.outcome = CLOSED;
+        return rc;
+    }
+
+    int SessionStore::bulk_apply(const replay::Options &opt,
+                                 const std::function<void(const replay::Progress&)> &progress,
+                                 replay::Stats &stats)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        auto elapsed = [&] {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        };
+
+        journal::Reader reader;
+        reader.open(opt.dir, opt.segment_bytes, opt.from_lsn);
+        std::vector<journal::Record> recs(opt.chunk_records > 0 ? opt.chunk_records : 1);
+        const uint64_t total = opt.to_lsn >= opt.from_lsn ? opt.to_lsn - opt.from_lsn + 1 : 0;
+        stats = replay::Stats();
+        stats.applied_lsn = opt.from_lsn - 1;
+        int rc = SQLITE_OK;
+
+        while(reader.next_lsn() <= opt.to_lsn) {
+            int n = reader.read(recs.data(), recs.size(), opt.to_lsn);
+            if(n <= 0) {
+                rc = SQLITE_IOERR;
+                break;
+            }
+
+            rc = begin();
+            for(int i = 0; i < n && rc == SQLITE_OK; i++) {
+                Applied a;
+                rc = apply(recs[i], a, nullptr);
+                stats.opened += a.outcome == OPENED;
+                stats.closed += a.outcome == CLOSED;
+                stats.already_open += a.outcome == ALREADY_OPEN;
+                stats.unmatched += a.outcome == NOT_OPEN;
+            }
+            if(rc == SQLITE_OK) rc = commit(recs[n - 1].lsn);
+            if(rc != SQLITE_OK) {
+                rollback();
+                break;
+            }
+
+            stats.applied_lsn = recs[n - 1].lsn;
+            stats.records += (uint64_t)n;
+            if(progress) progress({stats.records, total, elapsed()});
+        }
+        stats.seconds = elapsed();
+        return rc;
+    }
+
+    std::unique_ptr<SessionStore> make_store(const std::string &backend, sqlite3 *db,
+                                             const std::unordered_map<int,double> *overrides)
+    {
+        if(backend == "sqlite") return make_sqlite_store(db, overrides);
+        if(backend == "memory") return std::unique_ptr<SessionStore>(new MemoryStore(db, overrides));
+        if(backend == "journal") return std::unique_ptr<SessionStore>(new JournalStore(db, overrides));
+        return nullptr;
+    }
+}
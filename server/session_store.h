@@ -0,0 +1,203 @@
+#ifndef SESSION_STORE_H
+#define SESSION_STORE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include "sqlite3.h"
+#include "dedup.h"
+#include "journal.h"
+#include "replay.h"
+
+namespace trace { class FrameTrace; }
+
+/**
+ * @file session_store.h
+ * @brief Where parking sessions are kept, behind one interface.
+ *
+ * SessionStore::apply() holds the session rules: a START opens a session
+ * unless one is open for the customer at that spot, an END closes the open
+ * one and bills it. The backends only find, open and close sessions inside
+ * transactions of the materializer:
+ *
+ *   - "sqlite": customer_data in data.db. Sequence windows and the applied
+ *     position are stored in the same transaction; a large backlog is
+ *     replayed in parallel (replay.h).
+ *   - "memory": open sessions in a hash table, closed ones only counted.
+ *     Starts empty at the end of the journal, and does no disk I/O while
+ *     running: for capacity tests.
+ *   - "journal": the memory store, rebuilt from the whole journal at startup.
+ *     The journal is its only persistence.
+ *
+ * All backends return SQLite result codes. The prices table is read from
+ * data.db whatever the backend.
+ */
+namespace sessions
+{
+    /// @brief One row of the prices table.
+    struct City {
+        int code;
+        double lat;
+        double lng;
+    };
+
+    /// @brief The prices table, looked up the way the SQLite backend's statements do.
+    struct Prices {
+        std::vector<City> cities;                   ///< Rows with coordinates, in rowid order
+        std::unordered_map<int,double> per_hour;    ///< First price of each city_code
+        const std::unordered_map<int,double> *overrides = nullptr;  ///< Prices from shared memory
+
+        /// @brief City at a coordinate, 0 if none.
+        int city_at(double x, double y) const;
+
+        /// @brief Hourly price of a city: the shared memory cache, then the table.
+        double hourly(int city) const;
+    };
+
+    /**
+     * @brief Read the prices table.
+     * @return SQLITE_OK or the SQLite error code
+     */
+    int load_prices(sqlite3 *db, Prices &prices);
+
+    /// @brief What identifies an open session: customer, city and coordinates.
+    struct Key {
+        uint16_t device;
+        int city;
+        long lat;       ///< Coordinates in 1e-3 degrees (events are rounded to 3 decimals)
+        long lng;
+        bool operator==(const Key &o) const {
+            return device == o.device && city == o.city && lat == o.lat && lng == o.lng;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &k) const {
+            uint64_t h = (uint64_t)k.device * 0x9E3779B97F4A7C15ull;
+            h ^= (uint64_t)(uint32_t)k.city + 0x7F4A7C159E3779B9ull + (h << 6) + (h >> 2);
+            h ^= (uint64_t)k.lat * 0xC2B2AE3D27D4EB4Full + (h << 6) + (h >> 2);
+            h ^= (uint64_t)k.lng * 0x165667B19E3779F9ull + (h << 6) + (h >> 2);
+            return (size_t)h;
+        }
+    };
+
+    /// @brief Key of an event's session.
+    Key key_of(const journal::Record &r, int city);
+
+    /**
+     * @brief Seconds of a "YYYY-MM-DD HH:MM:SS[.sss]" time the way SQLite's
+     *        strftime('%s') reads it: the fields as UTC, fraction dropped.
+     */
+    bool sql_seconds(const char *text, int64_t &out);
+
+    /// @brief sql_seconds() of utils::local_time_from_ms(ms), without the text.
+    int64_t sql_seconds_of_ms(uint64_t ms);
+
+    /// @brief An open session as find_open() returns it.
+    struct Open {
+        int64_t id = 0;             ///< Backend's id (rowid in customer_data)
+        int64_t created_s = 0;      ///< Start time as sql_seconds() reads it
+        bool has_time = false;      ///< created_s is known
+    };
+
+    /// @brief What apply() did with an event.
+    enum Outcome {
+        OPENED,                     ///< START opened a session
+        ALREADY_OPEN,               ///< START found its session open
+        CLOSED,                     ///< END closed a session
+        NOT_OPEN,                   ///< END found no open session
+        IGNORED                     ///< Neither START nor END
+    };
+
+    struct Applied {
+        Outcome outcome = IGNORED;
+        int city_code = 0;
+        int minutes = 0;            ///< CLOSED: billed duration
+        double fee = 0.0;           ///< CLOSED: ticket fee
+    };
+
+    class SessionStore {
+    public:
+        virtual ~SessionStore() = default;
+
+        /// @brief Backend name as selected in storage.json.
+        virtual const char *name() const = 0;
+
+        /**
+         * @brief Prepare statements or load tables, once at startup.
+         * @return SQLITE_OK or the SQLite error code
+         */
+        virtual int prepare() = 0;
+
+        /**
+         * @brief Position to resume from and the ingest sequence windows it implies.
+         * @param durable Last LSN in the journal
+         * @param applied Set to the last LSN the store holds
+         * @param windows Loaded with the windows of the events up to windows_lsn
+         * @param windows_lsn Set to the LSN the windows are current to; the
+         *        server reads the journal after it to complete them
+         * @return SQLITE_OK or the SQLite error code
+         */
+        virtual int recover(uint64_t durable, uint64_t &applied, dedup::SeqFilter &windows,
+                            uint64_t &windows_lsn) = 0;
+
+        /// @brief Transaction around a batch; commit() stores lsn as the applied position.
+        virtual int begin() = 0;
+        virtual int commit(uint64_t lsn) = 0;
+        virtual void rollback() = 0;
+
+        /**
+         * @brief Apply one event inside a transaction.
+         * @param ft Stage trace of the event, nullptr for none
+         * @return SQLITE_OK, or the error of the first step that failed
+         */
+        virtual int apply(const journal::Record &r, Applied &out, trace::FrameTrace *ft);
+
+        /// @brief True if rc failed only this event and the transaction can go on without it.
+        virtual bool rejected(int rc) const { (void)rc; return false; }
+
+        /**
+         * @brief Apply a large startup backlog, opt.from_lsn..opt.to_lsn, in
+         *        transactions of opt.chunk_records.
+         * @return SQLITE_OK, the SQLite error code, or SQLITE_IOERR if the
+         *         journal cannot be read (errno set)
+         */
+        virtual int bulk_apply(const replay::Options &opt,
+                               const std::function<void(const replay::Progress&)> &progress,
+                               replay::Stats &stats);
+
+        /// @brief The prices table or the shared memory prices changed (SIGHUP).
+        virtual int prices_changed() { return SQLITE_OK; }
+
+    protected:
+        /// @brief City code of a position (0: unknown).
+        virtual int locate(double x, double y, int &city_code) = 0;
+
+        /// @brief Hourly price of a city.
+        virtual int hourly_price(int city_code, double &per_hour) = 0;
+
+        virtual int find_open(const journal::Record &r, int city_code, Open &s, bool &found) = 0;
+        virtual int open(const journal::Record &r, int city_code) = 0;
+        virtual int close(const Open &s, const journal::Record &r, int city_code, int minutes, double fee) = 0;
+    };
+
+    /**
+     * @brief Create a backend.
+     * @param backend "sqlite", "memory" or "journal"
+     * @param db data.db, for the prices table (and customer_data for "sqlite")
+     * @param overrides Prices from shared memory, consulted before the table
+     * @return nullptr for an unknown backend
+     */
+    std::unique_ptr<SessionStore> make_store(const std::string &backend, sqlite3 *db,
+                                             const std::unordered_map<int,double> *overrides);
+
+    /// @brief The "sqlite" backend (sqlite_store.cpp).
+    std::unique_ptr<SessionStore> make_sqlite_store(sqlite3 *db,
+                                                    const std::unordered_map<int,double> *overrides);
+}
+
+#endif // SESSION_STORE_H
@@ -0,0 +1,220 @@
+#include "session_store.h"
+#include "stmt_handle.h"
+#include "storage.h"
+#include "probes.h"
+#include "utils.h"
+
+namespace
+{
+    /**
+     * @brief Run sqlite3_step wrapped in the sql_step_start/sql_step_done USDT probes.
+     * @param stmt Prepared statement.
+     * @param which SqlProbeStmt identifier reported to the probes.
+     * @return The sqlite3_step result code.
+     */
+    inline int probed_step(sqlite3_stmt *stmt, int which)
+    {
+        PROBE_SQL_STEP_START(which);
+        int rc = sqlite3_step(stmt);
+        PROBE_SQL_STEP_DONE(which, rc);
+        (void)which;
+        return rc;
+    }
+
+    /**
+     * @brief Sessions in customer_data, one prepared statement per step.
+     * @details The sequence windows of the applied events (ingest_hwm) and
+     *          journal_state.applied_lsn are written in the transaction of
+     *          the events, so a restart resumes exactly after the last
+     *          applied record.
+     */
+    class SqliteStore : public sessions::SessionStore {
+    public:
+        SqliteStore(sqlite3 *db, const std::unordered_map<int,double> *overrides)
+            : db_(db), overrides_(overrides) {}
+
+        const char *name() const override { return "sqlite"; }
+
+        int prepare() override {
+            const struct { StmtHandle *handle; const char *sql; } stmts[] = {
+                {&insert_open_,
+                 "INSERT INTO customer_data "
+                 "(customer_id, city_code, gps_lat, gps_lng, status , parking_duration_minutes, ticket_fee, created_at)"
+                 "VALUES (?1, ?2, ?3, ?4, 1, 0, 0.0, ?5);"},
+                {&find_open_,
+                 "SELECT rowid, created_at FROM customer_data WHERE customer_id=?1 AND city_code=?2 "
+                 "AND ABS(gps_lat - ?3)<0.0001 AND ABS(gps_lng - ?4)<0.0001 AND status=1 "
+                 "ORDER BY created_at DESC LIMIT 1;"},
+                {&price_,
+                 "SELECT price_per_hour FROM prices WHERE city_code=?1 LIMIT 1;"},
+                {&update_close_,
+                 "UPDATE customer_data SET status=0, parking_duration_minutes=?1, ticket_fee=?2, ended_at=?3 "
+                 "WHERE rowid=?4;"},
+                {&find_city_,
+                 "SELECT city_code FROM prices WHERE ABS(gps_lat - ?1)<0.0001 "
+                 "AND ABS(gps_lng - ?2)<0.0001 LIMIT 1;"},
+                {&applied_lsn_,
+                 "UPDATE journal_state SET applied_lsn=?1 WHERE id=0;"},
+            };
+            for(const auto &st : stmts) {
+                int rc = sqlite3_prepare_v2(db_, st.sql, -1, &st.handle->stmt, nullptr);
+                if(rc != SQLITE_OK) return rc;
+            }
+            return SQLITE_OK;
+        }
+
+        int recover(uint64_t durable, uint64_t &applied, dedup::SeqFilter &windows,
+                    uint64_t &windows_lsn) override {
+            (void)durable;
+            StmtHandle q;
+            int rc = sqlite3_prepare_v2(db_, "SELECT applied_lsn FROM journal_state WHERE id=0;", -1, &q.stmt, nullptr);
+            if(rc != SQLITE_OK) return rc;
+            applied = 0;
+            if(sqlite3_step(q.stmt) == SQLITE_ROW) applied = (uint64_t)sqlite3_column_int64(q.stmt, 0);
+
+            rc = windows_.load(db_);
+            if(rc == SQLITE_OK) rc = windows.load(db_);
+            windows_lsn = applied;
+            return rc;
+        }
+
+        int begin() override { return sqlite3_exec(db_, "BEGIN;", nullptr, nullptr, nullptr); }
+
+        int commit(uint64_t lsn) override {
+            reset_lookups();
+            int rc = windows_.flush(db_);
+            if(rc == SQLITE_OK) {
+                sqlite3_reset(applied_lsn_.stmt);
+                sqlite3_bind_int64(applied_lsn_.stmt, 1, (sqlite3_int64)lsn);
+                rc = sqlite3_step(applied_lsn_.stmt);
+                if(rc == SQLITE_DONE) rc = SQLITE_OK;
+            }
+            if(rc == SQLITE_OK) rc = sqlite3_exec(db_, "COMMIT;", nullptr, nullptr, nullptr);
+            if(rc == SQLITE_OK) windows_.committed();
+            return rc;
+        }
+
+        void rollback() override {
+            reset_lookups();
+            sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, nullptr);
+        }
+
+        int apply(const journal::Record &r, sessions::Applied &out, trace::FrameTrace *ft) override {
+            if(r.seq) (void)windows_.check(r.device_id, r.seq, r.epoch);
+            return SessionStore::apply(r, out, ft);
+        }
+
+        /// @brief Each event is a single write, and a rejected statement is
+        ///        undone on its own: the transaction goes on without the event.
+        bool rejected(int rc) const override {
+            return storage::classify(rc) == storage::EVENT && !sqlite3_get_autocommit(db_);
+        }
+
+        int bulk_apply(const replay::Options &opt,
+                       const std::function<void(const replay::Progress&)> &progress,
+                       replay::Stats &stats) override {
+            return replay::run(db_, opt, windows_, progress, stats);
+        }
+
+    protected:
+        int locate(double x, double y, int &city_code) override {
+            sqlite3_reset(find_city_.stmt);
+            sqlite3_clear_bindings(find_city_.stmt);
+            sqlite3_bind_double(find_city_.stmt, 1, x);
+            sqlite3_bind_double(find_city_.stmt, 2, y);
+            int rc = probed_step(find_city_.stmt, SQL_PROBE_FIND_CITY);
+            city_code = rc == SQLITE_ROW ? sqlite3_column_int(find_city_.stmt, 0) : 0;
+            return rc == SQLITE_ROW || rc == SQLITE_DONE ? SQLITE_OK : rc;
+        }
+
+        int hourly_price(int city_code, double &per_hour) override {
+            sqlite3_reset(price_.stmt);
+            sqlite3_clear_bindings(price_.stmt);
+            sqlite3_bind_int(price_.stmt, 1, city_code);
+            int rc = probed_step(price_.stmt, SQL_PROBE_PRICE);
+            if(rc != SQLITE_ROW && rc != SQLITE_DONE) return rc;
+            per_hour = rc == SQLITE_ROW ? sqlite3_column_double(price_.stmt, 0) : 0.0;
+
+            if(overrides_) {
+                auto o = overrides_->find(city_code);
+                if(o != overrides_->end()) per_hour = o->second;
+            }
+            return SQLITE_OK;
+        }
+
+        int find_open(const journal::Record &r, int city_code, sessions::Open &s, bool &found) override {
+            char customer_id[16];
+            snprintf(customer_id, sizeof(customer_id), "%u", (unsigned)r.device_id);
+            sqlite3_reset(find_open_.stmt);
+            sqlite3_clear_bindings(find_open_.stmt);
+            sqlite3_bind_text(find_open_.stmt, 1, customer_id, -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int(find_open_.stmt, 2, city_code);
+            sqlite3_bind_double(find_open_.stmt, 3, r.x);
+            sqlite3_bind_double(find_open_.stmt, 4, r.y);
+
+            int rc = probed_step(find_open_.stmt, r.status == 1 ? SQL_PROBE_CHECK_OPEN : SQL_PROBE_FIND_OPEN);
+            if(rc != SQLITE_ROW && rc != SQLITE_DONE) return rc;
+            found = rc == SQLITE_ROW;
+            if(found) {
+                s.id = sqlite3_column_int64(find_open_.stmt, 0);
+                s.has_time = sessions::sql_seconds((const char*)sqlite3_column_text(find_open_.stmt, 1), s.created_s);
+            }
+            return SQLITE_OK;
+        }
+
+        int open(const journal::Record &r, int city_code) override {
+            char customer_id[16];
+            snprintf(customer_id, sizeof(customer_id), "%u", (unsigned)r.device_id);
+            std::string created_at = utils::local_time_from_ms(r.event_time_ms);
+            sqlite3_reset(insert_open_.stmt);
+            sqlite3_clear_bindings(insert_open_.stmt);
+            sqlite3_bind_text(insert_open_.stmt, 1, customer_id, -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int(insert_open_.stmt, 2, city_code);
+            sqlite3_bind_double(insert_open_.stmt, 3, r.x);
+            sqlite3_bind_double(insert_open_.stmt, 4, r.y);
+            sqlite3_bind_text(insert_open_.stmt, 5, created_at.c_str(), -1, SQLITE_TRANSIENT);
+            int rc = probed_step(insert_open_.stmt, SQL_PROBE_INSERT_OPEN);
+            return rc == SQLITE_DONE ? SQLITE_OK : rc;
+        }
+
+        int close(const sessions::Open &s, const journal::Record &r, int city_code, int minutes, double fee) override {
+            (void)city_code;
+            std::string ended_at = utils::local_time_from_ms(r.event_time_ms);
+            sqlite3_reset(update_close_.stmt);
+            sqlite3_clear_bindings(update_close_.stmt);
+            sqlite3_bind_int(update_close_.stmt, 1, minutes);
+            sqlite3_bind_double(update_close_.stmt, 2, fee);
+            sqlite3_bind_text(update_close_.stmt, 3, ended_at.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int64(update_close_.stmt, 4, s.id);
+            int rc = probed_step(update_close_.stmt, SQL_PROBE_UPDATE_CLOSE);
+            return rc == SQLITE_DONE ? SQLITE_OK : rc;
+        }
+
+    private:
+        /// @brief A lookup left on SQLITE_ROW would keep its read snapshot open
+        ///        after COMMIT, and no checkpoint could copy the WAL past it.
+        void reset_lookups() {
+            for(StmtHandle *st : {&find_city_, &find_open_, &price_})
+                sqlite3_reset(st->stmt);
+        }
+
+        sqlite3 *db_;
+        const std::unordered_map<int,double> *overrides_;
+        StmtHandle insert_open_;
+        StmtHandle find_open_;
+        StmtHandle price_;
+        StmtHandle update_close_;
+        StmtHandle find_city_;
+        StmtHandle applied_lsn_;
+        dedup::SeqFilter windows_;  ///< Sequence windows of the applied events, stored in ingest_hwm
+    };
+}
+
+namespace sessions
+{
+    std::unique_ptr<SessionStore> make_sqlite_store(sqlite3 *db,
+                                                    const std::unordered_map<int,double> *overrides)
+    {
+        return std::unique_ptr<SessionStore>(new SqliteStore(db, overrides));
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef STMT_HANDLE_H
+#define STMT_HANDLE_H
+
+#include "sqlite3.h"
+
+/**
+ * @file stmt_handle.h
+ * @brief The prepared statement handle shared by the server sources.
+ */
+
+/**
+ * @brief RAII wrapper for sqlite3_stmt* statement handle.
+ * Ensures the prepared statement is finalized when the object goes out of scope.
+ */
+struct StmtHandle {
+    sqlite3_stmt* stmt = nullptr;  /// Pointer to SQLite statement
+
+    /// @brief Destructor finalizes the statement if not null
+    ~StmtHandle() { if(stmt) sqlite3_finalize(stmt); }
+
+    StmtHandle() = default;
+
+    /// @brief Move constructor transfers ownership
+    StmtHandle(StmtHandle&& other) noexcept : stmt(other.stmt) { other.stmt = nullptr; }
+
+    /// @brief Move assignment operator transfers ownership
+    StmtHandle& operator=(StmtHandle&& other) noexcept {
+        if(this != &other) {
+            if(stmt) sqlite3_finalize(stmt);
+            stmt = other.stmt; other.stmt = nullptr;
+        }
+        return *this;
+    }
+
+    StmtHandle(const StmtHandle&) = delete;             /// Copy constructor deleted
+    StmtHandle& operator=(const StmtHandle&) = delete;  /// Copy assignment deleted
+
+    /// @brief Get raw sqlite3_stmt pointer
+    sqlite3_stmt* get() const { return stmt; }
+};
+
+#endif // STMT_HANDLE_H
@@ -0,0 +1,188 @@
+#include "storage.h"
+#include "utils.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+    /// @brief Copy a string setting if it is one of the allowed values (upper case).
+    bool get_choice(const char *json, const char *key, const char *const *allowed,
+                    std::string &out, std::string &problem)
+    {
+        char buf[32];
+        if(!utils::json_get_string(json, key, buf, sizeof(buf))) return true;
+        for(char *p = buf; *p; p++) *p = (char)toupper((unsigned char)*p);
+        for(; *allowed; allowed++) {
+            if(strcmp(buf, *allowed) == 0) {
+                out = buf;
+                return true;
+            }
+        }
+        problem = std::string(key) + "=\"" + buf + "\" is not valid";
+        return false;
+    }
+
+    /// @brief Copy a numeric setting if it is within [lo, hi].
+    bool get_number(const char *json, const char *key, long lo, long hi, long &out, std::string &problem)
+    {
+        long v;
+        if(!utils::json_get_long(json, key, &v)) return true;
+        if(v < lo || v > hi) {
+            problem = std::string(key) + "=" + std::to_string(v) + " is out of range";
+            return false;
+        }
+        out = v;
+        return true;
+    }
+
+    /// @brief First column of a one-row pragma as text.
+    std::string pragma_value(sqlite3 *db, const char *pragma)
+    {
+        std::string sql = std::string("PRAGMA ") + pragma + ";";
+        sqlite3_stmt *stmt = nullptr;
+        std::string value = "?";
+        if(sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK &&
+           sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_text(stmt, 0))
+            value = (const char*)sqlite3_column_text(stmt, 0);
+        sqlite3_finalize(stmt);
+        return value;
+    }
+}
+
+namespace storage
+{
+    bool load_config(const char *path, Config &cfg, std::string &problem)
+    {
+        std::ifstream f(path);
+        if(!f.is_open()) return true;
+        std::stringstream ss;
+        ss << f.rdbuf();
+        const std::string text = ss.str();
+        const char *json = text.c_str();
+
+        static const char *const journal_modes[] = {"WAL", "DELETE", nullptr};
+        static const char *const sync_modes[] = {"OFF", "NORMAL", "FULL", "EXTRA", nullptr};
+        static const char *const temp_stores[] = {"DEFAULT", "FILE", "MEMORY", nullptr};
+        static const char *const session_stores[] = {"SQLITE", "MEMORY", "JOURNAL", nullptr};
+        static const char *const vacuum_modes[] = {"NONE", "INCREMENTAL", nullptr};
+
+        /// @brief Every key is checked even after a bad one; problem keeps the first.
+        std::string p;
+        bool ok = true;
+        auto keep = [&](bool key_ok) {
+            if(!key_ok && ok) problem = p;
+            ok = ok && key_ok;
+        };
+        keep(get_choice(json, "journal_mode", journal_modes, cfg.journal_mode, p));
+        keep(get_choice(json, "synchronous", sync_modes, cfg.synchronous, p));
+        keep(get_number(json, "cache_size_kb", 0, 16L * 1024 * 1024, cfg.cache_size_kb, p));
+        keep(get_number(json, "mmap_size_mb", 0, 1L << 20, cfg.mmap_size_mb, p));
+        keep(get_choice(json, "temp_store", temp_stores, cfg.temp_store, p));
+        keep(get_number(json, "busy_timeout_ms", 0, 600000, cfg.busy_timeout_ms, p));
+        keep(get_number(json, "checkpoint_interval_ms", 10, 3600000, cfg.checkpoint_interval_ms, p));
+        keep(get_number(json, "wal_truncate_pages", 0, 1L << 30, cfg.wal_truncate_pages, p));
+        keep(get_number(json, "retry_attempts", 0, 1000, cfg.retry_attempts, p));
+        keep(get_number(json, "retry_backoff_ms", 1, 60000, cfg.retry_backoff_ms, p));
+        keep(get_number(json, "retry_backoff_max_ms", 1, 600000, cfg.retry_backoff_max_ms, p));
+        keep(get_choice(json, "session_store", session_stores, cfg.session_store, p));
+        keep(get_number(json, "archive_after_days", 0, 36500, cfg.archive_after_days, p));
+        keep(get_number(json, "archive_chunk_rows", 1, 100000, cfg.archive_chunk_rows, p));
+        keep(get_number(json, "archive_interval_ms", 10, 86400000, cfg.archive_interval_ms, p));
+        keep(get_number(json, "retention_days", 0, 36500, cfg.retention_days, p));
+        keep(get_number(json, "retention_chunk_rows", 1, 100000, cfg.retention_chunk_rows, p));
+        keep(get_number(json, "retention_interval_ms", 10, 86400000, cfg.retention_interval_ms, p));
+        keep(get_choice(json, "auto_vacuum", vacuum_modes, cfg.auto_vacuum, p));
+        keep(get_number(json, "vacuum_pages", 1, 1L << 20, cfg.vacuum_pages, p));
+        keep(get_number(json, "maintenance_backlog", 0, 1L << 30, cfg.maintenance_backlog, p));
+
+        /// @brief Backend names are lower case (sessions::make_store()).
+        for(char &c : cfg.session_store) c = (char)tolower((unsigned char)c);
+        return ok;
+    }
+
+    int apply(sqlite3 *db, const Config &cfg, std::string &effective)
+    {
+        /// @brief Values are whitelisted or numeric (load_config()), so they can be formatted in.
+        char sql[512];
+        snprintf(sql, sizeof(sql),
+                 "PRAGMA auto_vacuum=%s;"
+                 "PRAGMA journal_mode=%s;"
+                 "PRAGMA synchronous=%s;"
+                 "PRAGMA cache_size=-%ld;"
+                 "PRAGMA mmap_size=%lld;"
+                 "PRAGMA temp_store=%s;",
+                 cfg.auto_vacuum.c_str(), cfg.journal_mode.c_str(), cfg.synchronous.c_str(), cfg.cache_size_kb,
+                 (long long)cfg.mmap_size_mb * 1024 * 1024, cfg.temp_store.c_str());
+        int rc = sqlite3_exec(db, sql, nullptr, nullptr, nullptr);
+        if(rc != SQLITE_OK) return rc;
+        rc = sqlite3_busy_timeout(db, (int)cfg.busy_timeout_ms);
+        if(rc != SQLITE_OK) return rc;
+
+        effective = "journal_mode=" + pragma_value(db, "journal_mode") +
+                    " synchronous=" + pragma_value(db, "synchronous") +
+                    " cache_size=" + pragma_value(db, "cache_size") +
+                    " mmap_size=" + pragma_value(db, "mmap_size") +
+                    " temp_store=" + pragma_value(db, "temp_store") +
+                    " busy_timeout=" + std::to_string(cfg.busy_timeout_ms) +
+                    " auto_vacuum=" + pragma_value(db, "auto_vacuum");
+        return SQLITE_OK;
+    }
+
+    Failure classify(int rc)
+    {
+        switch(rc & 0xFF) {
+        case SQLITE_BUSY:
+        case SQLITE_LOCKED:
+            return TRANSIENT;
+        case SQLITE_CONSTRAINT:
+        case SQLITE_MISMATCH:
+        case SQLITE_TOOBIG:
+        case SQLITE_RANGE:
+            return EVENT;
+        default:
+            return STORAGE;
+        }
+    }
+
+    long backoff_ms(const Config &cfg, long attempt)
+    {
+        long ms = cfg.retry_backoff_ms;
+        for(long i = 0; i < attempt && ms < cfg.retry_backoff_max_ms; i++) ms *= 2;
+        return ms < cfg.retry_backoff_max_ms ? ms : cfg.retry_backoff_max_ms;
+    }
+
+    CheckpointResult checkpoint(sqlite3 *db, long truncate_pages)
+    {
+        CheckpointResult r;
+        r.rc = sqlite3_wal_checkpoint_v2(db, nullptr, SQLITE_CHECKPOINT_PASSIVE, &r.wal_pages, &r.copied_pages);
+        if(r.rc != SQLITE_OK || r.wal_pages < truncate_pages || r.copied_pages < r.wal_pages) return r;
+
+        int log = 0, copied = 0;
+        int rc = sqlite3_wal_checkpoint_v2(db, nullptr, SQLITE_CHECKPOINT_TRUNCATE, &log, &copied);
+        if(rc == SQLITE_OK) r.truncated = true;
+        else if(rc != SQLITE_BUSY) r.rc = rc;
+        return r;
+    }
+
+    bool incremental_vacuum(sqlite3 *db)
+    {
+        return pragma_value(db, "auto_vacuum") == "2";
+    }
+
+    VacuumResult vacuum_step(sqlite3 *db, long pages)
+    {
+        VacuumResult r;
+        long before = atol(pragma_value(db, "freelist_count").c_str());
+        if(before > 0) {
+            std::string sql = "PRAGMA incremental_vacuum(" + std::to_string(pages) + ");";
+            r.rc = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr);
+        }
+        r.free_pages = atol(pragma_value(db, "freelist_count").c_str());
+        if(r.rc == SQLITE_OK && before > r.free_pages) r.freed_pages = before - r.free_pages;
+        return r;
+    }
+}
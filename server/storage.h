@@ -0,0 +1,170 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <string>
+#include "sqlite3.h"
+
+/**
+ * @file storage.h
+ * @brief SQLite storage tuning: connection pragmas from a runtime config
+ *        file, and the WAL checkpoint policy.
+ *
+ * The settings are read from STORAGE_CONFIG_FILE (JSON, every key
+ * optional) at startup:
+ *
+ *     {
+ *       "journal_mode": "WAL",            WAL or DELETE
+ *       "synchronous": "NORMAL",          OFF, NORMAL, FULL or EXTRA
+ *       "cache_size_kb": 65536,
+ *       "mmap_size_mb": 256,
+ *       "temp_store": "MEMORY",           DEFAULT, FILE or MEMORY
+ *       "busy_timeout_ms": 5000,
+ *       "checkpoint_interval_ms": 1000,
+ *       "wal_truncate_pages": 16384,
+ *       "retry_attempts": 8,
+ *       "retry_backoff_ms": 5,
+ *       "retry_backoff_max_ms": 1000,
+ *       "session_store": "sqlite",        sqlite, memory or journal
+ *       "archive_after_days": 30,         0 keeps every session in customer_data
+ *       "archive_chunk_rows": 500,
+ *       "archive_interval_ms": 60000,
+ *       "retention_days": 0,              0 keeps every closed session
+ *       "retention_chunk_rows": 2000,
+ *       "retention_interval_ms": 600000,
+ *       "auto_vacuum": "INCREMENTAL",     NONE or INCREMENTAL, for a new data.db
+ *       "vacuum_pages": 256,
+ *       "maintenance_backlog": 1024
+ *     }
+ *
+ * In WAL mode readers (show_db.sh, reports) no longer block the
+ * materializer or get SQLITE_BUSY from it. The event journal, not SQLite,
+ * is the durability point, so synchronous=NORMAL is enough: a transaction
+ * lost to a power cut is applied again from the journal.
+ *
+ * Once clients are served, automatic checkpoints are turned off on the
+ * writer connection and a checkpoint thread takes over (checkpoint()): a
+ * PASSIVE checkpoint every checkpoint_interval_ms, which never waits for the
+ * writer, and a TRUNCATE checkpoint once the WAL has grown past
+ * wal_truncate_pages and is fully copied back, which holds the writer lock
+ * only while the file is truncated.
+ *
+ * Errors of the materializer are sorted by classify(). SQLITE_BUSY and
+ * SQLITE_LOCKED that the busy timeout does not absorb (a writer that holds
+ * the lock longer, a stale WAL snapshot) are retried up to retry_attempts
+ * times with a doubling backoff; errors of one event are dead-lettered;
+ * anything else stalls the materializer, never ingestion, until it clears.
+ *
+ * session_store selects where the materializer keeps the parking sessions
+ * (session_store.h). Only "sqlite" writes customer_data; the pragmas and
+ * the checkpoint thread apply whatever the store.
+ *
+ * With the sqlite store, sessions closed more than archive_after_days ago
+ * are moved to month archives (archive.h), archive_chunk_rows at a time;
+ * it looks for due sessions every archive_interval_ms. Sessions closed more
+ * than retention_days ago are deleted (retention.h), retention_chunk_rows
+ * rowids at a time, in a pass every retention_interval_ms. The pages they
+ * leave free are returned to the file system vacuum_pages at a time
+ * (vacuum_step()) and the checkpoint thread is woken to shrink data.db.
+ *
+ * This maintenance runs in the materializer thread between journal batches,
+ * one bounded chunk at a time, and only while at most maintenance_backlog
+ * journal records wait to be applied: events always come first. Its keys
+ * (archive_*, retention_*, vacuum_pages and maintenance_backlog) are read
+ * again on SIGHUP.
+ *
+ * auto_vacuum only takes effect when data.db is created. A file created
+ * without it keeps its free pages for reuse and never shrinks until it is
+ * converted with a VACUUM while the server is stopped.
+ */
+namespace storage
+{
+    /// @brief Storage settings; the initializers are the defaults.
+    struct Config {
+        std::string journal_mode = "WAL";
+        std::string synchronous = "NORMAL";
+        long cache_size_kb = 65536;
+        long mmap_size_mb = 256;
+        std::string temp_store = "MEMORY";
+        long busy_timeout_ms = 5000;
+        long checkpoint_interval_ms = 1000;
+        long wal_truncate_pages = 16384;
+        long retry_attempts = 8;
+        long retry_backoff_ms = 5;
+        long retry_backoff_max_ms = 1000;
+        std::string session_store = "sqlite";
+        long archive_after_days = 30;
+        long archive_chunk_rows = 500;
+        long archive_interval_ms = 60000;
+        long retention_days = 0;
+        long retention_chunk_rows = 2000;
+        long retention_interval_ms = 600000;
+        std::string auto_vacuum = "INCREMENTAL";
+        long vacuum_pages = 256;
+        long maintenance_backlog = 1024;
+
+        bool wal() const { return journal_mode == "WAL"; }
+    };
+
+    /**
+     * @brief Read path over the defaults in cfg; a missing file keeps them.
+     * @param problem Set to a description of the first invalid value
+     * @return false if a value is invalid (it keeps its default, the rest is read)
+     */
+    bool load_config(const char *path, Config &cfg, std::string &problem);
+
+    /**
+     * @brief Apply cfg to the writer connection.
+     * @param effective Set to the settings SQLite reports back
+     * @return SQLITE_OK or the SQLite error code
+     */
+    int apply(sqlite3 *db, const Config &cfg, std::string &effective);
+
+    /// @brief What a failed materializer transaction calls for.
+    enum Failure {
+        TRANSIENT,      ///< Lock contention: roll back, back off, retry
+        EVENT,          ///< The data of an event (constraint, type, size): dead-letter it
+        STORAGE         ///< Disk full, I/O, corruption, read-only: retry until it clears
+    };
+
+    /// @brief Sort a SQLite result code that is not OK, ROW or DONE.
+    Failure classify(int rc);
+
+    /// @brief Wait before retry attempt (0-based): retry_backoff_ms doubled per attempt, capped.
+    long backoff_ms(const Config &cfg, long attempt);
+
+    /// @brief Outcome of one checkpoint() call.
+    struct CheckpointResult {
+        int rc = SQLITE_OK;
+        int wal_pages = 0;              ///< Frames in the WAL
+        int copied_pages = 0;           ///< Frames copied back into the database
+        bool truncated = false;         ///< The WAL file was truncated
+    };
+
+    /**
+     * @brief One round of the checkpoint policy on a connection of its own.
+     * @details PASSIVE first; TRUNCATE only if the WAL holds at least
+     *          truncate_pages frames and PASSIVE copied them all. A busy
+     *          TRUNCATE is left for the next round.
+     */
+    CheckpointResult checkpoint(sqlite3 *db, long truncate_pages);
+
+    /// @brief data.db is in auto_vacuum=INCREMENTAL mode.
+    bool incremental_vacuum(sqlite3 *db);
+
+    /// @brief Outcome of one vacuum_step() call.
+    struct VacuumResult {
+        int rc = SQLITE_OK;
+        long freed_pages = 0;           ///< Pages returned to the file system
+        long free_pages = 0;            ///< Free pages left in the file
+    };
+
+    /**
+     * @brief Return at most pages free pages to the file system
+     *        (PRAGMA incremental_vacuum), in a transaction of its own.
+     * @details The file shrinks in WAL mode once the next checkpoint has
+     *          copied the change back.
+     */
+    VacuumResult vacuum_step(sqlite3 *db, long pages);
+}
+
+#endif // STORAGE_H
@@ -0,0 +1,126 @@
+#include "trace.h"
+#include "config.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdio>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace
+{
+    /// @brief Stage names as shown in the trace viewer.
+    const char *const STAGE_NAMES[trace::STAGE_COUNT] = {
+        "recv", "decode", "city_lookup", "open_check", "sql_step", "journal", "ack_send"
+    };
+
+    /// @brief One completed stage span.
+    struct TraceEvent {
+        uint64_t frame_id;
+        uint64_t start_ns;
+        uint32_t dur_ns;
+        uint8_t  stage;
+    };
+
+    /**
+     * @brief Ring buffer of events written by exactly one thread.
+     *
+     * The owner publishes with a release store on head; the dumper reads
+     * head with acquire and copies the newest slots. A slot overwritten
+     * while being dumped can appear torn, which is acceptable for a
+     * diagnostic trace.
+     */
+    struct ThreadBuffer {
+        long tid = 0;
+        std::atomic<uint64_t> head{0};
+        TraceEvent events[TRACE_BUFFER_EVENTS];
+    };
+
+    std::mutex registry_mtx;
+    std::vector<std::unique_ptr<ThreadBuffer>> registry;   /// Buffers outlive their threads
+
+    thread_local ThreadBuffer *tls_buffer = nullptr;
+    thread_local uint64_t tls_frames = 0;
+
+    /// @brief Get (and lazily register) the calling thread's buffer.
+    ThreadBuffer *local_buffer()
+    {
+        if(!tls_buffer) {
+            auto buf = std::make_unique<ThreadBuffer>();
+            buf->tid = (long)syscall(SYS_gettid);
+            std::lock_guard<std::mutex> lock(registry_mtx);
+            tls_buffer = buf.get();
+            registry.push_back(std::move(buf));
+        }
+        return tls_buffer;
+    }
+}
+
+namespace trace
+{
+
+uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+FrameTrace::FrameTrace()
+    : sampled_(false), frame_id_(tls_frames++), start_{}, end_{}
+{
+    if(TRACE_SAMPLE_EVERY > 0 && frame_id_ % TRACE_SAMPLE_EVERY == 0)
+        sampled_ = true;
+}
+
+FrameTrace::~FrameTrace()
+{
+    if(!sampled_) return;
+
+    ThreadBuffer *buf = local_buffer();
+    uint64_t h = buf->head.load(std::memory_order_relaxed);
+    for(int s = 0; s < STAGE_COUNT; ++s) {
+        if(start_[s] == 0 || end_[s] < start_[s]) continue;   // stage not reached
+        TraceEvent &ev = buf->events[h % TRACE_BUFFER_EVENTS];
+        ev.frame_id = frame_id_;
+        ev.start_ns = start_[s];
+        ev.dur_ns   = (uint32_t)(end_[s] - start_[s]);
+        ev.stage    = (uint8_t)s;
+        ++h;
+    }
+    buf->head.store(h, std::memory_order_release);
+}
+
+long dump_chrome_json(const char *path)
+{
+    FILE *f = std::fopen(path, "w");
+    if(!f) return -1;
+
+    long written = 0;
+    std::fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    std::lock_guard<std::mutex> lock(registry_mtx);
+    for(const auto &buf : registry) {
+        uint64_t h = buf->head.load(std::memory_order_acquire);
+        uint64_t first = h > TRACE_BUFFER_EVENTS ? h - TRACE_BUFFER_EVENTS : 0;
+        for(uint64_t i = first; i < h; ++i) {
+            const TraceEvent &ev = buf->events[i % TRACE_BUFFER_EVENTS];
+            if(ev.stage >= STAGE_COUNT) continue;
+            std::fprintf(f,
+                "%s\n{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":%d,\"tid\":%ld,"
+                "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%llu}}",
+                written ? "," : "", STAGE_NAMES[ev.stage], (int)getpid(), buf->tid,
+                ev.start_ns / 1000.0, ev.dur_ns / 1000.0, (unsigned long long)ev.frame_id);
+            ++written;
+        }
+    }
+
+    std::fprintf(f, "\n]}\n");
+    if(std::fclose(f) != 0) return -1;
+    return written;
+}
+
+} // namespace trace
@@ -0,0 +1,77 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @file trace.h
+ * @brief Lightweight per-frame stage tracing.
+ *
+ * Every TRACE_SAMPLE_EVERY-th frame handled by a thread is traced: each
+ * processing stage records a CLOCK_MONOTONIC_RAW start/end pair into a
+ * fixed-size ring buffer owned by that thread. Buffers can be dumped as
+ * Chrome trace JSON (chrome://tracing, ui.perfetto.dev) on demand.
+ */
+namespace trace
+{
+    /// @brief Processing stages of a single frame, in pipeline order.
+    enum Stage : uint8_t {
+        STAGE_RECV = 0,     ///< Socket recv, from first byte to full frame
+        STAGE_DECODE,       ///< Byte order conversion and rounding
+        STAGE_CITY,         ///< City lookup by coordinates
+        STAGE_CHECK_OPEN,   ///< Open-session check / lookup
+        STAGE_SQL_STEP,     ///< Insert/update step in SQLite
+        STAGE_JOURNAL,      ///< Journal append and group fdatasync
+        STAGE_ACK,          ///< Acknowledge send to the client
+        STAGE_COUNT
+    };
+
+    /// @brief Current CLOCK_MONOTONIC_RAW time in nanoseconds.
+    uint64_t now_ns();
+
+    /**
+     * @brief Trace state for one frame.
+     *
+     * Cheap to construct when the frame is not sampled: all calls become
+     * a single branch. Spans are flushed into the calling thread's buffer
+     * when the object goes out of scope.
+     */
+    class FrameTrace {
+    public:
+        FrameTrace();
+        ~FrameTrace();
+
+        FrameTrace(const FrameTrace&) = delete;             /// Copy constructor deleted
+        FrameTrace& operator=(const FrameTrace&) = delete;  /// Copy assignment deleted
+
+        /// @brief True if this frame is being recorded.
+        bool sampled() const { return sampled_; }
+
+        /// @brief Mark the start of a stage.
+        void begin(Stage s) { if(sampled_) start_[s] = now_ns(); }
+
+        /// @brief Mark the end of a stage.
+        void end(Stage s) { if(sampled_) end_[s] = now_ns(); }
+
+        /// @brief Record a stage with an externally captured start time.
+        void span(Stage s, uint64_t start, uint64_t stop) {
+            if(sampled_) { start_[s] = start; end_[s] = stop; }
+        }
+
+    private:
+        bool sampled_;
+        uint64_t frame_id_;
+        uint64_t start_[STAGE_COUNT];
+        uint64_t end_[STAGE_COUNT];
+    };
+
+    /**
+     * @brief Write all per-thread buffers as Chrome trace JSON.
+     * @param path Output file path.
+     * @return Number of events written, or -1 on error.
+     */
+    long dump_chrome_json(const char *path);
+}
+
+#endif // TRACE_H
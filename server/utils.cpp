@@ -1,4 +1,5 @@
 #include "utils.h"
+#include "stmt_handle.h"
 
 #include <cstring>
 #include <cctype>
@@ -6,36 +7,6 @@
 #include <cstdio>
 #include <ctime>
 
-/**
- * @brief RAII wrapper for sqlite3_stmt* (statement handle).
- * Ensures that sqlite3_finalize is called automatically.
- */
-struct StmtHandle {
-    sqlite3_stmt* stmt = nullptr;  /// Pointer to SQLite statement
-
-    /// @brief Destructor finalizes the statement if not null
-    ~StmtHandle() { if(stmt) sqlite3_finalize(stmt); }
-
-    StmtHandle() = default;
-
-    /// @brief Move constructor transfers ownership
-    StmtHandle(StmtHandle&& other) noexcept : stmt(other.stmt) { other.stmt = nullptr; }
-
-    /// @brief Move assignment operator transfers ownership
-    StmtHandle& operator=(StmtHandle&& other) noexcept {
-        if(this != &other) {
-            if(stmt) sqlite3_finalize(stmt);
-            stmt = other.stmt; other.stmt = nullptr;
-        }
-        return *this;
-    }
-    StmtHandle(const StmtHandle&) = delete;             /// Copy constructor deleted
-    StmtHandle& operator=(const StmtHandle&) = delete;  /// Copy assignment deleted
-
-    /// @brief Get raw sqlite3_stmt pointer
-    sqlite3_stmt* get() const { return stmt; }
-};
-
 /**
  * @brief RAII wrapper for sqlite3_exec error message.
  * Ensures that sqlite3_free is called automatically.
@@ -178,13 +149,18 @@ std::string current_local_time()
 {
     struct timespec ts;
     clock_gettime(CLOCK_REALTIME, &ts);
+    return local_time_from_ms((uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000);
+}
+
+std::string local_time_from_ms(uint64_t ms)
+{
+    time_t sec = (time_t)(ms / 1000);
     struct tm tm_buf;
-    localtime_r(&ts.tv_sec, &tm_buf);
+    localtime_r(&sec, &tm_buf);
     char buf[64];
-    int ms = (int)(ts.tv_nsec / 1000000);
     std::snprintf(buf, sizeof(buf), "%04d-%02d-%02d %02d:%02d:%02d.%03d",
         tm_buf.tm_year+1900, tm_buf.tm_mon+1, tm_buf.tm_mday,
-        tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec, ms);
+        tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec, (int)(ms % 1000));
     return std::string(buf);
 }
 
@@ -226,6 +202,36 @@ int init_db_schema_and_seed(sqlite3 *db)
     rc = sqlite3_exec(db, sql_customer_create, nullptr, nullptr, errmsg.ptr());
     CHECK_SQL(rc, db, "create customer_data");
 
+    /* Per-device sequence window of the duplicate filter (dedup.h) */
+    const char *sql_hwm_create =
+        "CREATE TABLE IF NOT EXISTS ingest_hwm ("
+        "  device_id INTEGER PRIMARY KEY,"
+        "  hwm INTEGER NOT NULL,"
+        "  seen INTEGER NOT NULL,"
+        "  epoch INTEGER NOT NULL DEFAULT 0"
+        ");";
+    rc = sqlite3_exec(db, sql_hwm_create, nullptr, nullptr, errmsg.ptr());
+    CHECK_SQL(rc, db, "create ingest_hwm");
+
+    /* Spool epochs (dedup.h) came after ingest_hwm: add the column to older databases */
+    sqlite3_stmt *probe = nullptr;
+    if(sqlite3_prepare_v2(db, "SELECT epoch FROM ingest_hwm LIMIT 0;", -1, &probe, nullptr) != SQLITE_OK) {
+        rc = sqlite3_exec(db, "ALTER TABLE ingest_hwm ADD COLUMN epoch INTEGER NOT NULL DEFAULT 0;",
+                          nullptr, nullptr, errmsg.ptr());
+        CHECK_SQL(rc, db, "add ingest_hwm.epoch");
+    }
+    sqlite3_finalize(probe);
+
+    /* Last journal record applied to customer_data (journal.h) */
+    const char *sql_journal_state_create =
+        "CREATE TABLE IF NOT EXISTS journal_state ("
+        "  id INTEGER PRIMARY KEY CHECK (id = 0),"
+        "  applied_lsn INTEGER NOT NULL"
+        ");"
+        "INSERT OR IGNORE INTO journal_state (id, applied_lsn) VALUES (0, 0);";
+    rc = sqlite3_exec(db, sql_journal_state_create, nullptr, nullptr, errmsg.ptr());
+    CHECK_SQL(rc, db, "create journal_state");
+
     struct City{ const char *name; int code; double lat; double lng; double price; };
     City cities[] = {
         {"Rishon Lezion", 8300, 31.962, 34.802, 5.0},
@@ -4,9 +4,11 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstddef>
+#include <cstdint>
 #include "sqlite3.h"
 #include <string>
 #include <ctime>
+#include <unistd.h>
 
 
 /**
@@ -33,7 +35,9 @@
  * @param msg Message to display on error.
  * 
  * If the return code indicates an error, prints the message and SQLite error,
- * waits for Enter key, closes the database, and exits the program.
+ * waits for Enter key when run from a terminal, closes the database, and exits
+ * the program. Only for setup steps; the server's materializer handles its
+ * errors itself (storage::classify()).
  */
 #define CHECK_SQL(rc, db, msg)                                                                 \
     do                                                                                         \
@@ -41,8 +45,11 @@
         if ((rc) != SQLITE_OK && (rc) != SQLITE_DONE && (rc) != SQLITE_ROW)                    \
         {                                                                                      \
             fprintf(stderr, "[SQL-ERR] %s: rc=%d, msg=%s\n", (msg), (rc), sqlite3_errmsg(db)); \
-            fprintf(stderr, "Press Enter to exit...");                                         \
-            (void)getchar();                                                                   \
+            if (isatty(STDIN_FILENO))                                                          \
+            {                                                                                  \
+                fprintf(stderr, "Press Enter to exit...");                                     \
+                (void)getchar();                                                               \
+            }                                                                                  \
             if (db)                                                                            \
                 sqlite3_close(db);                                                             \
             exit(1);                                                                           \
@@ -88,6 +95,9 @@ namespace utils
 
     // Return current local time in YYYY-MM-DD HH:MM:SS.sss format
     std::string current_local_time();
+
+    // Return a Unix time in milliseconds as local time in the same format
+    std::string local_time_from_ms(uint64_t ms);
 }
 
 #endif // UTILS_H
\ No newline at end of file
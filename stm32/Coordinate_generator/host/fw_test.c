@@ -0,0 +1,222 @@
+/*
+ * fw_test.c
+ *
+ *  Host test of the frame queue and the I2C2 transmit state machine,
+ *  driven through the HAL stub the way the BeagleBone master would drive
+ *  them. Built once per I2C_BURST_MODE by "make test". Prints the checks
+ *  that failed and the frames per second the queue and callbacks sustain
+ *  on this host; exits 1 if a check failed.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "hal_stub.h"
+#include "frame_queue.h"
+#include "I2C_Coordinate_generator.h"
+
+#define RATE_FRAMES 2000000     // frames pushed through for the rate report
+
+static int checks, failures;
+
+static void check(int ok, const char *what){
+	checks++;
+	if (!ok){
+		failures++;
+		printf("FAIL %s\n", what);
+	}
+}
+
+static gps_frame make_frame(uint32_t i){
+	gps_frame f;
+	f.device_id = (uint16_t)(1000 + i);
+	f.cord_x = 32.0f + (float)i / 1024.0f;
+	f.cord_y = 34.0f - (float)i / 2048.0f;
+	f.status = (uint16_t)(i & 1);
+	return f;
+}
+
+static int same_frame(const gps_frame *a, const gps_frame *b){
+	return memcmp(a, b, sizeof(gps_frame)) == 0;
+}
+
+/* Frame in a transmit buffer: the firmware sends it byte-reversed. */
+static gps_frame wire_frame(const uint8_t *p){
+	gps_frame f;
+	memcpy(&f, p, sizeof(f));
+	SwapEndian((uint8_t *)&f, sizeof(f));
+	return f;
+}
+
+static void test_queue(void){
+	static frame_queue q;
+	frame_queue_init(&q);
+
+	/* fill, then the next push is dropped and counted */
+	int ok = 1;
+	for (uint32_t i = 0; i < FRAME_QUEUE_SIZE; i++){
+		gps_frame f = make_frame(i);
+		ok = ok && frame_queue_push(&q, &f) == 0;
+	}
+	check(ok && frame_queue_count(&q) == FRAME_QUEUE_SIZE, "queue: fills to FRAME_QUEUE_SIZE");
+	gps_frame extra = make_frame(999);
+	check(frame_queue_push(&q, &extra) == -1 && q.dropped == 1 && frame_queue_count(&q) == FRAME_QUEUE_SIZE,
+	      "queue: push to a full queue is dropped and counted");
+	check(frame_queue_peek(&q, 0)->device_id == 1000 &&
+	      frame_queue_peek(&q, FRAME_QUEUE_SIZE - 1)->device_id == 1000 + FRAME_QUEUE_SIZE - 1,
+	      "queue: the dropped frame did not overwrite the oldest");
+
+	/* wrap around the slots and the free-running counters */
+	frame_queue_init(&q);
+	q.head = q.tail = 0xFFFFFFFFu - FRAME_QUEUE_SIZE / 2;
+	uint32_t next_in = 0, next_out = 0;
+	ok = 1;
+	for (int round = 0; round < 10; round++){
+		while (frame_queue_count(&q) < FRAME_QUEUE_SIZE - 3){
+			gps_frame f = make_frame(next_in++);
+			ok = ok && frame_queue_push(&q, &f) == 0;
+		}
+		uint32_t n = frame_queue_count(&q) - 5;
+		for (uint32_t i = 0; i < n; i++){
+			gps_frame f = make_frame(next_out + i);
+			ok = ok && same_frame(frame_queue_peek(&q, i), &f);
+		}
+		frame_queue_pop(&q, n);
+		next_out += n;
+	}
+	check(ok && frame_queue_count(&q) == next_in - next_out && q.dropped == 0,
+	      "queue: frames come out in order across the slot and counter wrap");
+}
+
+/* Queue frames [from, from + n) through the firmware API. */
+static void queue_frames(uint32_t from, uint32_t n){
+	for (uint32_t i = 0; i < n; i++){
+		gps_frame f = make_frame(from + i);
+		I2C2_Queue_Frame(&f);
+	}
+}
+
+/* Let data-ready stay low long enough for a new edge, then service the queue. */
+static void next_edge(void){
+	hal_stub_advance(DATA_READY_LOW_MS);
+	I2C2_Service();
+}
+
+#if I2C_BURST_MODE
+static void test_transmit(void){
+	uint8_t buf[BURST_BYTES];
+	I2C2_Queue_Init();
+	hal_stub_advance(DATA_READY_LOW_MS);
+
+	check(!hal_stub_data_ready() && hal_stub_armed() == 0, "burst: idle with an empty queue");
+
+	const uint32_t total = BURST_MAX * 2 + 3;
+	queue_frames(0, total);
+	check(hal_stub_data_ready() && hal_stub_armed() == BURST_BYTES, "burst: a queued frame arms a burst and raises data-ready");
+
+	/* aborted read: the same frames are armed again on the next edge */
+	hal_stub_master_abort();
+	check(!hal_stub_data_ready() && I2C2_Queued() == total, "burst: an abort keeps the frames and releases data-ready");
+	next_edge();
+	check(hal_stub_data_ready() && hal_stub_armed() == BURST_BYTES, "burst: re-armed after an abort");
+
+	/* the master drains the queue with data-ready high throughout */
+	uint32_t next = 0;
+	int ok = 1, high = 1;
+	while (hal_stub_armed()){
+		hal_stub_master_read(buf, sizeof(buf));
+		const burst_hdr *h = (const burst_hdr *)buf;
+		uint32_t pending = ((uint32_t)h->pending_hi << 8) | h->pending_lo;
+		ok = ok && h->magic == BURST_MAGIC && h->count <= BURST_MAX && next + h->count + pending == total;
+		for (uint8_t i = 0; ok && i < h->count; i++){
+			gps_frame f = make_frame(next + i);
+			gps_frame got = wire_frame(buf + sizeof(burst_hdr) + i * sizeof(gps_frame));
+			ok = same_frame(&got, &f);
+		}
+		next += h->count;
+		if (I2C2_Queued() > 0)
+			high = high && hal_stub_data_ready();
+	}
+	check(ok && next == total, "burst: frames, counts and pending are right");
+	check(high, "burst: data-ready stays high while frames are queued");
+	check(!hal_stub_data_ready() && I2C2_Queued() == 0, "burst: data-ready released once the queue is empty");
+}
+#else
+static void test_transmit(void){
+	uint8_t buf[sizeof(gps_frame)];
+	I2C2_Queue_Init();
+	hal_stub_advance(DATA_READY_LOW_MS);
+
+	check(!hal_stub_data_ready() && hal_stub_armed() == 0, "single: idle with an empty queue");
+
+	const uint32_t total = 10;
+	queue_frames(0, total);
+	check(hal_stub_data_ready() && hal_stub_armed() == sizeof(gps_frame), "single: a queued frame arms it and raises data-ready");
+
+	/* aborted read: the same frame is armed again on the next edge */
+	hal_stub_master_abort();
+	check(!hal_stub_data_ready() && I2C2_Queued() == total, "single: an abort keeps the frame and releases data-ready");
+	next_edge();
+	check(hal_stub_data_ready() && hal_stub_armed() == sizeof(gps_frame), "single: re-armed after an abort");
+
+	/* one frame per edge; data-ready comes back while frames are queued */
+	uint32_t next = 0;
+	int ok = 1, edges = 1;
+	while (hal_stub_armed()){
+		hal_stub_master_read(buf, sizeof(buf));
+		gps_frame f = make_frame(next++);
+		gps_frame got = wire_frame(buf);
+		ok = ok && same_frame(&got, &f);
+		ok = ok && !hal_stub_data_ready();
+		if (I2C2_Queued() > 0){
+			next_edge();
+			edges = edges && hal_stub_data_ready();
+		}
+	}
+	check(ok && next == total, "single: frames come out in order, data-ready low after each");
+	check(edges, "single: a new edge while frames are queued");
+	check(!hal_stub_data_ready() && I2C2_Queued() == 0, "single: data-ready stays low once the queue is empty");
+}
+#endif
+
+/* Frames per second through I2C2_Queue_Frame() and the master reads. */
+static void report_rate(void){
+#if I2C_BURST_MODE
+	uint8_t buf[BURST_BYTES];
+	const uint32_t batch = BURST_MAX * 4;
+#else
+	uint8_t buf[sizeof(gps_frame)];
+	const uint32_t batch = 1;
+#endif
+	struct timespec t0, t1;
+	I2C2_Queue_Init();
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	uint32_t read = 0;
+	while (read < RATE_FRAMES){
+		queue_frames(read, batch);
+		do {
+			next_edge();
+			while (hal_stub_armed()){
+				hal_stub_master_read(buf, sizeof(buf));
+#if I2C_BURST_MODE
+				read += ((const burst_hdr *)buf)->count;
+#else
+				read++;
+#endif
+			}
+		} while (I2C2_Queued() > 0);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	double secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+	check(I2C2_Queued() == 0, "rate: every queued frame was read");
+	printf("%s mode: %u frames in %.3f s, %.0f frames/s\n", I2C_BURST_MODE ? "burst" : "single",
+	       read, secs, secs > 0 ? read / secs : 0.0);
+}
+
+int main(void){
+	test_queue();
+	test_transmit();
+	report_rate();
+	printf("%d checks, %d failed\n", checks, failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * hal_stub.c
+ *
+ *  Host implementation of the HAL calls used by my_project. The I2C slave
+ *  transmit only records the armed buffer; hal_stub_master_read() plays the
+ *  master and completes it from the caller's context, as the interrupt would.
+ */
+
+#include <string.h>
+#include <time.h>
+#include "hal_stub.h"
+
+I2C_TypeDef hal_stub_i2c2;
+GPIO_TypeDef hal_stub_gpioe;
+I2C_HandleTypeDef hi2c2 = { &hal_stub_i2c2 };
+
+static uint8_t *armed_buf;
+static uint16_t armed_len;
+static int data_ready_pin;
+static uint32_t tick_offset;
+
+uint32_t HAL_GetTick(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000) + tick_offset;
+}
+
+void HAL_Delay(uint32_t ms){
+	hal_stub_advance(ms);
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state){
+	if (port == GPIOE && pin == GPIO_PIN_15)
+		data_ready_pin = (state == GPIO_PIN_SET);
+}
+
+HAL_StatusTypeDef HAL_I2C_Slave_Transmit_IT(I2C_HandleTypeDef *hi2c, uint8_t *data, uint16_t size){
+	if (hi2c != &hi2c2 || armed_buf != NULL)
+		return HAL_BUSY;
+	armed_buf = data;
+	armed_len = size;
+	return HAL_OK;
+}
+
+int hal_stub_data_ready(void){
+	return data_ready_pin;
+}
+
+uint16_t hal_stub_armed(void){
+	return armed_buf ? armed_len : 0;
+}
+
+uint16_t hal_stub_master_read(uint8_t *buf, uint16_t len){
+	if (armed_buf == NULL)
+		return 0;
+	if (len > armed_len)
+		len = armed_len;
+	memcpy(buf, armed_buf, len);
+	armed_buf = NULL;
+	HAL_I2C_SlaveTxCpltCallback(&hi2c2);
+	return len;
+}
+
+void hal_stub_master_abort(void){
+	if (armed_buf == NULL)
+		return;
+	armed_buf = NULL;
+	HAL_I2C_ErrorCallback(&hi2c2);
+}
+
+void hal_stub_advance(uint32_t ms){
+	tick_offset += ms;
+}
@@ -0,0 +1,33 @@
+/*
+ * hal_stub.h
+ *
+ *  Master side of the host HAL stub: lets a host program play the
+ *  BeagleBone against the firmware's I2C slave logic.
+ */
+
+#ifndef HOST_HAL_STUB_H_
+#define HOST_HAL_STUB_H_
+
+#include <stdint.h>
+#include "stm32f7xx_hal.h"
+
+/* State of the data-ready pin (PE15). */
+int hal_stub_data_ready(void);
+
+/* Bytes of the armed slave transmit, 0 if none is armed. */
+uint16_t hal_stub_armed(void);
+
+/*
+ * Read up to len bytes of the armed transmit into buf, like the master
+ * clocking them out, then run the transmit-complete (or, if nothing was
+ * armed, no) callback. Returns the number of bytes read.
+ */
+uint16_t hal_stub_master_read(uint8_t *buf, uint16_t len);
+
+/* Fail the armed transmit and run HAL_I2C_ErrorCallback(). */
+void hal_stub_master_abort(void);
+
+/* Move HAL_GetTick() forward without sleeping. */
+void hal_stub_advance(uint32_t ms);
+
+#endif /* HOST_HAL_STUB_H_ */
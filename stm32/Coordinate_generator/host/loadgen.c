@@ -0,0 +1,152 @@
+/*
+ * loadgen.c
+ *
+ *  Host load generator: runs traffic_gen.c and writes the events straight
+ *  to the server's TCP port in the wire format CLIENT_DAEMON uses, paced
+ *  to the target rate. Prints the achieved rate when done.
+ *
+ *  LOADGEN [--server IP] [--port N] [--devices N] [--base ID] [--rate HZ]
+ *          [--count N] [--seed N]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "traffic_gen.h"
+
+#define LOADGEN_SERVER "127.0.0.1"
+#define LOADGEN_PORT 13777          // server/config.h SERVER_PORT
+#define LOADGEN_BATCH 512           // frames per send()
+
+static traffic_gen generator;
+
+static uint64_t now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Server byte order: 16-bit fields and the float bit patterns big-endian. */
+static void encode(const gps_frame *in, gps_frame *out){
+	uint32_t bits;
+	out->device_id = htons(in->device_id);
+	out->status = htons(in->status);
+	memcpy(&bits, &in->cord_x, sizeof(bits));
+	bits = htonl(bits);
+	memcpy(&out->cord_x, &bits, sizeof(bits));
+	memcpy(&bits, &in->cord_y, sizeof(bits));
+	bits = htonl(bits);
+	memcpy(&out->cord_y, &bits, sizeof(bits));
+}
+
+static int send_all(int sock, const void *buf, size_t len){
+	const uint8_t *p = buf;
+	while (len > 0){
+		ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+		if (n < 0){
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+	/* discard the server's "OK CLOSED" replies so its writes never block */
+	char reply[256];
+	while (recv(sock, reply, sizeof(reply), MSG_DONTWAIT) > 0)
+		;
+	return 0;
+}
+
+static int connect_server(const char *ip, int port){
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1){
+		fprintf(stderr, "Bad server address %s\n", ip);
+		return -1;
+	}
+
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+		perror("connect");
+		if (sock >= 0)
+			close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+int main(int argc, char *argv[]){
+	const char *server = LOADGEN_SERVER;
+	int port = LOADGEN_PORT;
+	unsigned long devices = TRAFFIC_DEVICES, base = TRAFFIC_DEVICE_BASE;
+	unsigned long rate = 1000, count = 10000, seed = (unsigned long)time(NULL);
+
+	for (int i = 1; i < argc; i++){
+		const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+		if (val && strcmp(argv[i], "--server") == 0) server = val;
+		else if (val && strcmp(argv[i], "--port") == 0) port = atoi(val);
+		else if (val && strcmp(argv[i], "--devices") == 0) devices = strtoul(val, NULL, 10);
+		else if (val && strcmp(argv[i], "--base") == 0) base = strtoul(val, NULL, 10);
+		else if (val && strcmp(argv[i], "--rate") == 0) rate = strtoul(val, NULL, 10);
+		else if (val && strcmp(argv[i], "--count") == 0) count = strtoul(val, NULL, 10);
+		else if (val && strcmp(argv[i], "--seed") == 0) seed = strtoul(val, NULL, 10);
+		else {
+			fprintf(stderr, "usage: %s [--server IP] [--port N] [--devices N] [--base ID] "
+			        "[--rate HZ] [--count N] [--seed N]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+		i++;
+	}
+
+	if (devices > 0xFFFF || base > 0xFFFF ||
+	    traffic_gen_init(&generator, (uint16_t)base, (uint16_t)devices, (uint32_t)rate, (uint32_t)seed) < 0){
+		fprintf(stderr, "Invalid device range: %lu devices from id %lu (max %d)\n",
+		        devices, base, TRAFFIC_MAX_DEVICES);
+		return EXIT_FAILURE;
+	}
+
+	int sock = connect_server(server, port);
+	if (sock < 0)
+		return EXIT_FAILURE;
+	printf("Sending %lu events from %lu devices at %lu/s to %s:%d\n",
+	       count, devices, rate, server, port);
+
+	static gps_frame batch[LOADGEN_BATCH];
+	gps_frame frame;
+	unsigned long sent = 0;
+	uint64_t start = now_ns();
+
+	while (sent < count){
+		uint32_t due = traffic_gen_due(&generator, (uint32_t)(now_ns() / 1000000));
+		if (due == 0){
+			struct timespec tick = { 0, 1000000 };
+			nanosleep(&tick, NULL);
+			continue;
+		}
+
+		size_t n = 0;
+		while (n < LOADGEN_BATCH && n < due && sent + n < count){
+			traffic_gen_next(&generator, &frame);
+			encode(&frame, &batch[n++]);
+		}
+		if (send_all(sock, batch, n * sizeof(gps_frame)) < 0){
+			perror("send");
+			close(sock);
+			return EXIT_FAILURE;
+		}
+		sent += n;
+	}
+
+	double secs = (double)(now_ns() - start) / 1e9;
+	printf("Sent %lu events in %.3f s (%.0f events/s)\n", sent, secs, secs > 0 ? sent / secs : 0.0);
+	close(sock);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,40 @@
+/*
+ * stm32f7xx_hal.h (host stub)
+ *
+ *  Just enough of the STM32 HAL to build the my_project logic (frame queue,
+ *  I2C transmit state machine) on Linux. Not used by the firmware build:
+ *  this directory is outside the CubeIDE source paths.
+ */
+
+#ifndef HOST_STM32F7XX_HAL_H_
+#define HOST_STM32F7XX_HAL_H_
+
+#include <stdint.h>
+
+typedef enum { HAL_OK = 0, HAL_ERROR, HAL_BUSY, HAL_TIMEOUT } HAL_StatusTypeDef;
+typedef enum { GPIO_PIN_RESET = 0, GPIO_PIN_SET } GPIO_PinState;
+
+typedef struct { uint32_t id; } I2C_TypeDef;
+typedef struct { uint32_t id; } GPIO_TypeDef;
+
+typedef struct {
+	I2C_TypeDef *Instance;
+} I2C_HandleTypeDef;
+
+extern I2C_TypeDef hal_stub_i2c2;
+extern GPIO_TypeDef hal_stub_gpioe;
+#define I2C2  (&hal_stub_i2c2)
+#define GPIOE (&hal_stub_gpioe)
+
+#define GPIO_PIN_15   ((uint16_t)0x8000)
+#define HAL_MAX_DELAY 0xFFFFFFFFU
+
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t ms);
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state);
+HAL_StatusTypeDef HAL_I2C_Slave_Transmit_IT(I2C_HandleTypeDef *hi2c, uint8_t *data, uint16_t size);
+
+void HAL_I2C_SlaveTxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c);
+
+#endif /* HOST_STM32F7XX_HAL_H_ */
@@ -0,0 +1,2 @@
+/* stm32f7xx_hal_i2c.h (host stub): everything lives in stm32f7xx_hal.h */
+#include "stm32f7xx_hal.h"
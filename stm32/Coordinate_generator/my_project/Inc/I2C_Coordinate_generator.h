@@ -15,12 +15,30 @@
 #define DATA_READY_GPIO_PORT GPIOE
 #define DATA_READY_PIN GPIO_PIN_15
 
+/* 1: frames are sent as bursts (burst_hdr + BURST_MAX slots, see protocol.h),
+ * the BeagleBone daemon must run with --burst. 0: one 12-byte frame per edge. */
+#ifndef I2C_BURST_MODE
+#define I2C_BURST_MODE 0
+#endif
+
+#define DATA_READY_LOW_MS 2     // data-ready low time between two edges (>= 1 ms at 1 ms ticks)
 
-void FillDataStruct(gps_frame *data);
 
-void I2C2_Send_Data(const uint8_t *data, uint8_t length);
+void FillDataStruct(gps_frame *data);
 
 void SwapEndian(uint8_t *data, uint8_t length);
 
+/* Frames are queued and sent by the I2C2 interrupt; data-ready stays high
+ * while the master is reading the queue. */
+void I2C2_Queue_Init(void);
+
+int I2C2_Queue_Frame(const gps_frame *frame);
+
+void I2C2_Service(void);
+
+void I2C2_Wait(uint32_t ms);
+
+uint32_t I2C2_Queued(void);
+
 
 #endif /* INC_I2C_COORDINATE_GENERATOR_H_ */
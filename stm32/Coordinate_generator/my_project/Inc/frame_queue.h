@@ -0,0 +1,38 @@
+/*
+ * frame_queue.h
+ *
+ *  Single-producer / single-consumer ring of gps_frame waiting for the
+ *  I2C master. The main loop pushes, the I2C2 transmit-complete interrupt
+ *  pops. No HAL dependency, so it builds and runs on the host as well.
+ */
+
+#ifndef INC_FRAME_QUEUE_H_
+#define INC_FRAME_QUEUE_H_
+
+#include <stdint.h>
+#include "protocol.h"
+
+#define FRAME_QUEUE_SIZE 64     // frames, must be a power of two
+
+typedef struct {
+	gps_frame frames[FRAME_QUEUE_SIZE];
+	volatile uint32_t head;     // next slot to write, producer only
+	volatile uint32_t tail;     // oldest queued frame, consumer only
+	volatile uint32_t dropped;  // pushes rejected while full
+} frame_queue;
+
+void frame_queue_init(frame_queue *q);
+
+/* Producer: append a frame. Returns 0, or -1 if the queue is full (frame dropped). */
+int frame_queue_push(frame_queue *q, const gps_frame *frame);
+
+/* Number of queued frames. */
+uint32_t frame_queue_count(const frame_queue *q);
+
+/* Consumer: i-th queued frame, 0 = oldest (i < frame_queue_count()). */
+const gps_frame *frame_queue_peek(const frame_queue *q, uint32_t i);
+
+/* Consumer: release the n oldest frames. */
+void frame_queue_pop(frame_queue *q, uint32_t n);
+
+#endif /* INC_FRAME_QUEUE_H_ */
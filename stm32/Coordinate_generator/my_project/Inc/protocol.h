@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 
+/* I2C part of protocol/parking_protocol.h (the BeagleBone and server header);
+ * CubeIDE only builds this tree, so it keeps a copy. Keep the two in sync. */
+
 #define START 1
 #define AND 0
 
@@ -22,5 +25,24 @@ typedef struct __attribute__((packed)) {
     uint16_t status;
 } gps_frame;
 
+/**
+ * Burst mode: on one data-ready edge the master reads BURST_BYTES in a single
+ * I2C read: a burst_hdr followed by BURST_MAX frame slots, of which the first
+ * `count` are valid (each in the same byte-reversed layout as a single frame).
+ * `pending` tells the master how many frames are still queued on the STM32,
+ * so it can read again without waiting for another edge.
+ */
+#define BURST_MAGIC 0xB5
+#define BURST_MAX   8                                        /**< Frame slots per burst */
+
+typedef struct __attribute__((packed)) {
+    uint8_t magic;      /**< BURST_MAGIC */
+    uint8_t count;      /**< Valid frames in this burst (0..BURST_MAX) */
+    uint8_t pending_hi; /**< Frames still queued, big-endian */
+    uint8_t pending_lo;
+} burst_hdr;
+
+#define BURST_BYTES (sizeof(burst_hdr) + BURST_MAX * sizeof(gps_frame))
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,63 @@
+/*
+ * traffic_gen.h
+ *
+ *  Load generator: many virtual devices parking around the coordinates
+ *  table at a target event rate. No HAL dependency, so the same code runs
+ *  in the firmware (my_main.c, TRAFFIC_GEN_MODE 1) and in host/LOADGEN.
+ */
+
+#ifndef INC_TRAFFIC_GEN_H_
+#define INC_TRAFFIC_GEN_H_
+
+#include <stdint.h>
+#include "protocol.h"
+
+/* 1: my_main runs the generator instead of the single-device simulation. */
+#ifndef TRAFFIC_GEN_MODE
+#define TRAFFIC_GEN_MODE 0
+#endif
+
+#define TRAFFIC_MAX_DEVICES 4096    // virtual devices one generator can hold
+#define TRAFFIC_DEVICE_BASE 2000    // first virtual device id
+#define TRAFFIC_DEVICES 1000        // firmware default
+#define TRAFFIC_RATE_HZ 200         // firmware default, events per second
+#define TRAFFIC_STEP 0.002f         // random-walk step between parkings, degrees
+#define TRAFFIC_RADIUS 0.05f        // max distance from the device's home city, degrees
+
+typedef struct {
+	float x;
+	float y;
+	uint8_t parked;             // START sent, END pending
+} traffic_device;
+
+typedef struct {
+	traffic_device dev[TRAFFIC_MAX_DEVICES];
+	uint16_t devices;
+	uint16_t base_id;
+	uint32_t rate_hz;
+	uint32_t rng;
+	uint64_t produced;          // events handed out
+	uint64_t elapsed_ms;        // time accounted by traffic_gen_due()
+	uint32_t last_ms;
+	uint8_t started;
+} traffic_gen;
+
+/* Returns 0, or -1 if devices is 0, above TRAFFIC_MAX_DEVICES or the ids overflow 16 bits. */
+int traffic_gen_init(traffic_gen *tg, uint16_t base_id, uint16_t devices, uint32_t rate_hz, uint32_t seed);
+
+/*
+ * Next event of a randomly chosen device: END at its parking spot if it is
+ * parked, otherwise START at a new spot one random-walk step away. Every
+ * device therefore alternates START / END, starting with START.
+ * The frame is in host byte order.
+ */
+void traffic_gen_next(traffic_gen *tg, gps_frame *frame);
+
+/*
+ * Events due at now_ms (a free-running millisecond tick, wrap-safe) to keep
+ * the target rate since the first call. Events not taken are still due on
+ * the next call, so a slow consumer drains at its own maximum rate.
+ */
+uint32_t traffic_gen_due(traffic_gen *tg, uint32_t now_ms);
+
+#endif /* INC_TRAFFIC_GEN_H_ */
@@ -12,13 +12,20 @@
 #include "protocol.h"
 #include "coordinates.h"
 #include "I2C_Coordinate_generator.h"
+#include "frame_queue.h"
 
 extern I2C_HandleTypeDef hi2c2;
 
 static int coordinate_index = 0;
-static uint8_t txBuffer[sizeof(gps_frame)];
+static uint8_t txBuffer[BURST_BYTES];   // large enough for a single frame or a burst
 
-volatile uint8_t data_ready = 0;
+static frame_queue tx_queue;            // frames waiting for the master
+static volatile uint8_t tx_busy = 0;    // a transmit is armed
+static volatile uint8_t tx_frames = 0;  // frames in the armed transmit
+static volatile uint8_t tx_more = 0;    // the armed burst tells the master more frames follow
+static volatile uint32_t ready_low_tick = 0;  // tick data-ready was last released
+
+volatile uint8_t data_ready = 0;        // state of the data-ready pin
 
 void FillDataStruct(gps_frame *data){
 	if (coordinate_index >= MAX_COORDINATES){
@@ -34,36 +41,140 @@ void FillDataStruct(gps_frame *data){
 }
 
 
-void I2C2_Send_Data(const uint8_t *data, uint8_t length){
-	if (data_ready)
-		return;
-	memcpy(txBuffer, data, length);
-	data_ready = 1;
+void SwapEndian(uint8_t *data, uint8_t length){
+	for(int i = 0; i < length / 2; i++){
+		uint8_t temp_data = data[i];
+		data[i] = data[length - i - 1];
+		data[length - i - 1] = temp_data;
+	}
+}
 
-	HAL_GPIO_WritePin(DATA_READY_GPIO_PORT, DATA_READY_PIN, GPIO_PIN_SET);
 
-	if (HAL_I2C_Slave_Transmit(&hi2c2, txBuffer, length, HAL_MAX_DELAY) != HAL_OK) {
-		printf("I2C Error: transmit start failed\n");
-		HAL_GPIO_WritePin(DATA_READY_GPIO_PORT, DATA_READY_PIN, GPIO_PIN_RESET);
-		data_ready = 0;
-	}
+static void release_data_ready(void){
 	HAL_GPIO_WritePin(DATA_READY_GPIO_PORT, DATA_READY_PIN, GPIO_PIN_RESET);
 	data_ready = 0;
+	ready_low_tick = HAL_GetTick();
 }
 
 
-void SwapEndian(uint8_t *data, uint8_t length){
-	for(int i = 0; i < length / 2; i++){
-		uint8_t temp_data = data[i];
-		data[i] = data[length - i - 1];
-		data[length - i - 1] = temp_data;
+/*
+ * Encode the oldest queued frame (single mode) or up to BURST_MAX frames
+ * (burst mode) into txBuffer, arm the interrupt-driven slave transmit and
+ * raise data-ready. Called from the main loop when idle and from the
+ * transmit-complete interrupt while the master keeps reading.
+ * Returns 1 if a transmit was armed, 0 if the queue is empty, -1 on error.
+ */
+static int arm_transmit(void){
+	uint32_t queued = frame_queue_count(&tx_queue);
+	if (queued == 0)
+		return 0;
+
+#if I2C_BURST_MODE
+	uint8_t count = queued > BURST_MAX ? BURST_MAX : (uint8_t)queued;
+	uint32_t pending = queued - count;
+	if (pending > 0xFFFF)
+		pending = 0xFFFF;
+
+	memset(txBuffer, 0, sizeof(txBuffer));
+	burst_hdr *hdr = (burst_hdr *)txBuffer;
+	hdr->magic = BURST_MAGIC;
+	hdr->count = count;
+	hdr->pending_hi = (uint8_t)(pending >> 8);
+	hdr->pending_lo = (uint8_t)(pending & 0xFF);
+
+	for (uint8_t i = 0; i < count; i++){
+		uint8_t *slot = txBuffer + sizeof(burst_hdr) + i * sizeof(gps_frame);
+		memcpy(slot, frame_queue_peek(&tx_queue, i), sizeof(gps_frame));
+		SwapEndian(slot, sizeof(gps_frame));
+	}
+	uint16_t length = BURST_BYTES;
+	tx_more = pending > 0;
+#else
+	uint8_t count = 1;
+	memcpy(txBuffer, frame_queue_peek(&tx_queue, 0), sizeof(gps_frame));
+	SwapEndian(txBuffer, sizeof(gps_frame));
+	uint16_t length = sizeof(gps_frame);
+	tx_more = 0;
+#endif
+
+	tx_frames = count;
+	tx_busy = 1;
+	if (HAL_I2C_Slave_Transmit_IT(&hi2c2, txBuffer, length) != HAL_OK) {
+		printf("I2C Error: transmit start failed\n");
+		tx_busy = 0;
+		return -1;
+	}
+
+	HAL_GPIO_WritePin(DATA_READY_GPIO_PORT, DATA_READY_PIN, GPIO_PIN_SET);
+	data_ready = 1;
+	return 1;
+}
+
+
+void I2C2_Queue_Init(void){
+	frame_queue_init(&tx_queue);
+	tx_busy = 0;
+	release_data_ready();
+}
+
+
+int I2C2_Queue_Frame(const gps_frame *frame){
+	int ret = frame_queue_push(&tx_queue, frame);
+	if (ret < 0)
+		printf("I2C queue full, frame dropped (%lu total)\n", (unsigned long)tx_queue.dropped);
+	I2C2_Service();
+	return ret;
+}
+
+
+void I2C2_Service(void){
+	if (tx_busy || frame_queue_count(&tx_queue) == 0)
+		return;
+	/* keep data-ready low long enough for the master to see a new edge */
+	if (HAL_GetTick() - ready_low_tick < DATA_READY_LOW_MS)
+		return;
+	arm_transmit();
+}
+
+
+void I2C2_Wait(uint32_t ms){
+	uint32_t start = HAL_GetTick();
+	while (HAL_GetTick() - start < ms){
+		I2C2_Service();
 	}
 }
 
-//void HAL_I2C_SlaveTxCpltCallback(I2C_HandleTypeDef *hi2c)
-//{
-//	if (hi2c->Instance == I2C2 && data_ready) {
-//		HAL_GPIO_WritePin(DATA_READY_GPIO_PORT, DATA_READY_PIN, GPIO_PIN_RESET);
-//		data_ready = 0;
-//	}
-//}
+
+uint32_t I2C2_Queued(void){
+	return frame_queue_count(&tx_queue);
+}
+
+
+/*
+ * The master read the armed frames. If the burst told it more frames
+ * follow it reads again at once, so re-arm with data-ready still high;
+ * otherwise release data-ready and let I2C2_Service() raise a new edge.
+ */
+void HAL_I2C_SlaveTxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+	if (hi2c->Instance != I2C2 || !tx_busy)
+		return;
+
+	frame_queue_pop(&tx_queue, tx_frames);
+	tx_busy = 0;
+
+	if (tx_more && arm_transmit() > 0)
+		return;
+	release_data_ready();
+}
+
+
+/* Aborted transfer: the frames stay queued and are sent again. */
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
+{
+	if (hi2c->Instance != I2C2)
+		return;
+
+	tx_busy = 0;
+	release_data_ready();
+}
@@ -0,0 +1,41 @@
+/*
+ * frame_queue.c
+ *
+ *  head and tail are free-running counters; frame i lives in slot
+ *  i & (FRAME_QUEUE_SIZE - 1). The release/acquire pairs order the slot
+ *  contents against the index updates (a DMB on the Cortex-M7).
+ */
+
+#include <string.h>
+#include "frame_queue.h"
+
+void frame_queue_init(frame_queue *q){
+	memset(q, 0, sizeof(*q));
+}
+
+int frame_queue_push(frame_queue *q, const gps_frame *frame){
+	uint32_t head = q->head;
+	uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail >= FRAME_QUEUE_SIZE){
+		q->dropped++;
+		return -1;
+	}
+
+	q->frames[head & (FRAME_QUEUE_SIZE - 1)] = *frame;
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+uint32_t frame_queue_count(const frame_queue *q){
+	uint32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	return head - q->tail;
+}
+
+const gps_frame *frame_queue_peek(const frame_queue *q, uint32_t i){
+	return &q->frames[(q->tail + i) & (FRAME_QUEUE_SIZE - 1)];
+}
+
+void frame_queue_pop(frame_queue *q, uint32_t n){
+	__atomic_store_n(&q->tail, q->tail + n, __ATOMIC_RELEASE);
+}
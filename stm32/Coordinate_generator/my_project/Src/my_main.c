@@ -11,28 +11,48 @@
 #include "protocol.h"
 #include "coordinates.h"
 #include "I2C_Coordinate_generator.h"
+#include "frame_queue.h"
+#include "traffic_gen.h"
+
+#if TRAFFIC_GEN_MODE
+static traffic_gen generator;
+
+/* Queue the events due for the target rate; while the queue is full the
+ * generator falls behind and catches up at the rate the master reads. */
+static void run_traffic_gen(void){
+	gps_frame data;
+	traffic_gen_init(&generator, TRAFFIC_DEVICE_BASE, TRAFFIC_DEVICES, TRAFFIC_RATE_HZ, HAL_GetTick());
+
+	while (1){
+		uint32_t due = traffic_gen_due(&generator, HAL_GetTick());
+		while (due > 0 && I2C2_Queued() < FRAME_QUEUE_SIZE){
+			traffic_gen_next(&generator, &data);
+			I2C2_Queue_Frame(&data);
+			due--;
+		}
+		I2C2_Service();
+	}
+}
+#endif
 
 void my_main(){
 	gps_frame data;
 	srand(HAL_GetTick());
+	I2C2_Queue_Init();
+
+#if TRAFFIC_GEN_MODE
+	run_traffic_gen();
+#endif
 
 	while (1){
 		FillDataStruct(&data);
-
-		uint8_t data_arry[sizeof(gps_frame)];
-		memcpy(data_arry, &data, sizeof(gps_frame));
-		SwapEndian(data_arry, sizeof(gps_frame));
-
-		I2C2_Send_Data(data_arry, sizeof(gps_frame));
+		I2C2_Queue_Frame(&data);
 
 		int wait_time = RAND_WAITING;
-		HAL_Delay(wait_time);
+		I2C2_Wait(wait_time);
 
 		data.status = AND;
-		memcpy(data_arry, &data, sizeof(gps_frame));
-		SwapEndian(data_arry, sizeof(gps_frame));
-
-		I2C2_Send_Data(data_arry, sizeof(gps_frame));
-		HAL_Delay(30000);
+		I2C2_Queue_Frame(&data);
+		I2C2_Wait(30000);
 	}
 }
@@ -0,0 +1,86 @@
+/*
+ * traffic_gen.c
+ *
+ *  See traffic_gen.h.
+ */
+
+#include <string.h>
+#include "coordinates.h"
+#include "traffic_gen.h"
+
+/* xorshift32: cheap and good enough to scatter devices and steps */
+static uint32_t next_rand(traffic_gen *tg){
+	uint32_t x = tg->rng;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	tg->rng = x;
+	return x;
+}
+
+/* uniform in [-1, 1] */
+static float rand_unit(traffic_gen *tg){
+	return (float)(next_rand(tg) & 0xFFFF) / 32767.5f - 1.0f;
+}
+
+static float clamp(float v, float center){
+	if (v > center + TRAFFIC_RADIUS)
+		return center + TRAFFIC_RADIUS;
+	if (v < center - TRAFFIC_RADIUS)
+		return center - TRAFFIC_RADIUS;
+	return v;
+}
+
+int traffic_gen_init(traffic_gen *tg, uint16_t base_id, uint16_t devices, uint32_t rate_hz, uint32_t seed){
+	if (devices == 0 || devices > TRAFFIC_MAX_DEVICES || (uint32_t)base_id + devices > 0x10000)
+		return -1;
+
+	memset(tg, 0, sizeof(*tg));
+	tg->devices = devices;
+	tg->base_id = base_id;
+	tg->rate_hz = rate_hz;
+	tg->rng = seed ? seed : 0x2545F491;
+
+	for (uint16_t i = 0; i < devices; i++){
+		uint16_t home = i % MAX_COORDINATES;
+		tg->dev[i].x = coordinates[home].x + TRAFFIC_RADIUS * rand_unit(tg);
+		tg->dev[i].y = coordinates[home].y + TRAFFIC_RADIUS * rand_unit(tg);
+	}
+	return 0;
+}
+
+void traffic_gen_next(traffic_gen *tg, gps_frame *frame){
+	uint16_t i = (uint16_t)(next_rand(tg) % tg->devices);
+	traffic_device *d = &tg->dev[i];
+
+	if (d->parked){
+		d->parked = 0;
+		frame->status = AND;
+	} else {
+		uint16_t home = i % MAX_COORDINATES;
+		d->x = clamp(d->x + TRAFFIC_STEP * rand_unit(tg), coordinates[home].x);
+		d->y = clamp(d->y + TRAFFIC_STEP * rand_unit(tg), coordinates[home].y);
+		d->parked = 1;
+		frame->status = START;
+	}
+
+	frame->device_id = tg->base_id + i;
+	frame->cord_x = d->x;
+	frame->cord_y = d->y;
+	tg->produced++;
+}
+
+uint32_t traffic_gen_due(traffic_gen *tg, uint32_t now_ms){
+	if (!tg->started){
+		tg->last_ms = now_ms;
+		tg->started = 1;
+	}
+	tg->elapsed_ms += (uint32_t)(now_ms - tg->last_ms);
+	tg->last_ms = now_ms;
+
+	uint64_t target = tg->elapsed_ms * tg->rate_hz / 1000;
+	if (target <= tg->produced)
+		return 0;
+	uint64_t due = target - tg->produced;
+	return due > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)due;
+}